@@ -0,0 +1,349 @@
+#include "atlas.hpp"
+#include <algorithm>
+#include <cstring>
+
+TextureAtlas::TextureAtlas(int initialSize, int maxSize)
+    : width(0), height(0), maxSize(maxSize), whiteUV(0.0f), generation(0), growCount(0), defragmentCount(0), dirty(false), dirtyRegion({ 0, 0, 0, 0 }) {
+    reset(initialSize, initialSize);
+}
+
+void TextureAtlas::reset(int newWidth, int newHeight) {
+    width = newWidth;
+    height = newHeight;
+    pixelData.assign(static_cast<size_t>(width) * height * 4, 0);
+    skyline.clear();
+    skyline.push_back({ 0, 0, width });
+
+    int x, y;
+    pack(WHITE_SIZE + PADDING, WHITE_SIZE + PADDING, x, y);
+    for (int row = 0; row < WHITE_SIZE; ++row) {
+        memset(&pixelData[(static_cast<size_t>(y + row) * width + x) * 4], 0xff, WHITE_SIZE * 4);
+    }
+    // Sample the middle of the white block so linear filtering never reaches its padding.
+    whiteUV = (WHITE_SIZE * 0.5f) / width;
+
+    generation++;
+    markDirty({ 0, 0, width, height });
+}
+
+int TextureAtlas::fitNode(size_t index, int packWidth, int packHeight) const {
+    int x = skyline[index].x;
+    if (x + packWidth > width) {
+        return -1;
+    }
+
+    int y = skyline[index].y;
+    int widthLeft = packWidth;
+    for (size_t i = index; widthLeft > 0; ++i) {
+        if (i >= skyline.size()) {
+            return -1;
+        }
+        y = (std::max)(y, skyline[i].y);
+        if (y + packHeight > height) {
+            return -1;
+        }
+        widthLeft -= skyline[i].width;
+    }
+    return y;
+}
+
+void TextureAtlas::insertNode(size_t index, int x, int y, int packWidth, int packHeight) {
+    skyline.insert(skyline.begin() + index, { x, y + packHeight, packWidth });
+
+    for (size_t i = index + 1; i < skyline.size(); ++i) {
+        const SkylineNode& previous = skyline[i - 1];
+        int previousEnd = previous.x + previous.width;
+        if (skyline[i].x >= previousEnd) {
+            break;
+        }
+
+        int shrink = previousEnd - skyline[i].x;
+        skyline[i].x += shrink;
+        skyline[i].width -= shrink;
+        if (skyline[i].width > 0) {
+            break;
+        }
+        skyline.erase(skyline.begin() + i);
+        --i;
+    }
+
+    for (size_t i = 0; i + 1 < skyline.size(); ++i) {
+        if (skyline[i].y == skyline[i + 1].y) {
+            skyline[i].width += skyline[i + 1].width;
+            skyline.erase(skyline.begin() + i + 1);
+            --i;
+        }
+    }
+}
+
+bool TextureAtlas::pack(int packWidth, int packHeight, int& outX, int& outY) {
+    int bestBottom = height + 1;
+    int bestX = width + 1;
+    size_t bestIndex = skyline.size();
+
+    for (size_t i = 0; i < skyline.size(); ++i) {
+        int y = fitNode(i, packWidth, packHeight);
+        if (y < 0) {
+            continue;
+        }
+        int bottom = y + packHeight;
+        if (bottom < bestBottom || (bottom == bestBottom && skyline[i].x < bestX)) {
+            bestBottom = bottom;
+            bestX = skyline[i].x;
+            bestIndex = i;
+        }
+    }
+
+    if (bestIndex == skyline.size()) {
+        return false;
+    }
+
+    outX = skyline[bestIndex].x;
+    outY = bestBottom - packHeight;
+    insertNode(bestIndex, outX, outY, packWidth, packHeight);
+    return true;
+}
+
+bool TextureAtlas::grow() {
+    if (width >= maxSize && height >= maxSize) {
+        return false;
+    }
+
+    int oldWidth = width;
+    int oldHeight = height;
+    std::vector<uint8_t> oldPixels;
+    oldPixels.swap(pixelData);
+
+    width = (std::min)(width * 2, maxSize);
+    height = (std::min)(height * 2, maxSize);
+    pixelData.assign(static_cast<size_t>(width) * height * 4, 0);
+    blit(oldPixels.data(), oldWidth * 4, { 0, 0, oldWidth, oldHeight });
+
+    // Existing allocations keep their texel position, the new columns start out empty.
+    if (width > oldWidth) {
+        skyline.push_back({ oldWidth, 0, width - oldWidth });
+    }
+    whiteUV = (WHITE_SIZE * 0.5f) / width;
+
+    growCount++;
+    generation++;
+    markDirty({ 0, 0, width, height });
+    return true;
+}
+
+int TextureAtlas::addImage(int imageWidth, int imageHeight, const uint8_t* rgba) {
+    if (imageWidth <= 0 || imageHeight <= 0 || !rgba) {
+        return -1;
+    }
+
+    bool defragmented = false;
+    int x, y;
+    while (!pack(imageWidth + PADDING, imageHeight + PADDING, x, y)) {
+        Stats stats = getStats();
+        if (!defragmented && stats.packedPixels - stats.usedPixels >= static_cast<int64_t>(imageWidth) * imageHeight) {
+            defragmented = true;
+            if (defragment()) {
+                continue;
+            }
+        }
+        if (!grow()) {
+            return -1;
+        }
+    }
+
+    Region region = { x, y, imageWidth, imageHeight };
+    blit(rgba, imageWidth * 4, region);
+    markDirty(region);
+
+    bool opaque = true;
+    for (size_t i = 3; i < static_cast<size_t>(imageWidth) * imageHeight * 4 && opaque; i += 4) {
+        opaque = rgba[i] == 0xff;
+    }
+
+    entries.push_back({ region, true, opaque });
+    return static_cast<int>(entries.size() - 1);
+}
+
+void TextureAtlas::removeImage(int imageId) {
+    if (isValid(imageId)) {
+        entries[imageId].live = false;
+    }
+}
+
+bool TextureAtlas::isValid(int imageId) const {
+    return imageId >= 0 && imageId < static_cast<int>(entries.size()) && entries[imageId].live;
+}
+
+bool TextureAtlas::defragment() {
+    std::vector<size_t> order;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (entries[i].live) {
+            order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return entries[a].region.height > entries[b].region.height;
+    });
+
+    // Sorted by height the images usually pack tighter than in insertion order, but not
+    // always: place them on a scratch skyline first and only move anything when all fit.
+    std::vector<SkylineNode> oldSkyline;
+    oldSkyline.swap(skyline);
+    skyline.push_back({ 0, 0, width });
+    int whiteX, whiteY;
+    std::vector<Region> placed;
+    bool fits = pack(WHITE_SIZE + PADDING, WHITE_SIZE + PADDING, whiteX, whiteY);
+    for (size_t i = 0; i < order.size() && fits; ++i) {
+        const Region& region = entries[order[i]].region;
+        int x, y;
+        fits = pack(region.width + PADDING, region.height + PADDING, x, y);
+        placed.push_back({ x, y, region.width, region.height });
+    }
+    if (!fits) {
+        skyline.swap(oldSkyline);
+        return false;
+    }
+
+    std::vector<uint8_t> oldPixels(pixelData.size(), 0);
+    oldPixels.swap(pixelData);
+    for (int row = 0; row < WHITE_SIZE; ++row) {
+        memset(&pixelData[(static_cast<size_t>(whiteY + row) * width + whiteX) * 4], 0xff, WHITE_SIZE * 4);
+    }
+    for (size_t i = 0; i < order.size(); ++i) {
+        Region& region = entries[order[i]].region;
+        blit(&oldPixels[(static_cast<size_t>(region.y) * width + region.x) * 4], width * 4, placed[i]);
+        region = placed[i];
+    }
+
+    defragmentCount++;
+    generation++;
+    markDirty({ 0, 0, width, height });
+    return true;
+}
+
+TextureAtlas::UVRect TextureAtlas::uv(int imageId) const {
+    if (!isValid(imageId)) {
+        return { whiteUV, whiteUV, whiteUV, whiteUV };
+    }
+
+    const Region& region = entries[imageId].region;
+    float invWidth = 1.0f / width;
+    float invHeight = 1.0f / height;
+    return { region.x * invWidth, region.y * invHeight, (region.x + region.width) * invWidth, (region.y + region.height) * invHeight };
+}
+
+TextureAtlas::Stats TextureAtlas::getStats() const {
+    Stats stats;
+    stats.width = width;
+    stats.height = height;
+    stats.growCount = growCount;
+    stats.defragmentCount = defragmentCount;
+
+    for (const Entry& entry : entries) {
+        if (entry.live) {
+            stats.imageCount++;
+            stats.usedPixels += static_cast<int64_t>(entry.region.width) * entry.region.height;
+        }
+    }
+    for (const SkylineNode& node : skyline) {
+        stats.packedPixels += static_cast<int64_t>(node.width) * node.y;
+    }
+    return stats;
+}
+
+bool TextureAtlas::takeDirtyRegion(Region& region) {
+    if (!dirty) {
+        return false;
+    }
+    region = dirtyRegion;
+    dirty = false;
+    return true;
+}
+
+void TextureAtlas::markDirty(const Region& region) {
+    if (!dirty) {
+        dirtyRegion = region;
+        dirty = true;
+        return;
+    }
+
+    int left = (std::min)(dirtyRegion.x, region.x);
+    int top = (std::min)(dirtyRegion.y, region.y);
+    int right = (std::max)(dirtyRegion.x + dirtyRegion.width, region.x + region.width);
+    int bottom = (std::max)(dirtyRegion.y + dirtyRegion.height, region.y + region.height);
+    dirtyRegion = { left, top, right - left, bottom - top };
+}
+
+void TextureAtlas::blit(const uint8_t* source, int sourceStride, const Region& destination) {
+    for (int row = 0; row < destination.height; ++row) {
+        memcpy(&pixelData[(static_cast<size_t>(destination.y + row) * width + destination.x) * 4], source + static_cast<size_t>(row) * sourceStride, static_cast<size_t>(destination.width) * 4);
+    }
+}
+
+// Serialized layout: PageHeader, PageEntry[entryCount], SkylineNode[skylineCount], pixels.
+struct PageHeader {
+    int32_t width, height;
+    uint32_t entryCount, skylineCount;
+};
+
+struct PageEntry {
+    int32_t x, y, width, height;
+    uint8_t live, opaque, reserved[2];
+};
+
+void TextureAtlas::serialize(std::vector<uint8_t>& out) const {
+    PageHeader header = { width, height, static_cast<uint32_t>(entries.size()), static_cast<uint32_t>(skyline.size()) };
+    out.resize(sizeof(PageHeader) + entries.size() * sizeof(PageEntry) + skyline.size() * sizeof(SkylineNode) + pixelData.size());
+
+    uint8_t* cursor = out.data();
+    memcpy(cursor, &header, sizeof(header));
+    cursor += sizeof(header);
+    for (const Entry& entry : entries) {
+        PageEntry page = { entry.region.x, entry.region.y, entry.region.width, entry.region.height, entry.live, entry.opaque, { 0, 0 } };
+        memcpy(cursor, &page, sizeof(page));
+        cursor += sizeof(page);
+    }
+    if (!skyline.empty()) {
+        memcpy(cursor, skyline.data(), skyline.size() * sizeof(SkylineNode));
+        cursor += skyline.size() * sizeof(SkylineNode);
+    }
+    memcpy(cursor, pixelData.data(), pixelData.size());
+}
+
+bool TextureAtlas::restore(const uint8_t* data, size_t size) {
+    PageHeader header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.width <= 0 || header.height <= 0 || header.width > maxSize || header.height > maxSize) {
+        return false;
+    }
+    size_t pixelBytes = static_cast<size_t>(header.width) * header.height * 4;
+    size_t expected = sizeof(PageHeader) + header.entryCount * sizeof(PageEntry) + header.skylineCount * sizeof(SkylineNode) + pixelBytes;
+    if (size != expected || header.skylineCount == 0) {
+        return false;
+    }
+
+    const uint8_t* cursor = data + sizeof(header);
+    entries.resize(header.entryCount);
+    for (Entry& entry : entries) {
+        PageEntry page;
+        memcpy(&page, cursor, sizeof(page));
+        cursor += sizeof(page);
+        entry.region = { page.x, page.y, page.width, page.height };
+        entry.live = page.live != 0;
+        entry.opaque = page.opaque != 0;
+    }
+    skyline.resize(header.skylineCount);
+    memcpy(skyline.data(), cursor, header.skylineCount * sizeof(SkylineNode));
+    cursor += header.skylineCount * sizeof(SkylineNode);
+
+    width = header.width;
+    height = header.height;
+    pixelData.assign(cursor, cursor + pixelBytes);
+    whiteUV = (WHITE_SIZE * 0.5f) / width;
+    generation++;
+    markDirty({ 0, 0, width, height });
+    return true;
+}
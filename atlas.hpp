@@ -0,0 +1,100 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// RGBA8 texture atlas packed with a skyline (bottom-left) allocator. The top-left texel
+// block is always opaque white so untextured shapes can sample it and share the pipeline
+// with images. Pixels live on the CPU, the renderer uploads the dirty region or the whole
+// page after a resize (generation change).
+class TextureAtlas {
+public:
+    struct Region {
+        int x, y, width, height;
+    };
+
+    struct UVRect {
+        float u0, v0, u1, v1;
+    };
+
+    struct Stats {
+        int width = 0;
+        int height = 0;
+        int imageCount = 0;
+        int64_t usedPixels = 0;     // pixels of live images
+        int64_t packedPixels = 0;   // area below the skyline, including freed images and padding
+        int growCount = 0;
+        int defragmentCount = 0;
+
+        float occupancy() const { return width * height > 0 ? static_cast<float>(usedPixels) / (static_cast<float>(width) * height) : 0.0f; }
+        float fragmentation() const { return packedPixels > 0 ? 1.0f - static_cast<float>(usedPixels) / packedPixels : 0.0f; }
+    };
+
+    TextureAtlas(int initialSize = 256, int maxSize = 4096);
+
+    // Returns the image id, or -1 when the image does not fit even at the maximum size.
+    int addImage(int width, int height, const uint8_t* rgba);
+    void removeImage(int imageId);
+    bool isValid(int imageId) const;
+    // True when every texel of the image has full alpha.
+    bool isOpaque(int imageId) const { return isValid(imageId) && entries[imageId].opaque; }
+
+    // Repacks all live images tightly, reclaiming the space of removed ones. Returns false
+    // and keeps the current layout when they do not fit the page repacked.
+    bool defragment();
+
+    UVRect uv(int imageId) const;
+    float whiteU() const { return whiteUV; }
+    float whiteV() const { return whiteUV; }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    const uint8_t* pixels() const { return pixelData.data(); }
+    Stats getStats() const;
+
+    // The page with every image in it, image ids included, for PersistentCache. restore()
+    // leaves the atlas untouched and returns false when data is not a page from serialize()
+    // or does not fit maxSize.
+    void serialize(std::vector<uint8_t>& out) const;
+    bool restore(const uint8_t* data, size_t size);
+
+    // Bumped whenever the page is resized or repacked, requiring a full re-upload.
+    uint32_t getGeneration() const { return generation; }
+    bool takeDirtyRegion(Region& region);
+
+private:
+    struct SkylineNode {
+        int x, y, width;
+    };
+
+    struct Entry {
+        Region region;
+        bool live;
+        bool opaque;
+    };
+
+    static const int PADDING = 1;
+    static const int WHITE_SIZE = 2;
+
+    int width;
+    int height;
+    int maxSize;
+    float whiteUV;
+    uint32_t generation;
+    int growCount;
+    int defragmentCount;
+    std::vector<uint8_t> pixelData;
+    std::vector<SkylineNode> skyline;
+    std::vector<Entry> entries;
+    bool dirty;
+    Region dirtyRegion;
+
+    void reset(int newWidth, int newHeight);
+    bool pack(int packWidth, int packHeight, int& outX, int& outY);
+    int fitNode(size_t index, int packWidth, int packHeight) const;
+    void insertNode(size_t index, int x, int y, int packWidth, int packHeight);
+    // False at maxSize, where nothing changes.
+    bool grow();
+    void markDirty(const Region& region);
+    void blit(const uint8_t* source, int sourceStride, const Region& destination);
+};
@@ -0,0 +1,354 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+class LiveGraph;
+class VectorPath;
+
+// Platform independent part of the renderer: the shape types every backend understands
+// and the small interface ezUI, the capture replayer and headless tools draw through.
+class RenderBackend {
+public:
+    // Pixel space position, the vertex shader maps it to clip space. Solid shapes sample the
+    // atlas' white texel so they batch with images. translation is the slot whose offset the
+    // vertex shader adds to the position, see setTranslation().
+    struct Vertex {
+        float x, y, z;
+        float r, g, b, a;
+        float u, v;
+        uint32_t translation;
+    };
+
+    struct Color {
+        float r, g, b, a;
+        Color(float red, float green, float blue, float alpha) : r(red), g(green), b(blue), a(alpha) {}
+    };
+
+    struct Rectangle {
+        float x, y, width, height;
+        float rounding;
+        Color color;
+
+        Rectangle(float x, float y, float width, float height, float rounding, Color color)
+            : x(x), y(y), width(width), height(height), rounding(rounding), color(color) {}
+    };
+
+    struct Circle {
+        float centerX, centerY, radius;
+        Color color;
+        int segments;
+
+        Circle(float centerX, float centerY, float radius, Color color, int segments = 64)
+            : centerX(centerX), centerY(centerY), radius(radius), color(color), segments(segments) {}
+    };
+
+    struct Triangle {
+        float x1, y1, x2, y2, x3, y3;
+        Color color;
+
+        Triangle(float x1, float y1, float x2, float y2, float x3, float y3, Color color)
+            : x1(x1), y1(y1), x2(x2), y2(y2), x3(x3), y3(y3), color(color) {}
+    };
+
+    // Outline of a (rounded) rectangle: the stroke starts at the outer edge given by the bounds
+    // and extends thickness pixels inward, only the ring itself is tessellated.
+    struct Border {
+        float x, y, width, height;
+        float rounding;
+        float thickness;
+        Color color;
+
+        Border(float x, float y, float width, float height, float rounding, float thickness, Color color)
+            : x(x), y(y), width(width), height(height), rounding(rounding), thickness(thickness), color(color) {}
+    };
+
+    struct Ring {
+        float centerX, centerY, radius;
+        float thickness;
+        Color color;
+        int segments;
+
+        Ring(float centerX, float centerY, float radius, float thickness, Color color, int segments = 64)
+            : centerX(centerX), centerY(centerY), radius(radius), thickness(thickness), color(color), segments(segments) {}
+    };
+
+    struct Image {
+        float x, y, width, height;
+        int imageId;
+        Color tint;
+
+        Image(float x, float y, float width, float height, int imageId, Color tint)
+            : x(x), y(y), width(width), height(height), imageId(imageId), tint(tint) {}
+    };
+
+    enum JoinStyle {
+        JOIN_MITER,
+        JOIN_BEVEL
+    };
+
+    struct Line {
+        float x1, y1, x2, y2;
+        float thickness;
+        Color color;
+
+        Line(float x1, float y1, float x2, float y2, float thickness, Color color)
+            : x1(x1), y1(y1), x2(x2), y2(y2), thickness(thickness), color(color) {}
+    };
+
+    // Open stroke through pointCount (x, y) pairs. The points are not copied and have to stay
+    // valid until draw() returns.
+    struct Polyline {
+        const float* points;
+        uint32_t pointCount;
+        float thickness;
+        Color color;
+        JoinStyle join;
+
+        Polyline(const float* points, uint32_t pointCount, float thickness, Color color, JoinStyle join)
+            : points(points), pointCount(pointCount), thickness(thickness), color(color), join(join) {}
+    };
+
+    // The samples of a LiveGraph with its top left corner at x, y. Stroke thickness and color
+    // belong to the graph, which keeps its tessellation between frames.
+    struct Graph {
+        const LiveGraph* graph;
+        float x, y;
+
+        Graph(const LiveGraph* graph, float x, float y) : graph(graph), x(x), y(y) {}
+    };
+
+    // A VectorPath filled with color, moved by x, y. The path is not copied and has to stay
+    // valid until draw() returns; hash is the path's as of CreatePath(), retained batches
+    // compare it to find unchanged paths without looking at the path again.
+    struct Path {
+        const VectorPath* path;
+        uint64_t hash;
+        float x, y;
+        Color color;
+
+        Path(const VectorPath* path, uint64_t hash, float x, float y, Color color) : path(path), hash(hash), x(x), y(y), color(color) {}
+    };
+
+    // Soft shadow of a (rounded) rectangle, evaluated per pixel on one quad instead of being
+    // built from stacked translucent shapes. The shadow box is the rectangle moved by the
+    // offset and grown by spread on every side; blur is the CSS blur radius, twice the sigma
+    // of the Gaussian it is convolved with. See AnalyticShadow for the exact falloff.
+    struct Shadow {
+        float x, y, width, height;
+        float rounding;
+        float offsetX, offsetY;
+        float blur;
+        float spread;
+        Color color;
+
+        Shadow(float x, float y, float width, float height, float rounding, float offsetX, float offsetY, float blur, float spread, Color color)
+            : x(x), y(y), width(width), height(height), rounding(rounding), offsetX(offsetX), offsetY(offsetY), blur(blur), spread(spread), color(color) {}
+    };
+
+    // Composites an offscreen layer, see createLayer(). The layer's pixels map one to one
+    // onto width x height pixels at x, y.
+    struct Layer {
+        float x, y, width, height;
+        int layerId;
+
+        Layer(float x, float y, float width, float height, int layerId)
+            : x(x), y(y), width(width), height(height), layerId(layerId) {}
+    };
+
+    union Shape {
+        Rectangle rectangle;
+        Circle circle;
+        Triangle triangle;
+        Image image;
+        Border border;
+        Ring ring;
+        Line line;
+        Polyline polyline;
+        Graph graph;
+        Layer layer;
+        Shadow shadow;
+        Path path;
+
+        Shape() {}
+        ~Shape() {}
+    };
+
+    enum ShapeType {
+        SHAPE_RECTANGLE,
+        SHAPE_CIRCLE,
+        SHAPE_TRIANGLE,
+        SHAPE_IMAGE,
+        SHAPE_BORDER,
+        SHAPE_RING,
+        SHAPE_LINE,
+        SHAPE_POLYLINE,
+        SHAPE_GRAPH,
+        SHAPE_LAYER,
+        SHAPE_SHADOW,
+        SHAPE_PATH
+    };
+
+    struct DrawCommand {
+        ShapeType type;
+        Shape shape;
+
+        DrawCommand() : type(SHAPE_RECTANGLE) {}
+
+        static DrawCommand CreateRectangle(float x, float y, float width, float height, float rounding, Color color) {
+            DrawCommand command;
+            command.type = SHAPE_RECTANGLE;
+            command.shape.rectangle = Rectangle(x, y, width, height, rounding, color);
+            return command;
+        }
+
+        static DrawCommand CreateCircle(float centerX, float centerY, float radius, Color color, int segments = 48) {
+            DrawCommand command;
+            command.type = SHAPE_CIRCLE;
+            command.shape.circle = Circle(centerX, centerY, radius, color, segments);
+            return command;
+        }
+
+        static DrawCommand CreateTriangle(float x1, float y1, float x2, float y2, float x3, float y3, Color color) {
+            DrawCommand command;
+            command.type = SHAPE_TRIANGLE;
+            command.shape.triangle = Triangle(x1, y1, x2, y2, x3, y3, color);
+            return command;
+        }
+
+        static DrawCommand CreateImage(float x, float y, float width, float height, int imageId, Color tint = Color(1.0f, 1.0f, 1.0f, 1.0f)) {
+            DrawCommand command;
+            command.type = SHAPE_IMAGE;
+            command.shape.image = Image(x, y, width, height, imageId, tint);
+            return command;
+        }
+
+        static DrawCommand CreateBorder(float x, float y, float width, float height, float rounding, float thickness, Color color) {
+            DrawCommand command;
+            command.type = SHAPE_BORDER;
+            command.shape.border = Border(x, y, width, height, rounding, thickness, color);
+            return command;
+        }
+
+        static DrawCommand CreateRing(float centerX, float centerY, float radius, float thickness, Color color, int segments = 48) {
+            DrawCommand command;
+            command.type = SHAPE_RING;
+            command.shape.ring = Ring(centerX, centerY, radius, thickness, color, segments);
+            return command;
+        }
+
+        static DrawCommand CreateLine(float x1, float y1, float x2, float y2, float thickness, Color color) {
+            DrawCommand command;
+            command.type = SHAPE_LINE;
+            command.shape.line = Line(x1, y1, x2, y2, thickness, color);
+            return command;
+        }
+
+        static DrawCommand CreatePolyline(const float* points, uint32_t pointCount, float thickness, Color color, JoinStyle join = JOIN_MITER) {
+            DrawCommand command;
+            command.type = SHAPE_POLYLINE;
+            command.shape.polyline = Polyline(points, pointCount, thickness, color, join);
+            return command;
+        }
+
+        static DrawCommand CreateGraph(const LiveGraph& graph, float x, float y) {
+            DrawCommand command;
+            command.type = SHAPE_GRAPH;
+            command.shape.graph = Graph(&graph, x, y);
+            return command;
+        }
+
+        static DrawCommand CreateLayer(float x, float y, float width, float height, int layerId) {
+            DrawCommand command;
+            command.type = SHAPE_LAYER;
+            command.shape.layer = Layer(x, y, width, height, layerId);
+            return command;
+        }
+
+        static DrawCommand CreateShadow(float x, float y, float width, float height, float rounding, float offsetX, float offsetY, float blur, float spread, Color color) {
+            DrawCommand command;
+            command.type = SHAPE_SHADOW;
+            command.shape.shadow = Shadow(x, y, width, height, rounding, offsetX, offsetY, blur, spread, color);
+            return command;
+        }
+
+        // In path.cpp, so backends that never draw paths need no path code.
+        static DrawCommand CreatePath(const VectorPath& path, float x, float y, Color color);
+    };
+
+    virtual ~RenderBackend() {}
+
+    virtual void draw(const DrawCommand& command) = 0;
+    virtual void clearScreen(float r, float g, float b, float a) = 0;
+    virtual void present() = 0;
+    // True when present() blocks until the display takes the frame, which paces a render
+    // thread. Without it the render thread waits for a new snapshot instead of redrawing
+    // the last one as fast as it can.
+    virtual bool presentWaitsForVsync() const { return false; }
+    virtual void setWindowClickThrough(bool enable) {}
+
+    // Offscreen layers for content that is drawn once and composited many times. createLayer()
+    // returns -1 when the backend has none, callers then draw the content directly. Draws
+    // between beginLayer() and endLayer() go into the layer, cleared to transparent first,
+    // with the pixel at x, y landing on its top left corner.
+    virtual int createLayer(int width, int height) { return -1; }
+    virtual void destroyLayer(int layerId) {}
+    virtual bool beginLayer(int layerId, float x, float y) { return false; }
+    virtual void endLayer() {}
+
+    // Late latching. Draws between beginLateGroup() and endLateGroup() are held back and
+    // submitted by present() after everything else, right after the pointer source was asked
+    // for the newest pointer position: LATE_POINTER groups are drawn relative to the pointer
+    // and moved to it, LATE_HOVER groups are only drawn while the pointer is inside x, y,
+    // width, height. The source is only asked in frames that have late groups. Returns false
+    // when the backend has no late stage or no source, callers then draw the group directly.
+    enum LateGroupKind {
+        LATE_POINTER,
+        LATE_HOVER
+    };
+
+    typedef std::function<bool(float& x, float& y)> PointerSource;
+
+    virtual void setPointerSource(PointerSource source) {}
+    virtual bool beginLateGroup(LateGroupKind kind, float x, float y, float width, float height) { return false; }
+    virtual void endLateGroup() {}
+
+    // Translation slots. Draws after useTranslation(slot) are moved by the slot's offset
+    // when they are submitted, so content drawn relative to a parent keeps its geometry
+    // while the parent moves and moving it only updates the slot. Slot 0 is no translation
+    // and offsets stay set across frames. setTranslation() returns false for slots the
+    // backend does not have, any when it has none; callers then draw in absolute coordinates.
+    enum { MAX_TRANSLATIONS = 256 };
+    virtual bool setTranslation(uint32_t slot, float x, float y) { return false; }
+    virtual void useTranslation(uint32_t slot) {}
+
+    // Damage rendering, see DamageTracker. getBackBuffer() tells the size of the back buffer
+    // the next frame is drawn into and how many presents ago its contents were drawn: 1 when
+    // it still holds the last frame, 0 when they are undefined. Backends returning false
+    // only get whole frames. setDamage() limits the frame up to the next present() to the
+    // redraw rectangles, which must not overlap: clearScreen() clears only them and draws
+    // are clipped to them. dirty is what changed since the last present, for the compositor.
+    struct DamageRect {
+        int left, top, right, bottom;       // right and bottom exclusive
+
+        DamageRect() : left(0), top(0), right(0), bottom(0) {}
+        DamageRect(int left, int top, int right, int bottom) : left(left), top(top), right(right), bottom(bottom) {}
+        int64_t area() const { return static_cast<int64_t>(right - left) * (bottom - top); }
+    };
+
+    virtual bool getBackBuffer(int& width, int& height, uint32_t& age) { return false; }
+    virtual void setDamage(const DamageRect* redraw, size_t redrawCount, const DamageRect* dirty, size_t dirtyCount) {}
+};
+
+// Backend that discards everything it is given. Used to replay captures and drive ezUI
+// on machines without a GPU, where only the CPU side of a frame is of interest.
+class NullRenderer : public RenderBackend {
+public:
+    size_t commandCount = 0;
+    size_t frameCount = 0;
+
+    void draw(const DrawCommand& command) override { commandCount++; }
+    void clearScreen(float r, float g, float b, float a) override {}
+    void present() override { frameCount++; }
+};
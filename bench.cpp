@@ -0,0 +1,459 @@
+// CPU benchmarks for ezUI and its backends, run headless through NullRenderer and
+// TraceRenderer so the numbers do not depend on a GPU. Runs every scenario, or the ones
+// named on the command line; "replay file.ezcap [loops]" replays a capture instead of the
+// one the scenario records. Build in Release, the Debug checks dominate every number.
+#include "ezui.hpp"
+#include "capture.hpp"
+#include "geometry.hpp"
+#include "graph.hpp"
+#include "styles.hpp"
+#include "trace.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Results are added up here so the optimizer cannot drop the work being measured.
+static volatile double sink = 0.0;
+
+// From the command line, see main().
+static std::string replayPath;
+static int replayLoops = 10;
+
+// Average milliseconds per call of run over iterations calls, after one warm-up call.
+template <typename Function>
+static double millisecondsPer(int iterations, Function run) {
+    run();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        run();
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+static void printReplay(const char* backend, const ReplayStats& stats) {
+    std::printf("  %s: %u frames, %llu commands (%llu images without pixels), %.0f fps, frame ms p50 %.3f p99 %.3f max %.3f\n", backend, stats.frames,
+        static_cast<unsigned long long>(stats.commands), static_cast<unsigned long long>(stats.images), stats.framesPerSecond(), stats.p50FrameMs,
+        stats.p99FrameMs, stats.maxFrameMs);
+}
+
+// Records 300 frames of 20 panels of 50 buttons, each drawn as a border and a fill, with 20
+// buttons recolored per frame.
+static bool recordReplay(const std::string& path) {
+    CaptureRecorder recorder;
+    if (!recorder.open(path)) {
+        return false;
+    }
+    RenderBackend::Color border(0.15f, 0.15f, 0.15f, 1.0f);
+    RenderBackend::Color background(0.2f, 0.2f, 0.2f, 1.0f);
+    std::vector<RenderBackend::Color> colors(1000, RenderBackend::Color(0.45f, 0.45f, 0.45f, 1.0f));
+    for (int frame = 0; frame < 300; ++frame) {
+        for (int i = 0; i < 20; ++i) {
+            float shade = 0.4f + 0.3f * ((frame + i) % 10) / 10.0f;
+            size_t button = (frame * 37 + i * 53) % colors.size();
+            colors[button] = RenderBackend::Color(shade, shade, shade, 1.0f);
+            recorder.recordWidgetColor("panel" + std::to_string(button / 50) + "/" + std::to_string(button % 50), colors[button]);
+        }
+        recorder.recordClear(RenderBackend::Color(0.0f, 0.0f, 0.0f, 0.0f));
+        for (int c = 0; c < 20; ++c) {
+            float x = (c % 5) * 380.0f;
+            float y = (c / 5) * 250.0f;
+            recorder.recordDraw(RenderBackend::DrawCommand::CreateRectangle(x - 2.0f, y - 2.0f, 364.0f, 234.0f, 2.0f, border));
+            recorder.recordDraw(RenderBackend::DrawCommand::CreateRectangle(x, y, 360.0f, 230.0f, 0.0f, background));
+            for (int i = 0; i < 50; ++i) {
+                float buttonX = x + (i % 5) * 70.0f + 10.0f;
+                float buttonY = y + (i / 5) * 22.0f + 5.0f;
+                recorder.recordDraw(RenderBackend::DrawCommand::CreateRectangle(buttonX - 2.0f, buttonY - 2.0f, 64.0f, 22.0f, 5.0f, border));
+                recorder.recordDraw(RenderBackend::DrawCommand::CreateRectangle(buttonX, buttonY, 60.0f, 18.0f, 3.0f, colors[c * 50 + i]));
+            }
+        }
+        recorder.endFrame();
+    }
+    recorder.close();
+    return true;
+}
+
+// Replays a capture into NullRenderer, which measures the decoding alone, and once into
+// TraceRenderer, which batches and uploads like the D3D11 backend. Without a capture on
+// the command line, one is recorded first and deleted afterwards.
+static void benchReplay() {
+    std::string path = replayPath.empty() ? "bench_replay.ezcap" : replayPath;
+    if (replayPath.empty() && !recordReplay(path)) {
+        std::printf("  cannot write %s\n", path.c_str());
+        return;
+    }
+
+    CaptureFile capture;
+    if (!capture.open(path)) {
+        std::printf("  cannot open %s\n", path.c_str());
+        return;
+    }
+    CaptureReplayer replayer;
+    NullRenderer null;
+    printReplay("NullRenderer", replayer.replay(capture, null, replayLoops));
+
+    TraceRenderer trace;
+    ReplayStats stats = replayer.replay(capture, trace, 1);
+    printReplay("TraceRenderer", stats);
+    uint64_t drawCalls = 0;
+    uint64_t uploadedBytes = 0;
+    for (uint32_t frame = 0; frame < trace.frameCount(); ++frame) {
+        TraceRenderer::FrameSummary summary = trace.summarize(frame);
+        drawCalls += summary.drawCalls;
+        uploadedBytes += summary.uploadedBytes;
+    }
+    if (stats.frames > 0) {
+        std::printf("  TraceRenderer: %.1f draw calls/frame, %llu bytes uploaded/frame\n", static_cast<double>(drawCalls) / stats.frames,
+            static_cast<unsigned long long>(uploadedBytes / stats.frames));
+    }
+    if (replayPath.empty()) {
+        capture.close();
+        std::remove(path.c_str());
+    }
+}
+
+// Per-frame cost of a virtualized list scrolling through 1k and 1M items. Only the visible
+// rows are generated and drawn, so both should cost the same.
+static void benchScrollList() {
+    for (size_t itemCount : { static_cast<size_t>(1000), static_cast<size_t>(1000000) }) {
+        NullRenderer renderer;
+        ezUI ui(renderer);
+        ui.addContainer("panel", 100.0f, 100.0f, 300.0f, 400.0f);
+        ui.toggleVisibility("panel");
+        size_t generated = 0;
+        ui.addScrollList("panel", "list", RenderBackend::Rectangle(0.0f, 0.0f, 300.0f, 400.0f, 0.0f, RenderBackend::Color(0.2f, 0.2f, 0.2f, 1.0f)), itemCount, 20.0f,
+            [&](size_t index, ezUI::ListRow& row) {
+                generated++;
+                row.color.r = index % 2 ? 0.3f : 0.25f;
+            });
+
+        const int frames = 10000;
+        // Scrolls a bit less than a page per frame and wraps around at the end.
+        float position = 0.0f;
+        float end = static_cast<float>(itemCount) * 20.0f - 400.0f;
+        size_t commands = renderer.commandCount;
+        double ms = millisecondsPer(frames, [&] {
+            float delta = position + 380.0f > end ? -position : 380.0f;
+            position += delta;
+            ui.scrollList("list", delta);
+            ui.handleInput();
+            ui.drawAllElements();
+        });
+        std::printf("  %7zu items: %.4f ms/frame, %.1f draws/frame, %zu rows generated\n", itemCount, ms,
+            static_cast<double>(renderer.commandCount - commands) / (frames + 1), generated);
+    }
+}
+
+// Tessellating 100k points per frame, as one polyline rebuilt every frame and as a live
+// graph that scrolls by 100 new samples per frame and only tessellates those.
+static void benchPolyline() {
+    const uint32_t pointCount = 100000;
+    std::vector<float> points(pointCount * 2);
+    for (uint32_t i = 0; i < pointCount; ++i) {
+        points[i * 2] = i * 0.02f;
+        points[i * 2 + 1] = 300.0f + 100.0f * std::sin(i * 0.01f);
+    }
+
+    TextureAtlas atlas;
+    GeometryBatch batch(atlas);
+    RenderBackend::Color color(1.0f, 1.0f, 1.0f, 1.0f);
+    for (RenderBackend::JoinStyle join : { RenderBackend::JOIN_MITER, RenderBackend::JOIN_BEVEL }) {
+        double ms = millisecondsPer(100, [&] {
+            batch.clear();
+            batch.add(RenderBackend::DrawCommand::CreatePolyline(points.data(), pointCount, 2.0f, color, join));
+        });
+        std::printf("  polyline, %s joins: %.3f ms/frame, %zu vertices\n", join == RenderBackend::JOIN_MITER ? "miter" : "bevel", ms, batch.vertices.size());
+    }
+
+    LiveGraph graph(pointCount, 1900.0f, 200.0f, -1.0f, 1.0f, 2.0f, color);
+    for (uint32_t i = 0; i < pointCount; ++i) {
+        graph.push(std::sin(i * 0.01f));
+    }
+    int frame = 0;
+    uint64_t segments = graph.getTessellatedSegments();
+    double ms = millisecondsPer(100, [&] {
+        for (int i = 0; i < 100; ++i) {
+            graph.push(std::sin((frame * 100 + i) * 0.01f));
+        }
+        frame++;
+        batch.clear();
+        batch.add(RenderBackend::DrawCommand::CreateGraph(graph, 0.0f, 0.0f));
+    });
+    std::printf("  live graph, 100 new samples: %.3f ms/frame, %.0f segments tessellated/frame\n", ms,
+        static_cast<double>(graph.getTessellatedSegments() - segments) / frame);
+}
+
+// The default button style wrapped in std::function the way dynamic styles are, as a static
+// style called through its function pointer and as the built-in style switched on, applied
+// to 1M widgets and drawn as 10k buttons of a frame.
+static void benchStyles() {
+    ezUI::Style dynamicStyle([](const RenderBackend::Rectangle& bounds, RenderBackend::Color color) {
+        std::vector<RenderBackend::DrawCommand> commands;
+        DefaultButtonStyle::emit(bounds, color, commands);
+        return commands;
+    });
+    ezUI::Style pointerStyle(&DefaultButtonStyle::emit);
+    ezUI::Style builtInStyle = ezUI::Style::of<DefaultButtonStyle>();
+    const ezUI::Style* styles[] = { &dynamicStyle, &pointerStyle, &builtInStyle };
+    const char* styleNames[] = { "std::function", "function pointer", "built-in" };
+
+    std::vector<RenderBackend::DrawCommand> commands;
+    RenderBackend::Rectangle bounds(10.0f, 10.0f, 80.0f, 20.0f, 2.0f, RenderBackend::Color(0.5f, 0.5f, 0.5f, 1.0f));
+    for (int pass = 0; pass < 3; ++pass) {
+        const ezUI::Style& style = *styles[pass];
+        const int widgets = 1000000;
+        double ms = millisecondsPer(1, [&] {
+            for (int i = 0; i < widgets; ++i) {
+                commands.clear();
+                bounds.x = static_cast<float>(i % 1000);
+                style.apply(bounds, bounds.color, commands);
+                sink = sink + commands[1].shape.rectangle.x;
+            }
+        });
+        std::printf("  %s: %.1f ns/widget\n", styleNames[pass], ms * 1e6 / widgets);
+    }
+
+    for (int pass = 0; pass < 3; ++pass) {
+        NullRenderer renderer;
+        ezUI ui(renderer);
+        ui.registerStyle("dynamicButton", dynamicStyle);
+        ui.registerStyle("pointerButton", pointerStyle);
+        const char* buttonStyles[] = { "dynamicButton", "pointerButton", "defaultButton" };
+        ui.addContainer("panel", 0.0f, 0.0f, 1900.0f, 1000.0f);
+        ui.toggleVisibility("panel");
+        for (int i = 0; i < 10000; ++i) {
+            ui.addButton("panel", "button" + std::to_string(i), RenderBackend::Rectangle((i % 100) * 19.0f, (i / 100) * 10.0f, 18.0f, 9.0f, 0.0f, RenderBackend::Color(0.5f, 0.5f, 0.5f, 1.0f)),
+                nullptr, nullptr, nullptr, buttonStyles[pass]);
+        }
+        double ms = millisecondsPer(100, [&] { ui.drawAllElements(); });
+        std::printf("  10k buttons, %s style: %.3f ms/frame\n", styleNames[pass], ms);
+    }
+}
+
+// Hit-testing and drawing 100k buttons spread over 100 containers, the linear scans over
+// the hot widget arrays.
+static void benchWidgetIteration() {
+    NullRenderer renderer;
+    ezUI ui(renderer);
+    for (int c = 0; c < 100; ++c) {
+        std::string container = "panel" + std::to_string(c);
+        ui.addContainer(container, (c % 10) * 190.0f, (c / 10) * 100.0f, 180.0f, 90.0f);
+        ui.toggleVisibility(container);
+        for (int i = 0; i < 1000; ++i) {
+            ui.addButton(container, container + "/" + std::to_string(i), RenderBackend::Rectangle((i % 40) * 4.5f, (i / 40) * 3.5f, 4.0f, 3.0f, 0.0f, RenderBackend::Color(0.5f, 0.5f, 0.5f, 1.0f)),
+                [](ezUI::Button&) {}, [](ezUI::Button&) {});
+        }
+    }
+    double inputMs = millisecondsPer(100, [&] { ui.handleInput(); });
+    double drawMs = millisecondsPer(100, [&] { ui.drawAllElements(); });
+    std::printf("  100k buttons: handleInput %.3f ms, drawAllElements %.3f ms, %.1f ns/button per frame\n", inputMs, drawMs, (inputMs + drawMs) * 1e6 / 100000);
+}
+
+// Dragging a container with thousands of children: moving the container alone, which only
+// changes its translation slot, against moving every child the way absolute child bounds
+// had to be, and moving a layered container. Unlayered, the upload stays the same size
+// but the CPU still emits, batches and depth orders every child each frame, so the frame
+// time is linear in the number of children. A layered container is one quad.
+static void benchContainerDrag() {
+    for (int childCount : { 1000, 10000 }) {
+        for (int pass = 0; pass < 3; ++pass) {
+            bool moveChildren = pass == 1;
+            bool layered = pass == 2;
+            TraceRenderer renderer;
+            ezUI ui(renderer);
+            ui.addContainer("panel", 100.0f, 100.0f, 1000.0f, 800.0f);
+            ui.toggleVisibility("panel");
+            std::vector<std::string> names;
+            std::vector<RenderBackend::Rectangle> bounds;
+            for (int i = 0; i < childCount; ++i) {
+                names.push_back("child" + std::to_string(i));
+                bounds.push_back(RenderBackend::Rectangle(5.0f + (i % 100) * 9.5f, 5.0f + (i / 100) * 7.5f, 8.0f, 6.0f, 2.0f, RenderBackend::Color(0.5f, 0.5f, 0.5f, 1.0f)));
+                ui.addButton("panel", names.back(), bounds.back());
+            }
+            ui.setContainerLayer("panel", layered);
+            ui.drawAllElements();
+            renderer.clearLog();
+
+            int frame = 0;
+            uint64_t uploadedBytes = 0;
+            double ms = millisecondsPer(60, [&] {
+                frame++;
+                float x = 100.0f + frame;
+                float y = 100.0f + frame / 2;
+                if (moveChildren) {
+                    ui.postBounds("panel", x, y, 1000.0f, 800.0f);
+                    for (int i = 0; i < childCount; ++i) {
+                        ui.postBounds(names[i], x + bounds[i].x, y + bounds[i].y, bounds[i].width, bounds[i].height);
+                    }
+                }
+                else {
+                    ui.moveContainer("panel", x, y);
+                }
+                ui.drawAllElements();
+                uploadedBytes += renderer.summarize(renderer.frameCount() - 1).uploadedBytes;
+                renderer.clearLog();
+            });
+            const char* mode = layered ? "layered container moved" : moveChildren ? "every child moved" : "container moved";
+            std::printf("  %5d children, %s: %.3f ms/frame, %llu bytes uploaded/frame\n", childCount, mode, ms,
+                static_cast<unsigned long long>(uploadedBytes / frame));
+        }
+    }
+}
+
+// Circle of four cubics, clockwise on screen unless counterClockwise.
+static void addCircle(VectorPath& path, float cx, float cy, float r, bool counterClockwise) {
+    float k = 0.5523f * r;
+    float s = counterClockwise ? -1.0f : 1.0f;
+    path.moveTo(cx + r, cy);
+    path.cubicTo(cx + r, cy + s * k, cx + k, cy + s * r, cx, cy + s * r);
+    path.cubicTo(cx - k, cy + s * r, cx - r, cy + s * k, cx - r, cy);
+    path.cubicTo(cx - r, cy - s * k, cx - k, cy - s * r, cx, cy - s * r);
+    path.cubicTo(cx + k, cy - s * r, cx + r, cy - s * k, cx + r, cy);
+    path.close();
+}
+
+// Tessellating complex paths from scratch, and drawing a glyph-like path 50 times a frame
+// through the batch's path cache, which should tessellate it once.
+static void benchPaths() {
+    VectorPath polygon;
+    for (int i = 0; i < 1000; ++i) {
+        float angle = i * 6.2831853f / 1000.0f;
+        float r = 200.0f + 60.0f * std::sin(i * 0.7f) + 30.0f * ((i * 7919) % 13) / 13.0f;
+        if (i == 0) {
+            polygon.moveTo(300.0f + r * std::cos(angle), 300.0f + r * std::sin(angle));
+        }
+        else {
+            polygon.lineTo(300.0f + r * std::cos(angle), 300.0f + r * std::sin(angle));
+        }
+    }
+    polygon.close();
+
+    VectorPath star;
+    for (int i = 0; i < 10; ++i) {
+        float angle = i * 3.14159265f / 5.0f;
+        float r = i % 2 ? 20.0f : 50.0f;
+        if (i == 0) {
+            star.moveTo(100.0f + r * std::cos(angle), 100.0f + r * std::sin(angle));
+        }
+        else {
+            star.lineTo(100.0f + r * std::cos(angle), 100.0f + r * std::sin(angle));
+        }
+    }
+    star.close();
+
+    // A "B": quadratic bowls with two rectangular holes.
+    VectorPath glyph;
+    glyph.moveTo(0.0f, 0.0f).lineTo(60.0f, 0.0f).quadTo(90.0f, 25.0f, 60.0f, 50.0f).quadTo(90.0f, 75.0f, 60.0f, 100.0f).lineTo(0.0f, 100.0f).close();
+    glyph.moveTo(15.0f, 15.0f).lineTo(50.0f, 15.0f).lineTo(50.0f, 40.0f).lineTo(15.0f, 40.0f).close();
+    glyph.moveTo(15.0f, 60.0f).lineTo(50.0f, 60.0f).lineTo(50.0f, 85.0f).lineTo(15.0f, 85.0f).close();
+
+    VectorPath ring;
+    addCircle(ring, 50.0f, 50.0f, 40.0f, false);
+    addCircle(ring, 50.0f, 50.0f, 20.0f, true);
+
+    struct NamedPath {
+        const char* name;
+        const VectorPath& path;
+    };
+    const NamedPath paths[] = { { "1000 point polygon", polygon }, { "star", star }, { "glyph with holes", glyph }, { "ring of cubics", ring } };
+    PathTessellator tessellator;
+    PathMesh mesh;
+    for (const NamedPath& named : paths) {
+        double ms = millisecondsPer(200, [&] { tessellator.tessellate(named.path, 0.25f, mesh); });
+        std::printf("  %s: %.4f ms, %zu triangles\n", named.name, ms, mesh.indices.size() / 3);
+    }
+
+    TextureAtlas atlas;
+    GeometryBatch batch(atlas);
+    RenderBackend::Color color(1.0f, 1.0f, 1.0f, 1.0f);
+    double ms = millisecondsPer(100, [&] {
+        batch.clear();
+        for (int i = 0; i < 50; ++i) {
+            batch.add(RenderBackend::DrawCommand::CreatePath(glyph, i * 10.0f, 0.0f, color));
+        }
+    });
+    const PathCache::Stats& stats = batch.getPathStats();
+    std::printf("  50 cached glyphs: %.4f ms/frame, %llu hits, %llu misses\n", ms, static_cast<unsigned long long>(stats.hits),
+        static_cast<unsigned long long>(stats.misses));
+}
+
+// 20k buttons on a 1920x1080 screen with one button recolored per frame, drawn whole and
+// with damage rendering on a traced two buffer flip chain.
+static void benchDamage() {
+    for (int pass = 0; pass < 2; ++pass) {
+        bool damage = pass == 1;
+        TraceRenderer renderer;
+        if (damage) {
+            renderer.setSwapChain(1920, 1080, 2);
+        }
+        ezUI ui(renderer);
+        std::vector<std::string> names;
+        for (int c = 0; c < 20; ++c) {
+            std::string container = "panel" + std::to_string(c);
+            ui.addContainer(container, (c % 5) * 384.0f, (c / 5) * 270.0f, 380.0f, 265.0f);
+            ui.toggleVisibility(container);
+            for (int i = 0; i < 1000; ++i) {
+                names.push_back(container + "/" + std::to_string(i));
+                ui.addButton(container, names.back(), RenderBackend::Rectangle((i % 40) * 9.5f, (i / 40) * 10.5f, 9.0f, 10.0f, 0.0f, RenderBackend::Color(0.45f, 0.45f, 0.45f, 1.0f)));
+            }
+        }
+        ui.drawAllElements();
+        renderer.clearLog();
+
+        int frame = 0;
+        uint64_t primitives = 0;
+        double ms = millisecondsPer(20, [&] {
+            float shade = frame % 2 ? 0.7f : 0.45f;
+            ui.postColor(names[(frame * 7919) % names.size()], RenderBackend::Color(shade, shade, shade, 1.0f));
+            ui.drawAllElements();
+            primitives += renderer.summarize(renderer.frameCount() - 1).primitives;
+            renderer.clearLog();
+            frame++;
+        });
+        DamageTracker::Stats stats = ui.getDamageStats();
+        std::printf("  %s: %.3f ms/frame, %llu primitives/frame, %llu of %llu pixels redrawn\n", damage ? "damage rendering" : "whole frames", ms,
+            static_cast<unsigned long long>(primitives / frame), static_cast<unsigned long long>(damage ? stats.redrawnPixels : 1920ull * 1080),
+            1920ull * 1080);
+    }
+}
+
+struct Scenario {
+    const char* name;
+    void (*run)();
+};
+
+static const Scenario scenarios[] = {
+    { "replay", benchReplay },
+    { "scroll_list", benchScrollList },
+    { "polyline", benchPolyline },
+    { "styles", benchStyles },
+    { "widget_iteration", benchWidgetIteration },
+    { "container_drag", benchContainerDrag },
+    { "paths", benchPaths },
+    { "damage", benchDamage },
+};
+
+int main(int argc, char** argv) {
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::strcmp(argv[i], "replay") == 0) {
+            replayPath = argv[i + 1];
+            if (i + 2 < argc) {
+                replayLoops = (std::max)(std::atoi(argv[i + 2]), 1);
+            }
+        }
+    }
+    for (const Scenario& scenario : scenarios) {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; ++i) {
+            selected = selected || std::strcmp(argv[i], scenario.name) == 0;
+        }
+        if (selected) {
+            std::printf("%s\n", scenario.name);
+            scenario.run();
+        }
+    }
+    return 0;
+}
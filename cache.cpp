@@ -0,0 +1,203 @@
+#include "cache.hpp"
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+static const size_t PAYLOAD_ALIGNMENT = 16;
+
+static uint64_t alignedOffset(uint64_t offset) {
+    return (offset + PAYLOAD_ALIGNMENT - 1) & ~static_cast<uint64_t>(PAYLOAD_ALIGNMENT - 1);
+}
+
+// Puts from in place of to in one step, to is either the old or the new file at any time.
+static bool replaceFile(const std::string& from, const std::string& to) {
+#ifdef _WIN32
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+uint64_t PersistentCache::hash(const void* data, size_t size, uint64_t seed) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint64_t value = seed;
+    for (size_t i = 0; i < size; ++i) {
+        value ^= bytes[i];
+        value *= 1099511628211ull;
+    }
+    return value;
+}
+
+PersistentCache::PersistentCache() : dirty(false) {}
+
+bool PersistentCache::open(const std::string& cachePath) {
+    close();
+    path = cachePath;
+    return load();
+}
+
+void PersistentCache::close() {
+    mapping.close();
+    slots.clear();
+    slotIndex.clear();
+    dirty = false;
+    stats = Stats();
+}
+
+bool PersistentCache::load() {
+    if (!mapping.open(path)) {
+        return false;
+    }
+
+    const uint8_t* data = mapping.data();
+    size_t size = mapping.size();
+    const FileHeader* header = reinterpret_cast<const FileHeader*>(data);
+    if (size < sizeof(FileHeader) || header->magic != MAGIC || header->version != VERSION || header->headerSize != sizeof(FileHeader)) {
+        mapping.close();
+        return false;
+    }
+    uint64_t indexSize = static_cast<uint64_t>(header->entryCount) * sizeof(Entry);
+    if (header->indexOffset < sizeof(FileHeader) || header->indexOffset > size || indexSize > size - header->indexOffset || header->indexOffset % 8 != 0) {
+        mapping.close();
+        return false;
+    }
+
+    const Entry* entries = reinterpret_cast<const Entry*>(data + header->indexOffset);
+    for (uint32_t i = 0; i < header->entryCount; ++i) {
+        const Entry& entry = entries[i];
+        // Compared without adding, a corrupt size must not wrap around past the check.
+        if (entry.offset < sizeof(FileHeader) || entry.size > header->indexOffset || entry.offset > header->indexOffset - entry.size) {
+            continue;
+        }
+        Slot slot;
+        slot.entry = entry;
+        slot.verified = false;
+        slot.used = false;
+        slotIndex[slotKey(static_cast<Kind>(entry.kind), entry.key)] = slots.size();
+        slots.push_back(slot);
+    }
+    stats.loadedEntries = static_cast<uint32_t>(slots.size());
+    return true;
+}
+
+const uint8_t* PersistentCache::payload(const Slot& slot) const {
+    return slot.added.empty() && slot.entry.size > 0 ? mapping.data() + slot.entry.offset : slot.added.data();
+}
+
+bool PersistentCache::find(Kind kind, uint64_t key, const uint8_t*& data, size_t& size) {
+    auto slotIt = slotIndex.find(slotKey(kind, key));
+    if (slotIt == slotIndex.end()) {
+        stats.misses++;
+        return false;
+    }
+
+    Slot& slot = slots[slotIt->second];
+    if (slot.entry.kind != kind || slot.entry.key != key) {
+        stats.misses++;
+        return false;
+    }
+    if (!slot.verified) {
+        // Checked once per session, a torn write or disk corruption must not reach the GPU.
+        if (hash(payload(slot), static_cast<size_t>(slot.entry.size)) != slot.entry.contentHash) {
+            slotIndex.erase(slotIt);
+            stats.rejected++;
+            stats.misses++;
+            return false;
+        }
+        slot.verified = true;
+    }
+
+    slot.used = true;
+    data = payload(slot);
+    size = static_cast<size_t>(slot.entry.size);
+    stats.hits++;
+    return true;
+}
+
+void PersistentCache::put(Kind kind, uint64_t key, const void* data, size_t size) {
+    Slot slot;
+    slot.entry.kind = kind;
+    slot.entry.reserved = 0;
+    slot.entry.key = key;
+    slot.entry.contentHash = hash(data, size);
+    slot.entry.offset = 0;
+    slot.entry.size = size;
+    slot.verified = true;
+    slot.used = true;
+    slot.added.assign(static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+
+    auto slotIt = slotIndex.find(slotKey(kind, key));
+    if (slotIt != slotIndex.end()) {
+        slots[slotIt->second] = slot;
+    }
+    else {
+        slotIndex[slotKey(kind, key)] = slots.size();
+        slots.push_back(slot);
+    }
+    dirty = true;
+}
+
+bool PersistentCache::save() {
+    if (path.empty() || !dirty) {
+        return true;
+    }
+
+    // Written next to the old file and swapped in, so a crash never leaves a torn cache.
+    std::string temporaryPath = path + ".tmp";
+    std::FILE* file = std::fopen(temporaryPath.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    std::vector<Entry> entries;
+    FileHeader header = { MAGIC, VERSION, static_cast<uint16_t>(sizeof(FileHeader)), 0, 0, 0 };
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    uint64_t offset = sizeof(FileHeader);
+    static const uint8_t padding[PAYLOAD_ALIGNMENT] = {};
+
+    for (const Slot& slot : slots) {
+        auto slotIt = slotIndex.find(slotKey(static_cast<Kind>(slot.entry.kind), slot.entry.key));
+        if (!slot.used || slotIt == slotIndex.end() || &slots[slotIt->second] != &slot) {
+            continue;
+        }
+        uint64_t payloadOffset = alignedOffset(offset);
+        ok = ok && std::fwrite(padding, 1, static_cast<size_t>(payloadOffset - offset), file) == payloadOffset - offset;
+        ok = ok && std::fwrite(payload(slot), 1, static_cast<size_t>(slot.entry.size), file) == slot.entry.size;
+        Entry entry = slot.entry;
+        entry.offset = payloadOffset;
+        entries.push_back(entry);
+        offset = payloadOffset + slot.entry.size;
+    }
+
+    header.entryCount = static_cast<uint32_t>(entries.size());
+    header.indexOffset = alignedOffset(offset);
+    ok = ok && std::fwrite(padding, 1, static_cast<size_t>(header.indexOffset - offset), file) == header.indexOffset - offset;
+    ok = ok && (entries.empty() || std::fwrite(entries.data(), sizeof(Entry), entries.size(), file) == entries.size());
+    ok = ok && std::fseek(file, 0, SEEK_SET) == 0 && std::fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok) {
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+
+    // The old file is still mapped and can not be replaced on Windows until it is unmapped.
+    Stats sessionStats = stats;
+    close();
+    bool renamed = replaceFile(temporaryPath, path);
+    if (!renamed) {
+        std::remove(temporaryPath.c_str());
+    }
+    load();
+    // Only the file just written holds payloads known to match, the old one still gets
+    // checked on use.
+    for (Slot& slot : slots) {
+        slot.verified = renamed;
+        slot.used = true;
+    }
+    sessionStats.loadedEntries = stats.loadedEntries;
+    stats = sessionStats;
+    return renamed;
+}
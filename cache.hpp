@@ -0,0 +1,95 @@
+#pragma once
+#include "mappedfile.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Persistent cache of startup work (.ezcache): shader bytecode, tessellated static geometry
+// and atlas pages, so a warm start maps the file instead of compiling and rebuilding. Same
+// conventions as captures, little endian and mapped in place:
+//
+//   FileHeader
+//   payloads...                  (16 byte aligned)
+//   Entry entries[]              (at FileHeader.indexOffset)
+//
+// Every entry is looked up by kind and a key hashing everything the payload was built
+// from, and its payload is checked against the stored content hash before it is handed
+// out. A missing file, another version or a corrupt entry is a miss and gets rebuilt.
+class PersistentCache {
+public:
+    enum : uint32_t { MAGIC = 0x43435a45 }; // "EZCC"
+    enum : uint16_t { VERSION = 1 };
+
+    enum Kind : uint32_t {
+        KIND_SHADER = 1,
+        KIND_GEOMETRY,
+        KIND_ATLAS
+    };
+
+    struct FileHeader {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t headerSize;
+        uint32_t entryCount;
+        uint32_t reserved;
+        uint64_t indexOffset;
+    };
+
+    struct Entry {
+        uint32_t kind;
+        uint32_t reserved;
+        uint64_t key;
+        uint64_t contentHash;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    struct Stats {
+        uint32_t loadedEntries = 0;     // valid entries in the file at open()
+        uint32_t hits = 0;
+        uint32_t misses = 0;
+        uint32_t rejected = 0;          // entries whose payload did not match its hash, also misses
+    };
+
+    // FNV-1a, 64 bit. Chain calls through seed to hash several pieces.
+    static const uint64_t HASH_SEED = 14695981039346656037ull;
+    static uint64_t hash(const void* data, size_t size, uint64_t seed = HASH_SEED);
+
+    PersistentCache();
+
+    // Maps the cache file. Returns false when it is missing or unusable, the cache then starts
+    // empty and save() writes a new one.
+    bool open(const std::string& path);
+    void close();
+
+    // Points data at the payload stored for kind and key. Valid until close() or save().
+    bool find(Kind kind, uint64_t key, const uint8_t*& data, size_t& size);
+    void put(Kind kind, uint64_t key, const void* data, size_t size);
+
+    // Rewrites the file with the entries used or added since open(), dropping stale ones.
+    // Does nothing when every lookup hit and nothing was added.
+    bool save();
+
+    const Stats& getStats() const { return stats; }
+
+private:
+    struct Slot {
+        Entry entry;
+        bool verified;
+        bool used;
+        std::vector<uint8_t> added;     // payload of entries added by put()
+    };
+
+    std::string path;
+    MappedFile mapping;
+    std::vector<Slot> slots;
+    std::unordered_map<uint64_t, size_t> slotIndex;
+    bool dirty;
+    Stats stats;
+
+    static uint64_t slotKey(Kind kind, uint64_t key) { return key * 31 + kind; }
+    const uint8_t* payload(const Slot& slot) const;
+    bool load();
+};
@@ -0,0 +1,462 @@
+#include "capture.hpp"
+#include "graph.hpp"
+#include <algorithm>
+#include <cstring>
+
+static size_t alignedSize(size_t size) {
+    return (size + 3) & ~static_cast<size_t>(3);
+}
+
+static size_t shapeSize(RenderBackend::ShapeType type) {
+    switch (type) {
+    case RenderBackend::SHAPE_RECTANGLE: return sizeof(RenderBackend::Rectangle);
+    case RenderBackend::SHAPE_CIRCLE: return sizeof(RenderBackend::Circle);
+    case RenderBackend::SHAPE_TRIANGLE: return sizeof(RenderBackend::Triangle);
+    case RenderBackend::SHAPE_IMAGE: return sizeof(RenderBackend::Image);
+    case RenderBackend::SHAPE_BORDER: return sizeof(RenderBackend::Border);
+    case RenderBackend::SHAPE_RING: return sizeof(RenderBackend::Ring);
+    case RenderBackend::SHAPE_LINE: return sizeof(RenderBackend::Line);
+    case RenderBackend::SHAPE_SHADOW: return sizeof(RenderBackend::Shadow);
+    // Polylines and graphs reference their points, see recordPolyline, paths are recorded
+    // as triangles.
+    default: return 0;
+    }
+}
+
+// Copies a fixed size payload, false for records too short to hold one, which a truncated
+// or corrupt file can contain.
+template <typename T>
+static bool readPayload(const CaptureFile::Record& record, T& value) {
+    if (record.size < sizeof(T)) {
+        return false;
+    }
+    memcpy(&value, record.payload, sizeof(T));
+    return true;
+}
+
+CaptureRecorder::CaptureRecorder() : file(nullptr), fileOffset(0), frameRecordCount(0) {}
+
+CaptureRecorder::~CaptureRecorder() {
+    close();
+}
+
+bool CaptureRecorder::open(const std::string& path) {
+    close();
+
+    file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    Capture::FileHeader header = {};
+    header.magic = Capture::MAGIC;
+    header.version = Capture::VERSION;
+    header.headerSize = sizeof(Capture::FileHeader);
+
+    fileOffset = 0;
+    frameData.clear();
+    frameRecordCount = 0;
+    frameOffsets.clear();
+    knownNames.clear();
+    startTime = std::chrono::steady_clock::now();
+
+    if (!write(&header, sizeof(header))) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void CaptureRecorder::close() {
+    if (!file) {
+        return;
+    }
+
+    // The frame index and final header are only written here, a capture that was never
+    // closed still holds valid frames but will be rejected by CaptureFile.
+    Capture::FileHeader header = {};
+    header.magic = Capture::MAGIC;
+    header.version = Capture::VERSION;
+    header.headerSize = sizeof(Capture::FileHeader);
+    header.frameCount = static_cast<uint32_t>(frameOffsets.size());
+    header.indexOffset = fileOffset;
+
+    write(frameOffsets.data(), frameOffsets.size() * sizeof(uint64_t));
+    std::fseek(file, 0, SEEK_SET);
+    std::fwrite(&header, sizeof(header), 1, file);
+    std::fclose(file);
+    file = nullptr;
+}
+
+bool CaptureRecorder::write(const void* data, size_t size) {
+    if (size == 0) {
+        return true;
+    }
+    if (std::fwrite(data, size, 1, file) != 1) {
+        return false;
+    }
+    fileOffset += size;
+    return true;
+}
+
+void CaptureRecorder::appendRecord(uint16_t type, const void* payload, size_t size, const void* extra, size_t extraSize) {
+    if (!file) {
+        return;
+    }
+
+    size_t payloadSize = alignedSize(size + extraSize);
+    Capture::RecordHeader recordHeader = { type, static_cast<uint16_t>(payloadSize) };
+
+    size_t offset = frameData.size();
+    frameData.resize(offset + sizeof(recordHeader) + payloadSize, 0);
+    memcpy(&frameData[offset], &recordHeader, sizeof(recordHeader));
+    memcpy(&frameData[offset + sizeof(recordHeader)], payload, size);
+    if (extraSize > 0) {
+        memcpy(&frameData[offset + sizeof(recordHeader) + size], extra, extraSize);
+    }
+    frameRecordCount++;
+}
+
+uint32_t CaptureRecorder::widgetId(const std::string& name) {
+    uint32_t id = Capture::hashName(name);
+    if (knownNames.insert(id).second) {
+        size_t length = (std::min)(name.size(), static_cast<size_t>(0xff00));
+        appendRecord(Capture::RECORD_WIDGET_NAME, &id, sizeof(id), name.data(), length);
+    }
+    return id;
+}
+
+void CaptureRecorder::recordClear(const RenderBackend::Color& color) {
+    Capture::ClearRecord record = { color.r, color.g, color.b, color.a };
+    appendRecord(Capture::RECORD_CLEAR, &record, sizeof(record));
+}
+
+void CaptureRecorder::recordPolyline(const float* points, uint32_t pointCount, float thickness, const RenderBackend::Color& color, RenderBackend::JoinStyle join) {
+    // Record sizes are 16 bit, long strokes are split into chunks sharing their end points.
+    const uint32_t maxChunkPoints = 8000;
+    struct {
+        uint32_t type;
+        Capture::PolylineRecord polyline;
+    } header = { RenderBackend::SHAPE_POLYLINE, { thickness, color.r, color.g, color.b, color.a, static_cast<uint32_t>(join), 0 } };
+
+    for (uint32_t first = 0; first + 1 < pointCount; first += maxChunkPoints - 1) {
+        header.polyline.pointCount = (std::min)(pointCount - first, maxChunkPoints);
+        appendRecord(Capture::RECORD_DRAW, &header, sizeof(header), points + first * 2, header.polyline.pointCount * 2 * sizeof(float));
+    }
+}
+
+void CaptureRecorder::recordDraw(const RenderBackend::DrawCommand& command) {
+    if (command.type == RenderBackend::SHAPE_POLYLINE) {
+        const RenderBackend::Polyline& polyline = command.shape.polyline;
+        recordPolyline(polyline.points, polyline.pointCount, polyline.thickness, polyline.color, polyline.join);
+        return;
+    }
+    if (command.type == RenderBackend::SHAPE_GRAPH) {
+        const RenderBackend::Graph& graph = command.shape.graph;
+        if (!graph.graph) {
+            return;
+        }
+        graph.graph->getPoints(graphPoints);
+        for (size_t i = 0; i < graphPoints.size(); i += 2) {
+            graphPoints[i] += graph.x;
+            graphPoints[i + 1] += graph.y;
+        }
+        recordPolyline(graphPoints.data(), static_cast<uint32_t>(graphPoints.size() / 2), graph.graph->getThickness(), graph.graph->getColor(), graph.graph->getJoin());
+        return;
+    }
+    if (command.type == RenderBackend::SHAPE_PATH) {
+        const RenderBackend::Path& path = command.shape.path;
+        if (!path.path) {
+            return;
+        }
+        const PathMesh& mesh = pathCache.get(*path.path);
+        const float* p = mesh.positions.data();
+        uint32_t type = RenderBackend::SHAPE_TRIANGLE;
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+            uint32_t a = mesh.indices[i] * 2, b = mesh.indices[i + 1] * 2, c = mesh.indices[i + 2] * 2;
+            RenderBackend::Triangle triangle(path.x + p[a], path.y + p[a + 1], path.x + p[b], path.y + p[b + 1], path.x + p[c], path.y + p[c + 1], path.color);
+            appendRecord(Capture::RECORD_DRAW, &type, sizeof(type), &triangle, sizeof(triangle));
+        }
+        return;
+    }
+
+    size_t size = shapeSize(command.type);
+    if (size == 0) {
+        return;
+    }
+    uint32_t type = static_cast<uint32_t>(command.type);
+    appendRecord(Capture::RECORD_DRAW, &type, sizeof(type), static_cast<const void*>(&command.shape), size);
+}
+
+void CaptureRecorder::recordInput(int x, int y, uint32_t buttons) {
+    Capture::InputRecord record = { x, y, buttons };
+    appendRecord(Capture::RECORD_INPUT, &record, sizeof(record));
+}
+
+void CaptureRecorder::recordHotkey(int virtualKey) {
+    Capture::HotkeyRecord record = { virtualKey };
+    appendRecord(Capture::RECORD_HOTKEY, &record, sizeof(record));
+}
+
+void CaptureRecorder::recordWidgetColor(const std::string& name, const RenderBackend::Color& color) {
+    Capture::WidgetColorRecord record = { widgetId(name), color.r, color.g, color.b, color.a };
+    appendRecord(Capture::RECORD_WIDGET_COLOR, &record, sizeof(record));
+}
+
+void CaptureRecorder::recordWidgetVisible(const std::string& name, bool visible) {
+    Capture::WidgetVisibleRecord record = { widgetId(name), visible ? 1u : 0u };
+    appendRecord(Capture::RECORD_WIDGET_VISIBLE, &record, sizeof(record));
+}
+
+void CaptureRecorder::recordMasterSwitch(bool enabled) {
+    Capture::MasterSwitchRecord record = { enabled ? 1u : 0u };
+    appendRecord(Capture::RECORD_MASTER_SWITCH, &record, sizeof(record));
+}
+
+void CaptureRecorder::endFrame() {
+    if (!file) {
+        return;
+    }
+
+    Capture::FrameHeader frameHeader = {};
+    frameHeader.frameIndex = static_cast<uint32_t>(frameOffsets.size());
+    frameHeader.byteSize = static_cast<uint32_t>(frameData.size());
+    frameHeader.timestampNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count());
+    frameHeader.recordCount = frameRecordCount;
+
+    frameOffsets.push_back(fileOffset);
+    write(&frameHeader, sizeof(frameHeader));
+    write(frameData.data(), frameData.size());
+
+    frameData.clear();
+    frameRecordCount = 0;
+}
+
+CaptureFile::CaptureFile() : data(nullptr), size(0), header(nullptr), frameOffsets(nullptr) {}
+
+CaptureFile::~CaptureFile() {
+    close();
+}
+
+bool CaptureFile::open(const std::string& path) {
+    close();
+
+    if (!mapping.open(path)) {
+        return false;
+    }
+    data = mapping.data();
+    size = mapping.size();
+
+    if (!data || size < sizeof(Capture::FileHeader)) {
+        close();
+        return false;
+    }
+
+    header = reinterpret_cast<const Capture::FileHeader*>(data);
+    if (header->magic != Capture::MAGIC || header->version != Capture::VERSION || header->headerSize != sizeof(Capture::FileHeader)) {
+        close();
+        return false;
+    }
+
+    uint64_t indexSize = static_cast<uint64_t>(header->frameCount) * sizeof(uint64_t);
+    if (header->indexOffset < sizeof(Capture::FileHeader) || header->indexOffset + indexSize > size || header->indexOffset % 4 != 0) {
+        close();
+        return false;
+    }
+    frameOffsets = reinterpret_cast<const uint64_t*>(data + header->indexOffset);
+    return true;
+}
+
+void CaptureFile::close() {
+    mapping.close();
+    data = nullptr;
+    size = 0;
+    header = nullptr;
+    frameOffsets = nullptr;
+}
+
+bool CaptureFile::frame(uint32_t index, Frame& frame) const {
+    if (!header || index >= header->frameCount) {
+        return false;
+    }
+
+    uint64_t offset = frameOffsets[index];
+    if (offset + sizeof(Capture::FrameHeader) > header->indexOffset) {
+        return false;
+    }
+
+    frame.header = reinterpret_cast<const Capture::FrameHeader*>(data + offset);
+    frame.begin = data + offset + sizeof(Capture::FrameHeader);
+    frame.end = frame.begin + frame.header->byteSize;
+    return frame.end <= data + header->indexOffset;
+}
+
+bool CaptureFile::Frame::next(const uint8_t*& cursor, Record& record) const {
+    if (cursor + sizeof(Capture::RecordHeader) > end) {
+        return false;
+    }
+
+    const Capture::RecordHeader* recordHeader = reinterpret_cast<const Capture::RecordHeader*>(cursor);
+    const uint8_t* payload = cursor + sizeof(Capture::RecordHeader);
+    if (payload + recordHeader->size > end) {
+        return false;
+    }
+
+    record.type = recordHeader->type;
+    record.size = recordHeader->size;
+    record.payload = payload;
+    cursor = payload + recordHeader->size;
+    return true;
+}
+
+bool CaptureFile::decodeDraw(const Record& record, RenderBackend::DrawCommand& command) {
+    if (record.type != Capture::RECORD_DRAW || record.size < sizeof(uint32_t)) {
+        return false;
+    }
+
+    uint32_t type;
+    memcpy(&type, record.payload, sizeof(type));
+
+    if (type == RenderBackend::SHAPE_POLYLINE) {
+        Capture::PolylineRecord polyline;
+        if (sizeof(type) + sizeof(polyline) > record.size) {
+            return false;
+        }
+        memcpy(&polyline, record.payload + sizeof(type), sizeof(polyline));
+        if (sizeof(type) + sizeof(polyline) + static_cast<size_t>(polyline.pointCount) * 2 * sizeof(float) > record.size) {
+            return false;
+        }
+        // Records are 4 byte aligned, the points are used straight from the mapping.
+        const float* points = reinterpret_cast<const float*>(record.payload + sizeof(type) + sizeof(polyline));
+        command = RenderBackend::DrawCommand::CreatePolyline(points, polyline.pointCount, polyline.thickness,
+            RenderBackend::Color(polyline.r, polyline.g, polyline.b, polyline.a), static_cast<RenderBackend::JoinStyle>(polyline.join));
+        return true;
+    }
+
+    size_t size = shapeSize(static_cast<RenderBackend::ShapeType>(type));
+    if (size == 0 || sizeof(type) + size > record.size) {
+        return false;
+    }
+
+    command.type = static_cast<RenderBackend::ShapeType>(type);
+    memcpy(static_cast<void*>(&command.shape), record.payload + sizeof(type), size);
+    return true;
+}
+
+const std::string& CaptureReplayer::nameOf(uint32_t widgetId) {
+    return names[widgetId];
+}
+
+ReplayStats CaptureReplayer::replay(const CaptureFile& file, RenderBackend& backend, int loops) {
+    ReplayStats stats;
+    std::vector<double> frameTimes;
+    frameTimes.reserve(static_cast<size_t>(file.frameCount()) * (std::max)(loops, 1));
+
+    RenderBackend::DrawCommand command;
+    auto replayStart = std::chrono::steady_clock::now();
+
+    for (int loop = 0; loop < loops; ++loop) {
+        for (uint32_t i = 0; i < file.frameCount(); ++i) {
+            CaptureFile::Frame frame;
+            if (!file.frame(i, frame)) {
+                break;
+            }
+
+            auto frameStart = std::chrono::steady_clock::now();
+            const uint8_t* cursor = frame.begin;
+            CaptureFile::Record record;
+
+            while (frame.next(cursor, record)) {
+                switch (record.type) {
+                case Capture::RECORD_CLEAR: {
+                    Capture::ClearRecord clear;
+                    if (readPayload(record, clear)) {
+                        backend.clearScreen(clear.r, clear.g, clear.b, clear.a);
+                    }
+                    break;
+                }
+                case Capture::RECORD_DRAW:
+                    if (CaptureFile::decodeDraw(record, command)) {
+                        backend.draw(command);
+                        stats.commands++;
+                        if (command.type == RenderBackend::SHAPE_IMAGE) {
+                            stats.images++;
+                        }
+                    }
+                    break;
+                case Capture::RECORD_INPUT:
+                    if (onInput) {
+                        Capture::InputRecord input;
+                        if (readPayload(record, input)) {
+                            onInput(input.x, input.y, input.buttons);
+                        }
+                    }
+                    break;
+                case Capture::RECORD_HOTKEY:
+                    if (onHotkey) {
+                        Capture::HotkeyRecord hotkey;
+                        if (readPayload(record, hotkey)) {
+                            onHotkey(hotkey.virtualKey);
+                        }
+                    }
+                    break;
+                case Capture::RECORD_WIDGET_NAME: {
+                    uint32_t id;
+                    if (!readPayload(record, id)) {
+                        break;
+                    }
+                    const char* name = reinterpret_cast<const char*>(record.payload + sizeof(id));
+                    size_t length = record.size - sizeof(id);
+                    while (length > 0 && name[length - 1] == '\0') length--;
+                    names[id] = std::string(name, length);
+                    break;
+                }
+                case Capture::RECORD_WIDGET_COLOR:
+                    if (onWidgetColor) {
+                        Capture::WidgetColorRecord color;
+                        if (readPayload(record, color)) {
+                            onWidgetColor(nameOf(color.widgetId), RenderBackend::Color(color.r, color.g, color.b, color.a));
+                        }
+                    }
+                    break;
+                case Capture::RECORD_WIDGET_VISIBLE:
+                    if (onWidgetVisible) {
+                        Capture::WidgetVisibleRecord visible;
+                        if (readPayload(record, visible)) {
+                            onWidgetVisible(nameOf(visible.widgetId), visible.visible != 0);
+                        }
+                    }
+                    break;
+                case Capture::RECORD_MASTER_SWITCH:
+                    if (onMasterSwitch) {
+                        Capture::MasterSwitchRecord masterSwitch;
+                        if (readPayload(record, masterSwitch)) {
+                            onMasterSwitch(masterSwitch.enabled != 0);
+                        }
+                    }
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            backend.present();
+
+            std::chrono::duration<double, std::milli> frameTime = std::chrono::steady_clock::now() - frameStart;
+            frameTimes.push_back(frameTime.count());
+            stats.frames++;
+        }
+    }
+
+    std::chrono::duration<double, std::milli> total = std::chrono::steady_clock::now() - replayStart;
+    stats.totalMs = total.count();
+
+    if (!frameTimes.empty()) {
+        std::sort(frameTimes.begin(), frameTimes.end());
+        stats.minFrameMs = frameTimes.front();
+        stats.maxFrameMs = frameTimes.back();
+        stats.p50FrameMs = frameTimes[frameTimes.size() / 2];
+        stats.p99FrameMs = frameTimes[(std::min)(frameTimes.size() - 1, frameTimes.size() * 99 / 100)];
+    }
+    return stats;
+}
@@ -0,0 +1,193 @@
+#pragma once
+#include "backend.hpp"
+#include "mappedfile.hpp"
+#include "path.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Binary frame capture (.ezcap). Everything is little endian and 4 byte aligned so a
+// mapped file can be walked in place without copying:
+//
+//   FileHeader
+//   FrameHeader, records...      (one block per frame, FrameHeader.byteSize bytes of records)
+//   uint64_t frameOffsets[]      (file offset of every FrameHeader, at FileHeader.indexOffset)
+//
+// A record is a RecordHeader followed by RecordHeader.size bytes of payload. Readers skip
+// record types they do not know, the version only changes when an existing layout does.
+struct Capture {
+    enum : uint32_t { MAGIC = 0x50435a45 }; // "EZCP"
+    enum : uint16_t { VERSION = 1 };
+
+    enum RecordType : uint16_t {
+        RECORD_CLEAR = 1,
+        RECORD_DRAW,
+        RECORD_INPUT,
+        RECORD_HOTKEY,
+        RECORD_WIDGET_NAME,
+        RECORD_WIDGET_COLOR,
+        RECORD_WIDGET_VISIBLE,
+        RECORD_MASTER_SWITCH
+    };
+
+    enum InputButtons : uint32_t {
+        INPUT_LEFT_BUTTON = 1 << 0
+    };
+
+    struct FileHeader {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t headerSize;
+        uint32_t frameCount;
+        uint32_t reserved;
+        uint64_t indexOffset;
+    };
+
+    struct FrameHeader {
+        uint32_t frameIndex;
+        uint32_t byteSize;
+        uint64_t timestampNs;
+        uint32_t recordCount;
+        uint32_t reserved;
+    };
+
+    struct RecordHeader {
+        uint16_t type;
+        uint16_t size;
+    };
+
+    struct ClearRecord { float r, g, b, a; };
+    struct InputRecord { int32_t x, y; uint32_t buttons; };
+    struct HotkeyRecord { int32_t virtualKey; };
+    struct WidgetColorRecord { uint32_t widgetId; float r, g, b, a; };
+    struct WidgetVisibleRecord { uint32_t widgetId; uint32_t visible; };
+    struct MasterSwitchRecord { uint32_t enabled; };
+    // Polylines and graphs are stored as their points, never as the pointers they draw from.
+    struct PolylineRecord { float thickness; float r, g, b, a; uint32_t join; uint32_t pointCount; };
+    // RECORD_DRAW:        uint32_t shapeType, then the raw shape struct of that type, or for
+    //                     SHAPE_POLYLINE a PolylineRecord followed by pointCount x, y pairs.
+    //                     SHAPE_IMAGE keeps the image id but not the pixels, a replay samples
+    //                     whatever the backend holds under that id (the white texel when it
+    //                     holds nothing), see ReplayStats::images
+    // RECORD_WIDGET_NAME: uint32_t widgetId, then the name bytes (not terminated, padded)
+
+    // FNV-1a, used as the widget id so names only have to be stored once per capture.
+    static uint32_t hashName(const std::string& name) {
+        uint32_t hash = 2166136261u;
+        for (unsigned char c : name) {
+            hash ^= c;
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+};
+
+class CaptureRecorder {
+public:
+    CaptureRecorder();
+    ~CaptureRecorder();
+
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return file != nullptr; }
+    uint32_t framesWritten() const { return static_cast<uint32_t>(frameOffsets.size()); }
+
+    void recordClear(const RenderBackend::Color& color);
+    void recordDraw(const RenderBackend::DrawCommand& command);
+    void recordInput(int x, int y, uint32_t buttons);
+    void recordHotkey(int virtualKey);
+    void recordWidgetColor(const std::string& name, const RenderBackend::Color& color);
+    void recordWidgetVisible(const std::string& name, bool visible);
+    void recordMasterSwitch(bool enabled);
+    void endFrame();
+
+private:
+    std::FILE* file;
+    uint64_t fileOffset;
+    std::vector<uint8_t> frameData;
+    uint32_t frameRecordCount;
+    std::vector<uint64_t> frameOffsets;
+    std::unordered_set<uint32_t> knownNames;
+    std::chrono::time_point<std::chrono::steady_clock> startTime;
+    std::vector<float> graphPoints;
+    // Paths are recorded as the triangles they fill, replay needs no path format.
+    PathCache pathCache;
+
+    uint32_t widgetId(const std::string& name);
+    void recordPolyline(const float* points, uint32_t pointCount, float thickness, const RenderBackend::Color& color, RenderBackend::JoinStyle join);
+    void appendRecord(uint16_t type, const void* payload, size_t size, const void* extra = nullptr, size_t extraSize = 0);
+    bool write(const void* data, size_t size);
+};
+
+// Read only view of a capture, memory mapped so replay does no parsing or copying up front.
+class CaptureFile {
+public:
+    struct Record {
+        uint16_t type;
+        uint16_t size;
+        const uint8_t* payload;
+    };
+
+    struct Frame {
+        const Capture::FrameHeader* header;
+        const uint8_t* begin;
+        const uint8_t* end;
+
+        // Walks the records of the frame, returns false once all have been visited.
+        bool next(const uint8_t*& cursor, Record& record) const;
+    };
+
+    CaptureFile();
+    ~CaptureFile();
+
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return data != nullptr; }
+    uint32_t frameCount() const { return header ? header->frameCount : 0; }
+    bool frame(uint32_t index, Frame& frame) const;
+
+    static bool decodeDraw(const Record& record, RenderBackend::DrawCommand& command);
+
+private:
+    MappedFile mapping;
+    const uint8_t* data;
+    size_t size;
+    const Capture::FileHeader* header;
+    const uint64_t* frameOffsets;
+};
+
+struct ReplayStats {
+    uint32_t frames = 0;
+    uint64_t commands = 0;
+    uint64_t images = 0;        // of the commands, drawn without the captured pixels
+    double totalMs = 0.0;
+    double minFrameMs = 0.0;
+    double maxFrameMs = 0.0;
+    double p50FrameMs = 0.0;
+    double p99FrameMs = 0.0;
+
+    double framesPerSecond() const { return totalMs > 0.0 ? frames * 1000.0 / totalMs : 0.0; }
+};
+
+// Feeds a capture into any backend as fast as it accepts it. Input and widget records are
+// handed to the optional callbacks so a harness can drive ezUI from the same file.
+class CaptureReplayer {
+public:
+    std::function<void(int x, int y, uint32_t buttons)> onInput;
+    std::function<void(int virtualKey)> onHotkey;
+    std::function<void(const std::string& name, const RenderBackend::Color& color)> onWidgetColor;
+    std::function<void(const std::string& name, bool visible)> onWidgetVisible;
+    std::function<void(bool enabled)> onMasterSwitch;
+
+    ReplayStats replay(const CaptureFile& file, RenderBackend& backend, int loops = 1);
+
+private:
+    std::unordered_map<uint32_t, std::string> names;
+
+    const std::string& nameOf(uint32_t widgetId);
+};
@@ -0,0 +1,159 @@
+#include "damage.hpp"
+#include <algorithm>
+#include <cmath>
+
+void DamageTracker::begin(int frameWidth, int frameHeight, uint32_t age) {
+    if (frameWidth != width || frameHeight != height) {
+        width = frameWidth;
+        height = frameHeight;
+        invalidated = true;
+    }
+    bufferAge = age;
+    previousEntries.swap(entries);
+    entries.clear();
+}
+
+void DamageTracker::add(float left, float top, float right, float bottom, uint64_t signature) {
+    entries.push_back({ left, top, right, bottom, signature });
+}
+
+void DamageTracker::damage(const Entry& entry) {
+    Rect rect(static_cast<int>(std::floor(entry.left)), static_cast<int>(std::floor(entry.top)), static_cast<int>(std::ceil(entry.right)), static_cast<int>(std::ceil(entry.bottom)));
+    rect.left = (std::max)(rect.left, 0);
+    rect.top = (std::max)(rect.top, 0);
+    rect.right = (std::min)(rect.right, width);
+    rect.bottom = (std::min)(rect.bottom, height);
+    if (rect.right > rect.left && rect.bottom > rect.top) {
+        insert(dirty, rect);
+    }
+}
+
+static bool overlaps(const RenderBackend::DamageRect& a, const RenderBackend::DamageRect& b) {
+    return a.left < b.right && b.left < a.right && a.top < b.bottom && b.top < a.bottom;
+}
+
+static RenderBackend::DamageRect unite(const RenderBackend::DamageRect& a, const RenderBackend::DamageRect& b) {
+    return RenderBackend::DamageRect((std::min)(a.left, b.left), (std::min)(a.top, b.top), (std::max)(a.right, b.right), (std::max)(a.bottom, b.bottom));
+}
+
+void DamageTracker::insert(std::vector<Rect>& rects, Rect rect) {
+    // Swallow everything the rectangle overlaps; the union may reach further, so repeat.
+    bool grown = true;
+    while (grown) {
+        grown = false;
+        for (size_t i = 0; i < rects.size();) {
+            if (overlaps(rects[i], rect)) {
+                rect = unite(rects[i], rect);
+                rects[i] = rects.back();
+                rects.pop_back();
+                grown = true;
+            }
+            else {
+                ++i;
+            }
+        }
+    }
+    rects.push_back(rect);
+    if (rects.size() <= MAX_RECTS) {
+        return;
+    }
+
+    size_t bestA = 0, bestB = 1;
+    int64_t bestWaste = INT64_MAX;
+    for (size_t a = 0; a < rects.size(); ++a) {
+        for (size_t b = a + 1; b < rects.size(); ++b) {
+            int64_t waste = unite(rects[a], rects[b]).area() - rects[a].area() - rects[b].area();
+            if (waste < bestWaste) {
+                bestWaste = waste;
+                bestA = a;
+                bestB = b;
+            }
+        }
+    }
+    Rect merged = unite(rects[bestA], rects[bestB]);
+    rects.erase(rects.begin() + bestB);
+    rects.erase(rects.begin() + bestA);
+    insert(rects, merged);
+}
+
+void DamageTracker::end() {
+    dirty.clear();
+    Rect screen(0, 0, width, height);
+    if (invalidated) {
+        if (screen.area() > 0) {
+            dirty.push_back(screen);
+        }
+        invalidated = false;
+    }
+    else {
+        size_t common = (std::min)(entries.size(), previousEntries.size());
+        for (size_t i = 0; i < common; ++i) {
+            const Entry& current = entries[i];
+            const Entry& previous = previousEntries[i];
+            if (current.signature != previous.signature || current.left != previous.left || current.top != previous.top ||
+                current.right != previous.right || current.bottom != previous.bottom) {
+                damage(previous);
+                damage(current);
+            }
+        }
+        for (size_t i = common; i < entries.size(); ++i) {
+            damage(entries[i]);
+        }
+        for (size_t i = common; i < previousEntries.size(); ++i) {
+            damage(previousEntries[i]);
+        }
+    }
+
+    // The back buffer misses the changes of every frame presented since it was drawn.
+    redraw = dirty;
+    whole = bufferAge == 0 || bufferAge > MAX_BUFFER_AGE || historyFrames + 1 < bufferAge;
+    for (uint32_t i = 0; !whole && i + 1 < bufferAge; ++i) {
+        for (const Rect& rect : history[i]) {
+            insert(redraw, rect);
+        }
+    }
+    int64_t redrawArea = 0;
+    for (const Rect& rect : redraw) {
+        redrawArea += rect.area();
+    }
+    // Clipping to most of the screen saves little, drawing it whole skips the per rectangle passes.
+    if (redrawArea * 4 > screen.area() * 3) {
+        whole = true;
+    }
+    if (whole) {
+        redraw.assign(1, screen);
+        redrawArea = screen.area();
+    }
+
+    for (size_t i = MAX_BUFFER_AGE - 2; i > 0; --i) {
+        history[i].swap(history[i - 1]);
+    }
+    history[0] = dirty;
+    historyFrames = (std::min)(historyFrames + 1, static_cast<uint32_t>(MAX_BUFFER_AGE - 1));
+
+    stats.screenPixels = static_cast<uint64_t>(screen.area());
+    stats.damagedPixels = 0;
+    for (const Rect& rect : dirty) {
+        stats.damagedPixels += static_cast<uint64_t>(rect.area());
+    }
+    stats.redrawnPixels = static_cast<uint64_t>(redrawArea);
+    stats.redrawRects = whole ? 0 : static_cast<uint32_t>(redraw.size());
+    if (whole) {
+        stats.wholeFrames++;
+    }
+    else {
+        stats.partialFrames++;
+    }
+}
+
+bool DamageTracker::needsRedraw(float left, float top, float right, float bottom) const {
+    if (whole) {
+        return true;
+    }
+    for (const Rect& rect : redraw) {
+        if (left < rect.right && right > rect.left && top < rect.bottom && bottom > rect.top) {
+            return true;
+        }
+    }
+    return false;
+}
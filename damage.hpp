@@ -0,0 +1,74 @@
+#pragma once
+#include "backend.hpp"
+#include <cstdint>
+#include <vector>
+
+// Which pixels of a frame have to be drawn again. Every frame lists what it draws, in
+// drawing order, as bounds with a signature of the content; an entry whose bounds or
+// signature differ from the entry at the same position in the previous frame damages its
+// old and its new bounds, as do entries that appeared or disappeared. Damage is kept as a
+// few rectangles that do not overlap, merging the pair that wastes the least area when
+// there are more.
+//
+// The back buffer of a flip model swap chain holds the frame presented bufferAge frames
+// ago, so what is redrawn is the damage of that many frames; dirty, what the compositor is
+// told, is the damage of this frame alone. Frames whose redraw would cover most of the
+// screen are drawn whole. Does not touch a backend, headless tests drive it directly.
+class DamageTracker {
+public:
+    typedef RenderBackend::DamageRect Rect;
+
+    struct Stats {
+        uint64_t screenPixels = 0;
+        uint64_t damagedPixels = 0;     // changed since the last frame
+        uint64_t redrawnPixels = 0;     // drawn, the screen for whole frames
+        uint32_t redrawRects = 0;       // 0 for whole frames
+        uint64_t wholeFrames = 0;
+        uint64_t partialFrames = 0;
+    };
+
+    enum {
+        MAX_RECTS = 4,
+        MAX_BUFFER_AGE = 4
+    };
+
+    // Starts listing the frame to be drawn into a width x height back buffer of the age
+    // RenderBackend::getBackBuffer() reported, 0 when it has none.
+    void begin(int width, int height, uint32_t bufferAge);
+    void add(float left, float top, float right, float bottom, uint64_t signature);
+    void end();
+    // The next frame is damaged entirely, for changes the signatures do not cover.
+    void invalidate() { invalidated = true; }
+
+    // As of end().
+    bool isWhole() const { return whole; }
+    const std::vector<Rect>& getRedraw() const { return redraw; }
+    const std::vector<Rect>& getDirty() const { return dirty; }
+    // Whether anything inside the bounds has to be drawn.
+    bool needsRedraw(float left, float top, float right, float bottom) const;
+    const Stats& getStats() const { return stats; }
+
+private:
+    struct Entry {
+        float left, top, right, bottom;
+        uint64_t signature;
+    };
+
+    std::vector<Entry> entries;
+    std::vector<Entry> previousEntries;
+    // Dirty rectangles of the last MAX_BUFFER_AGE - 1 frames, newest first.
+    std::vector<Rect> history[MAX_BUFFER_AGE - 1];
+    uint32_t historyFrames = 0;
+    std::vector<Rect> dirty;
+    std::vector<Rect> redraw;
+    int width = 0;
+    int height = 0;
+    uint32_t bufferAge = 0;
+    bool invalidated = true;
+    bool whole = true;
+    Stats stats;
+
+    void damage(const Entry& entry);
+    // Adds rect to rects, merging until they neither overlap nor exceed MAX_RECTS.
+    static void insert(std::vector<Rect>& rects, Rect rect);
+};
@@ -1,9 +1,24 @@
 #pragma once
 #include "renderer.hpp"
+#include "capture.hpp"
+#include "latency.hpp"
+#include "layers.hpp"
+#include "damage.hpp"
+#include "immediate.hpp"
+#include "uistate.hpp"
+#include "styles.hpp"
+#include <deque>
 #include <functional>
 #include <unordered_map>
 #include <chrono>
 #include <vector>
+#include <atomic>
+#include <cmath>
+#include <cfloat>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <thread>
 
 #ifdef _DEBUG
 #define EZUI_DEBUG 1
@@ -13,30 +28,60 @@
 
 class ezUI {
 public:
-    ezUI(DX11Renderer& renderer) : renderer(renderer) {
+    ezUI(RenderBackend& renderer) : renderer(renderer), layerCache(renderer) {
         registerDefaultStyles();
     }
 
+    ~ezUI() {
+        stopRenderThread();
+    }
+
     static void dbg(const std::string& message) {
 #if EZUI_DEBUG
         std::cout << "[dbg] " << message << std::endl;
 #endif
     }
 
+    // Either a static style (a plain function, see styles.hpp) or a dynamic one built at
+    // runtime around std::function. Built-in static styles are switched on, see
+    // emitBuiltInStyle(), others are called through emit.
     struct Style {
+        typedef void (*EmitFunction)(const DX11Renderer::Rectangle&, const DX11Renderer::Color&, std::vector<DX11Renderer::DrawCommand>&);
+
         std::function<std::vector<DX11Renderer::DrawCommand>(const DX11Renderer::Rectangle&, DX11Renderer::Color)> createCommands;
+        EmitFunction emit;
+        BuiltInStyle builtIn;
 
-        Style() {}
+        Style() : emit(nullptr), builtIn(STYLE_CUSTOM) {}
 
         Style(std::function<std::vector<DX11Renderer::DrawCommand>(const DX11Renderer::Rectangle&, DX11Renderer::Color)> createCommands)
-            : createCommands(createCommands) {}
+            : createCommands(createCommands), emit(nullptr), builtIn(STYLE_CUSTOM) {}
+
+        explicit Style(EmitFunction emit, BuiltInStyle builtIn = STYLE_CUSTOM) : emit(emit), builtIn(builtIn) {}
+
+        template <typename S>
+        static Style of() {
+            return Style(&S::emit, BuiltInStyleOf<S>::value);
+        }
+
+        void apply(const DX11Renderer::Rectangle& bounds, const DX11Renderer::Color& accentColor, std::vector<DX11Renderer::DrawCommand>& out) const {
+            if (emitBuiltInStyle(builtIn, bounds, accentColor, out)) {
+                return;
+            }
+            if (emit) {
+                emit(bounds, accentColor, out);
+            }
+            else if (createCommands) {
+                std::vector<DX11Renderer::DrawCommand> commands = createCommands(bounds, accentColor);
+                out.insert(out.end(), commands.begin(), commands.end());
+            }
+        }
     };
 
+    // Cold part of a container. Bounds and visibility live in the hot widget arrays.
     struct Container {
         std::string name;
         std::string styleName;
-        DX11Renderer::Rectangle bounds;
-        bool visible;
         float paddingX;
         float paddingY;
         float maxWidth;
@@ -45,13 +90,16 @@ public:
         float currentWidth;
 
         Container()
-            : name(""), styleName("defaultContainer"), bounds(0.0f, 0.0f, 100.0f, 100.0f, 0.0f, DX11Renderer::Color(0.0f, 0.0f, 0.0f, 1.0f)),
-            visible(false), paddingX(10.0f), paddingY(10.0f), maxWidth(500.0f), maxHeight(500.0f),
+            : name(""), styleName("defaultContainer"), paddingX(10.0f), paddingY(10.0f), maxWidth(500.0f), maxHeight(500.0f),
             currentHeight(0.0f), currentWidth(0.0f) {}
-        Container(const std::string& name, float x, float y, float width, float height, DX11Renderer::Color color = DX11Renderer::Color(0.0f, 0.0f, 0.0f, 1.0f), const std::string& style = "defaultContainer", float paddingX = 10.0f, float paddingY = 10.0f, float maxWidth = 500.0f, float maxHeight = 500.0f)
-            : name(name), styleName(style), bounds(x, y, width, height, 0.0f, color), visible(false), paddingX(paddingX), paddingY(paddingY), maxWidth(maxWidth), maxHeight(maxHeight), currentHeight(0.0f), currentWidth(0.0f) {}
+        Container(const std::string& name, const std::string& style = "defaultContainer", float paddingX = 10.0f, float paddingY = 10.0f, float maxWidth = 500.0f, float maxHeight = 500.0f)
+            : name(name), styleName(style), paddingX(paddingX), paddingY(paddingY), maxWidth(maxWidth), maxHeight(maxHeight), currentHeight(0.0f), currentWidth(0.0f) {}
     };
 
+    // Cold part of a button, what the callbacks get to see. The live bounds are kept in the
+    // hot widget arrays and only copied into bounds for the duration of a callback, changes
+    // the callback makes to them are copied back. Bounds are relative to the container, so
+    // moving the container moves its buttons without touching them.
     struct Button {
         std::string containername;
         std::string name;
@@ -83,39 +131,212 @@ public:
             : containername(containername), virtualKey(vk), onKeyPress(callback), lastUseTime(std::chrono::steady_clock::now()), rateLimitMs(rateLimitMs) {}
     };
 
+    // One materialized row of a ScrollList. Filled in by the list's generator when the row
+    // scrolls into view and kept until its slot is needed for another row.
+    struct ListRow {
+        size_t index;
+        std::string styleName;
+        DX11Renderer::Color color;
+        DX11Renderer::Color hoverColor;
+        bool hovered;
+
+        ListRow()
+            : index(SIZE_MAX), styleName("defaultListRow"), color(0.25f, 0.25f, 0.25f, 1.0f), hoverColor(0.35f, 0.35f, 0.35f, 1.0f), hovered(false) {}
+    };
+
+    // Scrollable list of itemCount rows with a fixed height. Only the rows intersecting the
+    // viewport are materialized, into a pool with one slot per visible row, so styling and
+    // hit-testing cost the same for ten items as for a million.
+    struct ScrollList {
+        std::string containername;
+        std::string name;
+        std::string styleName;
+        DX11Renderer::Rectangle bounds;
+        size_t itemCount;
+        float rowHeight;
+        double scrollOffset;    // double so offsets stay pixel exact with millions of rows
+        size_t hoveredIndex;
+        std::function<void(size_t, ListRow&)> generateRow;
+        std::function<void(ListRow&)> onClick;
+        std::vector<ListRow> rows;
+        uint32_t container;     // index into the container arrays
+        // Resolved from styleName and the rows' styleName when they are set, so drawing the
+        // list does no lookups. nullptr until the style is registered.
+        const Style* style;
+        std::vector<const Style*> rowStyles;
+
+        ScrollList()
+            : containername(""), name(""), styleName("defaultList"), bounds(0.0f, 0.0f, 100.0f, 100.0f, 0.0f, DX11Renderer::Color(0.18f, 0.18f, 0.18f, 1.0f)),
+            itemCount(0), rowHeight(20.0f), scrollOffset(0.0f), hoveredIndex(SIZE_MAX), generateRow(nullptr), onClick(nullptr), container(0), style(nullptr) {}
+
+        ScrollList(const std::string& containername, const std::string& name, DX11Renderer::Rectangle bounds, size_t itemCount, float rowHeight, std::function<void(size_t, ListRow&)> generateRow, std::function<void(ListRow&)> clickCallback = nullptr, const std::string& style = "defaultList")
+            : containername(containername), name(name), styleName(style), bounds(bounds), itemCount(itemCount), rowHeight(rowHeight), scrollOffset(0.0f),
+            hoveredIndex(SIZE_MAX), generateRow(generateRow), onClick(clickCallback),
+            rows(static_cast<size_t>(std::ceil(bounds.height / rowHeight)) + 1), container(0), style(nullptr), rowStyles(rows.size(), nullptr) {}
+    };
+
+    // A change posted from any thread. Queued without locks and applied on the UI thread
+    // by the next publish().
+    struct WidgetChange {
+        enum Kind { SET_COLOR, SET_BOUNDS, SET_VISIBLE };
+
+        Kind kind;
+        uint32_t widgetId;
+        float x, y, width, height;
+        DX11Renderer::Color color;
+        bool visible;
+
+        WidgetChange()
+            : kind(SET_COLOR), widgetId(0), x(0.0f), y(0.0f), width(0.0f), height(0.0f), color(0.0f, 0.0f, 0.0f, 0.0f), visible(false) {}
+    };
+
+    struct RenderThreadStats {
+        uint64_t frames = 0;
+        uint64_t snapshots = 0;
+        uint64_t droppedChanges = 0;
+        double lastFrameMs = 0.0;
+        double maxFrameMs = 0.0;
+    };
+
     void registerStyle(const std::string& styleName, const Style& style) {
         if (styles.find(styleName) != styles.end()) {
             dbg("Style with name '" + styleName + "' already exists. Skipping registration.");
             return;
         }
         styles[styleName] = style;
+
+        // Widgets added before their style was registered pick it up now.
+        const Style* registered = &styles[styleName];
+        resolveStyles(containerTable, containerInfo, styleName, registered);
+        resolveStyles(buttonTable, buttonInfo, styleName, registered);
+        for (ScrollList& list : lists) {
+            if (!list.style && list.styleName == styleName) {
+                list.style = registered;
+            }
+            for (size_t i = 0; i < list.rows.size(); ++i) {
+                if (!list.rowStyles[i] && list.rows[i].index != SIZE_MAX && list.rows[i].styleName == styleName) {
+                    list.rowStyles[i] = registered;
+                }
+            }
+        }
+        for (ContainerLayer& layer : containerLayers) {
+            layer.version++;
+        }
+    }
+
+    template <typename S>
+    void registerStyle(const std::string& styleName) {
+        registerStyle(styleName, Style::of<S>());
     }
 
     void addContainer(const std::string& name, float x, float y, float width, float height, DX11Renderer::Color color = DX11Renderer::Color(0.0f, 0.0f, 0.0f, 1.0f), const std::string& style = "defaultContainer", float paddingX = 10.0f, float paddingY = 10.0f, float maxWidth = 500.0f, float maxHeight = 500.0f) {
-        if (containers.find(name) != containers.end()) {
+        if (containerIndex.find(name) != containerIndex.end()) {
             dbg("Container with name '" + name + "' already exists. Skipping addition.");
             return;
         }
-        containers[name] = Container(name, x, y, width, height, color, style, paddingX, paddingY, maxWidth, maxHeight);
+        uint32_t index = containerTable.add(DX11Renderer::Rectangle(x, y, width, height, 0.0f, color), 0, NO_PARENT, findStyle(style));
+        containerInfo.push_back(Container(name, style, paddingX, paddingY, maxWidth, maxHeight));
+        containerLayers.push_back(ContainerLayer());
+        containerIndex[name] = index;
+        containersById[Capture::hashName(name)] = index;
     }
 
     void addButton(const std::string& containername, const std::string& name, DX11Renderer::Rectangle bounds, std::function<void(Button&)> clickCallback = nullptr, std::function<void(Button&)> hoverCallback = nullptr, std::function<void(Button&)> idleCallback = nullptr, const std::string& style = "defaultButton") {       
-        if (buttons.find(name) != buttons.end()) {
+        if (buttonIndex.find(name) != buttonIndex.end()) {
             dbg("Button with name '" + name + "' already exists. Skipping addition.");
             return;
         }
 
-        auto containerIt = containers.find(containername);
-        if (containerIt == containers.end()) {
+        auto containerIt = containerIndex.find(containername);
+        if (containerIt == containerIndex.end()) {
             dbg("Container '" + containername + "' not found. Cannot add button.");
             return;
         }
 
-        Container& container = containerIt->second;
-        bounds.x += container.bounds.x;
-        bounds.y += container.bounds.y;
-        
-        buttons[name] = Button(containername, name, bounds, clickCallback, hoverCallback, idleCallback, style);
+        uint8_t flags = static_cast<uint8_t>((clickCallback ? WIDGET_ON_CLICK : 0) | (hoverCallback ? WIDGET_ON_HOVER : 0) | (idleCallback ? WIDGET_ON_IDLE : 0));
+        uint32_t index = buttonTable.add(bounds, flags, containerIt->second, findStyle(style));
+        buttonInfo.push_back(Button(containername, name, bounds, clickCallback, hoverCallback, idleCallback, style));
+        buttonIndex[name] = index;
+        buttonsById[Capture::hashName(name)] = index;
+        touchContainer(containerIt->second);
+    }
+
+    // bounds are relative to the container like button bounds, rowHeight must be positive.
+    void addScrollList(const std::string& containername, const std::string& name, DX11Renderer::Rectangle bounds, size_t itemCount, float rowHeight, std::function<void(size_t, ListRow&)> generateRow, std::function<void(ListRow&)> clickCallback = nullptr, const std::string& style = "defaultList") {
+        if (listIndex.find(name) != listIndex.end()) {
+            dbg("List with name '" + name + "' already exists. Skipping addition.");
+            return;
+        }
+        if (rowHeight <= 0.0f) {
+            dbg("List '" + name + "' needs a positive row height. Skipping addition.");
+            return;
+        }
+
+        auto containerIt = containerIndex.find(containername);
+        if (containerIt == containerIndex.end()) {
+            dbg("Container '" + containername + "' not found. Cannot add list.");
+            return;
+        }
+
+        lists.push_back(ScrollList(containername, name, bounds, itemCount, rowHeight, generateRow, clickCallback, style));
+        lists.back().container = containerIt->second;
+        lists.back().style = findStyle(style);
+        listIndex[name] = static_cast<uint32_t>(lists.size() - 1);
+        touchContainer(containerIt->second);
+    }
+
+    // Moves a container together with everything in it. Children are drawn relative to their
+    // container through a translation slot of the renderer, so this costs the same for a
+    // container with thousands of buttons as for an empty one. UI thread only, postBounds()
+    // does the same from any thread.
+    void moveContainer(const std::string& containername, float x, float y) {
+        auto containerIt = containerIndex.find(containername);
+        if (containerIt == containerIndex.end()) {
+            dbg("Container not found: " + containername);
+            return;
+        }
+        DX11Renderer::Rectangle& bounds = containerTable.bounds[containerIt->second];
+        bounds.x = x;
+        bounds.y = y;
+    }
+
+    void scrollList(const std::string& name, float delta) {
+        auto listIt = listIndex.find(name);
+        if (listIt == listIndex.end()) {
+            dbg("List not found: " + name);
+            return;
+        }
+        ScrollList& list = lists[listIt->second];
+        list.scrollOffset = (std::min)((std::max)(list.scrollOffset + delta, 0.0), maxScrollOffset(list));
+        touchContainer(list.container);
+    }
+
+    // Changes the number of rows and regenerates the visible ones.
+    void setListItemCount(const std::string& name, size_t itemCount) {
+        auto listIt = listIndex.find(name);
+        if (listIt == listIndex.end()) {
+            dbg("List not found: " + name);
+            return;
+        }
+        ScrollList& list = lists[listIt->second];
+        list.itemCount = itemCount;
+        list.scrollOffset = (std::min)(list.scrollOffset, maxScrollOffset(list));
+        invalidateList(name);
+    }
+
+    // Regenerates the visible rows on the next frame, for when the underlying items changed.
+    void invalidateList(const std::string& name) {
+        auto listIt = listIndex.find(name);
+        if (listIt == listIndex.end()) {
+            dbg("List not found: " + name);
+            return;
+        }
+        ScrollList& list = lists[listIt->second];
+        for (ListRow& row : list.rows) {
+            row.index = SIZE_MAX;
+        }
+        list.hoveredIndex = SIZE_MAX;
+        touchContainer(list.container);
     }
 
     void addHotkey(const std::string& containername, int virtualKey, std::function<void()> callback, int rateLimitMs = 250) {
@@ -126,23 +347,212 @@ public:
         hotkeys[virtualKey] = Hotkey(containername, virtualKey, callback, rateLimitMs);
     }
 
+    // Room for the default styles' borders and drop shadows around the widget bounds, kept
+    // around layers and counted as damaged when a widget changes.
+    static const int STYLE_MARGIN = 32;
+
+    // Opt-in for containers that rarely change: the container, its lists and buttons are
+    // rendered once into an offscreen layer and composited as one quad from then on. Any
+    // change to their bounds, color, visibility or styles through ezUI re-renders the layer;
+    // styles that draw from other state need invalidateLayer() when it changes. A layered
+    // container is composited at its own place in the draw order, with its widgets, instead
+    // of its widgets being drawn after all containers. Content reaching more than a few
+    // pixels (STYLE_MARGIN) outside the widget bounds is cut off. UI thread only.
+    void setContainerLayer(const std::string& containername, bool enable) {
+        auto containerIt = containerIndex.find(containername);
+        if (containerIt == containerIndex.end()) {
+            dbg("Container not found: " + containername);
+            return;
+        }
+        containerLayers[containerIt->second].enabled = enable;
+        touchContainer(containerIt->second);
+    }
+
+    void invalidateLayer(const std::string& containername) {
+        auto containerIt = containerIndex.find(containername);
+        if (containerIt == containerIndex.end()) {
+            dbg("Container not found: " + containername);
+            return;
+        }
+        touchContainer(containerIt->second);
+    }
+
+    // Memory the layers may take together. The least recently composited layers are dropped
+    // when it is exceeded, and containers whose layer does not fit are drawn directly.
+    void setLayerBudget(uint64_t bytes) {
+        layerBudget.store(bytes, std::memory_order_relaxed);
+    }
+
+    // As of the last frame rendered, any thread.
+    LayerCache::Stats getLayerStats() const {
+        return layerStats.load();
+    }
+
+    // Damage rendering, on by default where the renderer supports it (DX11Renderer with
+    // setFlipModel(true)): only what changed since the back buffer was drawn is cleared and
+    // redrawn, see DamageTracker. Widgets damage their bounds and STYLE_MARGIN around them
+    // when their bounds, color or style change, appear or disappear; styles that draw from
+    // other state need invalidateDamage() when it changes. Frames with followPointer() or
+    // late hover items, the frame after them and recorded frames are drawn whole. Any thread.
+    void setDamageTracking(bool enable) {
+        damageTracking.store(enable, std::memory_order_relaxed);
+    }
+
+    void invalidateDamage() {
+        damageInvalidated.store(true, std::memory_order_relaxed);
+    }
+
+    // Pixels damaged and redrawn by the last frame rendered, any thread.
+    DamageTracker::Stats getDamageStats() const {
+        return damageStats.load();
+    }
+
+    // What an immediate mode widget saw this frame.
+    struct Interaction {
+        bool hovered = false;
+        bool held = false;          // pressed on the widget and not released yet
+        bool clicked = false;       // released on the widget after being pressed on it
+    };
+
+    // Immediate mode front end, for UIs rebuilt every frame. Call the widgets between
+    // handleInput() and drawAllElements() each frame; a widget that is not called in a frame
+    // is gone, together with its state. Ids come from ImmediateId, e.g.
+    //     constexpr uint32_t quitId = ImmediateId::hash("quit");
+    // Bounds are in screen pixels, widgets are drawn after the retained ones in call order
+    // with the same styles, a null style being the default one. Nothing here allocates once
+    // the widget count stopped growing. UI thread only.
+    Interaction panel(uint32_t id, const DX11Renderer::Rectangle& bounds, const Style* style = nullptr) {
+        return immediateWidget(id, bounds, style ? style : immediatePanelStyle);
+    }
+
+    Interaction button(uint32_t id, const DX11Renderer::Rectangle& bounds, const Style* style = nullptr) {
+        return immediateWidget(id, bounds, style ? style : immediateButtonStyle);
+    }
+
+    // Same, drawn in hoverColor while the cursor is over it. With late latching the hover
+    // color follows the pointer as sampled right before present, the Interaction does not.
+    Interaction button(uint32_t id, DX11Renderer::Rectangle bounds, const DX11Renderer::Color& hoverColor, const Style* style = nullptr) {
+        const Style* buttonStyle = style ? style : immediateButtonStyle;
+        if (lateLatch) {
+            Interaction interaction = immediateWidget(id, bounds, buttonStyle);
+            if (masterSwitch && buttonStyle) {
+                bounds.color = hoverColor;
+                immediateLateItems.push_back({ RenderBackend::LATE_HOVER, buttonStyle, bounds, interaction.hovered });
+            }
+            return interaction;
+        }
+        if (masterSwitch && isMouseOver(bounds, lastMouseX, lastMouseY)) {
+            bounds.color = hoverColor;
+        }
+        return immediateWidget(id, bounds, buttonStyle);
+    }
+
+    // Draws bounds, relative to the pointer, on top of everything else at the pointer. With
+    // late latching it is moved to the pointer as sampled right before present.
+    void followPointer(const DX11Renderer::Rectangle& bounds, const Style* style = nullptr) {
+        const Style* pointerStyle = style ? style : immediatePanelStyle;
+        if (!masterSwitch || !pointerStyle || lastMouseX == INT_MIN) {
+            return;
+        }
+        immediateLateItems.push_back({ RenderBackend::LATE_POINTER, pointerStyle, bounds, true });
+    }
+
+    // Opt-in late latching for the pointer dependent parts of a frame: followPointer() and
+    // the hover color of immediate buttons. The renderer samples the pointer once more right
+    // before it submits them and patches their position and hover state, instead of showing
+    // the pointer as of handleInput(). Pointer latency of frames that latched is measured
+    // from that sample. Backends without a late stage keep the handleInput() position.
+    // Set before startRenderThread().
+    void setLateLatch(bool enable) {
+        lateLatch = enable;
+        if (!enable) {
+            renderer.setPointerSource(nullptr);
+            return;
+        }
+        renderer.setPointerSource([this](float& x, float& y) {
+            int pointerX, pointerY;
+            if (!cursor(pointerX, pointerY)) {
+                return false;
+            }
+            x = static_cast<float>(pointerX);
+            y = static_cast<float>(pointerY);
+            latchX = x;
+            latchY = y;
+            latchNs = clock();
+            latched = true;
+            return true;
+        });
+    }
+
+    // Resolve a style once and hand the pointer to the immediate widgets every frame.
+    const Style* getStyle(const std::string& styleName) const {
+        return findStyle(styleName);
+    }
+
+    ImmediateStateTable::Stats getImmediateStats() const {
+        return immediateStates.getStats();
+    }
+
+    void setRecorder(CaptureRecorder* captureRecorder) {
+        recorder = captureRecorder;
+    }
+
+    // Monotonic nanoseconds used to stamp inputs and presents. The default steady_clock is
+    // QueryPerformanceCounter based with MSVC, the same clock DXGI frame statistics use.
+    // Set both before startRenderThread().
+    void setClock(std::function<uint64_t()> latencyClock) {
+        clock = latencyClock;
+    }
+
+    // Where the pointer is in screen pixels, GetCursorPos by default. Lets headless tests
+    // move the pointer together with the clock. Sampled by handleInput() and by the late
+    // latch, set before startRenderThread().
+    void setCursorSource(std::function<bool(int& x, int& y)> source) {
+        cursor = source;
+    }
+
+    // Reports when a frame reached the screen, counted in presents done by ezUI. Without one,
+    // latency is measured up to present() returning. Called on whichever thread renders.
+    void setPresentCallback(LatencyTracker::PresentCallback callback) {
+        latency.setPresentCallback(callback);
+    }
+
+    // Time from handleInput() sampling an input to the frame reflecting it being displayed.
+    LatencyTracker::Percentiles getInputLatency(LatencyTracker::InputType type) const {
+        return latency.percentiles(type);
+    }
+
+    const LatencyTracker& getLatencyTracker() const {
+        return latency;
+    }
+
     void handleInput() {
-        POINT mousePos;
-        GetCursorPos(&mousePos);
-        int mouseX = mousePos.x;
-        int mouseY = mousePos.y;
+        // Where the cursor can not be read, it stays where it was.
+        int mouseX = lastMouseX;
+        int mouseY = lastMouseY;
+        cursor(mouseX, mouseY);
+        uint64_t sampledNs = clock();
+
+        if (mouseX != lastMouseX || mouseY != lastMouseY) {
+            if (lastMouseX != INT_MIN) {
+                addInput(LatencyTracker::INPUT_POINTER, sampledNs);
+            }
+            lastMouseX = mouseX;
+            lastMouseY = mouseY;
+        }
 
         bool isHoveringAnyContainer = false;
 
-        for (auto& containerPair : containers) {
-            Container& container = containerPair.second;
-            if (isContainerVisible(container.name) && isMouseOver(container.bounds, mouseX, mouseY)) {
+        const size_t containerCount = masterSwitch ? containerTable.size() : 0;
+        for (size_t i = 0; i < containerCount; ++i) {
+            if ((containerTable.flags[i] & WIDGET_VISIBLE) && isMouseOver(containerTable.bounds[i], mouseX, mouseY)) {
                 isHoveringAnyContainer = true;
                 break;
             }
         }
 
-        if (isHoveringAnyContainer) {
+        // Immediate widgets are only known once called, the ones hovered last frame count.
+        if (isHoveringAnyContainer || immediateHovered) {
             renderer.setWindowClickThrough(false);
         }
         else {
@@ -150,24 +560,86 @@ public:
         }
 
         bool mouseLeftDown = (GetAsyncKeyState(VK_LBUTTON) & 0x8000) != 0;
+        immediatePressed = mouseLeftDown && !immediateMouseDown;
+        immediateReleased = !mouseLeftDown && immediateMouseDown;
+        immediateMouseDown = mouseLeftDown;
+        immediateSampledNs = sampledNs;
+
+        if (recorder) {
+            recorder->recordInput(mouseX, mouseY, mouseLeftDown ? Capture::INPUT_LEFT_BUTTON : 0);
+        }
 
         auto currentTime = std::chrono::steady_clock::now();
         std::chrono::duration<float, std::milli> elapsed = currentTime - lastClickTime;
 
-        for (auto& buttonPair : buttons) {
-            Button& button = buttonPair.second;
-            if (isContainerVisible(button.containername)) {
-                if (isMouseOver(button.bounds, mouseX, mouseY)) {
-                    if (mouseLeftDown && elapsed.count() > 250) {
-                        lastClickTime = currentTime;
-                        if (button.onClick) button.onClick(button);
-                    }
-                    else if (button.onHover) {
-                        button.onHover(button);
+        // Children are hit-tested in their container's coordinates, the cursor is moved into
+        // those once per container.
+        localCursors.resize(containerTable.size());
+        for (size_t i = 0; i < containerTable.size(); ++i) {
+            localCursors[i].x = mouseX - containerTable.bounds[i].x;
+            localCursors[i].y = mouseY - containerTable.bounds[i].y;
+        }
+
+        // Only the hot arrays are read here, the cold Button is touched when a callback runs.
+        // Buttons added by a callback are first tested on the next call.
+        const size_t buttonCount = masterSwitch ? buttonTable.size() : 0;
+        for (size_t i = 0; i < buttonCount; ++i) {
+            uint32_t parent = buttonTable.parents[i];
+            if (!(containerTable.flags[parent] & WIDGET_VISIBLE)) {
+                continue;
+            }
+            uint8_t flags = buttonTable.flags[i];
+            if (isMouseOver(buttonTable.bounds[i], localCursors[parent].x, localCursors[parent].y)) {
+                if (mouseLeftDown && elapsed.count() > 250) {
+                    lastClickTime = currentTime;
+                    addInput(LatencyTracker::INPUT_CLICK, sampledNs);
+                    if (flags & WIDGET_ON_CLICK) runButtonCallback(i, &Button::onClick);
+                }
+                else if (flags & WIDGET_ON_HOVER) {
+                    runButtonCallback(i, &Button::onHover);
+                }
+            }
+            else if (flags & WIDGET_ON_IDLE) {
+                runButtonCallback(i, &Button::onIdle);
+            }
+        }
+
+        // Lists added by a click callback are first tested on the next call.
+        const size_t listCount = lists.size();
+        for (size_t i = 0; i < listCount; ++i) {
+            ScrollList& list = lists[i];
+            size_t hoveredIndex = SIZE_MAX;
+            const Translation& cursor = localCursors[list.container];
+            if (masterSwitch && (containerTable.flags[list.container] & WIDGET_VISIBLE) && isMouseOver(list.bounds, cursor.x, cursor.y)) {
+                // Rows have a fixed height, so the row under the cursor is a division away.
+                size_t index = static_cast<size_t>((cursor.y - list.bounds.y + list.scrollOffset) / list.rowHeight);
+                if (index < list.itemCount) {
+                    hoveredIndex = index;
+                }
+            }
+
+            if (list.hoveredIndex != hoveredIndex) {
+                if (list.hoveredIndex != SIZE_MAX) {
+                    ListRow& previous = list.rows[list.hoveredIndex % list.rows.size()];
+                    if (previous.index == list.hoveredIndex) {
+                        previous.hovered = false;
                     }
                 }
-                else if (button.onIdle) {
-                    button.onIdle(button);
+                list.hoveredIndex = hoveredIndex;
+                touchContainer(list.container);
+            }
+
+            if (hoveredIndex != SIZE_MAX) {
+                ListRow& row = materializeRow(list, hoveredIndex);
+                row.hovered = true;
+                if (mouseLeftDown && elapsed.count() > 250) {
+                    lastClickTime = currentTime;
+                    addInput(LatencyTracker::INPUT_CLICK, sampledNs);
+                    if (list.onClick) {
+                        // The callback may have restyled the row.
+                        list.onClick(row);
+                        list.rowStyles[hoveredIndex % list.rows.size()] = findStyle(row.styleName);
+                    }
                 }
             }
         }
@@ -178,6 +650,10 @@ public:
                 auto timeSinceLastUse = std::chrono::steady_clock::now() - hotkey.lastUseTime;
                 if (std::chrono::duration_cast<std::chrono::milliseconds>(timeSinceLastUse).count() > hotkey.rateLimitMs) {
                     hotkey.lastUseTime = std::chrono::steady_clock::now();
+                    if (recorder) {
+                        recorder->recordHotkey(hotkey.virtualKey);
+                    }
+                    addInput(LatencyTracker::INPUT_HOTKEY, sampledNs);
                     if (hotkey.onKeyPress) {
                         hotkey.onKeyPress();
                     }
@@ -186,40 +662,110 @@ public:
         }
     }
 
+    // Draws a frame on the calling thread, or only hands the current state over when the
+    // render thread is running.
     void drawAllElements() {
-        renderer.clearScreen(0.0f, 0.0f, 0.0f, 0.0f);
+        if (renderThread.joinable()) {
+            publish();
+            return;
+        }
 
-        if (masterSwitch) {
-            // Draw containers
-            for (auto& containerPair : containers) {
-                Container& container = containerPair.second;
-                if (container.visible) {
-                    applyStyle(container.styleName, container.bounds, container.bounds.color);
-                }
-            }
+        applyChanges();
+        buildSnapshot(syncSnapshot);
+        endImmediateFrame();
+        renderSnapshot(syncSnapshot, recorder);
+    }
 
-            // Draw buttons
-            for (auto& buttonPair : buttons) {
-                Button& button = buttonPair.second;
-                if (isContainerVisible(button.containername)) {
-                    applyStyle(button.styleName, button.bounds, button.bounds.color);
-                }
-            }
+    // Thread-safe and lock-free, may be called from any thread. Returns false when the change
+    // queue is full and the change was dropped.
+    bool postColor(const std::string& name, DX11Renderer::Color color) {
+        WidgetChange change;
+        change.kind = WidgetChange::SET_COLOR;
+        change.widgetId = Capture::hashName(name);
+        change.color = color;
+        return post(change);
+    }
+
+    // Button bounds are relative to their container. A container keeping its size is only
+    // moved, its layer and children are not redrawn.
+    bool postBounds(const std::string& name, float x, float y, float width, float height) {
+        WidgetChange change;
+        change.kind = WidgetChange::SET_BOUNDS;
+        change.widgetId = Capture::hashName(name);
+        change.x = x;
+        change.y = y;
+        change.width = width;
+        change.height = height;
+        return post(change);
+    }
+
+    bool postVisible(const std::string& containername, bool visible) {
+        WidgetChange change;
+        change.kind = WidgetChange::SET_VISIBLE;
+        change.widgetId = Capture::hashName(containername);
+        change.visible = visible;
+        return post(change);
+    }
+
+    // UI thread only. Applies the posted changes and publishes a snapshot of the widget state
+    // to the render thread. Never waits for the render thread, a slow frame only means the
+    // render thread skips straight to the newest snapshot.
+    void publish() {
+        applyChanges();
+        buildSnapshot(snapshots.back());
+        endImmediateFrame();
+        snapshots.publish();
+
+        if (recorder) {
+            // Draw commands are produced on the render thread and not captured in this mode.
+            recorder->endFrame();
         }
+    }
 
-        renderer.present();
+    // Moves clearing, drawing and presenting onto a dedicated thread. From here on the
+    // renderer belongs to that thread, the UI thread keeps calling handleInput() and
+    // drawAllElements() (which now only publishes). A renderer that does not wait for vsync
+    // in present() only gets frames for new snapshots.
+    void startRenderThread() {
+        if (renderThread.joinable()) {
+            return;
+        }
+        publish();
+        renderThreadRunning.store(true, std::memory_order_release);
+        renderThread = std::thread(&ezUI::renderLoop, this);
+    }
+
+    void stopRenderThread() {
+        if (!renderThread.joinable()) {
+            return;
+        }
+        renderThreadRunning.store(false, std::memory_order_release);
+        renderThread.join();
+    }
+
+    RenderThreadStats getRenderThreadStats() const {
+        RenderThreadStats stats;
+        stats.frames = renderFrames.load(std::memory_order_relaxed);
+        stats.snapshots = renderSnapshots.load(std::memory_order_relaxed);
+        stats.droppedChanges = droppedChanges.load(std::memory_order_relaxed);
+        stats.lastFrameMs = lastFrameMs.load(std::memory_order_relaxed);
+        stats.maxFrameMs = maxFrameMs.load(std::memory_order_relaxed);
+        return stats;
     }
 
 
     void masterToggle() {
         masterSwitch = !masterSwitch;
+        if (recorder) {
+            recorder->recordMasterSwitch(masterSwitch);
+        }
     }
 
     bool isContainerVisible(const std::string& containername) const {
         if (!masterSwitch) return false;
-        auto containerIt = containers.find(containername);
-        if (containerIt != containers.end()) {
-            return containerIt->second.visible;
+        auto containerIt = containerIndex.find(containername);
+        if (containerIt != containerIndex.end()) {
+            return (containerTable.flags[containerIt->second] & WIDGET_VISIBLE) != 0;
         }
         else {
             dbg("Container not found: " + containername);
@@ -228,9 +774,9 @@ public:
     }
 
     void toggleVisibility(const std::string& containername) {
-        auto containerIt = containers.find(containername);
-        if (containerIt != containers.end()) {
-            containerIt->second.visible = !containerIt->second.visible;
+        auto containerIt = containerIndex.find(containername);
+        if (containerIt != containerIndex.end()) {
+            setContainerVisible(containerIt->second, !(containerTable.flags[containerIt->second] & WIDGET_VISIBLE));
         }
         else {
             dbg("Container not found: " + containername);
@@ -238,68 +784,788 @@ public:
     }
 
     void registerDefaultStyles() {
-        registerStyle("defaultContainer", Style([](const DX11Renderer::Rectangle& bounds, DX11Renderer::Color accentColor) {
-            DX11Renderer::Rectangle outerBounds = bounds;
-            outerBounds.width += 4;
-            outerBounds.height += 4;
-            outerBounds.x -= 2;
-            outerBounds.y -= 2;
+        registerStyle<DefaultContainerStyle>("defaultContainer");
+        registerStyle<ShadowedContainerStyle>("shadowedContainer");
+        registerStyle<DefaultButtonStyle>("defaultButton");
+        registerStyle<DefaultListStyle>("defaultList");
+        registerStyle<DefaultListRowStyle>("defaultListRow");
+        immediatePanelStyle = findStyle("defaultContainer");
+        immediateButtonStyle = findStyle("defaultButton");
+    }
 
-            DX11Renderer::Color borderColor(0.15f, 0.15f, 0.15f, 1.0f);
-            DX11Renderer::Color backgroundColor(0.2f, 0.2f, 0.2f, 1.0f);
 
-            return std::vector<DX11Renderer::DrawCommand>{
-                // border
-                DX11Renderer::DrawCommand::CreateRectangle(outerBounds.x, outerBounds.y, outerBounds.width, outerBounds.height, bounds.rounding + 2, borderColor),
-                // core container
-                DX11Renderer::DrawCommand::CreateRectangle(bounds.x, bounds.y, bounds.width, bounds.height, bounds.rounding, backgroundColor)
-            };
-        }));
 
-        registerStyle("defaultButton", Style([](const DX11Renderer::Rectangle& bounds, DX11Renderer::Color accentColor) {
-            DX11Renderer::Color borderColor(0.15f, 0.15f, 0.15f, 1.0f);
+private:
+    // Everything the render thread needs for one frame. Style pointers stay valid because
+    // unordered_map never moves its elements.
+    struct SnapshotItem {
+        const Style* style;
+        DX11Renderer::Rectangle bounds;
+        uint32_t layer;         // index into Snapshot::layers where a layer is composited
+        uint32_t translation;   // slot the bounds are relative to, 0 for screen pixels
+    };
+
+    // Offset of a translation slot, a container's position.
+    struct Translation {
+        float x, y;
+    };
 
-            DX11Renderer::Rectangle shadowBounds = bounds;
-            shadowBounds.x -= 2;
-            shadowBounds.y -= 2;
-            shadowBounds.width += 4;
-            shadowBounds.height += 4;
+    // Drawn after everything else, in a late group when the renderer has a late stage.
+    // LATE_POINTER bounds are relative to the pointer, visible tells whether a LATE_HOVER
+    // item was hovered as of handleInput().
+    struct SnapshotLateItem {
+        RenderBackend::LateGroupKind kind;
+        const Style* style;
+        DX11Renderer::Rectangle bounds;
+        bool visible;
+    };
 
-            return std::vector<DX11Renderer::DrawCommand>{
-                //border
-                DX11Renderer::DrawCommand::CreateRectangle(shadowBounds.x, shadowBounds.y, shadowBounds.width, shadowBounds.height, bounds.rounding + 2, borderColor),
-                //button
-                DX11Renderer::DrawCommand::CreateRectangle(bounds.x, bounds.y, bounds.width, bounds.height, bounds.rounding, accentColor),
-            };
-        }));
-    }
+    // The widgets of a layered container, drawn into its layer when version changed.
+    struct SnapshotLayer {
+        uint32_t container;
+        uint64_t version;
+        std::vector<SnapshotItem> items;
+    };
+
+    // An input and the sequence of the first snapshot that reflects it, 0 until there is one.
+    struct PendingInput {
+        LatencyTracker::Input input;
+        uint64_t sequence;
+    };
 
+    struct Snapshot {
+        std::vector<SnapshotItem> items;
+        std::vector<SnapshotLayer> layers;
+        std::vector<SnapshotLateItem> lateItems;
+        // Indexed by translation slot, slot 0 is zero.
+        std::vector<Translation> translations;
+        float pointerX = 0.0f;      // as of handleInput()
+        float pointerY = 0.0f;
+        // Every input not known to be presented yet. A snapshot the render thread skips hands
+        // its inputs on to the next one, the renderer only counts those newer than the last
+        // snapshot it presented.
+        std::vector<PendingInput> inputs;
+        uint64_t sequence = 0;
+    };
 
+    enum WidgetFlags : uint8_t {
+        WIDGET_VISIBLE = 1 << 0,    // containers only, buttons follow their parent
+        WIDGET_ON_CLICK = 1 << 1,
+        WIDGET_ON_HOVER = 1 << 2,
+        WIDGET_ON_IDLE = 1 << 3
+    };
 
-private:
-    DX11Renderer& renderer;
-    std::unordered_map<std::string, Container> containers;
-    std::unordered_map<std::string, Button> buttons;
+    static const uint32_t NO_PARENT = UINT32_MAX;
+    static const uint32_t NO_LAYER = UINT32_MAX;
+
+    // Bumped by every change to what a container's layer shows.
+    struct ContainerLayer {
+        bool enabled = false;
+        uint64_t version = 0;
+    };
+
+    // Hot widget data as parallel arrays, one entry per widget in the order they were added.
+    // Everything a frame reads for every widget is in here, so hit-testing and building the
+    // snapshot are linear scans that never touch names or std::function.
+    struct WidgetTable {
+        std::vector<DX11Renderer::Rectangle> bounds;
+        std::vector<uint8_t> flags;
+        std::vector<uint32_t> parents;      // container index, NO_PARENT for containers
+        std::vector<const Style*> styles;   // nullptr until the style is registered
+
+        size_t size() const { return bounds.size(); }
+
+        uint32_t add(const DX11Renderer::Rectangle& widgetBounds, uint8_t widgetFlags, uint32_t parent, const Style* style) {
+            bounds.push_back(widgetBounds);
+            flags.push_back(widgetFlags);
+            parents.push_back(parent);
+            styles.push_back(style);
+            return static_cast<uint32_t>(bounds.size() - 1);
+        }
+    };
+
+    RenderBackend& renderer;
+    WidgetTable containerTable;
+    WidgetTable buttonTable;
+    // Cold side tables, same indices as the hot arrays. deque so a callback that adds a
+    // button does not move the Button it was handed.
+    std::deque<Container> containerInfo;
+    std::deque<Button> buttonInfo;
+    std::vector<ContainerLayer> containerLayers;
+    // Snapshot layer of every container while a snapshot is built, NO_LAYER if it has none.
+    std::vector<uint32_t> snapshotLayerSlots;
+    std::unordered_map<std::string, uint32_t> containerIndex;
+    std::unordered_map<std::string, uint32_t> buttonIndex;
+    // In the order they were added, which is the order they are drawn in. deque for the
+    // same reason as buttonInfo.
+    std::deque<ScrollList> lists;
+    std::unordered_map<std::string, uint32_t> listIndex;
     std::unordered_map<int, Hotkey> hotkeys;
     std::unordered_map<std::string, Style> styles;
+    std::unordered_map<uint32_t, uint32_t> containersById;
+    std::unordered_map<uint32_t, uint32_t> buttonsById;
+
+    ChangeQueue<WidgetChange> changes;
+    TripleBuffer<Snapshot> snapshots;
+    Snapshot syncSnapshot;
+    // Reused for every widget by whichever thread renders.
+    std::vector<DX11Renderer::DrawCommand> styleCommands;
+    uint64_t snapshotSequence = 0;
+
+    std::thread renderThread;
+    std::atomic<bool> renderThreadRunning{ false };
+    std::atomic<uint64_t> renderFrames{ 0 };
+    std::atomic<uint64_t> renderSnapshots{ 0 };
+    std::atomic<uint64_t> droppedChanges{ 0 };
+    std::atomic<double> lastFrameMs{ 0.0 };
+    std::atomic<double> maxFrameMs{ 0.0 };
+
+    // Owned by whichever thread renders.
+    LayerCache layerCache;
+    std::atomic<uint64_t> layerBudget{ LayerCache::DEFAULT_BUDGET };
+    StatsSlot<LayerCache::Stats> layerStats;
+
+    // Owned by whichever thread renders, with the screen bounds of every snapshot item.
+    struct Extent {
+        float left, top, right, bottom;
+    };
+
+    DamageTracker damage;
+    std::vector<Extent> itemExtents;
+    bool lateItemsDrawn = false;
+    std::atomic<bool> damageTracking{ true };
+    std::atomic<bool> damageInvalidated{ false };
+    StatsSlot<DamageTracker::Stats> damageStats;
+
+    std::function<uint64_t()> clock = [] { return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()); };
+    std::function<bool(int&, int&)> cursor = [](int& x, int& y) {
+        POINT pointer;
+        if (!GetCursorPos(&pointer)) {
+            return false;
+        }
+        x = pointer.x;
+        y = pointer.y;
+        return true;
+    };
+    LatencyTracker latency;
+    std::vector<PendingInput> unpresentedInputs;
+    std::atomic<uint64_t> presentedSequence{ 0 };
+    // Owned by whichever thread renders.
+    uint64_t lastPresentedSequence = 0;
+    std::vector<LatencyTracker::Input> presentedInputs;
+    int lastMouseX = INT_MIN;
+    int lastMouseY = INT_MIN;
+    // The cursor in the coordinates of every container, during handleInput().
+    std::vector<Translation> localCursors;
+    // Owned by whichever thread renders: the snapshot's slots were accepted by the renderer.
+    const std::vector<Translation>* renderTranslations = nullptr;
+    bool translationsApplied = false;
+
+    // Immediate mode widgets of the frame being built, and their state across frames.
+    enum ImmediateFlags : uint32_t {
+        IMMEDIATE_HELD = 1 << 0
+    };
+
+    ImmediateStateTable immediateStates;
+    std::vector<SnapshotItem> immediateItems;
+    std::vector<SnapshotLateItem> immediateLateItems;
+    const Style* immediatePanelStyle = nullptr;
+    const Style* immediateButtonStyle = nullptr;
+    uint32_t immediateFrame = 1;
+    bool immediateHovered = false;          // an immediate widget was hovered last frame
+    bool immediateHoveredNow = false;
+    bool immediateMouseDown = false;
+    bool immediatePressed = false;          // the button went down in the last handleInput()
+    bool immediateReleased = false;
+    uint64_t immediateSampledNs = 0;
+    bool lateLatch = false;
+    // Written by the pointer source, on whichever thread renders.
+    bool latched = false;
+    float latchX = 0.0f;
+    float latchY = 0.0f;
+    uint64_t latchNs = 0;
 
     std::chrono::time_point<std::chrono::steady_clock> lastClickTime;
     bool masterSwitch = true;
+    CaptureRecorder* recorder = nullptr;
+
+    static bool sameColor(const DX11Renderer::Color& a, const DX11Renderer::Color& b) {
+        return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+    }
 
-    bool isMouseOver(const DX11Renderer::Rectangle& bounds, int mouseX, int mouseY) {
+    bool isMouseOver(const DX11Renderer::Rectangle& bounds, float mouseX, float mouseY) {
         return mouseX >= bounds.x && mouseX <= (bounds.x + bounds.width) && mouseY >= bounds.y && mouseY <= (bounds.y + bounds.height);
     }
 
-    void applyStyle(const std::string& styleName, const DX11Renderer::Rectangle& bounds, const DX11Renderer::Color& accentColor) {
-        auto styleIt = styles.find(styleName);
-        if (styleIt != styles.end()) {
-            std::vector<DX11Renderer::DrawCommand> commands = styleIt->second.createCommands(bounds, accentColor);
-            for (const auto& command : commands) {
-                renderer.draw(command);
+    static bool sameBounds(const DX11Renderer::Rectangle& a, const DX11Renderer::Rectangle& b) {
+        return a.x == b.x && a.y == b.y && a.width == b.width && a.height == b.height && a.rounding == b.rounding && sameColor(a.color, b.color);
+    }
+
+    void touchContainer(uint32_t index) {
+        containerLayers[index].version++;
+    }
+
+    Interaction immediateWidget(uint32_t id, const DX11Renderer::Rectangle& bounds, const Style* style) {
+        Interaction interaction;
+        if (!masterSwitch) {
+            return interaction;
+        }
+
+        ImmediateStateTable::State& state = immediateStates.touch(id, immediateFrame);
+        interaction.hovered = isMouseOver(bounds, lastMouseX, lastMouseY);
+        if (interaction.hovered && immediatePressed) {
+            state.flags |= IMMEDIATE_HELD;
+        }
+        if (immediateReleased && (state.flags & IMMEDIATE_HELD)) {
+            interaction.clicked = interaction.hovered;
+            if (interaction.clicked) {
+                addInput(LatencyTracker::INPUT_CLICK, immediateSampledNs);
             }
         }
+        if (!immediateMouseDown) {
+            state.flags &= ~IMMEDIATE_HELD;
+        }
+        interaction.held = (state.flags & IMMEDIATE_HELD) != 0;
+        immediateHoveredNow |= interaction.hovered;
+
+        if (style) {
+            immediateItems.push_back({ style, bounds, NO_LAYER, 0 });
+        }
+        return interaction;
+    }
+
+    // Collects the state of widgets not called this frame, after the snapshot took the items.
+    void endImmediateFrame() {
+        immediateStates.sweep(immediateFrame);
+        immediateFrame++;
+        immediateItems.clear();
+        immediateLateItems.clear();
+        immediateHovered = immediateHoveredNow;
+        immediateHoveredNow = false;
+        // A press or release is handled by the first frame after it was sampled.
+        immediatePressed = false;
+        immediateReleased = false;
+    }
+
+    void runButtonCallback(size_t index, std::function<void(Button&)> Button::* callback) {
+        Button& button = buttonInfo[index];
+        DX11Renderer::Rectangle previousBounds = buttonTable.bounds[index];
+        button.bounds = previousBounds;
+        (button.*callback)(button);
+        buttonTable.bounds[index] = button.bounds;
+
+        if (!sameBounds(previousBounds, button.bounds)) {
+            touchContainer(buttonTable.parents[index]);
+        }
+        if (recorder && !sameColor(previousBounds.color, button.bounds.color)) {
+            recorder->recordWidgetColor(button.name, button.bounds.color);
+        }
+    }
+
+    void setContainerVisible(uint32_t index, bool visible) {
+        if (visible) {
+            containerTable.flags[index] |= WIDGET_VISIBLE;
+        }
         else {
+            containerTable.flags[index] &= ~WIDGET_VISIBLE;
+        }
+        if (recorder) {
+            recorder->recordWidgetVisible(containerInfo[index].name, visible);
+        }
+    }
+
+    template <typename Info>
+    static void resolveStyles(WidgetTable& table, const std::deque<Info>& info, const std::string& styleName, const Style* style) {
+        for (size_t i = 0; i < table.size(); ++i) {
+            if (!table.styles[i] && info[i].styleName == styleName) {
+                table.styles[i] = style;
+            }
+        }
+    }
+
+    void addInput(LatencyTracker::InputType type, uint64_t sampledNs) {
+        PendingInput pending;
+        pending.input.type = type;
+        pending.input.sampledNs = sampledNs;
+        pending.sequence = 0;
+        unpresentedInputs.push_back(pending);
+    }
+
+    bool post(const WidgetChange& change) {
+        if (!changes.push(change)) {
+            droppedChanges.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    void applyChanges() {
+        WidgetChange change;
+        while (changes.pop(change)) {
+            if (change.kind == WidgetChange::SET_VISIBLE) {
+                auto containerIt = containersById.find(change.widgetId);
+                if (containerIt != containersById.end() && ((containerTable.flags[containerIt->second] & WIDGET_VISIBLE) != 0) != change.visible) {
+                    setContainerVisible(containerIt->second, change.visible);
+                }
+                continue;
+            }
+
+            DX11Renderer::Rectangle* bounds = nullptr;
+            const std::string* name = nullptr;
+            auto buttonIt = buttonsById.find(change.widgetId);
+            if (buttonIt != buttonsById.end()) {
+                bounds = &buttonTable.bounds[buttonIt->second];
+                name = &buttonInfo[buttonIt->second].name;
+                touchContainer(buttonTable.parents[buttonIt->second]);
+            }
+            else {
+                auto containerIt = containersById.find(change.widgetId);
+                if (containerIt != containersById.end()) {
+                    bounds = &containerTable.bounds[containerIt->second];
+                    name = &containerInfo[containerIt->second].name;
+                    // Moving keeps what the layer shows, drawLayer() only redraws it when the
+                    // container lands on another sub-pixel offset.
+                    if (change.kind != WidgetChange::SET_BOUNDS || change.width != bounds->width || change.height != bounds->height) {
+                        touchContainer(containerIt->second);
+                    }
+                }
+            }
+            if (!bounds) {
+                dbg("Posted change for unknown widget " + std::to_string(change.widgetId));
+                continue;
+            }
+
+            if (change.kind == WidgetChange::SET_COLOR) {
+                bounds->color = change.color;
+                if (recorder) {
+                    recorder->recordWidgetColor(*name, change.color);
+                }
+            }
+            else {
+                bounds->x = change.x;
+                bounds->y = change.y;
+                bounds->width = change.width;
+                bounds->height = change.height;
+            }
+        }
+    }
+
+    const Style* findStyle(const std::string& styleName) const {
+        auto styleIt = styles.find(styleName);
+        if (styleIt == styles.end()) {
             dbg("Style not found: " + styleName);
+            return nullptr;
+        }
+        return &styleIt->second;
+    }
+
+    void buildSnapshot(Snapshot& snapshot) {
+        snapshot.items.clear();
+        snapshot.lateItems.clear();
+        snapshot.sequence = ++snapshotSequence;
+
+        // Drops inputs whose frame was presented and assigns the new ones to this snapshot.
+        uint64_t presented = presentedSequence.load(std::memory_order_acquire);
+        size_t keptInputs = 0;
+        for (PendingInput& pending : unpresentedInputs) {
+            if (pending.sequence != 0 && pending.sequence <= presented) {
+                continue;
+            }
+            if (pending.sequence == 0) {
+                pending.sequence = snapshot.sequence;
+            }
+            unpresentedInputs[keptInputs++] = pending;
+        }
+        unpresentedInputs.resize(keptInputs);
+        snapshot.inputs = unpresentedInputs;
+
+        if (!masterSwitch) {
+            snapshot.layers.clear();
+            snapshot.translations.clear();
+            return;
+        }
+
+        // Container i translates its children through slot i + 1. Containers past the last
+        // slot get their children in screen pixels instead.
+        const size_t containerCount = containerTable.size();
+        snapshot.translations.resize((std::min)(containerCount + 1, static_cast<size_t>(RenderBackend::MAX_TRANSLATIONS)));
+        snapshot.translations[0] = { 0.0f, 0.0f };
+        for (size_t i = 0; i + 1 < snapshot.translations.size(); ++i) {
+            snapshot.translations[i + 1] = { containerTable.bounds[i].x, containerTable.bounds[i].y };
+        }
+
+        // Containers first, then lists, then buttons, each in the order they were added.
+        // Widgets of a layered container go into its layer, which takes the container's place.
+        size_t layerCount = 0;
+        snapshotLayerSlots.assign(containerCount, static_cast<uint32_t>(NO_LAYER));
+        for (size_t i = 0; i < containerCount; ++i) {
+            if (!(containerTable.flags[i] & WIDGET_VISIBLE)) {
+                continue;
+            }
+            std::vector<SnapshotItem>* items = &snapshot.items;
+            if (containerLayers[i].enabled) {
+                if (snapshot.layers.size() <= layerCount) {
+                    snapshot.layers.resize(layerCount + 1);
+                }
+                SnapshotLayer& layer = snapshot.layers[layerCount];
+                layer.container = static_cast<uint32_t>(i);
+                layer.version = containerLayers[i].version;
+                layer.items.clear();
+                snapshotLayerSlots[i] = static_cast<uint32_t>(layerCount);
+                snapshot.items.push_back({ nullptr, containerTable.bounds[i], static_cast<uint32_t>(layerCount), 0 });
+                items = &layer.items;
+                layerCount++;
+            }
+            if (containerTable.styles[i]) {
+                items->push_back({ containerTable.styles[i], containerTable.bounds[i], NO_LAYER, 0 });
+            }
+        }
+        snapshot.layers.resize(layerCount);
+
+        for (ScrollList& list : lists) {
+            if (containerTable.flags[list.container] & WIDGET_VISIBLE) {
+                addListItems(list, snapshot, snapshotItems(snapshot, list.container));
+            }
+        }
+
+        const size_t buttonCount = buttonTable.size();
+        for (size_t i = 0; i < buttonCount; ++i) {
+            uint32_t parent = buttonTable.parents[i];
+            if ((containerTable.flags[parent] & WIDGET_VISIBLE) && buttonTable.styles[i]) {
+                snapshotItems(snapshot, parent).push_back(childItem(snapshot, parent, buttonTable.styles[i], buttonTable.bounds[i]));
+            }
+        }
+
+        snapshot.items.insert(snapshot.items.end(), immediateItems.begin(), immediateItems.end());
+        snapshot.lateItems.insert(snapshot.lateItems.end(), immediateLateItems.begin(), immediateLateItems.end());
+        snapshot.pointerX = static_cast<float>(lastMouseX);
+        snapshot.pointerY = static_cast<float>(lastMouseY);
+    }
+
+    // An item inside container, relative to it when the container has a translation slot.
+    SnapshotItem childItem(const Snapshot& snapshot, uint32_t container, const Style* style, DX11Renderer::Rectangle bounds) const {
+        uint32_t slot = container + 1;
+        if (slot >= snapshot.translations.size()) {
+            bounds.x += containerTable.bounds[container].x;
+            bounds.y += containerTable.bounds[container].y;
+            slot = 0;
+        }
+        return { style, bounds, NO_LAYER, slot };
+    }
+
+    std::vector<SnapshotItem>& snapshotItems(Snapshot& snapshot, uint32_t container) {
+        uint32_t slot = snapshotLayerSlots[container];
+        return slot == NO_LAYER ? snapshot.items : snapshot.layers[slot].items;
+    }
+
+    static double maxScrollOffset(const ScrollList& list) {
+        return (std::max)(static_cast<double>(list.itemCount) * list.rowHeight - list.bounds.height, 0.0);
+    }
+
+    ListRow& materializeRow(ScrollList& list, size_t index) {
+        size_t slot = index % list.rows.size();
+        ListRow& row = list.rows[slot];
+        if (row.index != index) {
+            row = ListRow();
+            row.index = index;
+            if (list.generateRow) list.generateRow(index, row);
+            list.rowStyles[slot] = findStyle(row.styleName);
+        }
+        return row;
+    }
+
+    void addListItems(ScrollList& list, const Snapshot& snapshot, std::vector<SnapshotItem>& items) {
+        items.push_back(childItem(snapshot, list.container, list.style, list.bounds));
+        if (list.itemCount == 0) {
+            return;
+        }
+
+        float top = list.bounds.y;
+        float bottom = list.bounds.y + list.bounds.height;
+        size_t first = static_cast<size_t>(list.scrollOffset / list.rowHeight);
+        size_t last = (std::min)(static_cast<size_t>((list.scrollOffset + list.bounds.height) / list.rowHeight), list.itemCount - 1);
+
+        for (size_t index = first; index <= last; ++index) {
+            ListRow& row = materializeRow(list, index);
+            // There is no scissor, rows cut by the viewport edge are drawn shortened instead.
+            float rowTop = list.bounds.y + static_cast<float>(static_cast<double>(index) * list.rowHeight - list.scrollOffset);
+            float clippedTop = (std::max)(rowTop, top);
+            float clippedBottom = (std::min)(rowTop + list.rowHeight, bottom);
+            if (clippedBottom <= clippedTop) {
+                continue;
+            }
+            DX11Renderer::Rectangle rowBounds(list.bounds.x, clippedTop, list.bounds.width, clippedBottom - clippedTop, 0.0f, row.hovered ? row.hoverColor : row.color);
+            items.push_back(childItem(snapshot, list.container, list.rowStyles[index % list.rows.size()], rowBounds));
+        }
+    }
+
+    void renderSnapshot(const Snapshot& snapshot, CaptureRecorder* frameRecorder) {
+        bool partial = trackDamage(snapshot, frameRecorder);
+        renderer.clearScreen(0.0f, 0.0f, 0.0f, 0.0f);
+        if (frameRecorder) {
+            frameRecorder->recordClear(DX11Renderer::Color(0.0f, 0.0f, 0.0f, 0.0f));
+        }
+
+        uint64_t budget = layerBudget.load(std::memory_order_relaxed);
+        if (budget != layerCache.getBudget()) {
+            layerCache.setBudget(budget);
+        }
+
+        // A backend without translation slots gets every item in screen pixels.
+        renderTranslations = &snapshot.translations;
+        translationsApplied = true;
+        for (size_t slot = 1; slot < snapshot.translations.size() && translationsApplied; ++slot) {
+            translationsApplied = renderer.setTranslation(static_cast<uint32_t>(slot), snapshot.translations[slot].x, snapshot.translations[slot].y);
+        }
+
+        for (size_t i = 0; i < snapshot.items.size(); ++i) {
+            const SnapshotItem& item = snapshot.items[i];
+            if (partial) {
+                const Extent& extent = itemExtents[i];
+                if (!damage.needsRedraw(extent.left, extent.top, extent.right, extent.bottom)) {
+                    continue;
+                }
+            }
+            if (item.layer != NO_LAYER) {
+                drawLayer(snapshot.layers[item.layer], frameRecorder);
+            }
+            else {
+                drawItem(item, true, frameRecorder);
+            }
+        }
+        for (const SnapshotLateItem& item : snapshot.lateItems) {
+            drawLateItem(snapshot, item, frameRecorder);
+        }
+
+        latched = false;
+        renderer.present();
+        layerCache.endFrame();
+        layerStats.store(layerCache.getStats());
+        uint64_t presentedNs = clock();
+
+        presentedInputs.clear();
+        for (const PendingInput& pending : snapshot.inputs) {
+            if (pending.sequence > lastPresentedSequence) {
+                presentedInputs.push_back(pending.input);
+            }
+        }
+        if (latched) {
+            // The frame shows the pointer as of the latch, not as of handleInput().
+            bool pointerInput = false;
+            for (LatencyTracker::Input& input : presentedInputs) {
+                if (input.type == LatencyTracker::INPUT_POINTER) {
+                    input.sampledNs = latchNs;
+                    pointerInput = true;
+                }
+            }
+            if (!pointerInput && (latchX != snapshot.pointerX || latchY != snapshot.pointerY)) {
+                presentedInputs.push_back({ LatencyTracker::INPUT_POINTER, latchNs });
+            }
+        }
+        latency.framePresented(presentedInputs.data(), presentedInputs.size(), presentedNs);
+        lastPresentedSequence = snapshot.sequence;
+        presentedSequence.store(snapshot.sequence, std::memory_order_release);
+
+        if (frameRecorder) {
+            frameRecorder->endFrame();
+        }
+    }
+
+    // Lists what the frame draws for the damage tracker and hands the renderer what to
+    // redraw. Returns false for whole frames, itemExtents is only filled for partial ones.
+    bool trackDamage(const Snapshot& snapshot, CaptureRecorder* frameRecorder) {
+        int width = 0;
+        int height = 0;
+        uint32_t age = 0;
+        if (!damageTracking.load(std::memory_order_relaxed) || !renderer.getBackBuffer(width, height, age)) {
+            damage.invalidate();
+            return false;
+        }
+
+        // Late items are placed after damage is known and are not listed: their frame and
+        // the one erasing them are damaged entirely.
+        bool lateItems = !snapshot.lateItems.empty();
+        if (lateItems || lateItemsDrawn || damageInvalidated.exchange(false, std::memory_order_relaxed)) {
+            damage.invalidate();
+        }
+        lateItemsDrawn = lateItems;
+
+        damage.begin(width, height, age);
+        itemExtents.resize(snapshot.items.size());
+        for (size_t i = 0; i < snapshot.items.size(); ++i) {
+            const SnapshotItem& item = snapshot.items[i];
+            Extent& extent = itemExtents[i];
+            uint64_t signature;
+            if (item.layer != NO_LAYER) {
+                const SnapshotLayer& layer = snapshot.layers[item.layer];
+                extent = layerBounds(snapshot.translations, layer);
+                signature = PersistentCache::hash(&layer.version, sizeof(layer.version));
+            }
+            else {
+                const Translation& offset = snapshot.translations[item.translation];
+                extent = { item.bounds.x + offset.x, item.bounds.y + offset.y, item.bounds.x + offset.x + item.bounds.width, item.bounds.y + offset.y + item.bounds.height };
+                signature = PersistentCache::hash(&item.style, sizeof(item.style));
+                signature = PersistentCache::hash(&item.bounds, sizeof(item.bounds), signature);
+            }
+            extent.left -= STYLE_MARGIN;
+            extent.top -= STYLE_MARGIN;
+            extent.right += STYLE_MARGIN;
+            extent.bottom += STYLE_MARGIN;
+            damage.add(extent.left, extent.top, extent.right, extent.bottom, signature);
+        }
+        damage.end();
+        damageStats.store(damage.getStats());
+
+        // Captures get every widget of every frame.
+        if (damage.isWhole() || frameRecorder) {
+            return false;
+        }
+        const std::vector<DamageTracker::Rect>& redraw = damage.getRedraw();
+        const std::vector<DamageTracker::Rect>& dirty = damage.getDirty();
+        renderer.setDamage(redraw.data(), redraw.size(), dirty.data(), dirty.size());
+        return true;
+    }
+
+    // Screen bounds of a layer's widgets, empty when it has none.
+    static Extent layerBounds(const std::vector<Translation>& translations, const SnapshotLayer& layer) {
+        if (layer.items.empty()) {
+            return { 0.0f, 0.0f, 0.0f, 0.0f };
+        }
+        Extent bounds = { FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (const SnapshotItem& item : layer.items) {
+            const Translation& offset = translations[item.translation];
+            bounds.left = (std::min)(bounds.left, item.bounds.x + offset.x);
+            bounds.top = (std::min)(bounds.top, item.bounds.y + offset.y);
+            bounds.right = (std::max)(bounds.right, item.bounds.x + offset.x + item.bounds.width);
+            bounds.bottom = (std::max)(bounds.bottom, item.bounds.y + offset.y + item.bounds.height);
+        }
+        return bounds;
+    }
+
+    void drawItem(const SnapshotItem& item, bool draw, CaptureRecorder* frameRecorder) {
+        if (!item.style) {
+            return;
+        }
+
+        // Translated items keep the same commands while their container moves, so the
+        // renderer reuses their geometry. Captures always get screen pixels.
+        bool translate = item.translation != 0 && translationsApplied;
+        if (draw && translate) {
+            styleCommands.clear();
+            item.style->apply(item.bounds, item.bounds.color, styleCommands);
+            renderer.useTranslation(item.translation);
+            for (const auto& command : styleCommands) {
+                renderer.draw(command);
+            }
+            renderer.useTranslation(0);
+            if (!frameRecorder) {
+                return;
+            }
+            draw = false;
+        }
+
+        DX11Renderer::Rectangle bounds = item.bounds;
+        if (item.translation != 0) {
+            bounds.x += (*renderTranslations)[item.translation].x;
+            bounds.y += (*renderTranslations)[item.translation].y;
+        }
+        styleCommands.clear();
+        item.style->apply(bounds, bounds.color, styleCommands);
+        for (const auto& command : styleCommands) {
+            if (draw) {
+                renderer.draw(command);
+            }
+            if (frameRecorder) {
+                frameRecorder->recordDraw(command);
+            }
+        }
+    }
+
+    void drawLateItem(const Snapshot& snapshot, const SnapshotLateItem& item, CaptureRecorder* frameRecorder) {
+        // Captures get the item where handleInput() saw the pointer, so they replay anywhere.
+        SnapshotItem early = { item.style, item.bounds, NO_LAYER, 0 };
+        if (item.kind == RenderBackend::LATE_POINTER) {
+            early.bounds.x += snapshot.pointerX;
+            early.bounds.y += snapshot.pointerY;
+        }
+
+        if (renderer.beginLateGroup(item.kind, item.bounds.x, item.bounds.y, item.bounds.width, item.bounds.height)) {
+            drawItem({ item.style, item.bounds, NO_LAYER, 0 }, true, nullptr);
+            renderer.endLateGroup();
+            if (frameRecorder && item.visible) {
+                drawItem(early, false, frameRecorder);
+            }
+        }
+        else if (item.visible) {
+            drawItem(early, true, frameRecorder);
+        }
+    }
+
+    void drawLayer(const SnapshotLayer& layer, CaptureRecorder* frameRecorder) {
+        if (layer.items.empty()) {
+            return;
+        }
+
+        // Whole pixels so the layer's texels land on screen pixels and are not filtered.
+        Extent bounds = layerBounds(*renderTranslations, layer);
+        float left = bounds.left, top = bounds.top, right = bounds.right, bottom = bounds.bottom;
+        float x = std::floor(left) - STYLE_MARGIN;
+        float y = std::floor(top) - STYLE_MARGIN;
+        int width = static_cast<int>(std::ceil(right) + STYLE_MARGIN - x);
+        int height = static_cast<int>(std::ceil(bottom) + STYLE_MARGIN - y);
+
+        // Moving the container by whole pixels moves the texels with it and keeps the layer,
+        // the sub-pixel offset of the content is part of what it shows.
+        float phase[2] = { left - std::floor(left), top - std::floor(top) };
+        uint32_t phaseBits[2];
+        memcpy(phaseBits, phase, sizeof(phaseBits));
+        uint64_t version = layer.version ^ ((static_cast<uint64_t>(phaseBits[0]) << 32 | phaseBits[1]) * 0x9e3779b97f4a7c15ull);
+
+        bool needsRender = false;
+        int layerId = layerCache.acquire(layer.container, width, height, version, needsRender);
+        if (layerId >= 0 && needsRender && !renderer.beginLayer(layerId, x, y)) {
+            layerCache.release(layer.container);
+            layerId = -1;
+        }
+        if (layerId < 0) {
+            for (const SnapshotItem& item : layer.items) {
+                drawItem(item, true, frameRecorder);
+            }
+            return;
+        }
+
+        // Captures get the layer's content every frame so they replay on any backend.
+        if (needsRender || frameRecorder) {
+            for (const SnapshotItem& item : layer.items) {
+                drawItem(item, needsRender, frameRecorder);
+            }
+        }
+        if (needsRender) {
+            renderer.endLayer();
+        }
+        renderer.draw(DX11Renderer::DrawCommand::CreateLayer(x, y, static_cast<float>(width), static_cast<float>(height), layerId));
+    }
+
+    void renderLoop() {
+        while (renderThreadRunning.load(std::memory_order_acquire)) {
+            auto frameStart = std::chrono::steady_clock::now();
+
+            if (snapshots.acquire()) {
+                renderSnapshots.fetch_add(1, std::memory_order_relaxed);
+            }
+            else if (!renderer.presentWaitsForVsync()) {
+                // Nothing would pace redrawing the same snapshot, poll for the next one.
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            renderSnapshot(snapshots.front(), nullptr);
+
+            double frameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+            lastFrameMs.store(frameMs, std::memory_order_relaxed);
+            if (frameMs > maxFrameMs.load(std::memory_order_relaxed)) {
+                maxFrameMs.store(frameMs, std::memory_order_relaxed);
+            }
+            renderFrames.fetch_add(1, std::memory_order_relaxed);
         }
     }
 
@@ -0,0 +1,972 @@
+#include "geometry.hpp"
+#include "graph.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+static const float GEOMETRY_PI = 3.14159265358979f;
+// Longest miter, in multiples of the half width, before a join is beveled instead.
+static const float STROKE_MITER_LIMIT = 4.0f;
+
+void GeometryBatch::clear() {
+    if (retained) {
+        vertices.swap(previousVertices);
+        indices.swap(previousIndices);
+        commands.swap(previousCommands);
+    }
+    vertices.clear();
+    indices.clear();
+    items.clear();
+    shadows.clear();
+    commands.clear();
+    itemVertexEnd = 0;
+    itemIndexEnd = 0;
+    reuseStats = ReuseStats();
+}
+
+void GeometryBatch::useTranslation(uint32_t slot) {
+    translation = slot;
+    if (translations.size() <= slot) {
+        translations.resize(slot + 1, Translation());
+    }
+}
+
+void GeometryBatch::setRetained(bool enable) {
+    retained = enable;
+    previousCommands.clear();
+    previousVertices.clear();
+    previousIndices.clear();
+}
+
+static bool sameColor(const RenderBackend::Color& a, const RenderBackend::Color& b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+static const RenderBackend::Color* commandColor(const RenderBackend::DrawCommand& command) {
+    switch (command.type) {
+    case RenderBackend::SHAPE_RECTANGLE: return &command.shape.rectangle.color;
+    case RenderBackend::SHAPE_CIRCLE: return &command.shape.circle.color;
+    case RenderBackend::SHAPE_TRIANGLE: return &command.shape.triangle.color;
+    case RenderBackend::SHAPE_IMAGE: return &command.shape.image.tint;
+    case RenderBackend::SHAPE_BORDER: return &command.shape.border.color;
+    case RenderBackend::SHAPE_RING: return &command.shape.ring.color;
+    case RenderBackend::SHAPE_LINE: return &command.shape.line.color;
+    case RenderBackend::SHAPE_PATH: return &command.shape.path.color;
+    default: return nullptr;
+    }
+}
+
+// True when both commands tessellate to the same positions, whatever their color.
+static bool sameGeometry(const RenderBackend::DrawCommand& a, const RenderBackend::DrawCommand& b) {
+    if (a.type != b.type) {
+        return false;
+    }
+    switch (a.type) {
+    case RenderBackend::SHAPE_RECTANGLE: {
+        const RenderBackend::Rectangle& x = a.shape.rectangle;
+        const RenderBackend::Rectangle& y = b.shape.rectangle;
+        return x.x == y.x && x.y == y.y && x.width == y.width && x.height == y.height && x.rounding == y.rounding;
+    }
+    case RenderBackend::SHAPE_CIRCLE: {
+        const RenderBackend::Circle& x = a.shape.circle;
+        const RenderBackend::Circle& y = b.shape.circle;
+        return x.centerX == y.centerX && x.centerY == y.centerY && x.radius == y.radius && x.segments == y.segments;
+    }
+    case RenderBackend::SHAPE_TRIANGLE: {
+        const RenderBackend::Triangle& x = a.shape.triangle;
+        const RenderBackend::Triangle& y = b.shape.triangle;
+        return x.x1 == y.x1 && x.y1 == y.y1 && x.x2 == y.x2 && x.y2 == y.y2 && x.x3 == y.x3 && x.y3 == y.y3;
+    }
+    case RenderBackend::SHAPE_IMAGE: {
+        const RenderBackend::Image& x = a.shape.image;
+        const RenderBackend::Image& y = b.shape.image;
+        return x.x == y.x && x.y == y.y && x.width == y.width && x.height == y.height && x.imageId == y.imageId;
+    }
+    case RenderBackend::SHAPE_BORDER: {
+        const RenderBackend::Border& x = a.shape.border;
+        const RenderBackend::Border& y = b.shape.border;
+        return x.x == y.x && x.y == y.y && x.width == y.width && x.height == y.height && x.rounding == y.rounding && x.thickness == y.thickness;
+    }
+    case RenderBackend::SHAPE_RING: {
+        const RenderBackend::Ring& x = a.shape.ring;
+        const RenderBackend::Ring& y = b.shape.ring;
+        return x.centerX == y.centerX && x.centerY == y.centerY && x.radius == y.radius && x.thickness == y.thickness && x.segments == y.segments;
+    }
+    case RenderBackend::SHAPE_LINE: {
+        const RenderBackend::Line& x = a.shape.line;
+        const RenderBackend::Line& y = b.shape.line;
+        return x.x1 == y.x1 && x.y1 == y.y1 && x.x2 == y.x2 && x.y2 == y.y2 && x.thickness == y.thickness;
+    }
+    case RenderBackend::SHAPE_LAYER: {
+        const RenderBackend::Layer& x = a.shape.layer;
+        const RenderBackend::Layer& y = b.shape.layer;
+        return x.x == y.x && x.y == y.y && x.width == y.width && x.height == y.height && x.layerId == y.layerId;
+    }
+    case RenderBackend::SHAPE_PATH: {
+        // The path itself may be gone by now, its hash was taken when the command was made.
+        const RenderBackend::Path& x = a.shape.path;
+        const RenderBackend::Path& y = b.shape.path;
+        return x.hash == y.hash && x.x == y.x && x.y == y.y;
+    }
+    default:
+        // Polylines and graphs point at data that may have changed in place. Shadows carry
+        // their index into the batch's shadow list, which is only known once tessellated.
+        return false;
+    }
+}
+
+static uint32_t commandTexture(const RenderBackend::DrawCommand& command) {
+    return command.type == RenderBackend::SHAPE_LAYER ? static_cast<uint32_t>(command.shape.layer.layerId) + 1 : 0;
+}
+
+void GeometryBatch::closeItem(bool opaque, uint32_t texture) {
+    uint32_t vertexEnd = static_cast<uint32_t>(vertices.size());
+    uint32_t indexEnd = static_cast<uint32_t>(indices.size());
+    if (indexEnd > itemIndexEnd) {
+        // Tessellation, graph caches and prebuilt geometry all produce slot 0.
+        if (translation != 0) {
+            for (uint32_t v = itemVertexEnd; v < vertexEnd; ++v) {
+                vertices[v].translation = translation;
+            }
+        }
+        items.push_back({ itemVertexEnd, vertexEnd - itemVertexEnd, itemIndexEnd, indexEnd - itemIndexEnd, opaque, texture, translation });
+    }
+    itemVertexEnd = vertexEnd;
+    itemIndexEnd = indexEnd;
+}
+
+void GeometryBatch::addPrebuilt(const Vertex* prebuiltVertices, const uint32_t* prebuiltIndices, const Item* prebuiltItems, uint32_t itemCount) {
+    for (uint32_t i = 0; i < itemCount; ++i) {
+        const Item& item = prebuiltItems[i];
+        uint32_t base = static_cast<uint32_t>(vertices.size());
+        vertices.insert(vertices.end(), prebuiltVertices + item.firstVertex, prebuiltVertices + item.firstVertex + item.vertexCount);
+        for (uint32_t index = 0; index < item.indexCount; ++index) {
+            indices.push_back(prebuiltIndices[item.firstIndex + index] - item.firstVertex + base);
+        }
+        closeItem(item.opaque, item.texture);
+    }
+}
+
+void GeometryBatch::add(const RenderBackend::DrawCommand& command) {
+    if (!retained) {
+        tessellate(command);
+        return;
+    }
+    if (reuse(command)) {
+        return;
+    }
+
+    RetainedCommand entry = { command, static_cast<uint32_t>(vertices.size()), 0, static_cast<uint32_t>(indices.size()), 0, false, translation };
+    size_t itemCount = items.size();
+    tessellate(command);
+    entry.vertexCount = static_cast<uint32_t>(vertices.size()) - entry.firstVertex;
+    entry.indexCount = static_cast<uint32_t>(indices.size()) - entry.firstIndex;
+    entry.opaque = itemOpaque(static_cast<uint32_t>(itemCount));
+    commands.push_back(entry);
+    reuseStats.tessellated++;
+}
+
+bool GeometryBatch::reuse(const RenderBackend::DrawCommand& command) {
+    // Atlas repacks move image texels and the white texel, nothing tessellated before is valid.
+    if (atlas.getGeneration() != retainedGeneration) {
+        retainedGeneration = atlas.getGeneration();
+        previousCommands.clear();
+        return false;
+    }
+
+    size_t position = commands.size();
+    if (position >= previousCommands.size()) {
+        return false;
+    }
+    const RetainedCommand& previous = previousCommands[position];
+    if (previous.translation != translation || !sameGeometry(previous.command, command)) {
+        return false;
+    }
+
+    RetainedCommand entry = previous;
+    entry.command = command;
+    entry.firstVertex = static_cast<uint32_t>(vertices.size());
+    entry.firstIndex = static_cast<uint32_t>(indices.size());
+
+    vertices.insert(vertices.end(), previousVertices.begin() + previous.firstVertex, previousVertices.begin() + previous.firstVertex + previous.vertexCount);
+    for (uint32_t i = 0; i < previous.indexCount; ++i) {
+        indices.push_back(previousIndices[previous.firstIndex + i] - previous.firstVertex + entry.firstVertex);
+    }
+
+    const RenderBackend::Color* color = commandColor(command);
+    if (color && !sameColor(*color, *commandColor(previous.command))) {
+        // Only the color changed, patch it into the copy instead of tessellating again.
+        for (uint32_t i = entry.firstVertex; i < entry.firstVertex + entry.vertexCount; ++i) {
+            vertices[i].r = color->r;
+            vertices[i].g = color->g;
+            vertices[i].b = color->b;
+            vertices[i].a = color->a;
+        }
+        entry.opaque = color->a >= 1.0f && (command.type != RenderBackend::SHAPE_IMAGE || atlas.isOpaque(command.shape.image.imageId));
+        reuseStats.recolored++;
+    }
+    else {
+        reuseStats.reused++;
+    }
+
+    closeItem(entry.opaque, commandTexture(command));
+    commands.push_back(entry);
+    return true;
+}
+
+void GeometryBatch::tessellate(const RenderBackend::DrawCommand& command) {
+    switch (command.type) {
+    case RenderBackend::SHAPE_RECTANGLE: {
+        const RenderBackend::Rectangle& rectangle = command.shape.rectangle;
+        if (rectangle.rounding > 0.0f) {
+            addRoundedRectangle(rectangle.x, rectangle.y, rectangle.width, rectangle.height, rectangle.rounding, rectangle.color, 32);
+        }
+        else {
+            addRectangle(rectangle.x, rectangle.y, rectangle.width, rectangle.height, rectangle.color);
+        }
+        break;
+    }
+    case RenderBackend::SHAPE_CIRCLE: {
+        const RenderBackend::Circle& circle = command.shape.circle;
+        addCircle(circle.centerX, circle.centerY, circle.radius, circle.color, circle.segments);
+        break;
+    }
+    case RenderBackend::SHAPE_TRIANGLE: {
+        const RenderBackend::Triangle& triangle = command.shape.triangle;
+        addTriangle(triangle.x1, triangle.y1, triangle.x2, triangle.y2, triangle.x3, triangle.y3, triangle.color);
+        break;
+    }
+    case RenderBackend::SHAPE_IMAGE: {
+        const RenderBackend::Image& image = command.shape.image;
+        addImage(image.x, image.y, image.width, image.height, image.imageId, image.tint);
+        break;
+    }
+    case RenderBackend::SHAPE_BORDER: {
+        const RenderBackend::Border& border = command.shape.border;
+        addBorder(border.x, border.y, border.width, border.height, border.rounding, border.thickness, border.color, 32);
+        break;
+    }
+    case RenderBackend::SHAPE_RING: {
+        const RenderBackend::Ring& ring = command.shape.ring;
+        addRing(ring.centerX, ring.centerY, ring.radius, ring.thickness, ring.color, ring.segments);
+        break;
+    }
+    case RenderBackend::SHAPE_LINE: {
+        const RenderBackend::Line& line = command.shape.line;
+        addLine(line.x1, line.y1, line.x2, line.y2, line.thickness, line.color);
+        break;
+    }
+    case RenderBackend::SHAPE_POLYLINE: {
+        const RenderBackend::Polyline& polyline = command.shape.polyline;
+        addPolyline(polyline.points, polyline.pointCount, polyline.thickness, polyline.color, polyline.join);
+        break;
+    }
+    case RenderBackend::SHAPE_GRAPH: {
+        const RenderBackend::Graph& graph = command.shape.graph;
+        if (graph.graph) {
+            addGraph(*graph.graph, graph.x, graph.y);
+        }
+        break;
+    }
+    case RenderBackend::SHAPE_LAYER: {
+        const RenderBackend::Layer& layer = command.shape.layer;
+        addLayer(layer.x, layer.y, layer.width, layer.height, layer.layerId);
+        break;
+    }
+    case RenderBackend::SHAPE_SHADOW:
+        addShadow(command.shape.shadow);
+        break;
+    case RenderBackend::SHAPE_PATH: {
+        const RenderBackend::Path& path = command.shape.path;
+        if (path.path) {
+            addPath(*path.path, path.x, path.y, path.color);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void GeometryBatch::addRectangle(float x, float y, float width, float height, const Color& color) {
+    uint32_t first = pushVertex(x, y, color);
+    pushVertex(x + width, y, color);
+    pushVertex(x, y + height, color);
+    pushVertex(x + width, y + height, color);
+    pushQuad(first);
+    closeItem(color.a >= 1.0f);
+}
+
+void GeometryBatch::addRoundedRectangle(float x, float y, float width, float height, float radius, const Color& color, int segments) {
+    radius = (std::min)(radius, (std::min)(width, height) / 2.0f);
+
+    uint32_t center = pushVertex(x + width / 2.0f, y + height / 2.0f, color);
+
+    float left = x + radius;
+    float right = x + width - radius;
+    float top = y + radius;
+    float bottom = y + height - radius;
+
+    int totalSegments = segments * 4;
+    for (int i = 0; i <= totalSegments; ++i) {
+        float theta = (2.0f * GEOMETRY_PI * i) / totalSegments;
+
+        float cornerX = 0.0f;
+        float cornerY = 0.0f;
+
+        if (theta >= 0 && theta < GEOMETRY_PI / 2.0f) {
+            cornerX = right;
+            cornerY = bottom;
+        }
+        else if (theta >= GEOMETRY_PI / 2.0f && theta < GEOMETRY_PI) {
+            cornerX = left;
+            cornerY = bottom;
+        }
+        else if (theta >= GEOMETRY_PI && theta < 3 * GEOMETRY_PI / 2.0f) {
+            cornerX = left;
+            cornerY = top;
+        }
+        else {
+            cornerX = right;
+            cornerY = top;
+        }
+
+        pushVertex(cornerX + radius * cosf(theta), cornerY + radius * sinf(theta), color);
+    }
+
+    for (int i = 1; i <= totalSegments; ++i) {
+        indices.push_back(center);
+        indices.push_back(center + i);
+        indices.push_back(center + (i == totalSegments ? 1 : i + 1));
+    }
+    closeItem(color.a >= 1.0f);
+}
+
+void GeometryBatch::addCircle(float centerX, float centerY, float radius, const Color& color, int segments) {
+    uint32_t center = pushVertex(centerX, centerY, color);
+
+    for (int i = 0; i <= segments; ++i) {
+        float theta = (2.0f * GEOMETRY_PI * i) / segments;
+        pushVertex(centerX + radius * cosf(theta), centerY + radius * sinf(theta), color);
+    }
+
+    for (int i = 1; i <= segments; ++i) {
+        indices.push_back(center);
+        indices.push_back(center + i);
+        indices.push_back(center + i + 1);
+    }
+    closeItem(color.a >= 1.0f);
+}
+
+void GeometryBatch::addTriangle(float x1, float y1, float x2, float y2, float x3, float y3, const Color& color) {
+    uint32_t first = pushVertex(x1, y1, color);
+    pushVertex(x2, y2, color);
+    pushVertex(x3, y3, color);
+    indices.push_back(first);
+    indices.push_back(first + 1);
+    indices.push_back(first + 2);
+    closeItem(color.a >= 1.0f);
+}
+
+void GeometryBatch::addImage(float x, float y, float width, float height, int imageId, const Color& tint) {
+    TextureAtlas::UVRect uv = atlas.uv(imageId);
+    uint32_t first = pushVertex(x, y, tint, uv.u0, uv.v0);
+    pushVertex(x + width, y, tint, uv.u1, uv.v0);
+    pushVertex(x, y + height, tint, uv.u0, uv.v1);
+    pushVertex(x + width, y + height, tint, uv.u1, uv.v1);
+    pushQuad(first);
+    closeItem(tint.a >= 1.0f && atlas.isOpaque(imageId));
+}
+
+void GeometryBatch::addLayer(float x, float y, float width, float height, int layerId) {
+    Color white(1.0f, 1.0f, 1.0f, 1.0f);
+    uint32_t first = pushVertex(x, y, white, 0.0f, 0.0f);
+    pushVertex(x + width, y, white, 1.0f, 0.0f);
+    pushVertex(x, y + height, white, 0.0f, 1.0f);
+    pushVertex(x + width, y + height, white, 1.0f, 1.0f);
+    pushQuad(first);
+    closeItem(false, static_cast<uint32_t>(layerId) + 1);
+}
+
+void GeometryBatch::addShadow(const RenderBackend::Shadow& shadow) {
+    AnalyticShadow::Params params = AnalyticShadow::fromShadow(shadow);
+    float reachX = params.halfWidth + AnalyticShadow::extent(params);
+    float reachY = params.halfHeight + AnalyticShadow::extent(params);
+    float u = -1.0f - static_cast<float>(shadows.size());
+    shadows.push_back(params);
+
+    uint32_t first = pushVertex(params.centerX - reachX, params.centerY - reachY, shadow.color, u, 0.0f);
+    pushVertex(params.centerX + reachX, params.centerY - reachY, shadow.color, u, 0.0f);
+    pushVertex(params.centerX - reachX, params.centerY + reachY, shadow.color, u, 0.0f);
+    pushVertex(params.centerX + reachX, params.centerY + reachY, shadow.color, u, 0.0f);
+    pushQuad(first);
+    closeItem(false);
+}
+
+void GeometryBatch::pushLoopStrip(uint32_t outerFirst, uint32_t innerFirst, uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t next = (i + 1) % count;
+        indices.push_back(outerFirst + i);
+        indices.push_back(outerFirst + next);
+        indices.push_back(innerFirst + i);
+        indices.push_back(innerFirst + i);
+        indices.push_back(outerFirst + next);
+        indices.push_back(innerFirst + next);
+    }
+}
+
+void GeometryBatch::addBorder(float x, float y, float width, float height, float rounding, float thickness, const Color& color, int segments) {
+    float halfExtent = (std::min)(width, height) / 2.0f;
+    thickness = (std::min)(thickness, halfExtent);
+    if (thickness <= 0.0f) {
+        return;
+    }
+
+    float outerRadius = (std::max)(0.0f, (std::min)(rounding, halfExtent));
+    float innerRadius = (std::max)(0.0f, outerRadius - thickness);
+    float innerX = x + thickness;
+    float innerY = y + thickness;
+    float innerWidth = width - 2.0f * thickness;
+    float innerHeight = height - 2.0f * thickness;
+
+    if (outerRadius <= 0.0f) {
+        uint32_t outer = pushVertex(x, y, color);
+        pushVertex(x + width, y, color);
+        pushVertex(x + width, y + height, color);
+        pushVertex(x, y + height, color);
+        uint32_t inner = pushVertex(innerX, innerY, color);
+        pushVertex(innerX + innerWidth, innerY, color);
+        pushVertex(innerX + innerWidth, innerY + innerHeight, color);
+        pushVertex(innerX, innerY + innerHeight, color);
+        pushLoopStrip(outer, inner, 4);
+        closeItem(color.a >= 1.0f);
+        return;
+    }
+
+    // Corners in the same angular order as addRoundedRectangle (bottom right first), so the
+    // inner edge of the ring lines up with a rounded fill of the inner bounds.
+    const float cornerX[4] = { x + width - outerRadius, x + outerRadius, x + outerRadius, x + width - outerRadius };
+    const float cornerY[4] = { y + height - outerRadius, y + height - outerRadius, y + outerRadius, y + outerRadius };
+    const float innerCornerX[4] = { innerX + innerWidth - innerRadius, innerX + innerRadius, innerX + innerRadius, innerX + innerWidth - innerRadius };
+    const float innerCornerY[4] = { innerY + innerHeight - innerRadius, innerY + innerHeight - innerRadius, innerY + innerRadius, innerY + innerRadius };
+
+    uint32_t count = static_cast<uint32_t>(4 * (segments + 1));
+    uint32_t outer = static_cast<uint32_t>(vertices.size());
+    for (int corner = 0; corner < 4; ++corner) {
+        for (int i = 0; i <= segments; ++i) {
+            float theta = (GEOMETRY_PI / 2.0f) * (corner + static_cast<float>(i) / segments);
+            pushVertex(cornerX[corner] + outerRadius * cosf(theta), cornerY[corner] + outerRadius * sinf(theta), color);
+        }
+    }
+    uint32_t inner = static_cast<uint32_t>(vertices.size());
+    for (int corner = 0; corner < 4; ++corner) {
+        for (int i = 0; i <= segments; ++i) {
+            float theta = (GEOMETRY_PI / 2.0f) * (corner + static_cast<float>(i) / segments);
+            pushVertex(innerCornerX[corner] + innerRadius * cosf(theta), innerCornerY[corner] + innerRadius * sinf(theta), color);
+        }
+    }
+    pushLoopStrip(outer, inner, count);
+    closeItem(color.a >= 1.0f);
+}
+
+void GeometryBatch::addRing(float centerX, float centerY, float radius, float thickness, const Color& color, int segments) {
+    thickness = (std::min)(thickness, radius);
+    if (thickness <= 0.0f || segments < 3) {
+        return;
+    }
+    float innerRadius = radius - thickness;
+
+    uint32_t outer = static_cast<uint32_t>(vertices.size());
+    for (int i = 0; i < segments; ++i) {
+        float theta = (2.0f * GEOMETRY_PI * i) / segments;
+        pushVertex(centerX + radius * cosf(theta), centerY + radius * sinf(theta), color);
+    }
+    uint32_t inner = static_cast<uint32_t>(vertices.size());
+    for (int i = 0; i < segments; ++i) {
+        float theta = (2.0f * GEOMETRY_PI * i) / segments;
+        pushVertex(centerX + innerRadius * cosf(theta), centerY + innerRadius * sinf(theta), color);
+    }
+    pushLoopStrip(outer, inner, static_cast<uint32_t>(segments));
+    closeItem(color.a >= 1.0f);
+}
+
+int GeometryBatch::strokeSegment(float x0, float y0, float x1, float y1, const float* previousDirection, float halfWidth, RenderBackend::JoinStyle join, const Color& color, Vertex* out) {
+    float dx = x1 - x0;
+    float dy = y1 - y0;
+    float length = sqrtf(dx * dx + dy * dy);
+    float normalX = length > 0.0f ? -dy / length : 0.0f;
+    float normalY = length > 0.0f ? dx / length : 0.0f;
+
+    // Same corner order as pushQuad (TL, TR, BL, BR) for a segment pointing right, which keeps
+    // the triangles clockwise for every direction.
+    out[0] = { x0 - normalX * halfWidth, y0 - normalY * halfWidth, 0.0f, color.r, color.g, color.b, color.a, 0.0f, 0.0f, 0 };
+    out[1] = { x1 - normalX * halfWidth, y1 - normalY * halfWidth, 0.0f, color.r, color.g, color.b, color.a, 0.0f, 0.0f, 0 };
+    out[2] = { x0 + normalX * halfWidth, y0 + normalY * halfWidth, 0.0f, color.r, color.g, color.b, color.a, 0.0f, 0.0f, 0 };
+    out[3] = { x1 + normalX * halfWidth, y1 + normalY * halfWidth, 0.0f, color.r, color.g, color.b, color.a, 0.0f, 0.0f, 0 };
+    out[4] = { x0, y0, 0.0f, color.r, color.g, color.b, color.a, 0.0f, 0.0f, 0 };
+    out[5] = out[4];
+    if (!previousDirection) {
+        return 0;
+    }
+
+    // The wedge fills the gap between both quads on the outer side of the turn, the inner
+    // side is already covered by their overlap. Its outer corners are the end corner of the
+    // previous segment and the start corner of this one, only the tip is new.
+    float previousNormalX = -previousDirection[1];
+    float previousNormalY = previousDirection[0];
+    int side = previousDirection[0] * dy - previousDirection[1] * dx > 0.0f ? -1 : 1;
+    float previousX = x0 + side * previousNormalX * halfWidth;
+    float previousY = y0 + side * previousNormalY * halfWidth;
+    float currentX = x0 + side * normalX * halfWidth;
+    float currentY = y0 + side * normalY * halfWidth;
+
+    out[5].x = (previousX + currentX) * 0.5f;
+    out[5].y = (previousY + currentY) * 0.5f;
+    if (join == RenderBackend::JOIN_MITER) {
+        float miterX = previousNormalX + normalX;
+        float miterY = previousNormalY + normalY;
+        float miterLength = sqrtf(miterX * miterX + miterY * miterY);
+        if (miterLength > 1e-6f) {
+            float cosHalfAngle = (miterX * normalX + miterY * normalY) / miterLength;
+            if (cosHalfAngle * STROKE_MITER_LIMIT > 1.0f) {
+                float scale = side * halfWidth / (cosHalfAngle * miterLength);
+                out[5].x = x0 + miterX * scale;
+                out[5].y = y0 + miterY * scale;
+            }
+        }
+    }
+    return side;
+}
+
+uint32_t* GeometryBatch::writeStrokeIndices(uint32_t* out, uint32_t first, int joinSide) {
+    out[0] = first;
+    out[1] = first + 1;
+    out[2] = first + 2;
+    out[3] = first + 2;
+    out[4] = first + 1;
+    out[5] = first + 3;
+    if (joinSide == 0) {
+        return out + 6;
+    }
+
+    // The previous segment always directly precedes this one in the vertex buffer. The wedge
+    // is mirrored for right turns so it keeps the winding of the quads.
+    uint32_t previous = first - STROKE_VERTICES;
+    uint32_t center = first + 4;
+    uint32_t tip = first + 5;
+    out[6] = center;
+    out[8] = tip;
+    out[9] = center;
+    out[10] = tip;
+    if (joinSide < 0) {
+        out[7] = previous + 1;
+        out[11] = first;
+    }
+    else {
+        out[7] = first + 2;
+        out[11] = previous + 3;
+    }
+    return out + 12;
+}
+
+void GeometryBatch::addLine(float x1, float y1, float x2, float y2, float thickness, const Color& color) {
+    float points[] = { x1, y1, x2, y2 };
+    addPolyline(points, 2, thickness, color, RenderBackend::JOIN_BEVEL);
+}
+
+void GeometryBatch::addPolyline(const float* points, uint32_t pointCount, float thickness, const Color& color, RenderBackend::JoinStyle join) {
+    if (!points || pointCount < 2 || thickness <= 0.0f) {
+        return;
+    }
+
+    float halfWidth = thickness * 0.5f;
+    float u = atlas.whiteU();
+    float v = atlas.whiteV();
+
+    // Size the buffers for the worst case once and trim afterwards, so the loop below is
+    // straight line math without reallocation checks.
+    size_t firstVertex = vertices.size();
+    size_t firstIndex = indices.size();
+    vertices.resize(firstVertex + static_cast<size_t>(pointCount - 1) * STROKE_VERTICES);
+    indices.resize(firstIndex + static_cast<size_t>(pointCount - 1) * STROKE_INDICES);
+    Vertex* out = &vertices[firstVertex];
+    uint32_t* outIndex = &indices[firstIndex];
+
+    float direction[2] = { 0.0f, 0.0f };
+    bool hasPrevious = false;
+    float lastX = points[0];
+    float lastY = points[1];
+    for (uint32_t i = 1; i < pointCount; ++i) {
+        float x = points[i * 2];
+        float y = points[i * 2 + 1];
+        float dx = x - lastX;
+        float dy = y - lastY;
+        float length = sqrtf(dx * dx + dy * dy);
+        if (length <= 1e-6f) {
+            // Repeated points have no direction to stroke along.
+            continue;
+        }
+
+        int joinSide = strokeSegment(lastX, lastY, x, y, hasPrevious ? direction : nullptr, halfWidth, join, color, out);
+        for (uint32_t k = 0; k < STROKE_VERTICES; ++k) {
+            out[k].u = u;
+            out[k].v = v;
+        }
+        outIndex = writeStrokeIndices(outIndex, static_cast<uint32_t>(out - vertices.data()), joinSide);
+        out += STROKE_VERTICES;
+
+        direction[0] = dx / length;
+        direction[1] = dy / length;
+        hasPrevious = true;
+        lastX = x;
+        lastY = y;
+    }
+
+    vertices.resize(static_cast<size_t>(out - vertices.data()));
+    indices.resize(static_cast<size_t>(outIndex - indices.data()));
+    closeItem(color.a >= 1.0f);
+}
+
+void GeometryBatch::addGraph(const LiveGraph& graph, float x, float y) {
+    LiveGraph::Run runs[2];
+    int runCount = graph.getRuns(runs);
+    float u = atlas.whiteU();
+    float v = atlas.whiteV();
+    bool firstSegment = true;
+
+    for (int r = 0; r < runCount; ++r) {
+        const LiveGraph::Run& run = runs[r];
+        uint32_t first = static_cast<uint32_t>(vertices.size());
+        uint32_t count = run.slotCount * STROKE_VERTICES;
+        vertices.resize(first + count);
+
+        const Vertex* source = graph.slotVertices(run.firstSlot);
+        Vertex* target = &vertices[first];
+        float offsetX = x + run.offsetX;
+        for (uint32_t i = 0; i < count; ++i) {
+            target[i] = source[i];
+            target[i].x += offsetX;
+            target[i].y += y;
+            target[i].u = u;
+            target[i].v = v;
+        }
+
+        size_t firstIndex = indices.size();
+        indices.resize(firstIndex + static_cast<size_t>(run.slotCount) * STROKE_INDICES);
+        uint32_t* outIndex = &indices[firstIndex];
+        for (uint32_t slot = 0; slot < run.slotCount; ++slot) {
+            // The oldest segment joins one that has already scrolled out.
+            outIndex = writeStrokeIndices(outIndex, first + slot * STROKE_VERTICES, firstSegment ? 0 : graph.joinSide(run.firstSlot + slot));
+            firstSegment = false;
+        }
+        indices.resize(static_cast<size_t>(outIndex - indices.data()));
+    }
+    closeItem(graph.getColor().a >= 1.0f);
+}
+
+void GeometryBatch::addPath(const VectorPath& path, float x, float y, const Color& color) {
+    const PathMesh& mesh = pathCache.get(path);
+    if (mesh.indices.empty()) {
+        return;
+    }
+
+    uint32_t first = static_cast<uint32_t>(vertices.size());
+    size_t pointCount = mesh.positions.size() / 2;
+    vertices.reserve(first + pointCount);
+    for (size_t i = 0; i < pointCount; ++i) {
+        pushVertex(x + mesh.positions[i * 2], y + mesh.positions[i * 2 + 1], color);
+    }
+    size_t firstIndex = indices.size();
+    indices.resize(firstIndex + mesh.indices.size());
+    for (size_t i = 0; i < mesh.indices.size(); ++i) {
+        indices[firstIndex + i] = first + mesh.indices[i];
+    }
+    closeItem(color.a >= 1.0f);
+}
+
+uint32_t GeometryBatch::buildOpaqueOrder(std::vector<uint32_t>& orderedIndices) {
+    orderedIndices.clear();
+    orderedIndices.reserve(indices.size());
+
+    // The step is rounded to a power of two so depths stay put while the item count changes
+    // a little, which keeps partial vertex uploads small when shapes are added or removed.
+    size_t slots = 2;
+    while (slots < items.size() + 1) slots *= 2;
+    float step = 1.0f / slots;
+    for (size_t i = 0; i < items.size(); ++i) {
+        const Item& item = items[i];
+        float depth = 1.0f - (i + 1) * step;
+        for (uint32_t v = item.firstVertex; v < item.firstVertex + item.vertexCount; ++v) {
+            vertices[v].z = depth;
+        }
+    }
+
+    for (size_t i = items.size(); i-- > 0;) {
+        const Item& item = items[i];
+        if (item.opaque) {
+            orderedIndices.insert(orderedIndices.end(), indices.begin() + item.firstIndex, indices.begin() + item.firstIndex + item.indexCount);
+        }
+    }
+    return static_cast<uint32_t>(orderedIndices.size());
+}
+
+uint32_t GeometryBatch::buildDepthOrder(std::vector<uint32_t>& orderedIndices) {
+    uint32_t opaqueIndexCount = buildOpaqueOrder(orderedIndices);
+    for (const Item& item : items) {
+        if (!item.opaque) {
+            orderedIndices.insert(orderedIndices.end(), indices.begin() + item.firstIndex, indices.begin() + item.firstIndex + item.indexCount);
+        }
+    }
+    return opaqueIndexCount;
+}
+
+uint32_t GeometryBatch::buildSubmission(bool depthOrder, std::vector<uint32_t>& orderedIndices, std::vector<TextureRun>& runs) {
+    uint32_t opaqueIndexCount = 0;
+    if (depthOrder) {
+        opaqueIndexCount = buildOpaqueOrder(orderedIndices);
+    }
+    else {
+        orderedIndices.clear();
+        orderedIndices.reserve(indices.size());
+    }
+
+    painterItems.clear();
+    sortStats = SortStats();
+    for (uint32_t i = 0; i < items.size(); ++i) {
+        if (depthOrder && items[i].opaque) {
+            continue;
+        }
+        if (painterItems.empty() || items[painterItems.back()].texture != items[i].texture) {
+            sortStats.unsortedRuns++;
+        }
+        painterItems.push_back(i);
+    }
+    if (stateSorting && sortStats.unsortedRuns > 1) {
+        sortByState();
+    }
+
+    runs.clear();
+    for (uint32_t itemIndex : painterItems) {
+        const Item& item = items[itemIndex];
+        uint32_t first = static_cast<uint32_t>(orderedIndices.size());
+        orderedIndices.insert(orderedIndices.end(), indices.begin() + item.firstIndex, indices.begin() + item.firstIndex + item.indexCount);
+        if (!runs.empty() && runs.back().texture == item.texture) {
+            runs.back().indexCount += item.indexCount;
+        }
+        else {
+            runs.push_back({ first, item.indexCount, item.texture });
+        }
+    }
+    sortStats.runs = static_cast<uint32_t>(runs.size());
+    return opaqueIndexCount;
+}
+
+void GeometryBatch::sortByState() {
+    // Every item joins the latest run of its texture unless a run drawn after that one
+    // overlaps it, then it starts a new run. Runs keep the union of their items' bounds,
+    // which is conservative: items are only moved in front of ones they do not touch.
+    sortRuns.clear();
+    itemRuns.clear();
+    for (uint32_t itemIndex : painterItems) {
+        const Item& item = items[itemIndex];
+        float left, top, right, bottom;
+        itemBounds(item, left, top, right, bottom);
+
+        size_t target = sortRuns.size();
+        size_t oldest = sortRuns.size() > SORT_LOOKBACK ? sortRuns.size() - SORT_LOOKBACK : 0;
+        for (size_t run = sortRuns.size(); run-- > oldest;) {
+            const SortRun& candidate = sortRuns[run];
+            if (candidate.texture == item.texture) {
+                target = run;
+                break;
+            }
+            if (left < candidate.right && candidate.left < right && top < candidate.bottom && candidate.top < bottom) {
+                break;
+            }
+        }
+
+        if (target == sortRuns.size()) {
+            sortRuns.push_back({ item.texture, left, top, right, bottom });
+        }
+        else {
+            SortRun& run = sortRuns[target];
+            run.left = (std::min)(run.left, left);
+            run.top = (std::min)(run.top, top);
+            run.right = (std::max)(run.right, right);
+            run.bottom = (std::max)(run.bottom, bottom);
+        }
+        itemRuns.push_back(static_cast<uint32_t>(target));
+    }
+
+    // Stable counting sort by run keeps painter order inside every run.
+    runOffsets.assign(sortRuns.size() + 1, 0);
+    for (uint32_t run : itemRuns) {
+        runOffsets[run + 1]++;
+    }
+    for (size_t run = 1; run < runOffsets.size(); ++run) {
+        runOffsets[run] += runOffsets[run - 1];
+    }
+    sortedItems.resize(painterItems.size());
+    for (size_t i = 0; i < painterItems.size(); ++i) {
+        sortedItems[runOffsets[itemRuns[i]]++] = painterItems[i];
+    }
+    painterItems.swap(sortedItems);
+}
+
+void GeometryBatch::itemBounds(const Item& item, float& left, float& top, float& right, float& bottom) const {
+    left = FLT_MAX;
+    top = FLT_MAX;
+    right = -FLT_MAX;
+    bottom = -FLT_MAX;
+    for (uint32_t v = item.firstVertex; v < item.firstVertex + item.vertexCount; ++v) {
+        left = (std::min)(left, vertices[v].x);
+        top = (std::min)(top, vertices[v].y);
+        right = (std::max)(right, vertices[v].x);
+        bottom = (std::max)(bottom, vertices[v].y);
+    }
+    if (item.translation != 0 && item.translation < translations.size()) {
+        const Translation& offset = translations[item.translation];
+        left += offset.x;
+        right += offset.x;
+        top += offset.y;
+        bottom += offset.y;
+    }
+}
+
+// Calls visit(pixelIndex) for every pixel center covered by the triangle. Shared edges are
+// owned by exactly one of the two triangles, so a fan covers every pixel once.
+template <typename Visit>
+static void rasterizeTriangle(const RenderBackend::Vertex* a, const RenderBackend::Vertex* b, const RenderBackend::Vertex* c, int viewportWidth, int viewportHeight, Visit visit) {
+    float area = (b->x - a->x) * (c->y - a->y) - (b->y - a->y) * (c->x - a->x);
+    if (area == 0.0f) {
+        return;
+    }
+    if (area < 0.0f) {
+        std::swap(b, c);
+    }
+
+    int minX = (std::max)(0, static_cast<int>(floorf((std::min)((std::min)(a->x, b->x), c->x))));
+    int maxX = (std::min)(viewportWidth - 1, static_cast<int>(ceilf((std::max)((std::max)(a->x, b->x), c->x))));
+    int minY = (std::max)(0, static_cast<int>(floorf((std::min)((std::min)(a->y, b->y), c->y))));
+    int maxY = (std::min)(viewportHeight - 1, static_cast<int>(ceilf((std::max)((std::max)(a->y, b->y), c->y))));
+
+    const RenderBackend::Vertex* edges[3][2] = { { a, b }, { b, c }, { c, a } };
+    for (int py = minY; py <= maxY; ++py) {
+        float sampleY = py + 0.5f;
+        for (int px = minX; px <= maxX; ++px) {
+            float sampleX = px + 0.5f;
+            bool inside = true;
+            for (int e = 0; e < 3 && inside; ++e) {
+                const RenderBackend::Vertex* from = edges[e][0];
+                const RenderBackend::Vertex* to = edges[e][1];
+                float dx = to->x - from->x;
+                float dy = to->y - from->y;
+                float w = dx * (sampleY - from->y) - dy * (sampleX - from->x);
+                bool owned = dy < 0.0f || (dy == 0.0f && dx > 0.0f);
+                inside = w > 0.0f || (w == 0.0f && owned);
+            }
+            if (inside) {
+                visit(static_cast<size_t>(py) * viewportWidth + px);
+            }
+        }
+    }
+}
+
+GeometryBatch::OverdrawStats GeometryBatch::measureOverdraw(int viewportWidth, int viewportHeight) const {
+    OverdrawStats stats;
+    if (viewportWidth <= 0 || viewportHeight <= 0) {
+        return stats;
+    }
+
+    size_t pixelCount = static_cast<size_t>(viewportWidth) * viewportHeight;
+    std::vector<bool> covered(pixelCount, false);
+    std::vector<int32_t> topOpaque(pixelCount, -1);
+    RenderBackend::Vertex triangle[3];
+    auto translatedTriangle = [&](const Item& item, uint32_t first, RenderBackend::Vertex* out) {
+        const Translation offset = item.translation < translations.size() ? translations[item.translation] : Translation();
+        for (int corner = 0; corner < 3; ++corner) {
+            out[corner] = vertices[indices[first + corner]];
+            out[corner].x += offset.x;
+            out[corner].y += offset.y;
+        }
+    };
+
+    for (size_t i = 0; i < items.size(); ++i) {
+        const Item& item = items[i];
+        int32_t itemIndex = static_cast<int32_t>(i);
+        for (uint32_t t = item.firstIndex; t + 2 < item.firstIndex + item.indexCount; t += 3) {
+            translatedTriangle(item, t, triangle);
+            rasterizeTriangle(&triangle[0], &triangle[1], &triangle[2], viewportWidth, viewportHeight, [&](size_t pixel) {
+                if (!covered[pixel]) {
+                    covered[pixel] = true;
+                    stats.coveredPixels++;
+                }
+                if (item.opaque) {
+                    topOpaque[pixel] = itemIndex;
+                }
+                stats.shadedFragments++;
+            });
+        }
+    }
+
+    // A fragment is rejected by the depth test when a later opaque shape covers its pixel.
+    for (size_t i = 0; i < items.size(); ++i) {
+        const Item& item = items[i];
+        int32_t itemIndex = static_cast<int32_t>(i);
+        for (uint32_t t = item.firstIndex; t + 2 < item.firstIndex + item.indexCount; t += 3) {
+            translatedTriangle(item, t, triangle);
+            rasterizeTriangle(&triangle[0], &triangle[1], &triangle[2], viewportWidth, viewportHeight, [&](size_t pixel) {
+                if (topOpaque[pixel] > itemIndex) {
+                    stats.rejectedFragments++;
+                }
+            });
+        }
+    }
+    return stats;
+}
+
+void UploadMirror::compareSegment(const uint8_t* data, size_t offset, size_t size, std::vector<Range>& dirty) {
+    size_t mirrored = bytes.size() > offset ? (std::min)(bytes.size() - offset, size) : 0;
+    if (mirrored == size && memcmp(data + offset, bytes.data() + offset, size) == 0) {
+        return;
+    }
+
+    if (!dirty.empty() && offset <= dirty.back().offset + dirty.back().size + MERGE_GAP) {
+        dirty.back().size = offset + size - dirty.back().offset;
+    }
+    else {
+        dirty.push_back({ offset, size });
+    }
+}
+
+void UploadMirror::update(const uint8_t* data, size_t size, const std::vector<size_t>& segmentEnds, std::vector<Range>& dirty) {
+    dirty.clear();
+    size_t offset = 0;
+    for (size_t end : segmentEnds) {
+        end = (std::min)(end, size);
+        if (end > offset) {
+            compareSegment(data, offset, end - offset, dirty);
+            offset = end;
+        }
+    }
+    if (offset < size) {
+        compareSegment(data, offset, size - offset, dirty);
+    }
+    store(data, size, dirty);
+}
+
+void UploadMirror::update(const uint8_t* data, size_t size, size_t blockSize, std::vector<Range>& dirty) {
+    dirty.clear();
+    for (size_t offset = 0; offset < size; offset += blockSize) {
+        compareSegment(data, offset, (std::min)(blockSize, size - offset), dirty);
+    }
+    store(data, size, dirty);
+}
+
+void UploadMirror::store(const uint8_t* data, size_t size, const std::vector<Range>& dirty) {
+    bytes.resize(size);
+    for (const Range& range : dirty) {
+        memcpy(&bytes[range.offset], data + range.offset, range.size);
+    }
+}
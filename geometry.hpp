@@ -0,0 +1,244 @@
+#pragma once
+#include "backend.hpp"
+#include "atlas.hpp"
+#include "shadow.hpp"
+#include "path.hpp"
+#include <cstdint>
+#include <vector>
+
+class LiveGraph;
+
+// Tessellates draw commands into one indexed triangle list in pixel space. Every shape,
+// textured or not, ends up in the same buffers so a frame can be submitted in one draw.
+// Each shape is also recorded as an item so the submission order can be rearranged.
+class GeometryBatch {
+public:
+    typedef RenderBackend::Vertex Vertex;
+    typedef RenderBackend::Color Color;
+
+    struct Item {
+        uint32_t firstVertex, vertexCount;
+        uint32_t firstIndex, indexCount;
+        bool opaque;
+        uint32_t texture;       // 0 for the atlas, 1 + layer id for a composited layer
+        uint32_t translation;   // slot in translations
+    };
+
+    // Offset of a translation slot, padded to the float4 the vertex shader reads.
+    struct Translation {
+        float x, y;
+        float reserved0, reserved1;
+    };
+
+    // Submitted indices sampling the same texture, see Item::texture.
+    struct TextureRun {
+        uint32_t firstIndex, indexCount;
+        uint32_t texture;
+    };
+
+    struct OverdrawStats {
+        uint64_t shadedFragments = 0;
+        uint64_t coveredPixels = 0;
+        // Fragments hidden under a later opaque shape, i.e. what early-Z rejects in the
+        // depth pre-pass instead of shading and blending them.
+        uint64_t rejectedFragments = 0;
+
+        double perPixel() const { return coveredPixels > 0 ? static_cast<double>(shadedFragments) / coveredPixels : 0.0; }
+        double perPixelAfterRejection() const { return coveredPixels > 0 ? static_cast<double>(shadedFragments - rejectedFragments) / coveredPixels : 0.0; }
+    };
+
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<Item> items;
+    // Parameters of the shadows in the batch. A shadow quad's vertices carry u = -1 - its
+    // index in here, which tells the pixel shader to evaluate the shadow instead of sampling.
+    std::vector<AnalyticShadow::Params> shadows;
+    // Offsets by translation slot, slot 0 stays zero. Owned by the backend and kept across
+    // clear(): vertices hold the slot, so only this table changes when a slot moves.
+    std::vector<Translation> translations;
+
+    // Commands copied from the previous frame instead of being tessellated again.
+    struct ReuseStats {
+        uint32_t reused = 0;        // identical to the command at the same position last frame
+        uint32_t recolored = 0;     // same geometry, only the color changed
+        uint32_t tessellated = 0;
+    };
+
+    GeometryBatch(const TextureAtlas& atlas) : atlas(atlas) {}
+
+    void clear();
+    bool empty() const { return indices.empty(); }
+
+    // Items added from here on are moved by the offset of slot, see translations.
+    void useTranslation(uint32_t slot);
+    uint32_t currentTranslation() const { return translation; }
+
+    // Keeps the geometry of the previous frame around. A command identical to the one drawn at
+    // the same position last frame is then copied instead of tessellated, and one that only
+    // changed color has its copy recolored. Unchanged commands keep their vertex offsets as
+    // long as nothing before them changed size, which is what makes partial uploads pay off.
+    void setRetained(bool enable);
+    const ReuseStats& getReuseStats() const { return reuseStats; }
+
+    void add(const RenderBackend::DrawCommand& command);
+    void addRectangle(float x, float y, float width, float height, const Color& color);
+    void addRoundedRectangle(float x, float y, float width, float height, float radius, const Color& color, int segments = 32);
+    void addCircle(float centerX, float centerY, float radius, const Color& color, int segments = 64);
+    void addTriangle(float x1, float y1, float x2, float y2, float x3, float y3, const Color& color);
+    void addImage(float x, float y, float width, float height, int imageId, const Color& tint);
+    void addBorder(float x, float y, float width, float height, float rounding, float thickness, const Color& color, int segments = 32);
+    void addRing(float centerX, float centerY, float radius, float thickness, const Color& color, int segments = 64);
+    void addLine(float x1, float y1, float x2, float y2, float thickness, const Color& color);
+    void addPolyline(const float* points, uint32_t pointCount, float thickness, const Color& color, RenderBackend::JoinStyle join = RenderBackend::JOIN_MITER);
+    // Copies the graph's cached stroke, only translating it.
+    void addGraph(const LiveGraph& graph, float x, float y);
+    // Fills the path moved by x, y. Tessellation is looked up in the batch's PathCache, so a
+    // path drawn every frame is only copied.
+    void addPath(const VectorPath& path, float x, float y, const Color& color);
+    const PathCache::Stats& getPathStats() const { return pathCache.getStats(); }
+    // Quad covering the layer texture with uv 0..1, never opaque.
+    void addLayer(float x, float y, float width, float height, int layerId);
+    // Quad covering the shadow box and its blur.
+    void addShadow(const RenderBackend::Shadow& shadow);
+    // Appends items tessellated earlier, by another batch or loaded from a PersistentCache.
+    // Their vertex and index ranges refer to the given arrays, indices are absolute in them.
+    void addPrebuilt(const Vertex* prebuiltVertices, const uint32_t* prebuiltIndices, const Item* prebuiltItems, uint32_t itemCount);
+
+    // Every stroked segment has the same layout: a quad from (x0, y0) to (x1, y1), then the
+    // center and tip of the join wedge towards the previous segment. previousDirection is a
+    // unit vector, or null for the first segment. Returns the side of the turn the wedge is
+    // on (0 without one), which pushStrokeIndices needs. LiveGraph caches these per sample.
+    static const uint32_t STROKE_VERTICES = 6;
+    static const uint32_t STROKE_INDICES = 12;
+    static int strokeSegment(float x0, float y0, float x1, float y1, const float* previousDirection, float halfWidth, RenderBackend::JoinStyle join, const Color& color, Vertex* out);
+
+    // Writes painter order depth into the vertices (later shapes are nearer) and builds the
+    // submission order: opaque items front to back, followed by translucent items back to
+    // front. Drawn with depth testing this keeps painter semantics while early-Z rejects
+    // everything hidden behind an opaque shape. Returns the number of opaque indices.
+    uint32_t buildDepthOrder(std::vector<uint32_t>& orderedIndices);
+
+    // Builds what a backend submits: with depthOrder the buildDepthOrder() layout, otherwise
+    // all items in painter order. The painter ordered part is split into runs of items
+    // sampling the same texture, one texture bind and draw each. With state sorting the
+    // items are regrouped so that runs of one texture merge, keeping the relative order of
+    // any two items whose bounds overlap, which is all painter order has to guarantee.
+    // Returns the number of opaque indices, they come first and sample the atlas.
+    uint32_t buildSubmission(bool depthOrder, std::vector<uint32_t>& orderedIndices, std::vector<TextureRun>& runs);
+
+    // Enabled by default, output is identical either way.
+    void setStateSorting(bool enable) { stateSorting = enable; }
+
+    // Texture runs of the last buildSubmission(), i.e. state changes, with and without sorting.
+    struct SortStats {
+        uint32_t unsortedRuns = 0;
+        uint32_t runs = 0;
+    };
+    const SortStats& getSortStats() const { return sortStats; }
+
+    // Rasterizes the batch on the CPU (pixel centers, top-left rule) and counts how often
+    // every pixel would be shaded. Meant for headless measurements, not for rendering.
+    OverdrawStats measureOverdraw(int viewportWidth, int viewportHeight) const;
+
+private:
+    struct RetainedCommand {
+        RenderBackend::DrawCommand command;
+        uint32_t firstVertex, vertexCount;
+        uint32_t firstIndex, indexCount;
+        bool opaque;
+        uint32_t translation;
+    };
+
+    const TextureAtlas& atlas;
+    uint32_t translation = 0;
+    bool retained = false;
+    uint32_t retainedGeneration = 0;
+    std::vector<RetainedCommand> commands;
+    std::vector<RetainedCommand> previousCommands;
+    std::vector<Vertex> previousVertices;
+    std::vector<uint32_t> previousIndices;
+    ReuseStats reuseStats;
+    PathCache pathCache;
+
+    // Texture runs being built by sortByState(), with the bounds of everything in them.
+    struct SortRun {
+        uint32_t texture;
+        float left, top, right, bottom;
+    };
+    // How many of the latest runs an item may move back across before it starts a new one.
+    static const size_t SORT_LOOKBACK = 32;
+
+    bool stateSorting = true;
+    SortStats sortStats;
+    std::vector<uint32_t> painterItems;
+    std::vector<uint32_t> sortedItems;
+    std::vector<uint32_t> itemRuns;
+    std::vector<uint32_t> runOffsets;
+    std::vector<SortRun> sortRuns;
+
+    // Writes painter order depth and appends the opaque items front to back.
+    uint32_t buildOpaqueOrder(std::vector<uint32_t>& orderedIndices);
+    void sortByState();
+
+    void tessellate(const RenderBackend::DrawCommand& command);
+    bool reuse(const RenderBackend::DrawCommand& command);
+    uint32_t itemVertexEnd = 0;
+    uint32_t itemIndexEnd = 0;
+
+    // Turns everything added since the previous item into a new one, in the current
+    // translation slot.
+    void closeItem(bool opaque, uint32_t texture = 0);
+    // Bounds of an item with its translation applied.
+    void itemBounds(const Item& item, float& left, float& top, float& right, float& bottom) const;
+
+    bool itemOpaque(uint32_t itemCount) const { return items.size() > itemCount && items.back().opaque; }
+
+    uint32_t pushVertex(float x, float y, const Color& color) {
+        return pushVertex(x, y, color, atlas.whiteU(), atlas.whiteV());
+    }
+
+    uint32_t pushVertex(float x, float y, const Color& color, float u, float v) {
+        vertices.push_back({ x, y, 0.0f, color.r, color.g, color.b, color.a, u, v, 0 });
+        return static_cast<uint32_t>(vertices.size() - 1);
+    }
+
+    void pushQuad(uint32_t topLeft) {
+        // Same winding as the old four vertex triangle strip: TL, TR, BL, BR.
+        uint32_t quad[] = { topLeft, topLeft + 1, topLeft + 2, topLeft + 2, topLeft + 1, topLeft + 3 };
+        indices.insert(indices.end(), quad, quad + 6);
+    }
+
+    // Connects two closed loops of equal length into a triangle strip.
+    void pushLoopStrip(uint32_t outerFirst, uint32_t innerFirst, uint32_t count);
+
+    // Writes the quad and, unless joinSide is 0, the wedge of the stroke segment starting at
+    // vertex first. The wedge expects the previous segment's vertices directly before it.
+    static uint32_t* writeStrokeIndices(uint32_t* out, uint32_t first, int joinSide);
+};
+
+// CPU copy of what was last uploaded into a GPU buffer. update() compares new contents with
+// it segment by segment and returns the byte ranges that differ, so only those have to be
+// uploaded again. Nearby dirty ranges are merged to keep the number of copies down.
+class UploadMirror {
+public:
+    struct Range {
+        size_t offset;
+        size_t size;
+    };
+
+    // segmentEnds are increasing byte offsets splitting data into segments, e.g. one per shape.
+    void update(const uint8_t* data, size_t size, const std::vector<size_t>& segmentEnds, std::vector<Range>& dirty);
+    // Same with fixed size segments.
+    void update(const uint8_t* data, size_t size, size_t blockSize, std::vector<Range>& dirty);
+    // The next update reports everything, e.g. after the GPU buffer was recreated.
+    void invalidate() { bytes.clear(); }
+
+private:
+    // Dirty ranges closer than this are uploaded as one.
+    static const size_t MERGE_GAP = 256;
+
+    std::vector<uint8_t> bytes;
+
+    void compareSegment(const uint8_t* data, size_t offset, size_t size, std::vector<Range>& dirty);
+    void store(const uint8_t* data, size_t size, const std::vector<Range>& dirty);
+};
@@ -0,0 +1,119 @@
+#include "graph.hpp"
+#include "geometry.hpp"
+#include <algorithm>
+#include <cmath>
+
+LiveGraph::LiveGraph(uint32_t capacity, float width, float height, float minValue, float maxValue, float thickness, Color color, RenderBackend::JoinStyle join)
+    : capacity((std::max)(capacity, 2u)), width(width), height(height), minValue(minValue), maxValue(maxValue),
+    thickness(thickness), color(color), join(join), count(0), tessellatedSegments(0) {
+    spacing = width / (this->capacity - 1);
+    samples.assign(this->capacity, 0.0f);
+    strokes.resize(static_cast<size_t>(this->capacity) * GeometryBatch::STROKE_VERTICES);
+    joinSides.assign(this->capacity, 0);
+}
+
+void LiveGraph::push(float value) {
+    samples[count % capacity] = value;
+    if (count > 0) {
+        tessellate(count);
+    }
+    count++;
+}
+
+void LiveGraph::push(const float* values, size_t valueCount) {
+    for (size_t i = 0; i < valueCount; ++i) {
+        push(values[i]);
+    }
+}
+
+void LiveGraph::clear() {
+    count = 0;
+}
+
+void LiveGraph::setRange(float newMinValue, float newMaxValue) {
+    minValue = newMinValue;
+    maxValue = newMaxValue;
+    retessellate();
+}
+
+void LiveGraph::setStroke(float newThickness, Color newColor, RenderBackend::JoinStyle newJoin) {
+    thickness = newThickness;
+    color = newColor;
+    join = newJoin;
+    retessellate();
+}
+
+float LiveGraph::sampleY(uint64_t sampleIndex) const {
+    float range = maxValue - minValue;
+    float t = range != 0.0f ? (samples[sampleIndex % capacity] - minValue) / range : 0.0f;
+    t = (std::min)((std::max)(t, 0.0f), 1.0f);
+    return height - t * height;
+}
+
+void LiveGraph::tessellate(uint64_t sampleIndex) {
+    // The segment ending at sampleIndex, in the coordinates of its slot.
+    uint32_t slot = static_cast<uint32_t>(sampleIndex % capacity);
+    float x1 = slot * spacing;
+    float x0 = x1 - spacing;
+    float y0 = sampleY(sampleIndex - 1);
+    float y1 = sampleY(sampleIndex);
+
+    float direction[2];
+    bool hasPrevious = sampleIndex >= 2;
+    if (hasPrevious) {
+        float dy = y0 - sampleY(sampleIndex - 2);
+        float length = sqrtf(spacing * spacing + dy * dy);
+        direction[0] = spacing / length;
+        direction[1] = dy / length;
+    }
+
+    joinSides[slot] = static_cast<int8_t>(GeometryBatch::strokeSegment(x0, y0, x1, y1, hasPrevious ? direction : nullptr, thickness * 0.5f, join, color,
+        &strokes[static_cast<size_t>(slot) * GeometryBatch::STROKE_VERTICES]));
+    tessellatedSegments++;
+}
+
+void LiveGraph::retessellate() {
+    uint64_t first = count - size();
+    for (uint64_t i = first + 1; i < count; ++i) {
+        tessellate(i);
+    }
+}
+
+int LiveGraph::getRuns(Run runs[2]) const {
+    if (count < 2) {
+        return 0;
+    }
+
+    uint64_t newest = count - 1;
+    uint64_t segment = count - size() + 1;
+    int runCount = 0;
+    while (segment <= newest) {
+        uint64_t ringStart = segment - segment % capacity;
+        uint64_t runEnd = (std::min)(ringStart + capacity - 1, newest);
+
+        Run& run = runs[runCount++];
+        run.firstSlot = static_cast<uint32_t>(segment % capacity);
+        run.slotCount = static_cast<uint32_t>(runEnd - segment + 1);
+        // Places the newest sample at the right edge; the subtraction stays below two rings.
+        run.offsetX = width - static_cast<float>(newest - ringStart) * spacing;
+        segment = runEnd + 1;
+    }
+    return runCount;
+}
+
+const LiveGraph::Vertex* LiveGraph::slotVertices(uint32_t slot) const {
+    return &strokes[static_cast<size_t>(slot) * GeometryBatch::STROKE_VERTICES];
+}
+
+void LiveGraph::getPoints(std::vector<float>& points) const {
+    points.clear();
+    if (count == 0) {
+        return;
+    }
+
+    uint64_t newest = count - 1;
+    for (uint64_t i = count - size(); i <= newest; ++i) {
+        points.push_back(width - static_cast<float>(newest - i) * spacing);
+        points.push_back(sampleY(i));
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include "backend.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Scrolling line graph over a fixed capacity ring of samples, the newest sample sits at the
+// right edge. Ring slots keep a fixed x position, so scrolling is only a translation applied
+// when the graph is drawn and a pushed sample tessellates nothing but the segment leading to
+// it. Not thread-safe, push and draw from the same thread.
+class LiveGraph {
+public:
+    typedef RenderBackend::Vertex Vertex;
+    typedef RenderBackend::Color Color;
+
+    // Consecutive ring slots that share one x offset. The ring wraps at most once, so a graph
+    // is drawn as at most two runs.
+    struct Run {
+        uint32_t firstSlot;
+        uint32_t slotCount;
+        float offsetX;
+    };
+
+    // Samples are mapped from [minValue, maxValue] to the graph height, larger values up.
+    LiveGraph(uint32_t capacity, float width, float height, float minValue, float maxValue, float thickness, Color color, RenderBackend::JoinStyle join = RenderBackend::JOIN_MITER);
+
+    void push(float value);
+    void push(const float* values, size_t count);
+    void clear();
+
+    // Both re-tessellate every held sample.
+    void setRange(float minValue, float maxValue);
+    void setStroke(float thickness, Color color, RenderBackend::JoinStyle join);
+
+    uint32_t getCapacity() const { return capacity; }
+    uint32_t size() const { return static_cast<uint32_t>(count < capacity ? count : capacity); }
+    float getWidth() const { return width; }
+    float getHeight() const { return height; }
+    float getThickness() const { return thickness; }
+    const Color& getColor() const { return color; }
+    RenderBackend::JoinStyle getJoin() const { return join; }
+    // Segments tessellated since construction, lets callers check that pushes stay incremental.
+    uint64_t getTessellatedSegments() const { return tessellatedSegments; }
+
+    // Segments to draw, oldest first. Returns the number of runs written.
+    int getRuns(Run runs[2]) const;
+    const Vertex* slotVertices(uint32_t slot) const;
+    int joinSide(uint32_t slot) const { return joinSides[slot]; }
+    // Positions of the held samples relative to the graph origin, oldest first, as x, y pairs.
+    void getPoints(std::vector<float>& points) const;
+
+private:
+    uint32_t capacity;
+    float width;
+    float height;
+    float spacing;
+    float minValue;
+    float maxValue;
+    float thickness;
+    Color color;
+    RenderBackend::JoinStyle join;
+
+    std::vector<float> samples;
+    std::vector<Vertex> strokes;
+    std::vector<int8_t> joinSides;
+    uint64_t count;
+    uint64_t tessellatedSegments;
+
+    float sampleY(uint64_t sampleIndex) const;
+    void tessellate(uint64_t sampleIndex);
+    void retessellate();
+};
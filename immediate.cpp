@@ -0,0 +1,109 @@
+#include "immediate.hpp"
+
+ImmediateStateTable::ImmediateStateTable(size_t initialCapacity) : count(0) {
+    size_t capacity = 16;
+    while (capacity < initialCapacity) capacity *= 2;
+    slots.assign(capacity, Slot());
+    mask = capacity - 1;
+    stats.capacity = static_cast<uint32_t>(capacity);
+}
+
+ImmediateStateTable::State& ImmediateStateTable::touch(uint32_t id, uint32_t frame) {
+    size_t index = home(id);
+    while (slots[index].used) {
+        if (slots[index].state.id == id) {
+            slots[index].state.frame = frame;
+            return slots[index].state;
+        }
+        index = (index + 1) & mask;
+    }
+
+    // Kept at most half full so probe sequences stay short.
+    if ((count + 1) * 2 > slots.size()) {
+        grow();
+        index = home(id);
+        while (slots[index].used) {
+            index = (index + 1) & mask;
+        }
+    }
+
+    Slot& slot = slots[index];
+    slot.used = true;
+    slot.state.id = id;
+    slot.state.frame = frame;
+    slot.state.flags = 0;
+    count++;
+    stats.entries = static_cast<uint32_t>(count);
+    stats.created++;
+    return slot.state;
+}
+
+const ImmediateStateTable::State* ImmediateStateTable::find(uint32_t id) const {
+    size_t index = home(id);
+    while (slots[index].used) {
+        if (slots[index].state.id == id) {
+            return &slots[index].state;
+        }
+        index = (index + 1) & mask;
+    }
+    return nullptr;
+}
+
+void ImmediateStateTable::sweep(uint32_t frame) {
+    stats.collected = 0;
+    stats.created = 0;
+    if (count == 0) {
+        return;
+    }
+
+    size_t index = 0;
+    while (index < slots.size()) {
+        if (!slots[index].used || slots[index].state.frame == frame) {
+            index++;
+            continue;
+        }
+
+        // Backward shift: entries further along the probe sequence move into the hole when
+        // it lies between their home and where they are. The hole then moves on, the entry
+        // that filled index is looked at again.
+        size_t hole = index;
+        size_t next = (hole + 1) & mask;
+        while (slots[next].used) {
+            size_t target = home(slots[next].state.id);
+            bool movable = hole <= next ? (target <= hole || target > next) : (target <= hole && target > next);
+            if (movable) {
+                slots[hole] = slots[next];
+                hole = next;
+            }
+            next = (next + 1) & mask;
+        }
+        slots[hole].used = false;
+        count--;
+        stats.collected++;
+    }
+    stats.entries = static_cast<uint32_t>(count);
+}
+
+void ImmediateStateTable::clear() {
+    slots.assign(slots.size(), Slot());
+    count = 0;
+    stats.entries = 0;
+}
+
+void ImmediateStateTable::grow() {
+    std::vector<Slot> previous;
+    previous.swap(slots);
+    slots.assign(previous.size() * 2, Slot());
+    mask = slots.size() - 1;
+    for (const Slot& slot : previous) {
+        if (!slot.used) {
+            continue;
+        }
+        size_t index = home(slot.state.id);
+        while (slots[index].used) {
+            index = (index + 1) & mask;
+        }
+        slots[index] = slot;
+    }
+    stats.capacity = static_cast<uint32_t>(slots.size());
+}
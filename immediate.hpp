@@ -0,0 +1,75 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Ids of immediate mode widgets: FNV-1a of a name, the same hash captures use for widget
+// names, so a literal is hashed at compile time. Widgets created in a loop mix their index
+// into the id of their parent with combine().
+namespace ImmediateId {
+    constexpr uint32_t hash(const char* name, uint32_t seed = 2166136261u) {
+        uint32_t value = seed;
+        while (*name) {
+            value ^= static_cast<unsigned char>(*name++);
+            value *= 16777619u;
+        }
+        return value;
+    }
+
+    constexpr uint32_t combine(uint32_t parent, uint32_t index) {
+        uint32_t value = parent;
+        for (int i = 0; i < 4; ++i) {
+            value ^= (index >> (i * 8)) & 0xff;
+            value *= 16777619u;
+        }
+        return value;
+    }
+}
+
+// State kept between frames for immediate mode widgets, keyed by id. Open addressing with
+// linear probing in one power of two array; entries not touched during a frame are
+// collected by sweep(), with backward shift deletion so no tombstones pile up. Only growing
+// allocates, a UI showing the same widgets every frame runs without allocating.
+class ImmediateStateTable {
+public:
+    struct State {
+        uint32_t id;
+        uint32_t frame;     // last frame the widget was touched in
+        uint32_t flags;     // owned by the caller, 0 for a new widget
+    };
+
+    struct Stats {
+        uint32_t entries = 0;
+        uint32_t capacity = 0;
+        uint32_t created = 0;       // since the last sweep()
+        uint32_t collected = 0;     // by the last sweep()
+    };
+
+    explicit ImmediateStateTable(size_t initialCapacity = 64);
+
+    // The state of id, created with zero flags when it has none yet. Marks it as used in
+    // frame. The reference is valid until the next touch() or sweep().
+    State& touch(uint32_t id, uint32_t frame);
+    // Null when id has no state.
+    const State* find(uint32_t id) const;
+    // Drops the state of every widget not touched in frame.
+    void sweep(uint32_t frame);
+    void clear();
+
+    const Stats& getStats() const { return stats; }
+
+private:
+    struct Slot {
+        State state;
+        bool used;
+    };
+
+    std::vector<Slot> slots;
+    size_t mask;
+    size_t count;
+    Stats stats;
+
+    // FNV leaves the low bits weakest, fold the high ones in.
+    size_t home(uint32_t id) const { return (id ^ (id >> 16)) & mask; }
+    void grow();
+};
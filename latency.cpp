@@ -0,0 +1,91 @@
+#include "latency.hpp"
+#include <algorithm>
+#include <vector>
+
+LatencyTracker::LatencyTracker(size_t samplesPerType) : samplesPerType((std::max)(samplesPerType, static_cast<size_t>(1))) {
+    for (History& typeHistory : history) {
+        typeHistory.latencies.reset(new std::atomic<uint64_t>[this->samplesPerType]);
+        for (size_t i = 0; i < this->samplesPerType; ++i) {
+            typeHistory.latencies[i].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+void LatencyTracker::setPresentCallback(PresentCallback callback) {
+    presentCallback = callback;
+}
+
+void LatencyTracker::framePresented(const Input* inputs, size_t inputCount, uint64_t presentedNs) {
+    uint64_t present = presents++;
+    if (inputCount > 0) {
+        pendingFrames.push_back({ present, presentedNs, inputCount });
+        pendingInputs.insert(pendingInputs.end(), inputs, inputs + inputCount);
+    }
+    resolve();
+}
+
+void LatencyTracker::resolve() {
+    // Frames reach the screen in present order, so resolving stops at the first unknown one.
+    while (!pendingFrames.empty()) {
+        const PendingFrame& frame = pendingFrames.front();
+        uint64_t displayedNs = frame.presentedNs;
+        if (presentCallback && !presentCallback(frame.present, displayedNs)) {
+            if (presents - frame.present <= MAX_PENDING_PRESENTS) {
+                return;
+            }
+            displayedNs = frame.presentedNs;
+            fallbackFrames.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        for (size_t i = 0; i < frame.inputCount; ++i) {
+            const Input& input = pendingInputs[i];
+            addSample(input.type, displayedNs > input.sampledNs ? displayedNs - input.sampledNs : 0);
+        }
+        pendingInputs.erase(pendingInputs.begin(), pendingInputs.begin() + frame.inputCount);
+        pendingFrames.pop_front();
+    }
+}
+
+void LatencyTracker::addSample(InputType type, uint64_t latencyNs) {
+    History& typeHistory = history[type];
+    uint64_t samples = typeHistory.samples.load(std::memory_order_relaxed);
+    typeHistory.latencies[samples % samplesPerType].store(latencyNs, std::memory_order_relaxed);
+    typeHistory.samples.store(samples + 1, std::memory_order_release);
+}
+
+LatencyTracker::Percentiles LatencyTracker::percentiles(InputType type) const {
+    const History& typeHistory = history[type];
+    uint64_t samples = typeHistory.samples.load(std::memory_order_acquire);
+    uint64_t resetSamples = typeHistory.resetSamples.load(std::memory_order_relaxed);
+    Percentiles result;
+    result.samples = samples > resetSamples ? samples - resetSamples : 0;
+    if (result.samples == 0) {
+        return result;
+    }
+
+    // The most recent samples, newest first.
+    size_t count = static_cast<size_t>((std::min)(result.samples, static_cast<uint64_t>(samplesPerType)));
+    std::vector<uint64_t> sorted(count);
+    for (size_t i = 0; i < count; ++i) {
+        sorted[i] = typeHistory.latencies[(samples - 1 - i) % samplesPerType].load(std::memory_order_relaxed);
+    }
+
+    std::sort(sorted.begin(), sorted.end());
+    result.p50Ms = sorted[sorted.size() / 2] / 1e6;
+    result.p99Ms = sorted[(std::min)(sorted.size() * 99 / 100, sorted.size() - 1)] / 1e6;
+    result.maxMs = sorted.back() / 1e6;
+    return result;
+}
+
+uint64_t LatencyTracker::getFallbackFrames() const {
+    uint64_t frames = fallbackFrames.load(std::memory_order_relaxed);
+    uint64_t resetFrames = resetFallbackFrames.load(std::memory_order_relaxed);
+    return frames > resetFrames ? frames - resetFrames : 0;
+}
+
+void LatencyTracker::reset() {
+    for (History& typeHistory : history) {
+        typeHistory.resetSamples.store(typeHistory.samples.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+    resetFallbackFrames.store(fallbackFrames.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
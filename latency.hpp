@@ -0,0 +1,89 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+
+// Input-to-present latency. ezUI stamps every input when handleInput() samples it, carries
+// the stamps along with the frame that first reflects the input and hands them in here once
+// that frame was presented. Latency is measured up to when the frame reached the screen as
+// reported by the present callback, or up to present() returning without one.
+//
+// framePresented() and the present callback run on whichever thread renders and never take
+// a lock, finished latencies are handed to the queries, which may run on any thread, through
+// relaxed atomics. Set the callback before frames are presented.
+class LatencyTracker {
+public:
+    enum InputType {
+        INPUT_POINTER,      // the cursor moved
+        INPUT_CLICK,        // a button or list row was clicked
+        INPUT_HOTKEY,
+        INPUT_TYPE_COUNT
+    };
+
+    struct Input {
+        InputType type;
+        uint64_t sampledNs;
+    };
+
+    // Asked for the time the present-th frame (counted from 0 across framePresented calls)
+    // reached the screen, on the same clock as the input stamps. Returns false while that is
+    // not known yet, the frame is asked again after later presents. Frames still unknown after
+    // MAX_PENDING_PRESENTS presents fall back to the time present() returned.
+    typedef std::function<bool(uint64_t present, uint64_t& displayedNs)> PresentCallback;
+
+    struct Percentiles {
+        uint64_t samples = 0;       // total, percentiles cover the most recent ones
+        double p50Ms = 0.0;
+        double p99Ms = 0.0;
+        double maxMs = 0.0;
+    };
+
+    static const uint64_t MAX_PENDING_PRESENTS = 8;
+
+    // Keeps the latest samplesPerType latencies of every input type for the percentiles.
+    explicit LatencyTracker(size_t samplesPerType = 1024);
+
+    void setPresentCallback(PresentCallback callback);
+
+    // A frame reflecting inputs was presented, present() returned at presentedNs. Call for
+    // every presented frame, with or without inputs, so present numbers line up.
+    void framePresented(const Input* inputs, size_t inputCount, uint64_t presentedNs);
+
+    Percentiles percentiles(InputType type) const;
+    // Frames whose display time was not reported in time and fell back to presentedNs.
+    uint64_t getFallbackFrames() const;
+    // Forgets the latencies so far, for the queries. Any thread.
+    void reset();
+
+private:
+    struct PendingFrame {
+        uint64_t present;
+        uint64_t presentedNs;
+        size_t inputCount;
+    };
+
+    // Ring of the latest samples in ns. A sample is stored before samples is bumped, so a
+    // query reads the samples counted or newer ones written over them meanwhile.
+    struct History {
+        std::unique_ptr<std::atomic<uint64_t>[]> latencies;
+        std::atomic<uint64_t> samples{ 0 };
+        std::atomic<uint64_t> resetSamples{ 0 };    // samples as of reset()
+    };
+
+    size_t samplesPerType;
+    History history[INPUT_TYPE_COUNT];
+    std::atomic<uint64_t> fallbackFrames{ 0 };
+    std::atomic<uint64_t> resetFallbackFrames{ 0 };
+
+    // Owned by the thread that renders.
+    PresentCallback presentCallback;
+    std::deque<PendingFrame> pendingFrames;
+    std::deque<Input> pendingInputs;    // inputs of pendingFrames, in the same order
+    uint64_t presents = 0;
+
+    void resolve();
+    void addSample(InputType type, uint64_t latencyNs);
+};
@@ -0,0 +1,95 @@
+#include "layers.hpp"
+
+LayerCache::LayerCache(RenderBackend& backend, uint64_t budgetBytes) : backend(backend), budget(budgetBytes) {}
+
+LayerCache::~LayerCache() {
+    clear();
+}
+
+void LayerCache::setBudget(uint64_t budgetBytes) {
+    budget = budgetBytes;
+    makeRoom(0);
+}
+
+int LayerCache::acquire(uint64_t owner, int width, int height, uint64_t version, bool& needsRender) {
+    needsRender = false;
+    if (width <= 0 || height <= 0) {
+        return -1;
+    }
+
+    auto entryIt = entries.find(owner);
+    if (entryIt != entries.end() && (entryIt->second.width != width || entryIt->second.height != height)) {
+        destroy(entryIt);
+        entryIt = entries.end();
+    }
+
+    if (entryIt == entries.end()) {
+        if (!makeRoom(layerBytes(width, height))) {
+            stats.rejected++;
+            return -1;
+        }
+        int layerId = backend.createLayer(width, height);
+        if (layerId < 0) {
+            stats.rejected++;
+            return -1;
+        }
+        // Any version, the new layer is rendered below.
+        entryIt = entries.insert({ owner, { layerId, width, height, version, frame } }).first;
+        stats.layers++;
+        stats.bytes += layerBytes(width, height);
+        needsRender = true;
+    }
+
+    Entry& entry = entryIt->second;
+    if (entry.version != version) {
+        entry.version = version;
+        needsRender = true;
+    }
+    entry.lastUsedFrame = frame;
+    stats.composited++;
+    if (needsRender) {
+        stats.rendered++;
+    }
+    return entry.layerId;
+}
+
+void LayerCache::release(uint64_t owner) {
+    auto entryIt = entries.find(owner);
+    if (entryIt != entries.end()) {
+        destroy(entryIt);
+    }
+}
+
+void LayerCache::clear() {
+    for (auto& entry : entries) {
+        backend.destroyLayer(entry.second.layerId);
+    }
+    entries.clear();
+    stats.layers = 0;
+    stats.bytes = 0;
+}
+
+void LayerCache::destroy(std::unordered_map<uint64_t, Entry>::iterator entryIt) {
+    backend.destroyLayer(entryIt->second.layerId);
+    stats.layers--;
+    stats.bytes -= layerBytes(entryIt->second.width, entryIt->second.height);
+    entries.erase(entryIt);
+}
+
+bool LayerCache::makeRoom(uint64_t needed) {
+    // Layers are few, a linear search for the oldest one is cheaper than keeping a list.
+    while (stats.bytes + needed > budget) {
+        auto oldest = entries.end();
+        for (auto entryIt = entries.begin(); entryIt != entries.end(); ++entryIt) {
+            if (entryIt->second.lastUsedFrame < frame && (oldest == entries.end() || entryIt->second.lastUsedFrame < oldest->second.lastUsedFrame)) {
+                oldest = entryIt;
+            }
+        }
+        if (oldest == entries.end()) {
+            return false;
+        }
+        destroy(oldest);
+        stats.evicted++;
+    }
+    return true;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "backend.hpp"
+#include <cstdint>
+#include <unordered_map>
+
+// Offscreen layers of a RenderBackend, one per owner (ezUI uses the container index). The
+// owner's content is rendered into its layer once and composited from then on, until the
+// version the owner passes in changes. Layers take width * height * 4 bytes; when a new one
+// would exceed the budget, the least recently composited layers not used in the current
+// frame are destroyed to make room. Owned by whichever thread renders.
+class LayerCache {
+public:
+    struct Stats {
+        uint32_t layers = 0;
+        uint64_t bytes = 0;
+        uint64_t composited = 0;    // acquire() calls that handed out a layer
+        uint64_t rendered = 0;      // of those, the ones whose content had to be rendered
+        uint64_t evicted = 0;
+        uint64_t rejected = 0;      // did not fit the budget or the backend has no layers
+    };
+
+    static const uint64_t DEFAULT_BUDGET = 64ull * 1024 * 1024;
+
+    explicit LayerCache(RenderBackend& backend, uint64_t budgetBytes = DEFAULT_BUDGET);
+    ~LayerCache();
+
+    // Evicts right away when the layers already take more.
+    void setBudget(uint64_t budgetBytes);
+    uint64_t getBudget() const { return budget; }
+
+    // The layer to composite owner's content from this frame, or -1 to draw the content
+    // directly. needsRender is set when the layer is new, was resized or version changed;
+    // render the content between beginLayer() and endLayer() then, or release() the layer
+    // when beginLayer() fails.
+    int acquire(uint64_t owner, int width, int height, uint64_t version, bool& needsRender);
+    void release(uint64_t owner);
+    void clear();
+    // Layers used before endFrame() may be evicted by the acquire() calls after it.
+    void endFrame() { frame++; }
+
+    const Stats& getStats() const { return stats; }
+
+private:
+    struct Entry {
+        int layerId;
+        int width, height;
+        uint64_t version;
+        uint64_t lastUsedFrame;
+    };
+
+    RenderBackend& backend;
+    uint64_t budget;
+    uint64_t frame = 0;
+    std::unordered_map<uint64_t, Entry> entries;
+    Stats stats;
+
+    static uint64_t layerBytes(int width, int height) { return static_cast<uint64_t>(width) * height * 4; }
+    void destroy(std::unordered_map<uint64_t, Entry>::iterator entryIt);
+    // Evicts unused layers until needed more bytes fit, false when they can not be made to.
+    bool makeRoom(uint64_t needed);
+};
@@ -86,7 +86,51 @@ HWND WindowHijacker::createWindow(const std::string& windowName, int width, int
     return hwnd;
 }
 
-int main() {
+int replayCapture(DX11Renderer& renderer, const std::string& path, int loops) {
+    CaptureFile capture;
+    if (!capture.open(path)) {
+        std::cerr << "Failed to open capture '" << path << "'" << std::endl;
+        return 1;
+    }
+
+    CaptureReplayer replayer;
+    ReplayStats stats = replayer.replay(capture, renderer, loops);
+
+    std::cout << "Replayed " << stats.frames << " frames, " << stats.commands << " draw commands (" << stats.images << " images without their pixels) in " << stats.totalMs << " ms\n"
+        << "  " << stats.framesPerSecond() << " fps, frame ms min " << stats.minFrameMs << " p50 " << stats.p50FrameMs
+        << " p99 " << stats.p99FrameMs << " max " << stats.maxFrameMs << std::endl;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    std::string recordPath;
+    std::string replayPath;
+    int replayLoops = 1;
+    bool useRenderThread = false;
+    bool flipModel = false;
+    std::string cachePath;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--record" && i + 1 < argc) {
+            recordPath = argv[++i];
+        }
+        else if (arg == "--replay" && i + 1 < argc) {
+            replayPath = argv[++i];
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                replayLoops = atoi(argv[++i]);
+            }
+        }
+        else if (arg == "--render-thread") {
+            useRenderThread = true;
+        }
+        else if (arg == "--cache" && i + 1 < argc) {
+            cachePath = argv[++i];
+        }
+        else if (arg == "--flip-model") {
+            flipModel = true;
+        }
+    }
+
     WindowHijacker hijacker;
     HWND hwnd = hijacker.findWindow("yourwindowtohijack");
 
@@ -99,13 +143,34 @@ int main() {
     }
 
     DX11Renderer renderer(hwnd);
+    renderer.setFlipModel(flipModel);
+    PersistentCache cache;
+    if (!cachePath.empty()) {
+        if (!cache.open(cachePath)) {
+            std::cout << "No usable cache at '" << cachePath << "', building from scratch.\n";
+        }
+        renderer.setCache(&cache);
+    }
     renderer.initD3D11();
 
+    if (!replayPath.empty()) {
+        return replayCapture(renderer, replayPath, replayLoops);
+    }
 
     ezUI ui(renderer);
 
+    CaptureRecorder recorder;
+    if (!recordPath.empty()) {
+        if (recorder.open(recordPath)) {
+            ui.setRecorder(&recorder);
+        }
+        else {
+            std::cerr << "Failed to create capture '" << recordPath << "'" << std::endl;
+        }
+    }
+
 
-    ui.addContainer("A", 100.0f, 100.0f, 250.0f, 350.0f);
+    ui.addContainer("A", 100.0f, 100.0f, 250.0f, 350.0f, DX11Renderer::Color(0.0f, 0.0f, 0.0f, 1.0f), "shadowedContainer");
     ui.toggleVisibility("A");
 
     ui.addButton("A", "TestButton", { 210.0f, 330.0f, 40.0f, 20.0f, 0.0f, DX11Renderer::Color(.45f, 0.45f, 0.45f, 1.0f) },
@@ -118,7 +183,25 @@ int main() {
         button.bounds.color = DX11Renderer::Color(.45f, 0.45f, 0.45f, 1.0f);
     }
     );
+    // Static panel, composited from a layer and only re-rendered when the button changes.
+    ui.setContainerLayer("A", true);
+
+
+    ui.addContainer("B", 400.0f, 100.0f, 250.0f, 350.0f);
+    ui.toggleVisibility("B");
+
+    ui.addScrollList("B", "Items", { 0.0f, 0.0f, 250.0f, 350.0f, 0.0f, DX11Renderer::Color(0.18f, 0.18f, 0.18f, 1.0f) }, 1000000, 20.0f,
+        [](size_t index, ezUI::ListRow& row) {
+        row.color = index % 2 ? DX11Renderer::Color(0.25f, 0.25f, 0.25f, 1.0f) : DX11Renderer::Color(0.22f, 0.22f, 0.22f, 1.0f);
+    });
 
+    ui.addHotkey("B", VK_PRIOR, [&ui]() {
+        ui.scrollList("Items", -350.0f);
+    }, 100);
+
+    ui.addHotkey("B", VK_NEXT, [&ui]() {
+        ui.scrollList("Items", 350.0f);
+    }, 100);
 
     ui.addHotkey("A", VK_END, []() {
         PostQuitMessage(0);
@@ -128,6 +211,19 @@ int main() {
         ui.masterToggle();
     });
 
+    // Only ezUI presents from here on, so its frame numbers are the renderer's presents.
+    ui.setPresentCallback([&renderer](uint64_t present, uint64_t& displayedNs) {
+        return renderer.getPresentDisplayTime(present, displayedNs);
+    });
+
+    // The quick panel's hover color is resolved from the pointer sampled right before present.
+    ui.setLateLatch(true);
+
+    if (useRenderThread) {
+        ui.startRenderThread();
+    }
+
+    bool firstFrameReported = false;
     MSG msg = {};
     while (msg.message != WM_QUIT) {
         if (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE)) {
@@ -136,8 +232,45 @@ int main() {
         }
 
         ui.handleInput();
+
+        // Immediate mode panel, rebuilt every frame next to the retained containers.
+        static constexpr uint32_t panelId = ImmediateId::hash("QuickPanel");
+        static constexpr uint32_t quitId = ImmediateId::hash("QuickQuit");
+        ui.panel(panelId, DX11Renderer::Rectangle(700.0f, 100.0f, 120.0f, 60.0f, 0.0f, DX11Renderer::Color(0.0f, 0.0f, 0.0f, 1.0f)));
+        if (ui.button(quitId, DX11Renderer::Rectangle(740.0f, 120.0f, 40.0f, 20.0f, 0.0f, DX11Renderer::Color(0.45f, 0.45f, 0.45f, 1.0f)), DX11Renderer::Color(0.7f, 0.7f, 0.7f, 1.0f)).clicked) {
+            PostQuitMessage(0);
+        }
+
         ui.drawAllElements();
+
+        if (!firstFrameReported && renderer.getTimeToFirstFrameMs() > 0.0) {
+            firstFrameReported = true;
+            const PersistentCache::Stats& cacheStats = cache.getStats();
+            std::cout << "Time to first frame: " << renderer.getTimeToFirstFrameMs() << " ms";
+            if (!cachePath.empty()) {
+                std::cout << " (" << (cacheStats.misses == 0 && cacheStats.hits > 0 ? "warm" : "cold") << " cache, " << cacheStats.hits << " hits, "
+                    << cacheStats.misses << " misses, " << cacheStats.rejected << " rejected)";
+                // Everything startup builds exists by now.
+                if (!cache.save()) {
+                    std::cerr << "\nFailed to write cache '" << cachePath << "'";
+                }
+            }
+            std::cout << std::endl;
+        }
     }
 
+    ui.stopRenderThread();
+
+    const char* inputNames[] = { "pointer", "click", "hotkey" };
+    for (int type = 0; type < LatencyTracker::INPUT_TYPE_COUNT; ++type) {
+        LatencyTracker::Percentiles latency = ui.getInputLatency(static_cast<LatencyTracker::InputType>(type));
+        if (latency.samples > 0) {
+            std::cout << "Input to present, " << inputNames[type] << ": " << latency.samples << " inputs, p50 " << latency.p50Ms
+                << " ms p99 " << latency.p99Ms << " ms max " << latency.maxMs << " ms" << std::endl;
+        }
+    }
+    LayerCache::Stats layerStats = ui.getLayerStats();
+    std::cout << "Layers: " << layerStats.composited << " composited, " << layerStats.rendered << " rendered, "
+        << layerStats.evicted << " evicted, " << layerStats.bytes / 1024 << " KiB" << std::endl;
     return 0;
 }
@@ -0,0 +1,598 @@
+#include "path.hpp"
+#include "backend.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static const float PATH_PI = 3.14159265358979f;
+static const uint32_t NO_NODE = UINT32_MAX;
+// Curves are never split into more segments than this, whatever the tolerance.
+static const int MAX_CURVE_SEGMENTS = 512;
+
+const float PathTessellator::DEFAULT_TOLERANCE = 0.25f;
+
+VectorPath::VectorPath() : hashValue(14695981039346656037ull), startX(0.0f), startY(0.0f), lastX(0.0f), lastY(0.0f), contourOpen(false) {}
+
+void VectorPath::append(Verb verb, const float* verbPoints, size_t pointCount) {
+    verbs.push_back(verb);
+    points.insert(points.end(), verbPoints, verbPoints + pointCount * 2);
+
+    // FNV-1a over the verb and its coordinates, the same hash PersistentCache uses.
+    hashValue ^= verb;
+    hashValue *= 1099511628211ull;
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(verbPoints);
+    for (size_t i = 0; i < pointCount * 2 * sizeof(float); ++i) {
+        hashValue ^= bytes[i];
+        hashValue *= 1099511628211ull;
+    }
+}
+
+void VectorPath::ensureContour() {
+    if (!contourOpen) {
+        moveTo(lastX, lastY);
+    }
+}
+
+VectorPath& VectorPath::moveTo(float x, float y) {
+    float point[2] = { x, y };
+    append(VERB_MOVE, point, 1);
+    startX = lastX = x;
+    startY = lastY = y;
+    contourOpen = true;
+    return *this;
+}
+
+VectorPath& VectorPath::lineTo(float x, float y) {
+    ensureContour();
+    float point[2] = { x, y };
+    append(VERB_LINE, point, 1);
+    lastX = x;
+    lastY = y;
+    return *this;
+}
+
+VectorPath& VectorPath::quadTo(float controlX, float controlY, float x, float y) {
+    ensureContour();
+    float quad[4] = { controlX, controlY, x, y };
+    append(VERB_QUAD, quad, 2);
+    lastX = x;
+    lastY = y;
+    return *this;
+}
+
+VectorPath& VectorPath::cubicTo(float control1X, float control1Y, float control2X, float control2Y, float x, float y) {
+    ensureContour();
+    float cubic[6] = { control1X, control1Y, control2X, control2Y, x, y };
+    append(VERB_CUBIC, cubic, 3);
+    lastX = x;
+    lastY = y;
+    return *this;
+}
+
+VectorPath& VectorPath::arcTo(float x1, float y1, float x2, float y2, float radius) {
+    ensureContour();
+    float toStartX = lastX - x1, toStartY = lastY - y1;
+    float toEndX = x2 - x1, toEndY = y2 - y1;
+    float startLength = sqrtf(toStartX * toStartX + toStartY * toStartY);
+    float endLength = sqrtf(toEndX * toEndX + toEndY * toEndY);
+    float cross = toStartX * toEndY - toStartY * toEndX;
+    if (radius <= 0.0f || startLength < 1e-6f || endLength < 1e-6f || fabsf(cross) < 1e-6f * startLength * endLength) {
+        return lineTo(x1, y1);
+    }
+
+    // The circle touches both lines at distance radius / tan(angle / 2) from the corner.
+    toStartX /= startLength;
+    toStartY /= startLength;
+    toEndX /= endLength;
+    toEndY /= endLength;
+    float angle = acosf((std::max)(-1.0f, (std::min)(1.0f, toStartX * toEndX + toStartY * toEndY)));
+    float tangent = radius / tanf(angle * 0.5f);
+    float fromX = x1 + toStartX * tangent, fromY = y1 + toStartY * tangent;
+    float toX = x1 + toEndX * tangent, toY = y1 + toEndY * tangent;
+    float bisectorX = toStartX + toEndX, bisectorY = toStartY + toEndY;
+    float bisectorLength = sqrtf(bisectorX * bisectorX + bisectorY * bisectorY);
+    float centerDistance = radius / sinf(angle * 0.5f);
+    float centerX = x1 + bisectorX / bisectorLength * centerDistance;
+    float centerY = y1 + bisectorY / bisectorLength * centerDistance;
+
+    lineTo(fromX, fromY);
+
+    // Cubics of at most a quarter turn each, within 3e-4 radius of the circle.
+    float sweep = PATH_PI - angle;
+    float direction = cross > 0.0f ? -1.0f : 1.0f;
+    int pieces = static_cast<int>(ceilf(sweep / (PATH_PI * 0.5f) - 1e-4f));
+    pieces = (std::max)(pieces, 1);
+    float step = sweep / pieces;
+    float handle = 4.0f / 3.0f * tanf(step * 0.25f) * radius;
+    float theta = atan2f(fromY - centerY, fromX - centerX);
+    for (int i = 0; i < pieces; ++i) {
+        float next = theta + direction * step;
+        float endX = i + 1 == pieces ? toX : centerX + radius * cosf(next);
+        float endY = i + 1 == pieces ? toY : centerY + radius * sinf(next);
+        cubicTo(centerX + radius * cosf(theta) - direction * handle * sinf(theta), centerY + radius * sinf(theta) + direction * handle * cosf(theta),
+            centerX + radius * cosf(next) + direction * handle * sinf(next), centerY + radius * sinf(next) - direction * handle * cosf(next),
+            endX, endY);
+        theta = next;
+    }
+    return *this;
+}
+
+VectorPath& VectorPath::close() {
+    if (contourOpen) {
+        append(VERB_CLOSE, nullptr, 0);
+        lastX = startX;
+        lastY = startY;
+        contourOpen = false;
+    }
+    return *this;
+}
+
+void VectorPath::clear() {
+    verbs.clear();
+    points.clear();
+    hashValue = 14695981039346656037ull;
+    startX = startY = lastX = lastY = 0.0f;
+    contourOpen = false;
+}
+
+// Wang's formula: segments needed for a Bezier of the given degree to stay within tolerance.
+static int curveSegments(float secondDifference, float degreeFactor, float tolerance) {
+    float segments = ceilf(sqrtf(degreeFactor * secondDifference / tolerance));
+    return static_cast<int>((std::max)(1.0f, (std::min)(segments, static_cast<float>(MAX_CURVE_SEGMENTS))));
+}
+
+static void pushPoint(std::vector<float>& flatPoints, size_t contourFirst, float x, float y) {
+    size_t size = flatPoints.size();
+    if (size > contourFirst && flatPoints[size - 2] == x && flatPoints[size - 1] == y) {
+        return;
+    }
+    flatPoints.push_back(x);
+    flatPoints.push_back(y);
+}
+
+void VectorPath::flatten(float tolerance, std::vector<float>& flatPoints, std::vector<uint32_t>& contourEnds) const {
+    flatPoints.clear();
+    contourEnds.clear();
+    tolerance = (std::max)(tolerance, 0.01f);
+
+    size_t contourFirst = 0;
+    auto endContour = [&]() {
+        // Contours are closed implicitly, a point repeating the first one adds nothing.
+        size_t size = flatPoints.size();
+        if (size >= contourFirst + 4 && flatPoints[size - 2] == flatPoints[contourFirst] && flatPoints[size - 1] == flatPoints[contourFirst + 1]) {
+            flatPoints.resize(size - 2);
+        }
+        if (flatPoints.size() > contourFirst) {
+            contourEnds.push_back(static_cast<uint32_t>(flatPoints.size() / 2));
+        }
+        contourFirst = flatPoints.size();
+    };
+
+    const float* point = points.data();
+    float x = 0.0f, y = 0.0f;
+    for (uint8_t verb : verbs) {
+        switch (verb) {
+        case VERB_MOVE:
+            endContour();
+            x = point[0];
+            y = point[1];
+            pushPoint(flatPoints, contourFirst, x, y);
+            point += 2;
+            break;
+        case VERB_LINE:
+            x = point[0];
+            y = point[1];
+            pushPoint(flatPoints, contourFirst, x, y);
+            point += 2;
+            break;
+        case VERB_QUAD: {
+            float ddx = x - 2.0f * point[0] + point[2];
+            float ddy = y - 2.0f * point[1] + point[3];
+            int segments = curveSegments(sqrtf(ddx * ddx + ddy * ddy), 0.25f, tolerance);
+            for (int i = 1; i <= segments; ++i) {
+                float t = static_cast<float>(i) / segments;
+                float s = 1.0f - t;
+                pushPoint(flatPoints, contourFirst, s * s * x + 2.0f * s * t * point[0] + t * t * point[2], s * s * y + 2.0f * s * t * point[1] + t * t * point[3]);
+            }
+            x = point[2];
+            y = point[3];
+            point += 4;
+            break;
+        }
+        case VERB_CUBIC: {
+            float ddx0 = x - 2.0f * point[0] + point[2];
+            float ddy0 = y - 2.0f * point[1] + point[3];
+            float ddx1 = point[0] - 2.0f * point[2] + point[4];
+            float ddy1 = point[1] - 2.0f * point[3] + point[5];
+            float secondDifference = sqrtf((std::max)(ddx0 * ddx0 + ddy0 * ddy0, ddx1 * ddx1 + ddy1 * ddy1));
+            int segments = curveSegments(secondDifference, 0.75f, tolerance);
+            for (int i = 1; i <= segments; ++i) {
+                float t = static_cast<float>(i) / segments;
+                float s = 1.0f - t;
+                float a = s * s * s, b = 3.0f * s * s * t, c = 3.0f * s * t * t, d = t * t * t;
+                pushPoint(flatPoints, contourFirst, a * x + b * point[0] + c * point[2] + d * point[4], a * y + b * point[1] + c * point[3] + d * point[5]);
+            }
+            x = point[4];
+            y = point[5];
+            point += 6;
+            break;
+        }
+        case VERB_CLOSE:
+            endContour();
+            break;
+        }
+    }
+    endContour();
+}
+
+// Twice the signed area of p, q, r, negative when they turn clockwise on screen.
+template <typename N>
+static float turn(const N& p, const N& q, const N& r) {
+    return (q.y - p.y) * (r.x - q.x) - (q.x - p.x) * (r.y - q.y);
+}
+
+static bool pointInTriangle(float ax, float ay, float bx, float by, float cx, float cy, float px, float py) {
+    return (cx - px) * (ay - py) >= (ax - px) * (cy - py) &&
+        (ax - px) * (by - py) >= (bx - px) * (ay - py) &&
+        (bx - px) * (cy - py) >= (cx - px) * (by - py);
+}
+
+bool PathTessellator::isConvex(const Contour& contour) const {
+    // Every corner turns the same way and the outline passes each x and y extreme once.
+    const float* p = &flatPoints[contour.first * 2];
+    uint32_t n = contour.count;
+    int turnSign = 0;
+    int xFlips = 0, yFlips = 0;
+    float lastDx = 0.0f, lastDy = 0.0f;
+    for (uint32_t i = 0; i < n + 1; ++i) {
+        uint32_t a = i % n, b = (i + 1) % n, c = (i + 2) % n;
+        float dx = p[b * 2] - p[a * 2], dy = p[b * 2 + 1] - p[a * 2 + 1];
+        float cross = dx * (p[c * 2 + 1] - p[b * 2 + 1]) - dy * (p[c * 2] - p[b * 2]);
+        int sign = cross > 0.0f ? 1 : cross < 0.0f ? -1 : 0;
+        if (sign != 0) {
+            if (turnSign != 0 && sign != turnSign) {
+                return false;
+            }
+            turnSign = sign;
+        }
+        if (i < n) {
+            if (dx != 0.0f) {
+                xFlips += lastDx != 0.0f && (dx > 0.0f) != (lastDx > 0.0f);
+                lastDx = dx;
+            }
+            if (dy != 0.0f) {
+                yFlips += lastDy != 0.0f && (dy > 0.0f) != (lastDy > 0.0f);
+                lastDy = dy;
+            }
+        }
+    }
+    return turnSign != 0 && xFlips <= 2 && yFlips <= 2;
+}
+
+bool PathTessellator::containsPoint(const Contour& contour, float x, float y) const {
+    const float* p = &flatPoints[contour.first * 2];
+    bool inside = false;
+    for (uint32_t i = 0, j = contour.count - 1; i < contour.count; j = i++) {
+        float xi = p[i * 2], yi = p[i * 2 + 1], xj = p[j * 2], yj = p[j * 2 + 1];
+        if ((yi > y) != (yj > y) && x < (xj - xi) * (y - yi) / (yj - yi) + xi) {
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+
+void PathTessellator::fillConvex(const Contour& contour, PathMesh& mesh) {
+    bool clockwise = contour.area > 0.0;
+    for (uint32_t i = 1; i + 1 < contour.count; ++i) {
+        uint32_t a = contour.first, b = contour.first + i, c = contour.first + i + 1;
+        mesh.indices.push_back(a);
+        mesh.indices.push_back(clockwise ? b : c);
+        mesh.indices.push_back(clockwise ? c : b);
+    }
+}
+
+uint32_t PathTessellator::linkContour(const Contour& contour, bool clockwise) {
+    // Node i is point i, so triangles index the positions directly.
+    bool forward = (contour.area > 0.0) == clockwise;
+    uint32_t first = contour.first, last = contour.first + contour.count - 1;
+    for (uint32_t i = first; i <= last; ++i) {
+        Node& node = nodes[i];
+        uint32_t previous = i == first ? last : i - 1;
+        uint32_t next = i == last ? first : i + 1;
+        node.previous = forward ? previous : next;
+        node.next = forward ? next : previous;
+    }
+    return first;
+}
+
+// Unlinks points that repeat their predecessor or lie on a straight line through their
+// neighbours. Returns a node still linked, or NO_NODE when fewer than three are left.
+uint32_t PathTessellator::removeDegenerate(uint32_t start) {
+    uint32_t p = start, end = start;
+    bool again;
+    do {
+        again = false;
+        Node& node = nodes[p];
+        const Node& next = nodes[node.next];
+        if ((node.x == next.x && node.y == next.y) || turn(nodes[node.previous], node, next) == 0.0f) {
+            nodes[node.previous].next = node.next;
+            nodes[node.next].previous = node.previous;
+            p = end = node.previous;
+            if (p == nodes[p].next || nodes[p].next == nodes[p].previous) {
+                return NO_NODE;
+            }
+            again = true;
+        }
+        else {
+            p = node.next;
+        }
+    } while (again || p != end);
+    return end;
+}
+
+void PathTessellator::bridgeHole(uint32_t outer, uint32_t hole) {
+    // A ray from the hole's leftmost point to the left hits the outer contour; the bridge
+    // goes to the nearest point of that edge, or to a reflex point hiding the edge from it.
+    float hx = nodes[hole].x, hy = nodes[hole].y;
+    float qx = -INFINITY;
+    uint32_t m = NO_NODE;
+    uint32_t p = outer;
+    do {
+        const Node& node = nodes[p];
+        const Node& next = nodes[node.next];
+        if (hy <= node.y && hy >= next.y && next.y != node.y) {
+            float x = node.x + (hy - node.y) * (next.x - node.x) / (next.y - node.y);
+            if (x <= hx && x > qx) {
+                qx = x;
+                m = node.x < next.x ? p : node.next;
+                if (x == hx) {
+                    break;
+                }
+            }
+        }
+        p = node.next;
+    } while (p != outer);
+    if (m == NO_NODE) {
+        return;
+    }
+
+    if (qx != hx) {
+        uint32_t stop = m;
+        float mx = nodes[m].x, my = nodes[m].y;
+        float tanMin = INFINITY;
+        p = m;
+        do {
+            const Node& node = nodes[p];
+            if (hx >= node.x && node.x >= mx && hx != node.x &&
+                pointInTriangle(hy < my ? hx : qx, hy, mx, my, hy < my ? qx : hx, hy, node.x, node.y)) {
+                float tangent = fabsf(hy - node.y) / (hx - node.x);
+                // p must see the hole point from inside the polygon.
+                const Node& h = nodes[hole];
+                bool locallyInside = turn(nodes[node.previous], node, nodes[node.next]) < 0.0f
+                    ? turn(node, h, nodes[node.next]) >= 0.0f && turn(node, nodes[node.previous], h) >= 0.0f
+                    : turn(node, h, nodes[node.previous]) < 0.0f || turn(node, nodes[node.next], h) < 0.0f;
+                if (locallyInside && (tangent < tanMin || (tangent == tanMin && node.x > nodes[m].x))) {
+                    m = p;
+                    tanMin = tangent;
+                }
+            }
+            p = node.next;
+        } while (p != stop);
+    }
+
+    // Splits m and the hole point into two copies each and links the hole in between.
+    uint32_t m2 = static_cast<uint32_t>(nodes.size());
+    uint32_t h2 = m2 + 1;
+    nodes.push_back(nodes[m]);
+    nodes.push_back(nodes[hole]);
+    uint32_t mNext = nodes[m].next;
+    uint32_t hPrevious = nodes[hole].previous;
+    nodes[m].next = hole;
+    nodes[hole].previous = m;
+    nodes[m2].next = mNext;
+    nodes[mNext].previous = m2;
+    nodes[h2].next = m2;
+    nodes[m2].previous = h2;
+    nodes[hPrevious].next = h2;
+    nodes[h2].previous = hPrevious;
+}
+
+bool PathTessellator::isEar(uint32_t ear) const {
+    const Node& a = nodes[nodes[ear].previous];
+    const Node& b = nodes[ear];
+    const Node& c = nodes[b.next];
+    if (turn(a, b, c) >= 0.0f) {
+        return false;
+    }
+
+    // No reflex point may lie inside the triangle.
+    float left = (std::min)(a.x, (std::min)(b.x, c.x)), right = (std::max)(a.x, (std::max)(b.x, c.x));
+    float top = (std::min)(a.y, (std::min)(b.y, c.y)), bottom = (std::max)(a.y, (std::max)(b.y, c.y));
+    uint32_t p = c.next;
+    while (p != b.previous) {
+        const Node& node = nodes[p];
+        if (node.x >= left && node.x <= right && node.y >= top && node.y <= bottom && !(node.x == a.x && node.y == a.y) &&
+            pointInTriangle(a.x, a.y, b.x, b.y, c.x, c.y, node.x, node.y) && turn(nodes[node.previous], node, nodes[node.next]) >= 0.0f) {
+            return false;
+        }
+        p = node.next;
+    }
+    return true;
+}
+
+void PathTessellator::clipEars(uint32_t ear, PathMesh& mesh) {
+    uint32_t stop = ear;
+    int pass = 0;
+    while (ear != NO_NODE && nodes[ear].previous != nodes[ear].next) {
+        uint32_t previous = nodes[ear].previous;
+        uint32_t next = nodes[ear].next;
+        if (isEar(ear)) {
+            mesh.indices.push_back(previous);
+            mesh.indices.push_back(ear);
+            mesh.indices.push_back(next);
+            nodes[previous].next = next;
+            nodes[next].previous = previous;
+            ear = stop = nodes[next].next;
+            continue;
+        }
+        ear = next;
+        if (ear == stop) {
+            // A whole lap without an ear: drop degenerate points once and retry. Crossing
+            // outlines can still end up here, what is left of them is not filled.
+            if (pass++ > 0) {
+                break;
+            }
+            ear = stop = removeDegenerate(ear);
+        }
+    }
+}
+
+void PathTessellator::tessellate(const VectorPath& path, float tolerance, PathMesh& mesh) {
+    mesh.positions.clear();
+    mesh.indices.clear();
+    path.flatten(tolerance, flatPoints, contourEnds);
+
+    contours.clear();
+    uint32_t first = 0;
+    for (uint32_t end : contourEnds) {
+        if (end - first >= 3) {
+            double area = 0.0;
+            for (uint32_t i = first, j = end - 1; i < end; j = i++) {
+                area += static_cast<double>(flatPoints[j * 2]) * flatPoints[i * 2 + 1] - static_cast<double>(flatPoints[i * 2]) * flatPoints[j * 2 + 1];
+            }
+            if (fabs(area) > 1e-9) {
+                contours.push_back({ first, end - first, area * 0.5, 0, NO_NODE });
+            }
+        }
+        first = end;
+    }
+    if (contours.empty()) {
+        return;
+    }
+
+    mesh.positions = flatPoints;
+    if (contours.size() == 1 && isConvex(contours[0])) {
+        fillConvex(contours[0], mesh);
+        return;
+    }
+
+    // Nesting decides what is a hole: a contour inside an odd number of others.
+    for (size_t i = 0; i < contours.size(); ++i) {
+        Contour& contour = contours[i];
+        float x = flatPoints[contour.first * 2], y = flatPoints[contour.first * 2 + 1];
+        double parentArea = INFINITY;
+        for (size_t j = 0; j < contours.size(); ++j) {
+            if (j != i && containsPoint(contours[j], x, y)) {
+                contour.depth++;
+                if (fabs(contours[j].area) < parentArea) {
+                    parentArea = fabs(contours[j].area);
+                    contour.parent = static_cast<uint32_t>(j);
+                }
+            }
+        }
+    }
+
+    nodes.resize(flatPoints.size() / 2);
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        nodes[i].x = flatPoints[i * 2];
+        nodes[i].y = flatPoints[i * 2 + 1];
+    }
+
+    for (size_t i = 0; i < contours.size(); ++i) {
+        if (contours[i].depth % 2 != 0) {
+            continue;
+        }
+        uint32_t outer = removeDegenerate(linkContour(contours[i], true));
+        if (outer == NO_NODE) {
+            continue;
+        }
+
+        // Holes are bridged from left to right, each from its leftmost point.
+        holes.clear();
+        for (size_t j = 0; j < contours.size(); ++j) {
+            if (contours[j].parent != i || contours[j].depth % 2 == 0) {
+                continue;
+            }
+            uint32_t hole = removeDegenerate(linkContour(contours[j], false));
+            if (hole == NO_NODE) {
+                continue;
+            }
+            uint32_t leftmost = hole, p = hole;
+            do {
+                if (nodes[p].x < nodes[leftmost].x || (nodes[p].x == nodes[leftmost].x && nodes[p].y < nodes[leftmost].y)) {
+                    leftmost = p;
+                }
+                p = nodes[p].next;
+            } while (p != hole);
+            holes.push_back(leftmost);
+        }
+        std::sort(holes.begin(), holes.end(), [this](uint32_t a, uint32_t b) { return nodes[a].x < nodes[b].x; });
+        for (uint32_t hole : holes) {
+            bridgeHole(outer, hole);
+        }
+        clipEars(outer, mesh);
+    }
+
+    // Bridges duplicated points, the copies need positions of their own.
+    for (size_t i = flatPoints.size() / 2; i < nodes.size(); ++i) {
+        mesh.positions.push_back(nodes[i].x);
+        mesh.positions.push_back(nodes[i].y);
+    }
+}
+
+uint64_t PathCache::key(const VectorPath& path, float tolerance) {
+    uint32_t bits;
+    memcpy(&bits, &tolerance, sizeof(bits));
+    return (path.hash() ^ bits) * 1099511628211ull;
+}
+
+const PathMesh& PathCache::get(const VectorPath& path, float tolerance) {
+    uint64_t pathKey = key(path, tolerance);
+    useCounter++;
+    auto entryIt = entries.find(pathKey);
+    if (entryIt != entries.end()) {
+        entryIt->second.lastUse = useCounter;
+        stats.hits++;
+        return entryIt->second.mesh;
+    }
+
+    Entry& entry = entries[pathKey];
+    tessellator.tessellate(path, tolerance, entry.mesh);
+    entry.lastUse = useCounter;
+    stats.misses++;
+    stats.bytes += entry.mesh.bytes();
+    stats.entries = static_cast<uint32_t>(entries.size());
+    if (stats.bytes > budget) {
+        evict(pathKey);
+    }
+    return entry.mesh;
+}
+
+void PathCache::clear() {
+    entries.clear();
+    stats.entries = 0;
+    stats.bytes = 0;
+}
+
+void PathCache::evict(uint64_t keep) {
+    // Only runs once the budget is exceeded, a linear scan for the oldest entry will do.
+    while (stats.bytes > budget && entries.size() > 1) {
+        auto oldest = entries.end();
+        for (auto entryIt = entries.begin(); entryIt != entries.end(); ++entryIt) {
+            if (entryIt->first != keep && (oldest == entries.end() || entryIt->second.lastUse < oldest->second.lastUse)) {
+                oldest = entryIt;
+            }
+        }
+        stats.bytes -= oldest->second.mesh.bytes();
+        stats.evicted++;
+        entries.erase(oldest);
+    }
+    stats.entries = static_cast<uint32_t>(entries.size());
+}
+
+RenderBackend::DrawCommand RenderBackend::DrawCommand::CreatePath(const VectorPath& path, float x, float y, Color color) {
+    DrawCommand command;
+    command.type = SHAPE_PATH;
+    command.shape.path = Path(&path, path.hash(), x, y, color);
+    return command;
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Outline made of straight and curved segments, filled with DrawCommand::CreatePath. Built
+// like a canvas path: every moveTo() starts a contour, close() or the next moveTo() ends
+// it, contours are always filled as if closed. Contours must not cross themselves or each
+// other; one lying inside another is a hole, one inside a hole is filled again. arcTo()
+// is stored as cubics, so the hash only depends on what ends up being tessellated. The hash
+// is kept up to date while building, which makes looking a path up in a PathCache cheap.
+class VectorPath {
+public:
+    enum Verb : uint8_t {
+        VERB_MOVE,      // 1 point
+        VERB_LINE,      // 1 point
+        VERB_QUAD,      // control, end
+        VERB_CUBIC,     // two controls, end
+        VERB_CLOSE      // no points
+    };
+
+    VectorPath();
+
+    VectorPath& moveTo(float x, float y);
+    VectorPath& lineTo(float x, float y);
+    VectorPath& quadTo(float controlX, float controlY, float x, float y);
+    VectorPath& cubicTo(float control1X, float control1Y, float control2X, float control2Y, float x, float y);
+    // Canvas arcTo: a line towards x1, y1, then the arc of the given radius tangent to that
+    // line and the one from x1, y1 to x2, y2. Without a tangent circle it is lineTo(x1, y1).
+    VectorPath& arcTo(float x1, float y1, float x2, float y2, float radius);
+    VectorPath& close();
+    void clear();
+
+    bool empty() const { return verbs.empty(); }
+    uint64_t hash() const { return hashValue; }
+    const std::vector<uint8_t>& getVerbs() const { return verbs; }
+    const std::vector<float>& getPoints() const { return points; }
+
+    // Replaces the curves with line segments no further than tolerance pixels from them.
+    // points gets x, y pairs, contourEnds the end of every contour in points (in pairs).
+    void flatten(float tolerance, std::vector<float>& flatPoints, std::vector<uint32_t>& contourEnds) const;
+
+private:
+    std::vector<uint8_t> verbs;
+    std::vector<float> points;
+    uint64_t hashValue;
+    float startX, startY;       // of the current contour
+    float lastX, lastY;
+    bool contourOpen;
+
+    void append(Verb verb, const float* verbPoints, size_t pointCount);
+    // Lines lead from the end of the previous contour when no moveTo() started one.
+    void ensureContour();
+};
+
+// Triangles filling a path, in the path's coordinates. Every triangle is wound like the
+// batch's other shapes, clockwise on screen.
+struct PathMesh {
+    std::vector<float> positions;       // x, y pairs
+    std::vector<uint32_t> indices;
+
+    size_t bytes() const { return positions.size() * sizeof(float) + indices.size() * sizeof(uint32_t); }
+};
+
+// Flattens a path and fills it: a single convex contour becomes a fan, anything else is
+// ear clipped after the holes were bridged into the contour around them. Keeps its scratch
+// buffers between calls.
+class PathTessellator {
+public:
+    static const float DEFAULT_TOLERANCE;
+
+    void tessellate(const VectorPath& path, float tolerance, PathMesh& mesh);
+
+private:
+    struct Node {
+        float x, y;
+        uint32_t previous, next;
+    };
+
+    struct Contour {
+        uint32_t first, count;      // in flatPoints, in pairs
+        double area;                // positive when clockwise on screen
+        int depth;                  // contours around it, odd for holes
+        uint32_t parent;            // innermost contour around it
+    };
+
+    std::vector<float> flatPoints;
+    std::vector<uint32_t> contourEnds;
+    std::vector<Contour> contours;
+    std::vector<Node> nodes;
+    std::vector<uint32_t> holes;
+
+    void fillConvex(const Contour& contour, PathMesh& mesh);
+    // Links the contour's points into nodes, in the winding clockwise selects.
+    uint32_t linkContour(const Contour& contour, bool clockwise);
+    void bridgeHole(uint32_t outer, uint32_t hole);
+    void clipEars(uint32_t start, PathMesh& mesh);
+    bool isEar(uint32_t ear) const;
+    uint32_t removeDegenerate(uint32_t start);
+    bool isConvex(const Contour& contour) const;
+    bool containsPoint(const Contour& contour, float x, float y) const;
+};
+
+// Tessellated paths by hash and tolerance, so an icon drawn every frame, or by several
+// widgets, is tessellated once. Meshes unused for longest are dropped when the cache holds
+// more than its budget. Not thread-safe, every GeometryBatch has its own.
+class PathCache {
+public:
+    struct Stats {
+        uint32_t entries = 0;
+        uint64_t bytes = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;        // paths tessellated
+        uint64_t evicted = 0;
+    };
+
+    static const uint64_t DEFAULT_BUDGET = 4ull * 1024 * 1024;
+
+    explicit PathCache(uint64_t budgetBytes = DEFAULT_BUDGET) : budget(budgetBytes) {}
+
+    // Valid until the next call.
+    const PathMesh& get(const VectorPath& path, float tolerance = PathTessellator::DEFAULT_TOLERANCE);
+    void clear();
+    const Stats& getStats() const { return stats; }
+
+private:
+    struct Entry {
+        PathMesh mesh;
+        uint64_t lastUse;
+    };
+
+    uint64_t budget;
+    uint64_t useCounter = 0;
+    std::unordered_map<uint64_t, Entry> entries;
+    PathTessellator tessellator;
+    Stats stats;
+
+    static uint64_t key(const VectorPath& path, float tolerance);
+    void evict(uint64_t keep);
+};
@@ -1,11 +1,16 @@
 #include "renderer.hpp"
 #include "ezui.hpp"
 
-DX11Renderer::DX11Renderer(HWND hwnd) : hwnd(hwnd) {}
+DX11Renderer::DX11Renderer(HWND hwnd) : hwnd(hwnd), batch(atlas), createdTime(std::chrono::steady_clock::now()), lateBatch(atlas) {
+    batch.setRetained(partialUploads);
+}
 
 DX11Renderer::~DX11Renderer() {
     if (renderTargetView) renderTargetView->Release();
+    if (scissorState) scissorState->Release();
+    if (swapChain1) swapChain1->Release();
     if (swapChain) swapChain->Release();
+    if (d3dContext1) d3dContext1->Release();
     if (d3dContext) d3dContext->Release();
     if (d3dDevice) d3dDevice->Release();
     if (vertexBuffer) vertexBuffer->Release();
@@ -13,6 +18,26 @@ DX11Renderer::~DX11Renderer() {
     if (vertexShader) vertexShader->Release();
     if (pixelShader) pixelShader->Release();
     if (inputLayout) inputLayout->Release();
+    if (constantBuffer) constantBuffer->Release();
+    if (translationBuffer) translationBuffer->Release();
+    if (atlasView) atlasView->Release();
+    if (atlasTexture) atlasTexture->Release();
+    if (shadowView) shadowView->Release();
+    if (shadowBuffer) shadowBuffer->Release();
+    if (lateVertexBuffer) lateVertexBuffer->Release();
+    if (lateIndexBuffer) lateIndexBuffer->Release();
+    if (samplerState) samplerState->Release();
+    if (depthView) depthView->Release();
+    if (depthTexture) depthTexture->Release();
+    if (opaqueDepthState) opaqueDepthState->Release();
+    if (translucentDepthState) translucentDepthState->Release();
+    if (noDepthState) noDepthState->Release();
+    if (screenBlendState) screenBlendState->Release();
+    if (layerBlendState) layerBlendState->Release();
+    if (compositeBlendState) compositeBlendState->Release();
+    for (LayerTarget& layer : layers) {
+        releaseLayer(layer);
+    }
 }
 
 void DX11Renderer::initD3D11() {
@@ -21,8 +46,9 @@ void DX11Renderer::initD3D11() {
         return;
     }
 
+    // Flip model keeps the back buffers' contents, which is what damage rendering builds on.
     DXGI_SWAP_CHAIN_DESC swapChainDesc = {};
-    swapChainDesc.BufferCount = 1;
+    swapChainDesc.BufferCount = flipModelRequested ? SWAP_CHAIN_BUFFERS : 1;
     swapChainDesc.BufferDesc.Width = 0;
     swapChainDesc.BufferDesc.Height = 0;
     swapChainDesc.BufferDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
@@ -33,7 +59,7 @@ void DX11Renderer::initD3D11() {
     swapChainDesc.Windowed = TRUE;
     swapChainDesc.SampleDesc.Count = 1;
     swapChainDesc.SampleDesc.Quality = 0;
-    swapChainDesc.SwapEffect = DXGI_SWAP_EFFECT_DISCARD;
+    swapChainDesc.SwapEffect = flipModelRequested ? DXGI_SWAP_EFFECT_FLIP_SEQUENTIAL : DXGI_SWAP_EFFECT_DISCARD;
 
     D3D_FEATURE_LEVEL featureLevels[] = {
         D3D_FEATURE_LEVEL_11_0,
@@ -57,6 +83,15 @@ void DX11Renderer::initD3D11() {
         &d3dContext
     );
 
+    bool flipModel = flipModelRequested && SUCCEEDED(hr);
+    if (flipModelRequested && !flipModel) {
+        // No flip model before Windows 8, and not for every window style; blt model always works.
+        swapChainDesc.BufferCount = 1;
+        swapChainDesc.SwapEffect = DXGI_SWAP_EFFECT_DISCARD;
+        hr = D3D11CreateDeviceAndSwapChain(nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr, D3D11_CREATE_DEVICE_BGRA_SUPPORT, featureLevels, ARRAYSIZE(featureLevels),
+            D3D11_SDK_VERSION, &swapChainDesc, &swapChain, &d3dDevice, &featureLevel, &d3dContext);
+    }
+
     if (FAILED(hr)) {
         ezUI::dbg("Failed to create D3D11 device and swap chain! HRESULT: " + std::to_string(hr));
         return;
@@ -64,19 +99,84 @@ void DX11Renderer::initD3D11() {
 
     createRenderTarget();
     createBlendState();
-    createVertexBuffer(1024);
+    createVertexBuffer(1024, 1536);
     createShaders();
+    createSampler();
+    updateViewport();
+    if (flipModel) {
+        createDamageState();
+    }
+}
+
+void DX11Renderer::createDamageState() {
+    if (FAILED(swapChain->QueryInterface(&swapChain1)) || FAILED(d3dContext->QueryInterface(&d3dContext1))) {
+        ezUI::dbg("No Present1 or ClearView, drawing whole frames.");
+        return;
+    }
+
+    // The D3D11 defaults, plus the scissor test.
+    D3D11_RASTERIZER_DESC rasterizerDesc = {};
+    rasterizerDesc.FillMode = D3D11_FILL_SOLID;
+    rasterizerDesc.CullMode = D3D11_CULL_BACK;
+    rasterizerDesc.DepthClipEnable = TRUE;
+    rasterizerDesc.ScissorEnable = TRUE;
+    HRESULT hr = d3dDevice->CreateRasterizerState(&rasterizerDesc, &scissorState);
+    if (FAILED(hr)) {
+        ezUI::dbg("Failed to create scissor rasterizer state! HRESULT: " + std::to_string(hr));
+    }
+}
+
+void DX11Renderer::updateViewport() {
+    // Inside a layer the layer is the viewport, shifted so its origin lands on its corner.
+    float width, height;
+    float originX = 0.0f;
+    float originY = 0.0f;
+    if (activeLayer >= 0) {
+        width = static_cast<float>(layers[activeLayer].width);
+        height = static_cast<float>(layers[activeLayer].height);
+        originX = layerOriginX;
+        originY = layerOriginY;
+    }
+    else {
+        RECT rect;
+        GetClientRect(hwnd, &rect);
+        width = static_cast<float>(rect.right - rect.left);
+        height = static_cast<float>(rect.bottom - rect.top);
+    }
+    if (width == viewportWidth && height == viewportHeight && originX == viewportOriginX && originY == viewportOriginY) {
+        return;
+    }
+    viewportWidth = width;
+    viewportHeight = height;
+    viewportOriginX = originX;
+    viewportOriginY = originY;
 
     D3D11_VIEWPORT viewport = {};
-    RECT rect;
-    GetClientRect(hwnd, &rect);
     viewport.TopLeftX = 0;
     viewport.TopLeftY = 0;
-    viewport.Width = static_cast<float>(rect.right - rect.left);
-    viewport.Height = static_cast<float>(rect.bottom - rect.top);
+    viewport.Width = width;
+    viewport.Height = height;
     viewport.MinDepth = 0.0f;
     viewport.MaxDepth = 1.0f;
     d3dContext->RSSetViewports(1, &viewport);
+
+    writeViewportConstants(originX, originY);
+}
+
+void DX11Renderer::writeViewportConstants(float originX, float originY) {
+    if (!constantBuffer) {
+        return;
+    }
+
+    D3D11_MAPPED_SUBRESOURCE mappedResource;
+    HRESULT hr = d3dContext->Map(constantBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
+    if (FAILED(hr)) {
+        ezUI::dbg("Failed to map constant buffer! HRESULT: " + std::to_string(hr));
+        return;
+    }
+    float viewportSize[4] = { viewportWidth, viewportHeight, originX, originY };
+    memcpy(mappedResource.pData, viewportSize, sizeof(viewportSize));
+    d3dContext->Unmap(constantBuffer, 0);
 }
 
 void DX11Renderer::createRenderTarget() {
@@ -88,6 +188,11 @@ void DX11Renderer::createRenderTarget() {
         return;
     }
 
+    D3D11_TEXTURE2D_DESC backBufferDesc;
+    backBuffer->GetDesc(&backBufferDesc);
+    backBufferWidth = backBufferDesc.Width;
+    backBufferHeight = backBufferDesc.Height;
+
     hr = d3dDevice->CreateRenderTargetView(backBuffer, nullptr, &renderTargetView);
     backBuffer->Release();
 
@@ -96,7 +201,57 @@ void DX11Renderer::createRenderTarget() {
         return;
     }
 
-    d3dContext->OMSetRenderTargets(1, &renderTargetView, nullptr);
+    createDepthBuffer(backBufferDesc.Width, backBufferDesc.Height);
+    d3dContext->OMSetRenderTargets(1, &renderTargetView, depthView);
+}
+
+void DX11Renderer::createDepthBuffer(UINT width, UINT height) {
+    D3D11_TEXTURE2D_DESC depthDesc = {};
+    depthDesc.Width = width;
+    depthDesc.Height = height;
+    depthDesc.MipLevels = 1;
+    depthDesc.ArraySize = 1;
+    depthDesc.Format = DXGI_FORMAT_D32_FLOAT;
+    depthDesc.SampleDesc.Count = 1;
+    depthDesc.Usage = D3D11_USAGE_DEFAULT;
+    depthDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL;
+
+    HRESULT hr = d3dDevice->CreateTexture2D(&depthDesc, nullptr, &depthTexture);
+    if (FAILED(hr)) {
+        ezUI::dbg("Failed to create depth buffer! HRESULT: " + std::to_string(hr));
+        return;
+    }
+
+    hr = d3dDevice->CreateDepthStencilView(depthTexture, nullptr, &depthView);
+    if (FAILED(hr)) {
+        ezUI::dbg("Failed to create depth stencil view! HRESULT: " + std::to_string(hr));
+        return;
+    }
+
+    // Opaque shapes test and write depth, translucent ones only test so they still blend in
+    // painter order, and without the pre-pass depth is ignored entirely.
+    D3D11_DEPTH_STENCIL_DESC depthStateDesc = {};
+    depthStateDesc.DepthEnable = TRUE;
+    depthStateDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
+    depthStateDesc.DepthFunc = D3D11_COMPARISON_LESS;
+    hr = d3dDevice->CreateDepthStencilState(&depthStateDesc, &opaqueDepthState);
+    if (FAILED(hr)) {
+        ezUI::dbg("Failed to create depth stencil state! HRESULT: " + std::to_string(hr));
+        return;
+    }
+
+    depthStateDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO;
+    hr = d3dDevice->CreateDepthStencilState(&depthStateDesc, &translucentDepthState);
+    if (FAILED(hr)) {
+        ezUI::dbg("Failed to create depth stencil state! HRESULT: " + std::to_string(hr));
+        return;
+    }
+
+    depthStateDesc.DepthEnable = FALSE;
+    hr = d3dDevice->CreateDepthStencilState(&depthStateDesc, &noDepthState);
+    if (FAILED(hr)) {
+        ezUI::dbg("Failed to create depth stencil state! HRESULT: " + std::to_string(hr));
+    }
 }
 
 void DX11Renderer::createBlendState() {
@@ -110,180 +265,301 @@ void DX11Renderer::createBlendState() {
     blendDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
     blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
 
-    ID3D11BlendState* blendState = nullptr;
-    HRESULT hr = d3dDevice->CreateBlendState(&blendDesc, &blendState);
-
+    HRESULT hr = d3dDevice->CreateBlendState(&blendDesc, &screenBlendState);
     if (FAILED(hr)) {
         ezUI::dbg("Failed to create blend state! HRESULT: " + std::to_string(hr));
         return;
     }
 
+    // Into a layer alpha accumulates coverage, which leaves premultiplied color behind.
+    // Compositing it with ONE, INV_SRC_ALPHA then matches drawing the shapes directly.
+    blendDesc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_INV_SRC_ALPHA;
+    hr = d3dDevice->CreateBlendState(&blendDesc, &layerBlendState);
+    if (FAILED(hr)) {
+        ezUI::dbg("Failed to create layer blend state! HRESULT: " + std::to_string(hr));
+        return;
+    }
+
+    blendDesc.RenderTarget[0].SrcBlend = D3D11_BLEND_ONE;
+    hr = d3dDevice->CreateBlendState(&blendDesc, &compositeBlendState);
+    if (FAILED(hr)) {
+        ezUI::dbg("Failed to create composite blend state! HRESULT: " + std::to_string(hr));
+        return;
+    }
+
     float blendFactor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-    d3dContext->OMSetBlendState(blendState, blendFactor, 0xffffffff);
-    blendState->Release();
+    d3dContext->OMSetBlendState(screenBlendState, blendFactor, 0xffffffff);
 }
 
 void DX11Renderer::createVertexBuffer(size_t vertexCount, size_t indexCount) {
-    if (vertexBuffer) {
-        vertexBuffer->Release();
-        vertexBuffer = nullptr;
-    }
-    if (indexCount > 0 && indexBuffer) {
-        indexBuffer->Release();
-        indexBuffer = nullptr;
-    }
+    // Buffers only ever grow, to the next power of two, so steady state frames reuse them.
+    HRESULT hr;
+    if (vertexCount > vertexCapacity) {
+        if (vertexBuffer) {
+            vertexBuffer->Release();
+            vertexBuffer = nullptr;
+        }
+        vertexCapacity = 1024;
+        while (vertexCapacity < vertexCount) vertexCapacity *= 2;
 
-    D3D11_BUFFER_DESC vertexBufferDesc = {};
-    vertexBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
-    vertexBufferDesc.ByteWidth = static_cast<UINT>(sizeof(Vertex) * vertexCount);
-    vertexBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-    vertexBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+        D3D11_BUFFER_DESC vertexBufferDesc = {};
+        // Default usage: frames only patch the ranges that changed, through UpdateSubresource.
+        vertexBufferDesc.Usage = D3D11_USAGE_DEFAULT;
+        vertexBufferDesc.ByteWidth = static_cast<UINT>(sizeof(Vertex) * vertexCapacity);
+        vertexBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+        vertexMirror.invalidate();
 
-    HRESULT hr = d3dDevice->CreateBuffer(&vertexBufferDesc, nullptr, &vertexBuffer);
-    if (FAILED(hr)) {
-        ezUI::dbg("Failed to create vertex buffer! HRESULT: " + std::to_string(hr));
-        return;
+        hr = d3dDevice->CreateBuffer(&vertexBufferDesc, nullptr, &vertexBuffer);
+        if (FAILED(hr)) {
+            ezUI::dbg("Failed to create vertex buffer! HRESULT: " + std::to_string(hr));
+            vertexCapacity = 0;
+            return;
+        }
     }
 
-    if (indexCount > 0) {
+    if (indexCount > indexCapacity) {
+        if (indexBuffer) {
+            indexBuffer->Release();
+            indexBuffer = nullptr;
+        }
+        indexCapacity = 1536;
+        while (indexCapacity < indexCount) indexCapacity *= 2;
+
         D3D11_BUFFER_DESC indexBufferDesc = {};
-        indexBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
-        indexBufferDesc.ByteWidth = static_cast<UINT>(sizeof(UINT) * indexCount);
+        indexBufferDesc.Usage = D3D11_USAGE_DEFAULT;
+        indexBufferDesc.ByteWidth = static_cast<UINT>(sizeof(UINT) * indexCapacity);
         indexBufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
-        indexBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+        indexMirror.invalidate();
 
         hr = d3dDevice->CreateBuffer(&indexBufferDesc, nullptr, &indexBuffer);
         if (FAILED(hr)) {
             ezUI::dbg("Failed to create index buffer! HRESULT: " + std::to_string(hr));
+            indexCapacity = 0;
             return;
         }
     }
 }
 
 void DX11Renderer::clearScreen(float r, float g, float b, float a) {
+    flush();
     float color[4] = { r, g, b, a };
-    d3dContext->ClearRenderTargetView(renderTargetView, color);
+    if (damageActive) {
+        if (!redrawRects.empty()) {
+            d3dContext1->ClearView(renderTargetView, color, redrawRects.data(), static_cast<UINT>(redrawRects.size()));
+        }
+    }
+    else {
+        d3dContext->ClearRenderTargetView(renderTargetView, color);
+    }
+    if (depthView) {
+        d3dContext->ClearDepthStencilView(depthView, D3D11_CLEAR_DEPTH, 1.0f, 0);
+    }
 }
 
 void DX11Renderer::present() {
-    swapChain->Present(1, 0);
+    flush();
+    drawLateGroups();
+
+    // Without dirty rectangles Present1 would mean the whole buffer changed, same as Present.
+    HRESULT presented;
+    if (damageActive && !dirtyRects.empty()) {
+        DXGI_PRESENT_PARAMETERS parameters = {};
+        parameters.DirtyRectsCount = static_cast<UINT>(dirtyRects.size());
+        parameters.pDirtyRects = dirtyRects.data();
+        presented = swapChain1->Present1(1, 0, &parameters);
+    }
+    else {
+        presented = swapChain->Present(1, 0);
+    }
+    // Occluded or failed presents do not rotate the buffers as expected, start over.
+    presentedBuffers = presented == S_OK ? presentedBuffers + 1 : 0;
+    damageActive = false;
+    redrawRects.clear();
+    dirtyRects.clear();
+    if (swapChain1) {
+        // Flip model unbinds the back buffer on present.
+        d3dContext->OMSetRenderTargets(1, &renderTargetView, depthView);
+    }
+
+    UINT dxgiPresent = 0;
+    swapChain->GetLastPresentCount(&dxgiPresent);
+    presentIds[presentCount % PRESENT_HISTORY] = dxgiPresent;
+    presentCount++;
+
+    if (presentCount == 1) {
+        timeToFirstFrameMs.store(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - createdTime).count(), std::memory_order_relaxed);
+    }
+
+    lastFrameStats = frameStats;
+    frameStats = FrameStats();
 }
 
-void DX11Renderer::drawRectangle(float x, float y, float width, float height, const Color& color) {
-    if (!d3dDevice || !d3dContext) {
-        ezUI::dbg("Device or Context not initialized!");
-        return;
+bool DX11Renderer::getBackBuffer(int& width, int& height, uint32_t& age) {
+    if (!swapChain1 || !d3dContext1 || !scissorState) {
+        return false;
     }
 
+    // The viewport follows the client area, the buffers keep their size; when the two
+    // differ the buffer is stretched and its pixels are not the viewport's.
     RECT rect;
     GetClientRect(hwnd, &rect);
-    float left = (2.0f * x / (rect.right - rect.left)) - 1.0f;
-    float right = (2.0f * (x + width) / (rect.right - rect.left)) - 1.0f;
-    float top = 1.0f - (2.0f * y / (rect.bottom - rect.top));
-    float bottom = 1.0f - (2.0f * (y + height) / (rect.bottom - rect.top));
-
-    Vertex vertices[] = {
-        { XMFLOAT3(left, top, 0.0f), XMFLOAT4(color.r, color.g, color.b, color.a) },
-        { XMFLOAT3(right, top, 0.0f), XMFLOAT4(color.r, color.g, color.b, color.a) },
-        { XMFLOAT3(left, bottom, 0.0f), XMFLOAT4(color.r, color.g, color.b, color.a) },
-        { XMFLOAT3(right, bottom, 0.0f), XMFLOAT4(color.r, color.g, color.b, color.a) }
-    };
-
-    createVertexBuffer(4);
+    width = rect.right - rect.left;
+    height = rect.bottom - rect.top;
+    bool sameSize = static_cast<UINT>(width) == backBufferWidth && static_cast<UINT>(height) == backBufferHeight;
+    age = sameSize && presentedBuffers >= SWAP_CHAIN_BUFFERS ? static_cast<uint32_t>(SWAP_CHAIN_BUFFERS) : 0;
+    return true;
+}
 
-    D3D11_MAPPED_SUBRESOURCE mappedResource;
-    HRESULT hr = d3dContext->Map(vertexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-    if (FAILED(hr)) {
-        ezUI::dbg("Failed to map vertex buffer! HRESULT: " + std::to_string(hr));
+void DX11Renderer::setDamage(const DamageRect* redraw, size_t redrawCount, const DamageRect* dirty, size_t dirtyCount) {
+    if (!swapChain1 || !d3dContext1 || !scissorState) {
         return;
     }
+    flush();
+    damageActive = true;
+    redrawRects.clear();
+    for (size_t i = 0; i < redrawCount; ++i) {
+        redrawRects.push_back({ redraw[i].left, redraw[i].top, redraw[i].right, redraw[i].bottom });
+    }
+    dirtyRects.clear();
+    for (size_t i = 0; i < dirtyCount; ++i) {
+        dirtyRects.push_back({ dirty[i].left, dirty[i].top, dirty[i].right, dirty[i].bottom });
+    }
+    frameStats.damageRects = static_cast<UINT>(redrawRects.size());
+}
 
-    memcpy(mappedResource.pData, vertices, sizeof(vertices));
-    d3dContext->Unmap(vertexBuffer, 0);
+static uint64_t qpcToNanoseconds(int64_t ticks) {
+    static const int64_t frequency = [] {
+        LARGE_INTEGER value;
+        QueryPerformanceFrequency(&value);
+        return value.QuadPart;
+    }();
+    return static_cast<uint64_t>(ticks / frequency) * 1000000000ull + static_cast<uint64_t>(ticks % frequency) * 1000000000ull / frequency;
+}
 
-    UINT stride = sizeof(Vertex);
-    UINT offset = 0;
-    d3dContext->IASetVertexBuffers(0, 1, &vertexBuffer, &stride, &offset);
-    d3dContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
-    d3dContext->Draw(4, 0);
+bool DX11Renderer::getPresentDisplayTime(uint64_t present, uint64_t& displayedNs) {
+    if (!swapChain || present >= presentCount || presentCount - present > PRESENT_HISTORY) {
+        return false;
+    }
+
+    // Fails for blt model swap chains and while the statistics are disjoint, e.g. right
+    // after a mode change. The caller then falls back to its own present time.
+    DXGI_FRAME_STATISTICS statistics = {};
+    if (SUCCEEDED(swapChain->GetFrameStatistics(&statistics)) && statistics.PresentCount != 0) {
+        DisplayedPresent& latest = displayedPresents[(displayedCount + PRESENT_HISTORY - 1) % PRESENT_HISTORY];
+        if (displayedCount == 0 || latest.dxgiPresent != statistics.PresentCount) {
+            displayedPresents[displayedCount % PRESENT_HISTORY] = { statistics.PresentCount, statistics.SyncQPCTime.QuadPart };
+            displayedCount++;
+        }
+    }
+
+    // Statistics only describe the latest present that reached the screen. Polled once per
+    // frame that is usually the one asked for, otherwise the first one seen after it is the
+    // closest upper bound.
+    UINT dxgiPresent = presentIds[present % PRESENT_HISTORY];
+    const DisplayedPresent* closest = nullptr;
+    size_t known = displayedCount < PRESENT_HISTORY ? displayedCount : PRESENT_HISTORY;
+    for (size_t i = 0; i < known; ++i) {
+        const DisplayedPresent& candidate = displayedPresents[i];
+        if (candidate.dxgiPresent >= dxgiPresent && (!closest || candidate.dxgiPresent < closest->dxgiPresent)) {
+            closest = &candidate;
+        }
+    }
+    if (!closest) {
+        return false;
+    }
+    displayedNs = qpcToNanoseconds(closest->syncQpcTime);
+    return true;
+}
+
+void DX11Renderer::drawRectangle(float x, float y, float width, float height, const Color& color) {
+    batch.addRectangle(x, y, width, height, color);
 }
 
 void DX11Renderer::drawTriangle(float x1, float y1, float x2, float y2, float x3, float y3, const Color& color) {
-    if (!d3dDevice || !d3dContext) {
-        ezUI::dbg("Device or Context not initialized!");
-        return;
-    }
+    batch.addTriangle(x1, y1, x2, y2, x3, y3, color);
+}
 
-    RECT rect;
-    GetClientRect(hwnd, &rect);
-    float nx1 = (2.0f * x1 / (rect.right - rect.left)) - 1.0f;
-    float ny1 = 1.0f - (2.0f * y1 / (rect.bottom - rect.top));
-    float nx2 = (2.0f * x2 / (rect.right - rect.left)) - 1.0f;
-    float ny2 = 1.0f - (2.0f * y2 / (rect.bottom - rect.top));
-    float nx3 = (2.0f * x3 / (rect.right - rect.left)) - 1.0f;
-    float ny3 = 1.0f - (2.0f * y3 / (rect.bottom - rect.top));
-
-    Vertex vertices[] = {
-        { XMFLOAT3(nx1, ny1, 0.0f), XMFLOAT4(color.r, color.g, color.b, color.a) },
-        { XMFLOAT3(nx2, ny2, 0.0f), XMFLOAT4(color.r, color.g, color.b, color.a) },
-        { XMFLOAT3(nx3, ny3, 0.0f), XMFLOAT4(color.r, color.g, color.b, color.a) }
-    };
+void DX11Renderer::drawCircle(float centerX, float centerY, float radius, const Color& color, int segments) {
+    batch.addCircle(centerX, centerY, radius, color, segments);
+}
 
-    createVertexBuffer(3);
+void DX11Renderer::drawRoundedRectangle(float x, float y, float width, float height, float radius, const Color& color, int segments) {
+    batch.addRoundedRectangle(x, y, width, height, radius, color, segments);
+}
 
-    D3D11_MAPPED_SUBRESOURCE mappedResource;
-    HRESULT hr = d3dContext->Map(vertexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-    if (FAILED(hr)) {
-        ezUI::dbg("Failed to map vertex buffer! HRESULT: " + std::to_string(hr));
-        return;
-    }
+void DX11Renderer::drawImage(float x, float y, float width, float height, int imageId, const Color& tint) {
+    batch.addImage(x, y, width, height, imageId, tint);
+}
 
-    memcpy(mappedResource.pData, vertices, sizeof(vertices));
-    d3dContext->Unmap(vertexBuffer, 0);
+void DX11Renderer::drawBorder(float x, float y, float width, float height, float rounding, float thickness, const Color& color, int segments) {
+    batch.addBorder(x, y, width, height, rounding, thickness, color, segments);
+}
 
-    UINT stride = sizeof(Vertex);
-    UINT offset = 0;
-    d3dContext->IASetVertexBuffers(0, 1, &vertexBuffer, &stride, &offset);
-    d3dContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-    d3dContext->Draw(3, 0);
+void DX11Renderer::drawRing(float centerX, float centerY, float radius, float thickness, const Color& color, int segments) {
+    batch.addRing(centerX, centerY, radius, thickness, color, segments);
+}
+
+void DX11Renderer::drawLine(float x1, float y1, float x2, float y2, float thickness, const Color& color) {
+    batch.addLine(x1, y1, x2, y2, thickness, color);
+}
+
+void DX11Renderer::drawPolyline(const float* points, uint32_t pointCount, float thickness, const Color& color, JoinStyle join) {
+    batch.addPolyline(points, pointCount, thickness, color, join);
+}
+
+void DX11Renderer::drawGraph(const LiveGraph& graph, float x, float y) {
+    batch.addGraph(graph, x, y);
+}
+
+void DX11Renderer::drawPath(const VectorPath& path, float x, float y, const Color& color) {
+    batch.addPath(path, x, y, color);
 }
 
 void DX11Renderer::createShaders() {
     const char* vsSource = R"(
+    cbuffer Viewport : register(b0) {
+        float2 viewportSize;
+        float2 origin;
+    };
+
+    // Offsets of the translation slots, slot 0 is zero.
+    cbuffer Translations : register(b1) {
+        float4 translations[256];
+    };
+
     struct VS_INPUT {
         float3 position : POSITION;
         float4 color : COLOR;
+        float2 uv : TEXCOORD;
+        uint translation : TRANSLATION;
     };
 
     struct PS_INPUT {
         float4 position : SV_POSITION;
         float4 color : COLOR;
+        float2 uv : TEXCOORD0;
+        float2 pixel : TEXCOORD1;
     };
 
     PS_INPUT main(VS_INPUT input) {
         PS_INPUT output;
-        output.position = float4(input.position, 1.0);
+        float2 position = input.position.xy + translations[input.translation].xy - origin;
+        output.position = float4(position.x * 2.0 / viewportSize.x - 1.0, 1.0 - position.y * 2.0 / viewportSize.y, input.position.z, 1.0);
         output.color = input.color;
+        output.uv = input.uv;
+        output.pixel = input.position.xy;
         return output;
     }
     )";
 
-    ID3DBlob* vsBlob = nullptr;
-    ID3DBlob* errorBlob = nullptr;
-    HRESULT hr = D3DCompile(vsSource, strlen(vsSource), nullptr, nullptr, nullptr, "main", "vs_4_0", 0, 0, &vsBlob, &errorBlob);
-
-    if (FAILED(hr)) {
-        if (errorBlob) {
-            ezUI::dbg("Vertex Shader Compilation Error: " + std::string((char*)errorBlob->GetBufferPointer()));
-            errorBlob->Release();
-        }
+    std::vector<uint8_t> vsBytecode;
+    if (!shaderBytecode(vsSource, "vs_4_0", vsBytecode)) {
         return;
     }
 
-    hr = d3dDevice->CreateVertexShader(vsBlob->GetBufferPointer(), vsBlob->GetBufferSize(), nullptr, &vertexShader);
+    HRESULT hr = d3dDevice->CreateVertexShader(vsBytecode.data(), vsBytecode.size(), nullptr, &vertexShader);
     if (FAILED(hr)) {
         ezUI::dbg("Failed to create vertex shader! HRESULT: " + std::to_string(hr));
-        vsBlob->Release();
         return;
     }
 
@@ -292,10 +568,11 @@ void DX11Renderer::createShaders() {
     D3D11_INPUT_ELEMENT_DESC layout[] = {
         { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
         { "COLOR", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+        { "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 28, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+        { "TRANSLATION", 0, DXGI_FORMAT_R32_UINT, 0, 36, D3D11_INPUT_PER_VERTEX_DATA, 0 },
     };
 
-    hr = d3dDevice->CreateInputLayout(layout, ARRAYSIZE(layout), vsBlob->GetBufferPointer(), vsBlob->GetBufferSize(), &inputLayout);
-    vsBlob->Release();
+    hr = d3dDevice->CreateInputLayout(layout, ARRAYSIZE(layout), vsBytecode.data(), vsBytecode.size(), &inputLayout);
 
     if (FAILED(hr)) {
         ezUI::dbg("Failed to create input layout! HRESULT: " + std::to_string(hr));
@@ -305,219 +582,649 @@ void DX11Renderer::createShaders() {
     d3dContext->IASetInputLayout(inputLayout);
 
     const char* psSource = R"(
+    Texture2D atlasTexture : register(t0);
+    SamplerState atlasSampler : register(s0);
+    // Two float4 per shadow: center and half size, then corner radius and sigma.
+    Buffer<float4> shadows : register(t1);
+
     struct PS_INPUT {
         float4 position : SV_POSITION;
         float4 color : COLOR;
+        float2 uv : TEXCOORD0;
+        float2 pixel : TEXCOORD1;
     };
 
+    // Same formula as AnalyticShadow::coverage, see shadow.cpp.
+    float approximateErf(float x) {
+        float s = sign(x);
+        float a = abs(x);
+        float t = 1.0 + (0.278393 + (0.230389 + 0.078108 * (a * a)) * a) * a;
+        t *= t;
+        return s - s / (t * t);
+    }
+
+    float gaussian(float x, float sigma) {
+        return exp(-(x * x) / (2.0 * sigma * sigma)) / (2.50662827 * sigma);
+    }
+
+    float shadowRow(float x, float y, float sigma, float corner, float2 halfSize) {
+        float delta = min(halfSize.y - corner - abs(y), 0.0);
+        float curved = halfSize.x - corner + sqrt(max(0.0, corner * corner - delta * delta));
+        float scale = 0.70710678 / sigma;
+        return 0.5 * (approximateErf((x + curved) * scale) - approximateErf((x - curved) * scale));
+    }
+
+    float shadowCoverage(float2 pixel, uint index) {
+        float4 box = shadows.Load(index * 2);
+        float4 shape = shadows.Load(index * 2 + 1);
+        float2 p = pixel - box.xy;
+        float sigma = shape.y;
+        float start = clamp(-3.0 * sigma, p.y - box.w, p.y + box.w);
+        float end = clamp(3.0 * sigma, p.y - box.w, p.y + box.w);
+        float rowStep = (end - start) / 4.0;
+        float row = start + rowStep * 0.5;
+        float value = 0.0;
+        [unroll] for (int i = 0; i < 4; ++i) {
+            value += shadowRow(p.x, p.y - row, sigma, shape.x, box.zw) * gaussian(row, sigma) * rowStep;
+            row += rowStep;
+        }
+        return value;
+    }
+
     float4 main(PS_INPUT input) : SV_TARGET {
-        return input.color;
+        // Shadow quads carry u = -1 - their index, atlas coordinates are never negative.
+        if (input.uv.x < 0.0) {
+            uint index = (uint)(-input.uv.x - 0.5);
+            return float4(input.color.rgb, input.color.a * shadowCoverage(input.pixel, index));
+        }
+        return atlasTexture.Sample(atlasSampler, input.uv) * input.color;
     }
     )";
 
-    ID3DBlob* psBlob = nullptr;
-    hr = D3DCompile(psSource, strlen(psSource), nullptr, nullptr, nullptr, "main", "ps_4_0", 0, 0, &psBlob, &errorBlob);
+    std::vector<uint8_t> psBytecode;
+    if (!shaderBytecode(psSource, "ps_4_0", psBytecode)) {
+        return;
+    }
+
+    hr = d3dDevice->CreatePixelShader(psBytecode.data(), psBytecode.size(), nullptr, &pixelShader);
+
+    if (FAILED(hr)) {
+        ezUI::dbg("Failed to create pixel shader! HRESULT: " + std::to_string(hr));
+        return;
+    }
+
+    d3dContext->PSSetShader(pixelShader, nullptr, 0);
+
+    D3D11_BUFFER_DESC constantBufferDesc = {};
+    constantBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+    constantBufferDesc.ByteWidth = 16;
+    constantBufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+    constantBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+    hr = d3dDevice->CreateBuffer(&constantBufferDesc, nullptr, &constantBuffer);
+    if (FAILED(hr)) {
+        ezUI::dbg("Failed to create constant buffer! HRESULT: " + std::to_string(hr));
+        return;
+    }
+
+    // Starts zeroed, slot 0 is never written.
+    std::vector<GeometryBatch::Translation> zeroTranslations(MAX_TRANSLATIONS, GeometryBatch::Translation());
+    D3D11_SUBRESOURCE_DATA translationData = {};
+    translationData.pSysMem = zeroTranslations.data();
+    constantBufferDesc.ByteWidth = static_cast<UINT>(sizeof(GeometryBatch::Translation) * zeroTranslations.size());
+    hr = d3dDevice->CreateBuffer(&constantBufferDesc, &translationData, &translationBuffer);
+    if (FAILED(hr)) {
+        ezUI::dbg("Failed to create translation buffer! HRESULT: " + std::to_string(hr));
+    }
+}
+
+bool DX11Renderer::shaderBytecode(const char* source, const char* profile, std::vector<uint8_t>& bytecode) {
+    // The key covers everything D3DCompile is given, an edited shader is a miss.
+    uint64_t key = PersistentCache::hash(source, strlen(source));
+    key = PersistentCache::hash(profile, strlen(profile), key);
+
+    const uint8_t* cached = nullptr;
+    size_t cachedSize = 0;
+    if (cache && cache->find(PersistentCache::KIND_SHADER, key, cached, cachedSize)) {
+        bytecode.assign(cached, cached + cachedSize);
+        return true;
+    }
 
+    ID3DBlob* blob = nullptr;
+    ID3DBlob* errorBlob = nullptr;
+    HRESULT hr = D3DCompile(source, strlen(source), nullptr, nullptr, nullptr, "main", profile, 0, 0, &blob, &errorBlob);
     if (FAILED(hr)) {
         if (errorBlob) {
-            ezUI::dbg("Pixel Shader Compilation Error: " + std::string((char*)errorBlob->GetBufferPointer()));
+            ezUI::dbg(std::string(profile) + " Shader Compilation Error: " + std::string((char*)errorBlob->GetBufferPointer()));
             errorBlob->Release();
         }
-        return;
+        return false;
     }
 
-    hr = d3dDevice->CreatePixelShader(psBlob->GetBufferPointer(), psBlob->GetBufferSize(), nullptr, &pixelShader);
-    psBlob->Release();
+    const uint8_t* bytes = static_cast<const uint8_t*>(blob->GetBufferPointer());
+    bytecode.assign(bytes, bytes + blob->GetBufferSize());
+    blob->Release();
+    if (cache) {
+        cache->put(PersistentCache::KIND_SHADER, key, bytecode.data(), bytecode.size());
+    }
+    return true;
+}
 
-    if (FAILED(hr)) {
-        ezUI::dbg("Failed to create pixel shader! HRESULT: " + std::to_string(hr));
+void DX11Renderer::draw(const DrawCommand& command) {
+    if (lateGroupOpen) {
+        lateBatch.add(command);
         return;
     }
+    batch.add(command);
+}
 
-    d3dContext->PSSetShader(pixelShader, nullptr, 0);
+void DX11Renderer::setPartialUploads(bool enable) {
+    partialUploads = enable;
+    batch.setRetained(enable);
 }
 
-void DX11Renderer::drawCircle(float centerX, float centerY, float radius, const Color& color, int segments) {
-    if (!d3dDevice || !d3dContext) {
-        ezUI::dbg("Device or Context not initialized!");
+void DX11Renderer::uploadRanges(ID3D11Buffer* buffer, const void* data, const std::vector<UploadMirror::Range>& ranges) {
+    // The previous frame may still be reading these ranges, so they are not written through a
+    // NO_OVERWRITE map. UpdateSubresource lets the driver version the touched region instead.
+    for (const UploadMirror::Range& range : ranges) {
+        D3D11_BOX box = { static_cast<UINT>(range.offset), 0, 0, static_cast<UINT>(range.offset + range.size), 1, 1 };
+        d3dContext->UpdateSubresource(buffer, 0, &box, static_cast<const uint8_t*>(data) + range.offset, 0, 0);
+        frameStats.uploadedBytes += static_cast<UINT>(range.size);
+        frameStats.uploadRanges++;
+    }
+}
+
+void DX11Renderer::uploadShadows(const std::vector<AnalyticShadow::Params>& shadows) {
+    if (shadows.empty()) {
         return;
     }
 
-    RECT rect;
-    GetClientRect(hwnd, &rect);
-    float screenWidth = static_cast<float>(rect.right - rect.left);
-    float screenHeight = static_cast<float>(rect.bottom - rect.top);
+    // Rewritten whole every flush, shadows are few and rebuilt with their quads anyway.
+    if (shadows.size() > shadowCapacity) {
+        if (shadowView) {
+            shadowView->Release();
+            shadowView = nullptr;
+        }
+        if (shadowBuffer) {
+            shadowBuffer->Release();
+            shadowBuffer = nullptr;
+        }
+        shadowCapacity = 64;
+        while (shadowCapacity < shadows.size()) shadowCapacity *= 2;
 
-    std::vector<Vertex> vertices;
-    std::vector<UINT> indices;
+        D3D11_BUFFER_DESC shadowBufferDesc = {};
+        shadowBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+        shadowBufferDesc.ByteWidth = static_cast<UINT>(sizeof(AnalyticShadow::Params) * shadowCapacity);
+        shadowBufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+        shadowBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
 
-    float xCenterNorm = (2.0f * centerX / screenWidth) - 1.0f;
-    float yCenterNorm = 1.0f - (2.0f * centerY / screenHeight);
-    vertices.push_back({ XMFLOAT3(xCenterNorm, yCenterNorm, 0.0f), XMFLOAT4(color.r, color.g, color.b, color.a) });
+        HRESULT hr = d3dDevice->CreateBuffer(&shadowBufferDesc, nullptr, &shadowBuffer);
+        if (FAILED(hr)) {
+            ezUI::dbg("Failed to create shadow buffer! HRESULT: " + std::to_string(hr));
+            shadowCapacity = 0;
+            return;
+        }
 
-    for (int i = 0; i <= segments; ++i) {
-        float theta = (2.0f * XM_PI * i) / segments;
-        float x = centerX + radius * cosf(theta);
-        float y = centerY + radius * sinf(theta);
-        float xNorm = (2.0f * x / screenWidth) - 1.0f;
-        float yNorm = 1.0f - (2.0f * y / screenHeight);
-        vertices.push_back({ XMFLOAT3(xNorm, yNorm, 0.0f), XMFLOAT4(color.r, color.g, color.b, color.a) });
+        D3D11_SHADER_RESOURCE_VIEW_DESC viewDesc = {};
+        viewDesc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+        viewDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+        viewDesc.Buffer.FirstElement = 0;
+        viewDesc.Buffer.NumElements = static_cast<UINT>(shadowCapacity * 2);
+        hr = d3dDevice->CreateShaderResourceView(shadowBuffer, &viewDesc, &shadowView);
+        if (FAILED(hr)) {
+            ezUI::dbg("Failed to create shadow buffer view! HRESULT: " + std::to_string(hr));
+            shadowBuffer->Release();
+            shadowBuffer = nullptr;
+            shadowCapacity = 0;
+            return;
+        }
     }
 
-    for (int i = 1; i <= segments; ++i) {
-        indices.push_back(0);
-        indices.push_back(i);
-        indices.push_back(i + 1);
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    if (SUCCEEDED(d3dContext->Map(shadowBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped))) {
+        size_t size = sizeof(AnalyticShadow::Params) * shadows.size();
+        memcpy(mapped.pData, shadows.data(), size);
+        d3dContext->Unmap(shadowBuffer, 0);
+        frameStats.uploadedBytes += static_cast<UINT>(size);
     }
+}
 
-    createVertexBuffer(vertices.size(), indices.size());
+bool DX11Renderer::setTranslation(uint32_t slot, float x, float y) {
+    if (slot == 0 || slot >= MAX_TRANSLATIONS) {
+        return false;
+    }
+    if (batch.translations.size() <= slot) {
+        batch.translations.resize(slot + 1, GeometryBatch::Translation());
+    }
+    batch.translations[slot].x = x;
+    batch.translations[slot].y = y;
+    return true;
+}
 
-    D3D11_MAPPED_SUBRESOURCE mappedResource;
-    HRESULT hr = d3dContext->Map(vertexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-    if (FAILED(hr)) {
-        ezUI::dbg("Failed to map vertex buffer! HRESULT: " + std::to_string(hr));
+void DX11Renderer::uploadTranslations() {
+    // Vertices only hold their slot, so a moved container costs this upload and nothing else.
+    const std::vector<GeometryBatch::Translation>& translations = batch.translations;
+    if (!translationBuffer || translations.empty()) {
         return;
     }
-    memcpy(mappedResource.pData, vertices.data(), sizeof(Vertex) * vertices.size());
-    d3dContext->Unmap(vertexBuffer, 0);
-
-    hr = d3dContext->Map(indexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-    if (FAILED(hr)) {
-        ezUI::dbg("Failed to map index buffer! HRESULT: " + std::to_string(hr));
+    size_t size = sizeof(GeometryBatch::Translation) * translations.size();
+    if (translations.size() == uploadedTranslations.size() && memcmp(translations.data(), uploadedTranslations.data(), size) == 0) {
         return;
     }
-    memcpy(mappedResource.pData, indices.data(), sizeof(UINT) * indices.size());
-    d3dContext->Unmap(indexBuffer, 0);
 
-    UINT stride = sizeof(Vertex);
-    UINT offset = 0;
-    d3dContext->IASetVertexBuffers(0, 1, &vertexBuffer, &stride, &offset);
-    d3dContext->IASetIndexBuffer(indexBuffer, DXGI_FORMAT_R32_UINT, 0);
-    d3dContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-    d3dContext->DrawIndexed(static_cast<UINT>(indices.size()), 0, 0);
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    if (SUCCEEDED(d3dContext->Map(translationBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped))) {
+        memcpy(mapped.pData, translations.data(), size);
+        d3dContext->Unmap(translationBuffer, 0);
+        uploadedTranslations = translations;
+        frameStats.uploadedBytes += static_cast<UINT>(size);
+    }
 }
 
-void DX11Renderer::drawRoundedRectangle(float x, float y, float width, float height, float radius, const Color& color, int segments) {
+void DX11Renderer::flush() {
+    if (batch.empty()) {
+        return;
+    }
     if (!d3dDevice || !d3dContext) {
         ezUI::dbg("Device or Context not initialized!");
+        batch.clear();
         return;
     }
 
-    radius = min(radius, min(width, height) / 2.0f);
+    updateViewport();
+    uploadAtlas();
 
-    RECT rect;
-    GetClientRect(hwnd, &rect);
-    float screenWidth = static_cast<float>(rect.right - rect.left);
-    float screenHeight = static_cast<float>(rect.bottom - rect.top);
-
-    std::vector<Vertex> vertices;
-    std::vector<UINT> indices;
-
-    float xCenterNorm = (2.0f * (x + width / 2.0f) / screenWidth) - 1.0f;
-    float yCenterNorm = 1.0f - (2.0f * (y + height / 2.0f) / screenHeight);
-    vertices.push_back({ XMFLOAT3(xCenterNorm, yCenterNorm, 0.0f), XMFLOAT4(color.r, color.g, color.b, color.a) });
+    // Depth only orders the shapes of this flush, so it starts from a cleared buffer each time.
+    // Layers have no depth buffer and are drawn in painter order.
+    const std::vector<uint32_t>* submittedIndices = &orderedIndices;
+    bool useDepth = activeLayer < 0 && depthPrepass && depthView && opaqueDepthState && translucentDepthState;
+    uint32_t opaqueIndexCount = batch.buildSubmission(useDepth, orderedIndices, textureRuns);
+    if (useDepth) {
+        d3dContext->ClearDepthStencilView(depthView, D3D11_CLEAR_DEPTH, 1.0f, 0);
+    }
 
-    float left = x + radius;
-    float right = x + width - radius;
-    float top = y + radius;
-    float bottom = y + height - radius;
+    createVertexBuffer(batch.vertices.size(), batch.indices.size());
+    if (!vertexBuffer || !indexBuffer) {
+        batch.clear();
+        return;
+    }
 
-    int totalSegments = segments * 4;
-    for (int i = 0; i <= totalSegments; ++i) {
-        float theta = (XM_2PI * i) / totalSegments;
+    // Every shape is its own segment, so a hover that recolors one button uploads that
+    // button's vertices. Indices only move when shapes are added, removed or resized.
+    vertexSegments.clear();
+    for (const GeometryBatch::Item& item : batch.items) {
+        vertexSegments.push_back(sizeof(Vertex) * (item.firstVertex + item.vertexCount));
+    }
+    if (!partialUploads) {
+        vertexMirror.invalidate();
+        indexMirror.invalidate();
+    }
+    vertexMirror.update(reinterpret_cast<const uint8_t*>(batch.vertices.data()), sizeof(Vertex) * batch.vertices.size(), vertexSegments, dirtyRanges);
+    uploadRanges(vertexBuffer, batch.vertices.data(), dirtyRanges);
+    indexMirror.update(reinterpret_cast<const uint8_t*>(submittedIndices->data()), sizeof(UINT) * submittedIndices->size(), 1024, dirtyRanges);
+    uploadRanges(indexBuffer, submittedIndices->data(), dirtyRanges);
+    uploadShadows(batch.shadows);
+    uploadTranslations();
 
-        float cosTheta = cosf(theta);
-        float sinTheta = sinf(theta);
+    const GeometryBatch::ReuseStats& reuseStats = batch.getReuseStats();
+    frameStats.reusedCommands += reuseStats.reused;
+    frameStats.recoloredCommands += reuseStats.recolored;
 
-        float cornerX = 0.0f;
-        float cornerY = 0.0f;
+    UINT stride = sizeof(Vertex);
+    UINT offset = 0;
+    d3dContext->IASetVertexBuffers(0, 1, &vertexBuffer, &stride, &offset);
+    d3dContext->IASetIndexBuffer(indexBuffer, DXGI_FORMAT_R32_UINT, 0);
+    d3dContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    ID3D11Buffer* vertexConstants[2] = { constantBuffer, translationBuffer };
+    d3dContext->VSSetConstantBuffers(0, 2, vertexConstants);
+    d3dContext->PSSetSamplers(0, 1, &samplerState);
+    d3dContext->PSSetShaderResources(1, 1, &shadowView);
+
+    // A partial frame draws everything once per redraw rectangle, clipped to it. The
+    // rectangles do not overlap, so translucent shapes still blend only once per pixel.
+    bool scissored = damageActive && activeLayer < 0;
+    size_t passes = scissored ? redrawRects.size() : 1;
+    if (scissored) {
+        d3dContext->RSSetState(scissorState);
+    }
 
-        if (theta >= 0 && theta < XM_PIDIV2) {
-            cornerX = right;
-            cornerY = bottom;
+    float blendFactor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    ID3D11BlendState* shapeBlendState = activeLayer >= 0 ? layerBlendState : screenBlendState;
+    for (size_t pass = 0; pass < passes; ++pass) {
+        if (scissored) {
+            d3dContext->RSSetScissorRects(1, &redrawRects[pass]);
         }
-        else if (theta >= XM_PIDIV2 && theta < XM_PI) {
-            cornerX = left;
-            cornerY = bottom;
+        if (opaqueIndexCount > 0) {
+            d3dContext->PSSetShaderResources(0, 1, &atlasView);
+            d3dContext->OMSetBlendState(shapeBlendState, blendFactor, 0xffffffff);
+            d3dContext->OMSetDepthStencilState(opaqueDepthState, 0);
+            d3dContext->DrawIndexed(opaqueIndexCount, 0, 0);
+            frameStats.drawCalls++;
         }
-        else if (theta >= XM_PI && theta < 3 * XM_PIDIV2) {
-            cornerX = left;
-            cornerY = top;
+
+        // Composited layers split the rest into one draw per texture run.
+        for (const GeometryBatch::TextureRun& run : textureRuns) {
+            ID3D11ShaderResourceView* view = atlasView;
+            ID3D11BlendState* runBlendState = shapeBlendState;
+            if (run.texture != 0) {
+                int layerId = static_cast<int>(run.texture) - 1;
+                if (layerId == activeLayer || static_cast<size_t>(layerId) >= layers.size() || !layers[layerId].shaderView) {
+                    continue;
+                }
+                view = layers[layerId].shaderView;
+                runBlendState = compositeBlendState;
+            }
+            d3dContext->PSSetShaderResources(0, 1, &view);
+            d3dContext->OMSetBlendState(runBlendState, blendFactor, 0xffffffff);
+            d3dContext->OMSetDepthStencilState(useDepth ? translucentDepthState : noDepthState, 0);
+            d3dContext->DrawIndexed(run.indexCount, run.firstIndex, 0);
+            frameStats.drawCalls++;
         }
-        else {
-            cornerX = right;
-            cornerY = top;
+    }
+    if (scissored) {
+        d3dContext->RSSetState(nullptr);
+    }
+
+    frameStats.vertices += static_cast<UINT>(batch.vertices.size());
+    frameStats.indices += static_cast<UINT>(batch.indices.size());
+    frameStats.opaqueIndices += opaqueIndexCount;
+    frameStats.unsortedStateChanges += batch.getSortStats().unsortedRuns;
+    frameStats.stateChanges += batch.getSortStats().runs;
+    batch.clear();
+}
+
+int DX11Renderer::createImage(int width, int height, const uint8_t* rgba) {
+    int imageId = atlas.addImage(width, height, rgba);
+    if (imageId < 0) {
+        ezUI::dbg("Image of " + std::to_string(width) + "x" + std::to_string(height) + " does not fit into the atlas!");
+    }
+    return imageId;
+}
+
+void DX11Renderer::destroyImage(int imageId) {
+    atlas.removeImage(imageId);
+}
+
+int DX11Renderer::createLayer(int width, int height) {
+    if (!d3dDevice || width <= 0 || height <= 0) {
+        return -1;
+    }
+
+    LayerTarget layer = { nullptr, nullptr, nullptr, width, height };
+    D3D11_TEXTURE2D_DESC textureDesc = {};
+    textureDesc.Width = width;
+    textureDesc.Height = height;
+    textureDesc.MipLevels = 1;
+    textureDesc.ArraySize = 1;
+    textureDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+    textureDesc.SampleDesc.Count = 1;
+    textureDesc.Usage = D3D11_USAGE_DEFAULT;
+    textureDesc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+
+    HRESULT hr = d3dDevice->CreateTexture2D(&textureDesc, nullptr, &layer.texture);
+    if (FAILED(hr)) {
+        ezUI::dbg("Failed to create layer texture! HRESULT: " + std::to_string(hr));
+        return -1;
+    }
+    hr = d3dDevice->CreateRenderTargetView(layer.texture, nullptr, &layer.targetView);
+    if (FAILED(hr)) {
+        ezUI::dbg("Failed to create layer render target view! HRESULT: " + std::to_string(hr));
+        releaseLayer(layer);
+        return -1;
+    }
+    hr = d3dDevice->CreateShaderResourceView(layer.texture, nullptr, &layer.shaderView);
+    if (FAILED(hr)) {
+        ezUI::dbg("Failed to create layer shader resource view! HRESULT: " + std::to_string(hr));
+        releaseLayer(layer);
+        return -1;
+    }
+
+    for (size_t i = 0; i < layers.size(); ++i) {
+        if (!layers[i].texture) {
+            layers[i] = layer;
+            return static_cast<int>(i);
         }
+    }
+    layers.push_back(layer);
+    return static_cast<int>(layers.size() - 1);
+}
 
-        float xPos = cornerX + radius * cosTheta;
-        float yPos = cornerY + radius * sinTheta;
+void DX11Renderer::releaseLayer(LayerTarget& layer) {
+    if (layer.shaderView) layer.shaderView->Release();
+    if (layer.targetView) layer.targetView->Release();
+    if (layer.texture) layer.texture->Release();
+    layer.shaderView = nullptr;
+    layer.targetView = nullptr;
+    layer.texture = nullptr;
+}
 
-        float xNorm = (2.0f * xPos / screenWidth) - 1.0f;
-        float yNorm = 1.0f - (2.0f * yPos / screenHeight);
+void DX11Renderer::destroyLayer(int layerId) {
+    if (layerId < 0 || static_cast<size_t>(layerId) >= layers.size() || layerId == activeLayer) {
+        return;
+    }
+    releaseLayer(layers[layerId]);
+}
 
-        vertices.push_back({ XMFLOAT3(xNorm, yNorm, 0.0f), XMFLOAT4(color.r, color.g, color.b, color.a) });
+bool DX11Renderer::beginLayer(int layerId, float x, float y) {
+    if (activeLayer >= 0 || layerId < 0 || static_cast<size_t>(layerId) >= layers.size() || !layers[layerId].texture) {
+        return false;
     }
+    flush();
+    activeLayer = layerId;
+    layerOriginX = x;
+    layerOriginY = y;
+
+    // The layer may still be bound for sampling from the flush above.
+    ID3D11ShaderResourceView* noView = nullptr;
+    d3dContext->PSSetShaderResources(0, 1, &noView);
+    float transparent[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    d3dContext->OMSetRenderTargets(1, &layers[layerId].targetView, nullptr);
+    d3dContext->ClearRenderTargetView(layers[layerId].targetView, transparent);
+    return true;
+}
 
-    for (int i = 1; i <= totalSegments; ++i) {
-        indices.push_back(0);
-        indices.push_back(i);
-        indices.push_back(i == totalSegments ? 1 : i + 1);
+void DX11Renderer::endLayer() {
+    if (activeLayer < 0) {
+        return;
     }
+    flush();
+    activeLayer = -1;
+    d3dContext->OMSetRenderTargets(1, &renderTargetView, depthView);
+}
 
-    createVertexBuffer(vertices.size(), indices.size());
+bool DX11Renderer::beginLateGroup(LateGroupKind kind, float x, float y, float width, float height) {
+    if (!pointerSource || lateGroupOpen || activeLayer >= 0) {
+        return false;
+    }
+    lateGroupOpen = true;
+    lateGroups.push_back({ kind, x, y, width, height, static_cast<uint32_t>(lateBatch.indices.size()), 0 });
+    return true;
+}
 
-    D3D11_MAPPED_SUBRESOURCE mappedResource;
-    HRESULT hr = d3dContext->Map(vertexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-    if (FAILED(hr)) {
-        ezUI::dbg("Failed to map vertex buffer! HRESULT: " + std::to_string(hr));
+void DX11Renderer::endLateGroup() {
+    if (!lateGroupOpen) {
         return;
     }
-    memcpy(mappedResource.pData, vertices.data(), sizeof(Vertex) * vertices.size());
-    d3dContext->Unmap(vertexBuffer, 0);
+    lateGroupOpen = false;
+    LateGroup& group = lateGroups.back();
+    group.indexCount = static_cast<uint32_t>(lateBatch.indices.size()) - group.firstIndex;
+}
+
+bool DX11Renderer::createDynamicBuffer(ID3D11Buffer*& buffer, size_t& capacity, size_t bytes, UINT bindFlags) {
+    if (buffer && bytes <= capacity) {
+        return true;
+    }
+    if (buffer) {
+        buffer->Release();
+        buffer = nullptr;
+    }
+    capacity = 4096;
+    while (capacity < bytes) capacity *= 2;
+
+    D3D11_BUFFER_DESC bufferDesc = {};
+    bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+    bufferDesc.ByteWidth = static_cast<UINT>(capacity);
+    bufferDesc.BindFlags = bindFlags;
+    bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
 
-    hr = d3dContext->Map(indexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
+    HRESULT hr = d3dDevice->CreateBuffer(&bufferDesc, nullptr, &buffer);
     if (FAILED(hr)) {
-        ezUI::dbg("Failed to map index buffer! HRESULT: " + std::to_string(hr));
+        ezUI::dbg("Failed to create dynamic buffer! HRESULT: " + std::to_string(hr));
+        capacity = 0;
+        return false;
+    }
+    return true;
+}
+
+void DX11Renderer::drawLateGroups() {
+    lateGroupOpen = false;
+    if (lateGroups.empty() || lateBatch.empty() || !d3dDevice || !d3dContext) {
+        lateGroups.clear();
+        lateBatch.clear();
+        return;
+    }
+
+    updateViewport();
+    uploadAtlas();
+
+    // The latch: everything else is submitted, this is the last moment the pointer can be
+    // sampled for this frame. A source that fails keeps the previous position.
+    float pointerX = latchedPointerX;
+    float pointerY = latchedPointerY;
+    if (pointerSource && pointerSource(pointerX, pointerY)) {
+        latchedPointerX = pointerX;
+        latchedPointerY = pointerY;
+    }
+
+    size_t vertexBytes = sizeof(Vertex) * lateBatch.vertices.size();
+    size_t indexBytes = sizeof(UINT) * lateBatch.indices.size();
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    if (!createDynamicBuffer(lateVertexBuffer, lateVertexCapacity, vertexBytes, D3D11_BIND_VERTEX_BUFFER) ||
+        !createDynamicBuffer(lateIndexBuffer, lateIndexCapacity, indexBytes, D3D11_BIND_INDEX_BUFFER)) {
+        lateGroups.clear();
+        lateBatch.clear();
         return;
     }
-    memcpy(mappedResource.pData, indices.data(), sizeof(UINT) * indices.size());
-    d3dContext->Unmap(indexBuffer, 0);
+    if (SUCCEEDED(d3dContext->Map(lateVertexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped))) {
+        memcpy(mapped.pData, lateBatch.vertices.data(), vertexBytes);
+        d3dContext->Unmap(lateVertexBuffer, 0);
+    }
+    if (SUCCEEDED(d3dContext->Map(lateIndexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped))) {
+        memcpy(mapped.pData, lateBatch.indices.data(), indexBytes);
+        d3dContext->Unmap(lateIndexBuffer, 0);
+    }
+    frameStats.uploadedBytes += static_cast<UINT>(vertexBytes + indexBytes);
+    uploadShadows(lateBatch.shadows);
+    uploadTranslations();
 
     UINT stride = sizeof(Vertex);
     UINT offset = 0;
-    d3dContext->IASetVertexBuffers(0, 1, &vertexBuffer, &stride, &offset);
-    d3dContext->IASetIndexBuffer(indexBuffer, DXGI_FORMAT_R32_UINT, 0);
+    float blendFactor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    ID3D11Buffer* vertexConstants[2] = { constantBuffer, translationBuffer };
+    d3dContext->IASetVertexBuffers(0, 1, &lateVertexBuffer, &stride, &offset);
     d3dContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-    d3dContext->DrawIndexed(static_cast<UINT>(indices.size()), 0, 0);
+    d3dContext->VSSetConstantBuffers(0, 2, vertexConstants);
+    d3dContext->PSSetSamplers(0, 1, &samplerState);
+    d3dContext->IASetIndexBuffer(lateIndexBuffer, DXGI_FORMAT_R32_UINT, 0);
+    d3dContext->PSSetShaderResources(0, 1, &atlasView);
+    d3dContext->PSSetShaderResources(1, 1, &shadowView);
+    d3dContext->OMSetBlendState(screenBlendState, blendFactor, 0xffffffff);
+    d3dContext->OMSetDepthStencilState(noDepthState, 0);
+
+    // Pointer groups are drawn around 0, 0; moving the origin by the pointer moves them
+    // without touching their vertices.
+    bool pointerOrigin = false;
+    for (const LateGroup& group : lateGroups) {
+        if (group.indexCount == 0) {
+            continue;
+        }
+        if (group.kind == LATE_HOVER && !(pointerX >= group.x && pointerX <= group.x + group.width && pointerY >= group.y && pointerY <= group.y + group.height)) {
+            continue;
+        }
+        bool wantPointerOrigin = group.kind == LATE_POINTER;
+        if (wantPointerOrigin != pointerOrigin) {
+            writeViewportConstants(viewportOriginX - (wantPointerOrigin ? pointerX : 0.0f), viewportOriginY - (wantPointerOrigin ? pointerY : 0.0f));
+            pointerOrigin = wantPointerOrigin;
+        }
+        d3dContext->DrawIndexed(group.indexCount, group.firstIndex, 0);
+        frameStats.drawCalls++;
+    }
+    if (pointerOrigin) {
+        writeViewportConstants(viewportOriginX, viewportOriginY);
+    }
+    lateGroups.clear();
+    lateBatch.clear();
 }
 
-void DX11Renderer::draw(const DrawCommand& command) {
-    switch (command.type) {
-    case SHAPE_RECTANGLE:
-        if (command.shape.rectangle.rounding > 0.0f) {
-            drawRoundedRectangle(command.shape.rectangle.x, command.shape.rectangle.y, command.shape.rectangle.width, command.shape.rectangle.height, command.shape.rectangle.rounding, command.shape.rectangle.color, 32);
-        } else {
-            drawRectangle(command.shape.rectangle.x, command.shape.rectangle.y, command.shape.rectangle.width, command.shape.rectangle.height, command.shape.rectangle.color);
+void DX11Renderer::uploadAtlas() {
+    TextureAtlas::Region region;
+    if (atlasTexture && atlasGeneration == atlas.getGeneration()) {
+        if (atlas.takeDirtyRegion(region)) {
+            D3D11_BOX box = { static_cast<UINT>(region.x), static_cast<UINT>(region.y), 0, static_cast<UINT>(region.x + region.width), static_cast<UINT>(region.y + region.height), 1 };
+            const uint8_t* source = atlas.pixels() + (static_cast<size_t>(region.y) * atlas.getWidth() + region.x) * 4;
+            d3dContext->UpdateSubresource(atlasTexture, 0, &box, source, atlas.getWidth() * 4, 0);
         }
-        break;
-    case SHAPE_CIRCLE:
-        drawCircle(command.shape.circle.centerX, command.shape.circle.centerY, command.shape.circle.radius, command.shape.circle.color, command.shape.circle.segments);
-        break;
-    case SHAPE_TRIANGLE:
-        drawTriangle(command.shape.triangle.x1, command.shape.triangle.y1, command.shape.triangle.x2, command.shape.triangle.y2, command.shape.triangle.x3, command.shape.triangle.y3, command.shape.triangle.color);
-        break;
-    default:
-        ezUI::dbg("Invalid shape type!");
-        break;
+        return;
+    }
+
+    // The page was created, resized or repacked: recreate the texture with the full contents.
+    atlas.takeDirtyRegion(region);
+    if (atlasView) {
+        atlasView->Release();
+        atlasView = nullptr;
+    }
+    if (atlasTexture) {
+        atlasTexture->Release();
+        atlasTexture = nullptr;
+    }
+
+    D3D11_TEXTURE2D_DESC textureDesc = {};
+    textureDesc.Width = atlas.getWidth();
+    textureDesc.Height = atlas.getHeight();
+    textureDesc.MipLevels = 1;
+    textureDesc.ArraySize = 1;
+    textureDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+    textureDesc.SampleDesc.Count = 1;
+    textureDesc.Usage = D3D11_USAGE_DEFAULT;
+    textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+    D3D11_SUBRESOURCE_DATA initialData = {};
+    initialData.pSysMem = atlas.pixels();
+    initialData.SysMemPitch = atlas.getWidth() * 4;
+
+    HRESULT hr = d3dDevice->CreateTexture2D(&textureDesc, &initialData, &atlasTexture);
+    if (FAILED(hr)) {
+        ezUI::dbg("Failed to create atlas texture! HRESULT: " + std::to_string(hr));
+        return;
+    }
+
+    hr = d3dDevice->CreateShaderResourceView(atlasTexture, nullptr, &atlasView);
+    if (FAILED(hr)) {
+        ezUI::dbg("Failed to create atlas shader resource view! HRESULT: " + std::to_string(hr));
+        return;
+    }
+    atlasGeneration = atlas.getGeneration();
+}
+
+void DX11Renderer::createSampler() {
+    D3D11_SAMPLER_DESC samplerDesc = {};
+    samplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+    samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+    samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+    samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+    samplerDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+    samplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
+
+    HRESULT hr = d3dDevice->CreateSamplerState(&samplerDesc, &samplerState);
+    if (FAILED(hr)) {
+        ezUI::dbg("Failed to create sampler state! HRESULT: " + std::to_string(hr));
     }
 }
 
 void DX11Renderer::drawElement(const std::string& name) {
     auto it = elements.find(name);
     if (it != elements.end()) {
-        for (const auto& command : it->second.commands) {
-            draw(command);
-        }
+        drawElementGeometry(it->second);
     }
 }
 
@@ -527,21 +1234,161 @@ void DX11Renderer::clearElements() {
 
 void DX11Renderer::registerElement(const std::string& name, int priority, const std::vector<DrawCommand>& commands) {
     elements[name] = Element(name, priority, commands);
+    prebuildElement(elements[name]);
 }
 
-void DX11Renderer::drawAllElements() {
-    std::vector<Element> sortedElements;
-    for (const auto& pair : elements) {
-        sortedElements.push_back(pair.second);
+// Cached element geometry: GeometryHeader, vertices, indices, then five uint32_t per item.
+struct GeometryHeader {
+    uint32_t vertexCount, indexCount, itemCount, reserved;
+};
+
+static bool loadElementGeometry(const uint8_t* data, size_t size, DX11Renderer::Element& element) {
+    GeometryHeader header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    size_t vertexBytes = header.vertexCount * sizeof(RenderBackend::Vertex);
+    size_t indexBytes = header.indexCount * sizeof(uint32_t);
+    if (size != sizeof(header) + vertexBytes + indexBytes + header.itemCount * 5 * sizeof(uint32_t)) {
+        return false;
+    }
+
+    const uint8_t* cursor = data + sizeof(header);
+    element.vertices.resize(header.vertexCount);
+    memcpy(element.vertices.data(), cursor, vertexBytes);
+    cursor += vertexBytes;
+    element.indices.resize(header.indexCount);
+    memcpy(element.indices.data(), cursor, indexBytes);
+    cursor += indexBytes;
+
+    element.items.resize(header.itemCount);
+    for (GeometryBatch::Item& item : element.items) {
+        uint32_t fields[5];
+        memcpy(fields, cursor, sizeof(fields));
+        cursor += sizeof(fields);
+        item = { fields[0], fields[1], fields[2], fields[3], fields[4] != 0 };
+        // addPrebuilt trusts the ranges, a valid hash only proves the bytes are what was written.
+        if (item.firstVertex + item.vertexCount > header.vertexCount || item.firstIndex + item.indexCount > header.indexCount) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void storeElementGeometry(const DX11Renderer::Element& element, std::vector<uint8_t>& out) {
+    GeometryHeader header = { static_cast<uint32_t>(element.vertices.size()), static_cast<uint32_t>(element.indices.size()), static_cast<uint32_t>(element.items.size()), 0 };
+    size_t vertexBytes = element.vertices.size() * sizeof(RenderBackend::Vertex);
+    size_t indexBytes = element.indices.size() * sizeof(uint32_t);
+    out.resize(sizeof(header) + vertexBytes + indexBytes + element.items.size() * 5 * sizeof(uint32_t));
+
+    uint8_t* cursor = out.data();
+    memcpy(cursor, &header, sizeof(header));
+    cursor += sizeof(header);
+    memcpy(cursor, element.vertices.data(), vertexBytes);
+    cursor += vertexBytes;
+    memcpy(cursor, element.indices.data(), indexBytes);
+    cursor += indexBytes;
+    for (const GeometryBatch::Item& item : element.items) {
+        uint32_t fields[5] = { item.firstVertex, item.vertexCount, item.firstIndex, item.indexCount, item.opaque ? 1u : 0u };
+        memcpy(cursor, fields, sizeof(fields));
+        cursor += sizeof(fields);
+    }
+}
+
+void DX11Renderer::prebuildElement(Element& element) {
+    element.prebuilt = false;
+    element.vertices.clear();
+    element.indices.clear();
+    element.items.clear();
+
+    // Everything the tessellation depends on goes into the key: the commands, the vertex
+    // layout and the white texel, which moves when the atlas grows.
+    uint64_t key = PersistentCache::HASH_SEED;
+    for (const DrawCommand& command : element.commands) {
+        size_t shapeSize = 0;
+        switch (command.type) {
+        case SHAPE_RECTANGLE: shapeSize = sizeof(Rectangle); break;
+        case SHAPE_CIRCLE: shapeSize = sizeof(Circle); break;
+        case SHAPE_TRIANGLE: shapeSize = sizeof(Triangle); break;
+        case SHAPE_BORDER: shapeSize = sizeof(Border); break;
+        case SHAPE_RING: shapeSize = sizeof(Ring); break;
+        case SHAPE_LINE: shapeSize = sizeof(Line); break;
+        default: return;
+        }
+        uint32_t type = command.type;
+        key = PersistentCache::hash(&type, sizeof(type), key);
+        key = PersistentCache::hash(&command.shape, shapeSize, key);
+    }
+    uint32_t vertexSize = sizeof(Vertex);
+    float whiteU = atlas.whiteU();
+    key = PersistentCache::hash(&vertexSize, sizeof(vertexSize), key);
+    key = PersistentCache::hash(&whiteU, sizeof(whiteU), key);
+
+    element.atlasGeneration = atlas.getGeneration();
+    const uint8_t* cached = nullptr;
+    size_t cachedSize = 0;
+    if (cache && cache->find(PersistentCache::KIND_GEOMETRY, key, cached, cachedSize) && loadElementGeometry(cached, cachedSize, element)) {
+        element.prebuilt = true;
+        return;
     }
-    std::sort(sortedElements.begin(), sortedElements.end(), [](const Element& a, const Element& b) {
-        return a.priority > b.priority;
-    });
 
-    for (const auto& element : sortedElements) {
+    GeometryBatch elementBatch(atlas);
+    for (const DrawCommand& command : element.commands) {
+        elementBatch.add(command);
+    }
+    element.vertices.swap(elementBatch.vertices);
+    element.indices.swap(elementBatch.indices);
+    element.items.swap(elementBatch.items);
+    element.prebuilt = true;
+
+    if (cache) {
+        std::vector<uint8_t> geometry;
+        storeElementGeometry(element, geometry);
+        cache->put(PersistentCache::KIND_GEOMETRY, key, geometry.data(), geometry.size());
+    }
+}
+
+void DX11Renderer::drawElementGeometry(Element& element) {
+    if (element.prebuilt && element.atlasGeneration != atlas.getGeneration()) {
+        prebuildElement(element);
+    }
+    if (!element.prebuilt) {
         for (const auto& command : element.commands) {
             draw(command);
         }
+        return;
+    }
+    batch.addPrebuilt(element.vertices.data(), element.indices.data(), element.items.data(), static_cast<uint32_t>(element.items.size()));
+}
+
+bool DX11Renderer::loadAtlas(uint64_t assetKey) {
+    const uint8_t* cached = nullptr;
+    size_t cachedSize = 0;
+    return cache && cache->find(PersistentCache::KIND_ATLAS, assetKey, cached, cachedSize) && atlas.restore(cached, cachedSize);
+}
+
+void DX11Renderer::storeAtlas(uint64_t assetKey) {
+    if (!cache) {
+        return;
+    }
+    std::vector<uint8_t> page;
+    atlas.serialize(page);
+    cache->put(PersistentCache::KIND_ATLAS, assetKey, page.data(), page.size());
+}
+
+void DX11Renderer::drawAllElements() {
+    // Sorted by pointer, elements carry their tessellated geometry and are not copied.
+    std::vector<Element*> sortedElements;
+    for (auto& pair : elements) {
+        sortedElements.push_back(&pair.second);
+    }
+    std::sort(sortedElements.begin(), sortedElements.end(), [](const Element* a, const Element* b) {
+        return a->priority > b->priority;
+    });
+
+    for (Element* element : sortedElements) {
+        drawElementGeometry(*element);
     }
 }
 
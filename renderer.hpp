@@ -2,6 +2,8 @@
 #include <iostream>
 #include <windows.h>
 #include <d3d11.h>
+#include <d3d11_1.h>
+#include <dxgi1_2.h>
 #include <d3dcompiler.h>
 #include <DirectXMath.h>
 #include <string>
@@ -9,6 +11,13 @@
 #include <dwmapi.h>
 #include <vector>
 #include <map>
+#include <atomic>
+#include <chrono>
+#include "backend.hpp"
+#include "atlas.hpp"
+#include "geometry.hpp"
+#include "graph.hpp"
+#include "cache.hpp"
 
 #pragma comment(lib, "dwmapi.lib")
 #pragma comment(lib, "d3d11.lib")
@@ -17,131 +26,263 @@
 using namespace DirectX;
 
 
-class DX11Renderer {
+class DX11Renderer : public RenderBackend {
 public:
-    struct Vertex {
-        XMFLOAT3 position;
-        XMFLOAT4 color;
-    };
-    struct Color {
-        float r, g, b, a;
-        Color(float red, float green, float blue, float alpha) : r(red), g(green), b(blue), a(alpha) {}
-    };
-
-    struct Rectangle {
-        float x, y, width, height;
-        float rounding;
-        Color color;
-
-        Rectangle(float x, float y, float width, float height, float rounding, Color color)
-            : x(x), y(y), width(width), height(height), rounding(rounding), color(color) {}
-    };
-
-    struct Circle {
-        float centerX, centerY, radius;
-        Color color;
-        int segments;
-
-        Circle(float centerX, float centerY, float radius, Color color, int segments = 64)
-            : centerX(centerX), centerY(centerY), radius(radius), color(color), segments(segments) {}
-    };
-
-    struct Triangle {
-        float x1, y1, x2, y2, x3, y3;
-        Color color;
-
-        Triangle(float x1, float y1, float x2, float y2, float x3, float y3, Color color)
-            : x1(x1), y1(y1), x2(x2), y2(y2), x3(x3), y3(y3), color(color) {}
-    };
-
-    union Shape {
-        Rectangle rectangle;
-        Circle circle;
-        Triangle triangle;
-
-        Shape() {}
-        ~Shape() {}
-    };
-
-    enum ShapeType {
-        SHAPE_RECTANGLE,
-        SHAPE_CIRCLE,
-        SHAPE_TRIANGLE
-    };
-
-    struct DrawCommand {
-        ShapeType type;
-        Shape shape;
-
-        DrawCommand() : type(SHAPE_RECTANGLE) {}
-
-        static DrawCommand CreateRectangle(float x, float y, float width, float height, float rounding, Color color) {
-            DrawCommand command;
-            command.type = SHAPE_RECTANGLE;
-            command.shape.rectangle = Rectangle(x, y, width, height, rounding, color);
-            return command;
-        }
-
-        static DrawCommand CreateCircle(float centerX, float centerY, float radius, Color color, int segments = 48) {
-            DrawCommand command;
-            command.type = SHAPE_CIRCLE;
-            command.shape.circle = Circle(centerX, centerY, radius, color, segments);
-            return command;
-        }
-
-        static DrawCommand CreateTriangle(float x1, float y1, float x2, float y2, float x3, float y3, Color color) {
-            DrawCommand command;
-            command.type = SHAPE_TRIANGLE;
-            command.shape.triangle = Triangle(x1, y1, x2, y2, x3, y3, color);
-            return command;
-        }
+    struct FrameStats {
+        UINT drawCalls = 0;
+        UINT vertices = 0;
+        UINT indices = 0;
+        UINT opaqueIndices = 0;
+        UINT uploadedBytes = 0;         // vertex, index and shadow bytes copied to the GPU
+        UINT uploadRanges = 0;
+        UINT reusedCommands = 0;        // copied from the previous frame, see GeometryBatch::setRetained
+        UINT recoloredCommands = 0;
+        UINT stateChanges = 0;          // texture and blend state binds of the translucent draws
+        UINT unsortedStateChanges = 0;  // the same in painter order, see setStateSorting
+        UINT damageRects = 0;           // scissored passes of a partial frame, 0 for whole frames
     };
 
     struct Element {
         std::string name;
         int priority;
         std::vector<DrawCommand> commands;
+        // Tessellated once by registerElement() and drawn as is from then on. Elements with
+        // images, polylines or graphs are not, their geometry depends on more than commands.
+        bool prebuilt;
+        uint32_t atlasGeneration;
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+        std::vector<GeometryBatch::Item> items;
 
-        Element() : name(""), priority(0), commands({}) {}
+        Element() : name(""), priority(0), commands({}), prebuilt(false), atlasGeneration(0) {}
 
         Element(const std::string& name, int priority, const std::vector<DrawCommand>& commands)
-            : name(name), priority(priority), commands(commands) {}
+            : name(name), priority(priority), commands(commands), prebuilt(false), atlasGeneration(0) {}
     };
 
 
     DX11Renderer(HWND hwnd);
+
+    // Takes shader bytecode, element geometry and atlas pages from the cache and adds what it
+    // had to build. Set before initD3D11() so the shaders are covered too; saving the cache
+    // is left to the caller.
+    void setCache(PersistentCache* persistentCache) { cache = persistentCache; }
+    // Asks initD3D11() for a flip model swap chain, which damage rendering needs. Off by
+    // default: flip model chains do not blend per-pixel alpha into a WS_EX_LAYERED window,
+    // so overlays keep the single buffer DISCARD chain and draw whole frames.
+    void setFlipModel(bool enable) { flipModelRequested = enable; }
     ~DX11Renderer();
 
     void registerElement(const std::string& name, int priority, const std::vector<DrawCommand>& commands);
     void drawAllElements();
     void drawElement(const std::string& name);
     void clearElements();
-    void draw(const DrawCommand& command);
+    void draw(const DrawCommand& command) override;
     void initD3D11();
-    void clearScreen(float r, float g, float b, float a);
-    void present();
+    void clearScreen(float r, float g, float b, float a) override;
+    void present() override;
+    // Presents with a sync interval of 1.
+    bool presentWaitsForVsync() const override { return true; }
     void drawRectangle(float x, float y, float width, float height, const Color& color);
     void drawTriangle(float x1, float y1, float x2, float y2, float x3, float y3, const Color& color);
     void drawCircle(float centerX, float centerY, float radius, const Color& color, int segments = 64);
     void drawRoundedRectangle(float x, float y, float width, float height, float radius, const Color& color, int segments = 64);
-    void setWindowClickThrough(bool enable);
+    void drawImage(float x, float y, float width, float height, int imageId, const Color& tint = Color(1.0f, 1.0f, 1.0f, 1.0f));
+    void drawBorder(float x, float y, float width, float height, float rounding, float thickness, const Color& color, int segments = 32);
+    void drawRing(float centerX, float centerY, float radius, float thickness, const Color& color, int segments = 64);
+    void drawLine(float x1, float y1, float x2, float y2, float thickness, const Color& color);
+    void drawPolyline(const float* points, uint32_t pointCount, float thickness, const Color& color, JoinStyle join = JOIN_MITER);
+    void drawGraph(const LiveGraph& graph, float x, float y);
+    void drawPath(const VectorPath& path, float x, float y, const Color& color);
+    void setWindowClickThrough(bool enable) override;
+
+    // Layers are render target textures, see RenderBackend. They hold premultiplied color and
+    // are composited with a blend state of their own.
+    int createLayer(int width, int height) override;
+    void destroyLayer(int layerId) override;
+    bool beginLayer(int layerId, float x, float y) override;
+    void endLayer() override;
+
+    // Late groups are tessellated into a batch of their own and drawn by present() with one
+    // constant buffer update per pointer group, see RenderBackend. Not inside layers.
+    void setPointerSource(PointerSource source) override { pointerSource = source; }
+    bool beginLateGroup(LateGroupKind kind, float x, float y, float width, float height) override;
+    void endLateGroup() override;
+
+    // Translation slots live in a constant buffer that flush() rewrites when an offset
+    // changed, see RenderBackend. The offsets in effect at flush() apply to the whole batch;
+    // late groups use slot 0.
+    bool setTranslation(uint32_t slot, float x, float y) override;
+    void useTranslation(uint32_t slot) override { batch.useTranslation(slot); }
+
+    // Damage rendering needs the flip model swap chain, Present1 and ClearView; without
+    // them, e.g. without setFlipModel(true), before Windows 8 or where the window rejects
+    // flip model, getBackBuffer() returns false. A partial frame clears the redraw rectangles with ClearView, draws
+    // every flush to the screen once per rectangle with the scissor set to it and passes
+    // the dirty rectangles to Present1. Late groups are not clipped.
+    bool getBackBuffer(int& width, int& height, uint32_t& age) override;
+    void setDamage(const DamageRect* redraw, size_t redrawCount, const DamageRect* dirty, size_t dirtyCount) override;
+
+    // Images are packed into the shared atlas, the returned id is used by CreateImage/drawImage.
+    int createImage(int width, int height, const uint8_t* rgba);
+    void destroyImage(int imageId);
+    TextureAtlas& getAtlas() { return atlas; }
+    TextureAtlas::Stats getAtlasStats() const { return atlas.getStats(); }
+    // Atlas pages cached under a key the caller derives from its image sources. loadAtlas()
+    // replaces the atlas, image ids included, and returns false on a cache miss; build the
+    // images then and call storeAtlas().
+    bool loadAtlas(uint64_t assetKey);
+    void storeAtlas(uint64_t assetKey);
+
+    // Submits everything drawn since the last flush, present() does this implicitly.
+    void flush();
+    // Draws opaque shapes front to back with depth testing before the translucent ones so
+    // hidden fragments are rejected early. Enabled by default, output is identical either way.
+    void setDepthPrepass(bool enable) { depthPrepass = enable; }
+    // Keeps last frame's geometry and uploads only the vertex and index ranges that changed.
+    // Enabled by default, turning it off re-tessellates and uploads everything every frame.
+    void setPartialUploads(bool enable);
+    // Groups translucent shapes by the texture they sample where they do not overlap, so
+    // composited layers do not split the frame into many draws. Enabled by default.
+    void setStateSorting(bool enable) { batch.setStateSorting(enable); }
+    const FrameStats& getLastFrameStats() const { return lastFrameStats; }
+
+    // When the present-th call to present() (counted from 0) reached the screen according to
+    // DXGI frame statistics, in QueryPerformanceCounter nanoseconds. False while DXGI has not
+    // reported it yet, or when the swap chain provides no statistics.
+    bool getPresentDisplayTime(uint64_t present, uint64_t& displayedNs);
+
+    // From construction to the first present() returning, 0 until then. Any thread.
+    double getTimeToFirstFrameMs() const { return timeToFirstFrameMs.load(std::memory_order_relaxed); }
 
 private:
     HWND hwnd;
     ID3D11Device* d3dDevice = nullptr;
     ID3D11DeviceContext* d3dContext = nullptr;
     IDXGISwapChain* swapChain = nullptr;
+    bool flipModelRequested = false;
+    // Only with a flip model swap chain, for damage rendering.
+    IDXGISwapChain1* swapChain1 = nullptr;
+    ID3D11DeviceContext1* d3dContext1 = nullptr;
+    ID3D11RasterizerState* scissorState = nullptr;
     ID3D11RenderTargetView* renderTargetView = nullptr;
     ID3D11Buffer* vertexBuffer = nullptr;
     std::map<std::string, Element> elements;
 
+    TextureAtlas atlas;
+    GeometryBatch batch;
+    FrameStats frameStats;
+    FrameStats lastFrameStats;
+    size_t vertexCapacity = 0;
+    size_t indexCapacity = 0;
+    size_t shadowCapacity = 0;
+    uint32_t atlasGeneration = 0;
+    float viewportWidth = 0.0f;
+    float viewportHeight = 0.0f;
+    float viewportOriginX = 0.0f;
+    float viewportOriginY = 0.0f;
+    bool depthPrepass = true;
+    bool partialUploads = true;
+    std::vector<uint32_t> orderedIndices;
+    UploadMirror vertexMirror;
+    UploadMirror indexMirror;
+    std::vector<size_t> vertexSegments;
+    std::vector<UploadMirror::Range> dirtyRanges;
+    std::vector<GeometryBatch::TextureRun> textureRuns;
+    PersistentCache* cache = nullptr;
+    std::chrono::time_point<std::chrono::steady_clock> createdTime;
+    std::atomic<double> timeToFirstFrameMs{ 0.0 };
+
+    struct DisplayedPresent {
+        UINT dxgiPresent;
+        LONGLONG syncQpcTime;
+    };
+
+    static const size_t PRESENT_HISTORY = 64;
+    uint64_t presentCount = 0;
+    UINT presentIds[PRESENT_HISTORY] = {};                  // DXGI present count of our presents
+    DisplayedPresent displayedPresents[PRESENT_HISTORY] = {};
+    size_t displayedCount = 0;
+
+    struct LayerTarget {
+        ID3D11Texture2D* texture;
+        ID3D11RenderTargetView* targetView;
+        ID3D11ShaderResourceView* shaderView;
+        int width, height;
+    };
+
+    // Indexed by layer id, destroyed layers keep their slot with a null texture.
+    std::vector<LayerTarget> layers;
+    int activeLayer = -1;
+    float layerOriginX = 0.0f;
+    float layerOriginY = 0.0f;
+
+    struct LateGroup {
+        LateGroupKind kind;
+        float x, y, width, height;
+        uint32_t firstIndex, indexCount;
+    };
+
+    GeometryBatch lateBatch;
+    std::vector<LateGroup> lateGroups;
+    bool lateGroupOpen = false;
+    PointerSource pointerSource;
+    float latchedPointerX = 0.0f;
+    float latchedPointerY = 0.0f;
+    size_t lateVertexCapacity = 0;
+    size_t lateIndexCapacity = 0;
+    std::vector<GeometryBatch::Translation> uploadedTranslations;
+
+    // The back buffer a flip model chain hands out again holds the frame presented this
+    // many presents earlier.
+    enum { SWAP_CHAIN_BUFFERS = 2 };
+    UINT backBufferWidth = 0;
+    UINT backBufferHeight = 0;
+    uint32_t presentedBuffers = 0;      // presents in a row that reached the chain
+    bool damageActive = false;
+    std::vector<D3D11_RECT> redrawRects;
+    std::vector<RECT> dirtyRects;
+
+    void releaseLayer(LayerTarget& layer);
     void createRenderTarget();
     void createBlendState();
+    void createDepthBuffer(UINT width, UINT height);
     void createVertexBuffer(size_t vertexCount, size_t indexCount = 0);
+    void uploadRanges(ID3D11Buffer* buffer, const void* data, const std::vector<UploadMirror::Range>& ranges);
+    void uploadShadows(const std::vector<AnalyticShadow::Params>& shadows);
+    void uploadTranslations();
+    void drawLateGroups();
+    bool createDynamicBuffer(ID3D11Buffer*& buffer, size_t& capacity, size_t bytes, UINT bindFlags);
+    void writeViewportConstants(float originX, float originY);
     void createShaders();
+    // Compiled bytecode of source, from the cache when it has it.
+    bool shaderBytecode(const char* source, const char* profile, std::vector<uint8_t>& bytecode);
+    void prebuildElement(Element& element);
+    void drawElementGeometry(Element& element);
+    void createSampler();
+    void createDamageState();
+    void uploadAtlas();
+    void updateViewport();
 
     ID3D11VertexShader* vertexShader = nullptr;
     ID3D11PixelShader* pixelShader = nullptr;
     ID3D11InputLayout* inputLayout = nullptr;
     ID3D11Buffer* indexBuffer = nullptr;
+    ID3D11Buffer* constantBuffer = nullptr;
+    ID3D11Buffer* translationBuffer = nullptr;
+    ID3D11Texture2D* atlasTexture = nullptr;
+    ID3D11ShaderResourceView* atlasView = nullptr;
+    ID3D11Buffer* shadowBuffer = nullptr;
+    ID3D11Buffer* lateVertexBuffer = nullptr;
+    ID3D11Buffer* lateIndexBuffer = nullptr;
+    ID3D11ShaderResourceView* shadowView = nullptr;
+    ID3D11SamplerState* samplerState = nullptr;
+    ID3D11Texture2D* depthTexture = nullptr;
+    ID3D11DepthStencilView* depthView = nullptr;
+    ID3D11DepthStencilState* opaqueDepthState = nullptr;
+    ID3D11DepthStencilState* translucentDepthState = nullptr;
+    ID3D11DepthStencilState* noDepthState = nullptr;
+    ID3D11BlendState* screenBlendState = nullptr;
+    ID3D11BlendState* layerBlendState = nullptr;
+    ID3D11BlendState* compositeBlendState = nullptr;
 };
\ No newline at end of file
@@ -0,0 +1,56 @@
+#include "shadow.hpp"
+#include <algorithm>
+#include <cmath>
+
+const float AnalyticShadow::MIN_SIGMA = 0.5f;
+
+// Abramowitz and Stegun 7.1.27, what the pixel shader uses too.
+static float approximateErf(float x) {
+    float sign = x < 0.0f ? -1.0f : 1.0f;
+    float a = std::fabs(x);
+    float t = 1.0f + (0.278393f + (0.230389f + 0.078108f * (a * a)) * a) * a;
+    t *= t;
+    return sign - sign / (t * t);
+}
+
+static float gaussian(float x, float sigma) {
+    return std::exp(-(x * x) / (2.0f * sigma * sigma)) / (2.50662827f * sigma);
+}
+
+// Blurred coverage along x of the box row at height y, relative to the center.
+static float shadowRow(float x, float y, float sigma, float corner, float halfWidth, float halfHeight) {
+    float delta = (std::min)(halfHeight - corner - std::fabs(y), 0.0f);
+    float curved = halfWidth - corner + std::sqrt((std::max)(0.0f, corner * corner - delta * delta));
+    float scale = 0.70710678f / sigma;
+    return 0.5f * (approximateErf((x + curved) * scale) - approximateErf((x - curved) * scale));
+}
+
+AnalyticShadow::Params AnalyticShadow::fromShadow(const RenderBackend::Shadow& shadow) {
+    Params params;
+    params.halfWidth = (std::max)(shadow.width / 2.0f + shadow.spread, 0.0f);
+    params.halfHeight = (std::max)(shadow.height / 2.0f + shadow.spread, 0.0f);
+    params.centerX = shadow.x + shadow.offsetX + shadow.width / 2.0f;
+    params.centerY = shadow.y + shadow.offsetY + shadow.height / 2.0f;
+    params.corner = (std::min)((std::max)(shadow.rounding + shadow.spread, 0.0f), (std::min)(params.halfWidth, params.halfHeight));
+    params.sigma = (std::max)(shadow.blur / 2.0f, MIN_SIGMA);
+    params.reserved0 = 0.0f;
+    params.reserved1 = 0.0f;
+    return params;
+}
+
+float AnalyticShadow::coverage(const Params& params, float x, float y) {
+    x -= params.centerX;
+    y -= params.centerY;
+
+    // Rows further than 3 sigma away or outside the box contribute nothing.
+    float start = (std::min)((std::max)(-3.0f * params.sigma, y - params.halfHeight), y + params.halfHeight);
+    float end = (std::min)((std::max)(3.0f * params.sigma, y - params.halfHeight), y + params.halfHeight);
+    float step = (end - start) / 4.0f;
+    float row = start + step * 0.5f;
+    float value = 0.0f;
+    for (int i = 0; i < 4; ++i) {
+        value += shadowRow(x, y - row, params.sigma, params.corner, params.halfWidth, params.halfHeight) * gaussian(row, params.sigma) * step;
+        row += step;
+    }
+    return value;
+}
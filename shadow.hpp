@@ -0,0 +1,25 @@
+#pragma once
+#include "backend.hpp"
+
+// Closed form drop shadows. The shadow box, a rounded rectangle, is convolved with a Gaussian:
+// exactly along x for every row of the box (an erf approximation, error below 5e-4), and
+// with four Gaussian weighted rows along y, which is what keeps rounded corners cheap.
+// The pixel shader evaluates the same formula; this is its CPU reference, so headless
+// tests can check shadows without a GPU.
+class AnalyticShadow {
+public:
+    // Per shadow data handed to the pixel shader, two float4.
+    struct Params {
+        float centerX, centerY, halfWidth, halfHeight;
+        float corner, sigma, reserved0, reserved1;
+    };
+
+    // Sharper shadows are clamped to this sigma, roughly an anti-aliased edge.
+    static const float MIN_SIGMA;
+
+    static Params fromShadow(const RenderBackend::Shadow& shadow);
+    // How far the shadow reaches beyond its box, where the Gaussian is cut off at 3 sigma.
+    static float extent(const Params& params) { return 3.0f * params.sigma; }
+    // Shadow opacity at pixel space x, y, from 0 to 1 before the color's alpha is applied.
+    static float coverage(const Params& params, float x, float y);
+};
@@ -0,0 +1,87 @@
+#pragma once
+#include "backend.hpp"
+#include <algorithm>
+#include <vector>
+
+// Built-in styles as plain types. A static style is a type with
+//     static void emit(const RenderBackend::Rectangle& bounds, const RenderBackend::Color& accentColor, std::vector<RenderBackend::DrawCommand>& out);
+// registered with ezUI::registerStyle<S>(name). emit appends its commands to out, which ezUI
+// reuses between widgets, so drawing a static style never allocates. The built-in styles
+// below are dispatched with a switch (emitBuiltInStyle), a direct call the compiler can
+// inline; other static styles are called through a function pointer.
+
+struct DefaultContainerStyle {
+    static void emit(const RenderBackend::Rectangle& bounds, const RenderBackend::Color& accentColor, std::vector<RenderBackend::DrawCommand>& out) {
+        RenderBackend::Color borderColor(0.15f, 0.15f, 0.15f, 1.0f);
+        RenderBackend::Color backgroundColor(0.2f, 0.2f, 0.2f, 1.0f);
+
+        // border, only the 2px ring around the container so the interior is shaded once
+        out.push_back(RenderBackend::DrawCommand::CreateBorder(bounds.x - 2, bounds.y - 2, bounds.width + 4, bounds.height + 4, bounds.rounding + 2, 2, borderColor));
+        // core container
+        out.push_back(RenderBackend::DrawCommand::CreateRectangle(bounds.x, bounds.y, bounds.width, bounds.height, bounds.rounding, backgroundColor));
+    }
+};
+
+// DefaultContainerStyle lifted off the background by a soft drop shadow below it.
+struct ShadowedContainerStyle {
+    static void emit(const RenderBackend::Rectangle& bounds, const RenderBackend::Color& accentColor, std::vector<RenderBackend::DrawCommand>& out) {
+        RenderBackend::Color shadowColor(0.0f, 0.0f, 0.0f, 0.5f);
+
+        // one analytic shadow quad, drawn first so the container covers its inner part
+        out.push_back(RenderBackend::DrawCommand::CreateShadow(bounds.x - 2, bounds.y - 2, bounds.width + 4, bounds.height + 4, bounds.rounding + 2, 0, 4, 12, 0, shadowColor));
+        DefaultContainerStyle::emit(bounds, accentColor, out);
+    }
+};
+
+struct DefaultButtonStyle {
+    static void emit(const RenderBackend::Rectangle& bounds, const RenderBackend::Color& accentColor, std::vector<RenderBackend::DrawCommand>& out) {
+        RenderBackend::Color borderColor(0.15f, 0.15f, 0.15f, 1.0f);
+
+        //border
+        out.push_back(RenderBackend::DrawCommand::CreateBorder(bounds.x - 2, bounds.y - 2, bounds.width + 4, bounds.height + 4, bounds.rounding + 2, 2, borderColor));
+        //button
+        out.push_back(RenderBackend::DrawCommand::CreateRectangle(bounds.x, bounds.y, bounds.width, bounds.height, bounds.rounding, accentColor));
+    }
+};
+
+struct DefaultListStyle {
+    static void emit(const RenderBackend::Rectangle& bounds, const RenderBackend::Color& accentColor, std::vector<RenderBackend::DrawCommand>& out) {
+        out.push_back(RenderBackend::DrawCommand::CreateRectangle(bounds.x, bounds.y, bounds.width, bounds.height, bounds.rounding, accentColor));
+    }
+};
+
+struct DefaultListRowStyle {
+    static void emit(const RenderBackend::Rectangle& bounds, const RenderBackend::Color& accentColor, std::vector<RenderBackend::DrawCommand>& out) {
+        // leave a 1px gap so adjacent rows stay distinguishable
+        out.push_back(RenderBackend::DrawCommand::CreateRectangle(bounds.x, bounds.y, bounds.width, (std::max)(bounds.height - 1.0f, 0.0f), 0.0f, accentColor));
+    }
+};
+
+enum BuiltInStyle {
+    STYLE_CUSTOM,           // not built in, called through its function pointer
+    STYLE_DEFAULT_CONTAINER,
+    STYLE_SHADOWED_CONTAINER,
+    STYLE_DEFAULT_BUTTON,
+    STYLE_DEFAULT_LIST,
+    STYLE_DEFAULT_LIST_ROW
+};
+
+// Which BuiltInStyle a style type is, resolved when it is registered.
+template <typename S> struct BuiltInStyleOf { static const BuiltInStyle value = STYLE_CUSTOM; };
+template <> struct BuiltInStyleOf<DefaultContainerStyle> { static const BuiltInStyle value = STYLE_DEFAULT_CONTAINER; };
+template <> struct BuiltInStyleOf<ShadowedContainerStyle> { static const BuiltInStyle value = STYLE_SHADOWED_CONTAINER; };
+template <> struct BuiltInStyleOf<DefaultButtonStyle> { static const BuiltInStyle value = STYLE_DEFAULT_BUTTON; };
+template <> struct BuiltInStyleOf<DefaultListStyle> { static const BuiltInStyle value = STYLE_DEFAULT_LIST; };
+template <> struct BuiltInStyleOf<DefaultListRowStyle> { static const BuiltInStyle value = STYLE_DEFAULT_LIST_ROW; };
+
+// Returns false for STYLE_CUSTOM, which has nothing to call here.
+inline bool emitBuiltInStyle(BuiltInStyle style, const RenderBackend::Rectangle& bounds, const RenderBackend::Color& accentColor, std::vector<RenderBackend::DrawCommand>& out) {
+    switch (style) {
+    case STYLE_DEFAULT_CONTAINER: DefaultContainerStyle::emit(bounds, accentColor, out); return true;
+    case STYLE_SHADOWED_CONTAINER: ShadowedContainerStyle::emit(bounds, accentColor, out); return true;
+    case STYLE_DEFAULT_BUTTON: DefaultButtonStyle::emit(bounds, accentColor, out); return true;
+    case STYLE_DEFAULT_LIST: DefaultListStyle::emit(bounds, accentColor, out); return true;
+    case STYLE_DEFAULT_LIST_ROW: DefaultListRowStyle::emit(bounds, accentColor, out); return true;
+    default: return false;
+    }
+}
@@ -0,0 +1,685 @@
+// Headless tests for ezUI and its backends. Nothing here needs a GPU or a window; ezUI is
+// driven through NullRenderer or TraceRenderer. Runs every test, or the ones named on the
+// command line, and exits with the number of failed checks.
+#include "ezui.hpp"
+#include "cache.hpp"
+#include "damage.hpp"
+#include "geometry.hpp"
+#include "immediate.hpp"
+#include "shadow.hpp"
+#include "styles.hpp"
+#include "trace.hpp"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <set>
+#include <thread>
+#include <vector>
+
+static std::atomic<int> failures{ 0 };
+
+// Every allocation of the process, so tests can check code paths that must not allocate.
+static std::atomic<size_t> allocations{ 0 };
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+static void check(bool passed, const char* expression, const char* file, int line) {
+    if (!passed) {
+        failures.fetch_add(1, std::memory_order_relaxed);
+        std::printf("  FAILED %s:%d: %s\n", file, line, expression);
+    }
+}
+
+#define CHECK(expression) check((expression), #expression, __FILE__, __LINE__)
+
+// Small random images into an atlas that cannot grow past 64x64, removing some on the way
+// so defragment() runs. Adding must give up with -1 when the page is full, and every image
+// kept must still hold its own pixels wherever repacking moved it.
+static void testAtlasFull() {
+    int rejected = 0;
+    int defragmented = 0;
+    bool pixelsKept = true;
+    for (uint32_t seed = 1; seed <= 8; ++seed) {
+        uint32_t random = seed;
+        auto next = [&](uint32_t range) {
+            random = random * 1664525u + 1013904223u;
+            return (random >> 8) % range;
+        };
+        TextureAtlas atlas(64, 64);
+        std::vector<int> ids;
+        std::vector<uint8_t> shades;
+        for (int i = 0; i < 200; ++i) {
+            int width = 1 + static_cast<int>(next(30));
+            int height = 1 + static_cast<int>(next(30));
+            uint8_t shade = static_cast<uint8_t>(1 + i);
+            std::vector<uint8_t> rgba(static_cast<size_t>(width) * height * 4, shade);
+            int id = atlas.addImage(width, height, rgba.data());
+            if (id < 0) {
+                rejected++;
+            }
+            else {
+                ids.push_back(id);
+                shades.push_back(shade);
+            }
+            if (next(4) == 0 && !ids.empty()) {
+                size_t victim = next(static_cast<uint32_t>(ids.size()));
+                atlas.removeImage(ids[victim]);
+                ids.erase(ids.begin() + victim);
+                shades.erase(shades.begin() + victim);
+            }
+        }
+
+        TextureAtlas::Stats stats = atlas.getStats();
+        CHECK(stats.width == 64 && stats.height == 64);
+        defragmented += stats.defragmentCount;
+        for (size_t i = 0; i < ids.size(); ++i) {
+            TextureAtlas::UVRect uv = atlas.uv(ids[i]);
+            int left = static_cast<int>(uv.u0 * 64.0f + 0.5f);
+            int top = static_cast<int>(uv.v0 * 64.0f + 0.5f);
+            int right = static_cast<int>(uv.u1 * 64.0f + 0.5f);
+            int bottom = static_cast<int>(uv.v1 * 64.0f + 0.5f);
+            for (int y = top; y < bottom; ++y) {
+                for (int x = left; x < right; ++x) {
+                    pixelsKept = pixelsKept && atlas.pixels()[(static_cast<size_t>(y) * 64 + x) * 4] == shades[i];
+                }
+            }
+        }
+    }
+    std::printf("  %d images rejected, %d defragments\n", rejected, defragmented);
+    CHECK(rejected > 0);
+    CHECK(defragmented > 0);
+    CHECK(pixelsKept);
+}
+
+// The default styles stroke their border as a ring around the fill, so every pixel they
+// cover is shaded once. The fill stacked on an enlarged one they replaced shades twice.
+static void testStyleOverdraw() {
+    TextureAtlas atlas;
+    RenderBackend::Color color(0.5f, 0.5f, 0.5f, 1.0f);
+    for (float rounding : { 0.0f, 6.0f }) {
+        RenderBackend::Rectangle bounds(100.0f, 100.0f, 250.0f, 350.0f, rounding, color);
+        std::vector<RenderBackend::DrawCommand> commands;
+        DefaultContainerStyle::emit(bounds, color, commands);
+        DefaultButtonStyle::emit(RenderBackend::Rectangle(400.0f, 100.0f, 120.0f, 40.0f, rounding, color), color, commands);
+        GeometryBatch styled(atlas);
+        for (const RenderBackend::DrawCommand& command : commands) {
+            styled.add(command);
+        }
+
+        GeometryBatch stacked(atlas);
+        stacked.add(RenderBackend::DrawCommand::CreateRectangle(98.0f, 98.0f, 254.0f, 354.0f, rounding + 2.0f, color));
+        stacked.add(RenderBackend::DrawCommand::CreateRectangle(100.0f, 100.0f, 250.0f, 350.0f, rounding, color));
+
+        GeometryBatch::OverdrawStats styledStats = styled.measureOverdraw(640, 480);
+        GeometryBatch::OverdrawStats stackedStats = stacked.measureOverdraw(640, 480);
+        std::printf("  rounding %.0f: default styles %.3f fragments per pixel, stacked fills %.3f\n", rounding, styledStats.perPixel(), stackedStats.perPixel());
+        CHECK(styledStats.coveredPixels > 0);
+        CHECK(styledStats.shadedFragments == styledStats.coveredPixels);
+        CHECK(stackedStats.perPixel() > 1.9);
+    }
+
+    // A ring only covers its outline.
+    GeometryBatch ring(atlas);
+    ring.add(RenderBackend::DrawCommand::CreateRing(100.0f, 100.0f, 50.0f, 5.0f, color));
+    GeometryBatch::OverdrawStats ringStats = ring.measureOverdraw(300, 300);
+    double ringArea = 3.14159265 * (50.0 * 50.0 - 45.0 * 45.0);
+    CHECK(ringStats.shadedFragments == ringStats.coveredPixels);
+    CHECK(std::fabs(static_cast<double>(ringStats.coveredPixels) - ringArea) < ringArea * 0.05);
+}
+
+// Draws a widget as one rectangle of its bounds and color, so a backend sees exactly what
+// the snapshot held.
+struct ProbeStyle {
+    static void emit(const RenderBackend::Rectangle& bounds, const RenderBackend::Color& color, std::vector<RenderBackend::DrawCommand>& out) {
+        out.push_back(RenderBackend::DrawCommand::CreateRectangle(bounds.x, bounds.y, bounds.width, bounds.height, 0.0f, color));
+    }
+};
+
+// Writers post value v to their buttons as bounds (v, id, v, v) followed by color (v, v, v, 1).
+// Applying a change halfway, or mixing changes of two posts, shows up as a widget whose
+// fields disagree, and a widget going back to an older value as a snapshot out of order.
+class SnapshotCheckRenderer : public NullRenderer {
+public:
+    std::atomic<int> tornWidgets{ 0 };
+    std::atomic<int> reorderedWidgets{ 0 };
+    std::vector<float> lastValues;
+
+    explicit SnapshotCheckRenderer(size_t widgetCount) : lastValues(widgetCount, 0.0f) {}
+
+    void draw(const DrawCommand& command) override {
+        NullRenderer::draw(command);
+        if (command.type != SHAPE_RECTANGLE || command.shape.rectangle.color.a != 1.0f) {
+            return;
+        }
+        const Rectangle& bounds = command.shape.rectangle;
+        const Color& color = bounds.color;
+        float value = bounds.x;
+        // The color of the same post may not be applied yet, never a newer one.
+        bool colorMatches = color.r == color.g && color.g == color.b && (color.r == value || color.r == value - 1.0f);
+        if (bounds.width != value || bounds.height != value || !colorMatches) {
+            tornWidgets.fetch_add(1, std::memory_order_relaxed);
+        }
+        size_t id = static_cast<size_t>(bounds.y);
+        if (id < lastValues.size()) {
+            if (value < lastValues[id]) {
+                reorderedWidgets.fetch_add(1, std::memory_order_relaxed);
+            }
+            lastValues[id] = value;
+        }
+    }
+};
+
+static void testConcurrentWriters() {
+    const int WRITERS = 4;
+    const int BUTTONS_PER_WRITER = 64;
+    const int POSTS = 2000;
+    const size_t buttonCount = static_cast<size_t>(WRITERS) * BUTTONS_PER_WRITER;
+
+    SnapshotCheckRenderer renderer(buttonCount);
+    ezUI ui(renderer);
+    ui.registerStyle<ProbeStyle>("probe");
+    // The container is told apart from the buttons by its alpha.
+    ui.addContainer("panel", 0.0f, 0.0f, 1000.0f, 1000.0f, RenderBackend::Color(0.0f, 0.0f, 0.0f, 0.5f), "probe");
+    ui.toggleVisibility("panel");
+    std::vector<std::string> names;
+    for (size_t i = 0; i < buttonCount; ++i) {
+        names.push_back("button" + std::to_string(i));
+        ui.addButton("panel", names.back(), RenderBackend::Rectangle(0.0f, static_cast<float>(i), 0.0f, 0.0f, 0.0f, RenderBackend::Color(0.0f, 0.0f, 0.0f, 1.0f)), nullptr, nullptr, nullptr, "probe");
+    }
+
+    ui.startRenderThread();
+    std::atomic<int> retries{ 0 };
+    std::vector<std::thread> writers;
+    for (int w = 0; w < WRITERS; ++w) {
+        writers.emplace_back([&, w] {
+            for (int v = 1; v <= POSTS; ++v) {
+                float value = static_cast<float>(v);
+                for (int b = 0; b < BUTTONS_PER_WRITER; ++b) {
+                    size_t id = static_cast<size_t>(w) * BUTTONS_PER_WRITER + b;
+                    // A full queue drops the change, retried so every value lands in order.
+                    while (!ui.postBounds(names[id], value, static_cast<float>(id), value, value)) {
+                        retries.fetch_add(1, std::memory_order_relaxed);
+                        std::this_thread::yield();
+                    }
+                    while (!ui.postColor(names[id], RenderBackend::Color(value, value, value, 1.0f))) {
+                        retries.fetch_add(1, std::memory_order_relaxed);
+                        std::this_thread::yield();
+                    }
+                }
+            }
+        });
+    }
+
+    std::atomic<int> writersDone{ 0 };
+    std::thread joiner([&] {
+        for (std::thread& writer : writers) {
+            writer.join();
+        }
+        writersDone.store(1, std::memory_order_release);
+    });
+
+    // The UI thread keeps publishing while the writers post and the render thread draws.
+    uint64_t publishes = 0;
+    double maxPublishMs = 0.0;
+    while (!writersDone.load(std::memory_order_acquire)) {
+        auto start = std::chrono::steady_clock::now();
+        ui.drawAllElements();
+        maxPublishMs = (std::max)(maxPublishMs, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        publishes++;
+    }
+    joiner.join();
+    ui.stopRenderThread();
+
+    ezUI::RenderThreadStats stats = ui.getRenderThreadStats();
+    std::printf("  %llu publishes, %llu frames from %llu snapshots, %d retried posts\n", static_cast<unsigned long long>(publishes),
+        static_cast<unsigned long long>(stats.frames), static_cast<unsigned long long>(stats.snapshots), retries.load());
+    std::printf("  frame %.3f ms max, publish %.3f ms max\n", stats.maxFrameMs, maxPublishMs);
+    CHECK(stats.frames > 0);
+    // NullRenderer does not wait in present(), the same snapshot is not drawn again.
+    CHECK(stats.frames <= stats.snapshots);
+    // Drawing or publishing 257 widgets takes well under a millisecond, this only allows
+    // for the scheduler.
+    CHECK(stats.maxFrameMs < 50.0);
+    CHECK(maxPublishMs < 50.0);
+    CHECK(renderer.tornWidgets.load() == 0);
+    CHECK(renderer.reorderedWidgets.load() == 0);
+
+    // Without the render thread the frame is drawn here, with every post applied.
+    ui.drawAllElements();
+    bool allApplied = true;
+    for (float value : renderer.lastValues) {
+        allApplied = allApplied && value == static_cast<float>(POSTS);
+    }
+    CHECK(allApplied);
+    CHECK(renderer.tornWidgets.load() == 0);
+}
+
+// Checks frame against expectation and prints what differs.
+static bool expectFrame(const TraceRenderer& renderer, uint32_t frame, const TraceRenderer::Expectation& expectation) {
+    std::string failure;
+    if (!renderer.expect(frame, expectation, &failure)) {
+        std::printf("  %s\n", failure.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Default buttons batch into one draw call with a known geometry: the border ring of
+// rounding + 2 is 264 vertices and 792 indices, the square fill 4 and 6, and so is the
+// default container. A recolored button re-uploads the 4 vertices of its fill and nothing
+// else, an unchanged frame nothing at all.
+static void testButtonBatching() {
+    const int BUTTONS = 100;
+    TraceRenderer renderer;
+    ezUI ui(renderer);
+    ui.addContainer("panel", 0.0f, 0.0f, 1000.0f, 1000.0f);
+    ui.toggleVisibility("panel");
+    for (int i = 0; i < BUTTONS; ++i) {
+        ui.addButton("panel", "button" + std::to_string(i), RenderBackend::Rectangle((i % 10) * 50.0f, (i / 10) * 30.0f, 40.0f, 20.0f, 0.0f, RenderBackend::Color(0.5f, 0.5f, 0.5f, 1.0f)));
+    }
+    ui.drawAllElements();
+    TraceRenderer::Expectation first;
+    first.primitives = 2 + 2 * BUTTONS;
+    first.drawCalls = 1;
+    first.vertices = 268 * (BUTTONS + 1);
+    first.indices = 798 * (BUTTONS + 1);
+    CHECK(expectFrame(renderer, 0, first));
+
+    ui.drawAllElements();
+    TraceRenderer::Expectation unchanged;
+    unchanged.drawCalls = 1;
+    unchanged.uploadedBytes = 0;
+    CHECK(expectFrame(renderer, 1, unchanged));
+
+    ui.postColor("button42", RenderBackend::Color(0.7f, 0.7f, 0.7f, 1.0f));
+    ui.drawAllElements();
+    TraceRenderer::Expectation recolored;
+    recolored.drawCalls = 1;
+    recolored.uploadedBytes = 4 * sizeof(GeometryBatch::Vertex);
+    recolored.atMost = true;
+    CHECK(expectFrame(renderer, 2, recolored));
+    CHECK(renderer.summarize(2).uploadedBytes > 0);
+    std::printf("  %llu vertices in 1 draw call, %llu bytes uploaded for a recolor\n", static_cast<unsigned long long>(renderer.summarize(0).vertices),
+        static_cast<unsigned long long>(renderer.summarize(2).uploadedBytes));
+}
+
+// A cache file with one good entry and one whose size wraps offset + size around. The bad
+// entry must be a miss, not a read past the mapping.
+static void testCacheCorruptEntry() {
+    const char* path = "ezui_tests.ezcache";
+    const uint8_t payload[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    const uint64_t offset = sizeof(PersistentCache::FileHeader);
+    PersistentCache::FileHeader header = { PersistentCache::MAGIC, PersistentCache::VERSION, static_cast<uint16_t>(sizeof(header)), 2, 0, offset + sizeof(payload) };
+    PersistentCache::Entry entries[2] = {
+        { PersistentCache::KIND_GEOMETRY, 0, 1, PersistentCache::hash(payload, sizeof(payload)), offset, sizeof(payload) },
+        { PersistentCache::KIND_GEOMETRY, 0, 2, 0, offset, ~0ull - 7 },
+    };
+    std::FILE* file = std::fopen(path, "wb");
+    CHECK(file != nullptr);
+    if (!file) {
+        return;
+    }
+    std::fwrite(&header, sizeof(header), 1, file);
+    std::fwrite(payload, sizeof(payload), 1, file);
+    std::fwrite(entries, sizeof(entries), 1, file);
+    std::fclose(file);
+
+    PersistentCache cache;
+    CHECK(cache.open(path));
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    CHECK(cache.find(PersistentCache::KIND_GEOMETRY, 1, data, size) && size == sizeof(payload) && std::memcmp(data, payload, size) == 0);
+    CHECK(!cache.find(PersistentCache::KIND_GEOMETRY, 2, data, size));
+    CHECK(cache.getStats().loadedEntries == 1);
+    cache.close();
+    std::remove(path);
+}
+
+// Whether x, y lies inside the rounded shadow box.
+static bool insideShadowBox(const AnalyticShadow::Params& params, double x, double y) {
+    double dx = std::fabs(x - params.centerX) - (params.halfWidth - params.corner);
+    double dy = std::fabs(y - params.centerY) - (params.halfHeight - params.corner);
+    if (dx > params.corner || dy > params.corner) {
+        return false;
+    }
+    return dx <= 0.0 || dy <= 0.0 || dx * dx + dy * dy <= static_cast<double>(params.corner) * params.corner;
+}
+
+// The box convolved with a Gaussian by brute force, what the closed form approximates.
+static double convolvedShadow(const AnalyticShadow::Params& params, double x, double y) {
+    double sigma = params.sigma;
+    double step = sigma / 8.0;
+    double covered = 0.0;
+    double total = 0.0;
+    for (double offsetY = -4.0 * sigma; offsetY <= 4.0 * sigma; offsetY += step) {
+        for (double offsetX = -4.0 * sigma; offsetX <= 4.0 * sigma; offsetX += step) {
+            double weight = std::exp(-(offsetX * offsetX + offsetY * offsetY) / (2.0 * sigma * sigma));
+            total += weight;
+            if (insideShadowBox(params, x + offsetX, y + offsetY)) {
+                covered += weight;
+            }
+        }
+    }
+    return covered / total;
+}
+
+// The CPU reference of the shadow pixel shader against a numeric convolution, and the
+// single quad a shadow is drawn as.
+static void testAnalyticShadow() {
+    struct Case {
+        float width, height, rounding, blur, spread;
+    };
+    const Case cases[] = {
+        { 40.0f, 30.0f, 0.0f, 12.0f, 0.0f },
+        { 40.0f, 30.0f, 8.0f, 12.0f, 0.0f },
+        { 20.0f, 20.0f, 10.0f, 4.0f, 2.0f },
+        { 60.0f, 10.0f, 5.0f, 24.0f, 0.0f },
+        { 10.0f, 10.0f, 0.0f, 1.0f, 0.0f },
+    };
+    double maxError = 0.0;
+    for (const Case& shadowCase : cases) {
+        RenderBackend::Shadow shadow(100.0f, 100.0f, shadowCase.width, shadowCase.height, shadowCase.rounding, 0.0f, 4.0f, shadowCase.blur, shadowCase.spread, RenderBackend::Color(0.0f, 0.0f, 0.0f, 1.0f));
+        AnalyticShadow::Params params = AnalyticShadow::fromShadow(shadow);
+        float extent = AnalyticShadow::extent(params);
+        for (float y = params.centerY - params.halfHeight - extent; y <= params.centerY + params.halfHeight + extent; y += 3.7f) {
+            for (float x = params.centerX - params.halfWidth - extent; x <= params.centerX + params.halfWidth + extent; x += 3.7f) {
+                maxError = (std::max)(maxError, std::fabs(AnalyticShadow::coverage(params, x, y) - convolvedShadow(params, x, y)));
+            }
+        }
+        // Cut off at the extent the quad is drawn to.
+        CHECK(AnalyticShadow::coverage(params, params.centerX + params.halfWidth + extent, params.centerY) < 0.005f);
+    }
+    std::printf("  max difference to the convolution %.4f\n", maxError);
+    CHECK(maxError < 0.04);
+
+    TextureAtlas atlas;
+    GeometryBatch batch(atlas);
+    batch.add(RenderBackend::DrawCommand::CreateShadow(10.0f, 10.0f, 50.0f, 50.0f, 4.0f, 0.0f, 4.0f, 12.0f, 0.0f, RenderBackend::Color(0.0f, 0.0f, 0.0f, 0.5f)));
+    CHECK(batch.shadows.size() == 1);
+    CHECK(batch.vertices.size() == 4);
+    CHECK(batch.indices.size() == 6);
+}
+
+// Ids whose home slot in a 128 slot table is home, see ImmediateStateTable::home(): the
+// high byte only reaches bits the mask drops.
+static uint32_t idAtHome(uint32_t home, uint32_t k) {
+    return home | (k << 24);
+}
+
+// Clusters that wrap around the end of the table, swept in patterns that make backward
+// shifts cross it, checked against a reference set. Afterwards the same widgets every frame
+// must not allocate.
+static void testImmediateSweep() {
+    ImmediateStateTable table(64);
+    std::set<uint32_t> live;
+    std::vector<uint32_t> ids;
+    // 3 ids sit at their home 0, 20 at home 124 run over the end past them into slots
+    // 3..18, 10 more at home 2 are pushed behind those, the rest spread out. 53 entries grow
+    // the table to 128 slots once.
+    for (uint32_t k = 1; k <= 3; ++k) {
+        ids.push_back(idAtHome(0, k));
+    }
+    for (uint32_t k = 1; k <= 20; ++k) {
+        ids.push_back(idAtHome(124, k));
+    }
+    for (uint32_t k = 1; k <= 10; ++k) {
+        ids.push_back(idAtHome(2, k));
+    }
+    for (uint32_t k = 1; k <= 20; ++k) {
+        ids.push_back(idAtHome(30 + k * 4, k));
+    }
+
+    uint32_t frame = 1;
+    for (uint32_t id : ids) {
+        table.touch(id, frame);
+        live.insert(id);
+    }
+    CHECK(table.getStats().capacity == 128);
+
+    bool found = true;
+    bool gone = true;
+    uint32_t random = 7;
+    for (int round = 0; round < 200; ++round) {
+        frame++;
+        for (size_t i = 0; i < ids.size(); ++i) {
+            random = random * 1664525u + 1013904223u;
+            // Every other round keeps alternate ids of the wrapping cluster, the rest at random.
+            bool keep = round % 2 ? (random >> 16) % 3 != 0 : i % 2 == 0;
+            if (keep) {
+                table.touch(ids[i], frame);
+                live.insert(ids[i]);
+            }
+            else {
+                live.erase(ids[i]);
+            }
+        }
+        table.sweep(frame);
+        for (uint32_t id : ids) {
+            const ImmediateStateTable::State* state = table.find(id);
+            found = found && (live.count(id) == 0 || (state && state->id == id && state->frame == frame));
+            gone = gone && (live.count(id) != 0 || !state);
+        }
+        CHECK(table.getStats().entries == live.size());
+    }
+    CHECK(found);
+    CHECK(gone);
+    CHECK(table.getStats().capacity == 128);
+
+    size_t before = allocations.load();
+    for (int round = 0; round < 100; ++round) {
+        frame++;
+        for (size_t i = 0; i < ids.size(); i += 2) {
+            table.touch(ids[i], frame).flags = 1;
+        }
+        table.sweep(frame);
+    }
+    std::printf("  %zu allocations in 100 steady frames\n", allocations.load() - before);
+    CHECK(allocations.load() == before);
+    CHECK(table.getStats().entries == (ids.size() + 1) / 2);
+}
+
+// A frame on a fake clock: 4 ms of UI work after handleInput(), 6 ms of rendering before
+// the late latch, during which the pointer moves on, and 1 ms of present.
+class SlowPresentRenderer : public TraceRenderer {
+public:
+    uint64_t& now;
+    int& pointerX;
+    int movedPointerX = 0;
+
+    SlowPresentRenderer(uint64_t& now, int& pointerX) : now(now), pointerX(pointerX) {}
+
+    void present() override {
+        now += 6000000;
+        pointerX = movedPointerX;
+        TraceRenderer::present();
+        now += 1000000;
+    }
+};
+
+// Pointer latency with and without the late latch, on an injected clock and cursor.
+static double pointerLatencyMs(bool lateLatch) {
+    uint64_t now = 1000000000;
+    int pointerX = 0;
+    SlowPresentRenderer renderer(now, pointerX);
+    ezUI ui(renderer);
+    ui.setClock([&] { return now; });
+    ui.setCursorSource([&](int& x, int& y) {
+        x = pointerX;
+        y = 100;
+        return true;
+    });
+    ui.setLateLatch(lateLatch);
+    const uint32_t hoverId = ImmediateId::hash("hover");
+    for (int frame = 0; frame < 200; ++frame) {
+        pointerX = 100 + frame % 40;
+        renderer.movedPointerX = pointerX + 3;
+        ui.handleInput();
+        now += 4000000;
+        ui.button(hoverId, RenderBackend::Rectangle(130.0f, 90.0f, 20.0f, 20.0f, 0.0f, RenderBackend::Color(0.4f, 0.4f, 0.4f, 1.0f)), RenderBackend::Color(0.8f, 0.8f, 0.8f, 1.0f));
+        ui.followPointer(RenderBackend::Rectangle(12.0f, 12.0f, 60.0f, 20.0f, 0.0f, RenderBackend::Color(0.0f, 0.0f, 0.0f, 1.0f)));
+        ui.drawAllElements();
+        renderer.clearLog();
+    }
+    LatencyTracker::Percentiles latency = ui.getInputLatency(LatencyTracker::INPUT_POINTER);
+    CHECK(latency.samples >= 199);
+    return latency.p50Ms;
+}
+
+// Latching the pointer right before present measures from the latch, 1 ms before the frame
+// is out, instead of from handleInput() 11 ms before.
+static void testLateLatchLatency() {
+    double sampled = pointerLatencyMs(false);
+    double latched = pointerLatencyMs(true);
+    std::printf("  pointer latency p50: %.2f ms sampled in handleInput(), %.2f ms late latched\n", sampled, latched);
+    CHECK(std::fabs(sampled - 11.0) < 0.01);
+    CHECK(std::fabs(latched - 1.0) < 0.01);
+}
+
+static bool hasRect(const std::vector<DamageTracker::Rect>& rects, int left, int top, int right, int bottom) {
+    for (const DamageTracker::Rect& rect : rects) {
+        if (rect.left == left && rect.top == top && rect.right == right && rect.bottom == bottom) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// What a changed widget damages through ezUI, and the tracker's buffer age, merging and
+// whole frame rules on their own.
+static void testDamage() {
+    TraceRenderer renderer;
+    renderer.setSwapChain(1920, 1080, 2);
+    ezUI ui(renderer);
+    ui.addContainer("panel", 100.0f, 100.0f, 400.0f, 300.0f);
+    ui.toggleVisibility("panel");
+    ui.addButton("panel", "a", RenderBackend::Rectangle(10.0f, 10.0f, 60.0f, 20.0f, 0.0f, RenderBackend::Color(0.4f, 0.4f, 0.4f, 1.0f)));
+    ui.addButton("panel", "b", RenderBackend::Rectangle(10.0f, 200.0f, 60.0f, 20.0f, 0.0f, RenderBackend::Color(0.4f, 0.4f, 0.4f, 1.0f)));
+    for (int frame = 0; frame < 4; ++frame) {
+        ui.drawAllElements();
+    }
+    CHECK(ui.getDamageStats().damagedPixels == 0);
+
+    // Recolored in place: its bounds, at 110, 110 on screen, and the margin around them.
+    const int margin = ezUI::STYLE_MARGIN;
+    ui.postColor("a", RenderBackend::Color(0.7f, 0.7f, 0.7f, 1.0f));
+    ui.drawAllElements();
+    DamageTracker::Stats stats = ui.getDamageStats();
+    CHECK(stats.damagedPixels == static_cast<uint64_t>((60 + 2 * margin) * (20 + 2 * margin)));
+    CHECK(stats.redrawnPixels == stats.damagedPixels);
+    CHECK(renderer.summarize(renderer.frameCount() - 1).partial);
+
+    // Moved 5 pixels right: the old and the new bounds, which overlap into one rectangle.
+    ui.postBounds("a", 15.0f, 10.0f, 60.0f, 20.0f);
+    ui.drawAllElements();
+    stats = ui.getDamageStats();
+    CHECK(stats.damagedPixels == static_cast<uint64_t>((65 + 2 * margin) * (20 + 2 * margin)));
+    std::printf("  %llu of %llu pixels redrawn after a move\n", static_cast<unsigned long long>(stats.redrawnPixels), static_cast<unsigned long long>(stats.screenPixels));
+
+    // A back buffer two frames old is redrawn with the damage of the frame before as well.
+    DamageTracker tracker;
+    const uint64_t unchanged = 1;
+    const uint64_t changed = 2;
+    for (int frame = 0; frame < 3; ++frame) {
+        tracker.begin(1000, 1000, 2);
+        tracker.add(10.0f, 10.0f, 20.0f, 20.0f, unchanged);
+        tracker.add(500.0f, 500.0f, 520.0f, 520.0f, unchanged);
+        tracker.end();
+    }
+    CHECK(!tracker.isWhole() && tracker.getRedraw().empty());
+    tracker.begin(1000, 1000, 2);
+    tracker.add(10.0f, 10.0f, 20.0f, 20.0f, changed);
+    tracker.add(500.0f, 500.0f, 520.0f, 520.0f, unchanged);
+    tracker.end();
+    tracker.begin(1000, 1000, 2);
+    tracker.add(10.0f, 10.0f, 20.0f, 20.0f, changed);
+    tracker.add(500.0f, 500.0f, 520.0f, 520.0f, changed);
+    tracker.end();
+    CHECK(!tracker.isWhole());
+    CHECK(tracker.getDirty().size() == 1 && hasRect(tracker.getDirty(), 500, 500, 520, 520));
+    CHECK(tracker.getRedraw().size() == 2 && hasRect(tracker.getRedraw(), 10, 10, 20, 20) && hasRect(tracker.getRedraw(), 500, 500, 520, 520));
+    CHECK(tracker.needsRedraw(15.0f, 15.0f, 16.0f, 16.0f) && !tracker.needsRedraw(100.0f, 100.0f, 200.0f, 200.0f));
+
+    // Six changes in one frame end up as MAX_RECTS rectangles: the two pairs with a 2 pixel
+    // gap are merged, they waste the least.
+    const float changes[6][4] = {
+        { 0.0f, 0.0f, 10.0f, 10.0f }, { 12.0f, 0.0f, 22.0f, 10.0f },
+        { 300.0f, 0.0f, 310.0f, 10.0f }, { 312.0f, 0.0f, 322.0f, 10.0f },
+        { 0.0f, 600.0f, 10.0f, 610.0f }, { 600.0f, 600.0f, 610.0f, 610.0f },
+    };
+    DamageTracker merging;
+    for (uint64_t signature = 1; signature <= 3; ++signature) {
+        merging.begin(1000, 1000, 1);
+        for (const float* change : changes) {
+            merging.add(change[0], change[1], change[2], change[3], signature == 3 ? changed : unchanged);
+        }
+        merging.end();
+    }
+    const std::vector<DamageTracker::Rect>& merged = merging.getDirty();
+    CHECK(merged.size() == DamageTracker::MAX_RECTS);
+    CHECK(hasRect(merged, 0, 0, 22, 10) && hasRect(merged, 300, 0, 322, 10) && hasRect(merged, 0, 600, 10, 610) && hasRect(merged, 600, 600, 610, 610));
+
+    // Redrawing more than 3/4 of the screen draws it whole.
+    for (int width : { 70, 80 }) {
+        DamageTracker large;
+        for (uint64_t signature = 1; signature <= 3; ++signature) {
+            large.begin(100, 100, 1);
+            large.add(0.0f, 0.0f, static_cast<float>(width), 100.0f, signature == 3 ? changed : unchanged);
+            large.end();
+        }
+        CHECK(large.isWhole() == (width == 80));
+        CHECK(large.getStats().redrawnPixels == (width == 80 ? 10000u : 7000u));
+    }
+}
+
+struct Test {
+    const char* name;
+    void (*run)();
+};
+
+static const Test tests[] = {
+    { "atlas_full", testAtlasFull },
+    { "style_overdraw", testStyleOverdraw },
+    { "concurrent_writers", testConcurrentWriters },
+    { "button_batching", testButtonBatching },
+    { "cache_corrupt_entry", testCacheCorruptEntry },
+    { "analytic_shadow", testAnalyticShadow },
+    { "immediate_sweep", testImmediateSweep },
+    { "late_latch_latency", testLateLatchLatency },
+    { "damage", testDamage },
+};
+
+int main(int argc, char** argv) {
+    for (const Test& test : tests) {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; ++i) {
+            selected = selected || std::strcmp(argv[i], test.name) == 0;
+        }
+        if (!selected) {
+            continue;
+        }
+        int failed = failures.load();
+        std::printf("%s\n", test.name);
+        test.run();
+        std::printf("%s %s\n", failures.load() == failed ? "ok  " : "FAIL", test.name);
+    }
+    std::printf("%d failed checks\n", failures.load());
+    return failures.load();
+}
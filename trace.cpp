@@ -0,0 +1,465 @@
+#include "trace.hpp"
+#include <cstring>
+
+TraceRenderer::TraceRenderer() : batch(atlas), lateBatch(atlas) {
+    batch.setRetained(partialUploads);
+}
+
+void TraceRenderer::setPartialUploads(bool enable) {
+    partialUploads = enable;
+    batch.setRetained(enable);
+}
+
+int TraceRenderer::createImage(int width, int height, const uint8_t* rgba) {
+    return atlas.addImage(width, height, rgba);
+}
+
+void TraceRenderer::destroyImage(int imageId) {
+    atlas.removeImage(imageId);
+}
+
+void TraceRenderer::log(EventType type, uint32_t detail, uint64_t offset, uint64_t size) {
+    events.push_back({ type, currentFrame, detail, offset, size });
+}
+
+void TraceRenderer::setState(StateKind kind, int64_t value) {
+    // D3D11 binds the same state every flush, only actual changes are logged.
+    int64_t& bound = kind == STATE_DEPTH ? boundDepth : kind == STATE_TEXTURE ? boundTexture : kind == STATE_TARGET ? boundTarget : boundScissor;
+    if (bound == value) {
+        return;
+    }
+    bound = value;
+    log(EVENT_STATE, kind, static_cast<uint64_t>(value));
+}
+
+void TraceRenderer::draw(const DrawCommand& command) {
+    log(EVENT_PRIMITIVE, command.type, commands.size());
+    commands.push_back(command);
+    if (lateGroupOpen) {
+        lateBatch.add(command);
+        return;
+    }
+    batch.add(command);
+}
+
+void TraceRenderer::clearScreen(float r, float g, float b, float a) {
+    flush();
+    // Partial frames only clear their redraw rectangles, if they have any.
+    if (!damageActive) {
+        log(EVENT_CLEAR);
+    }
+    else if (redrawRects > 0) {
+        log(EVENT_CLEAR, static_cast<uint32_t>(redrawRects));
+    }
+}
+
+void TraceRenderer::present() {
+    flush();
+    drawLateGroups();
+    log(EVENT_PRESENT);
+    currentFrame++;
+    presentedBuffers++;
+    damageActive = false;
+    redrawRects = 0;
+}
+
+void TraceRenderer::setSwapChain(int width, int height, uint32_t bufferCount) {
+    swapChainWidth = width;
+    swapChainHeight = height;
+    swapChainBuffers = bufferCount;
+    presentedBuffers = 0;
+}
+
+bool TraceRenderer::getBackBuffer(int& width, int& height, uint32_t& age) {
+    if (swapChainBuffers == 0) {
+        return false;
+    }
+    width = swapChainWidth;
+    height = swapChainHeight;
+    age = presentedBuffers >= swapChainBuffers ? swapChainBuffers : 0;
+    return true;
+}
+
+void TraceRenderer::setDamage(const DamageRect* redraw, size_t redrawCount, const DamageRect* dirty, size_t dirtyCount) {
+    if (swapChainBuffers == 0) {
+        return;
+    }
+    flush();
+    damageActive = true;
+    redrawRects = redrawCount;
+    uint64_t redrawn = 0, dirtied = 0;
+    for (size_t i = 0; i < redrawCount; ++i) {
+        redrawn += static_cast<uint64_t>(redraw[i].area());
+    }
+    for (size_t i = 0; i < dirtyCount; ++i) {
+        dirtied += static_cast<uint64_t>(dirty[i].area());
+    }
+    log(EVENT_DAMAGE, static_cast<uint32_t>(redrawCount), redrawn, dirtied);
+}
+
+int TraceRenderer::createLayer(int width, int height) {
+    for (size_t i = 0; i < liveLayers.size(); ++i) {
+        if (!liveLayers[i]) {
+            liveLayers[i] = true;
+            return static_cast<int>(i);
+        }
+    }
+    liveLayers.push_back(true);
+    return static_cast<int>(liveLayers.size() - 1);
+}
+
+void TraceRenderer::destroyLayer(int layerId) {
+    if (layerId >= 0 && static_cast<size_t>(layerId) < liveLayers.size()) {
+        liveLayers[layerId] = false;
+    }
+}
+
+bool TraceRenderer::beginLayer(int layerId, float x, float y) {
+    if (activeLayer >= 0 || layerId < 0 || static_cast<size_t>(layerId) >= liveLayers.size() || !liveLayers[layerId]) {
+        return false;
+    }
+    flush();
+    activeLayer = layerId;
+    setState(STATE_TARGET, layerId);
+    log(EVENT_CLEAR);
+    return true;
+}
+
+void TraceRenderer::endLayer() {
+    if (activeLayer < 0) {
+        return;
+    }
+    flush();
+    activeLayer = -1;
+    setState(STATE_TARGET, -1);
+}
+
+bool TraceRenderer::beginLateGroup(LateGroupKind kind, float x, float y, float width, float height) {
+    if (!pointerSource || lateGroupOpen || activeLayer >= 0) {
+        return false;
+    }
+    lateGroupOpen = true;
+    lateGroups.push_back({ kind, x, y, width, height, static_cast<uint32_t>(lateBatch.indices.size()), 0 });
+    return true;
+}
+
+bool TraceRenderer::setTranslation(uint32_t slot, float x, float y) {
+    if (slot == 0 || slot >= MAX_TRANSLATIONS) {
+        return false;
+    }
+    if (batch.translations.size() <= slot) {
+        batch.translations.resize(slot + 1, GeometryBatch::Translation());
+    }
+    batch.translations[slot].x = x;
+    batch.translations[slot].y = y;
+    return true;
+}
+
+void TraceRenderer::uploadTranslations() {
+    // Like DX11Renderer::uploadTranslations, the whole table when any slot changed.
+    const std::vector<GeometryBatch::Translation>& translations = batch.translations;
+    size_t size = sizeof(GeometryBatch::Translation) * translations.size();
+    if (translations.empty() || (translations.size() == uploadedTranslations.size() && memcmp(translations.data(), uploadedTranslations.data(), size) == 0)) {
+        return;
+    }
+    uploadedTranslations = translations;
+    log(EVENT_TRANSLATION_UPLOAD, 0, translations.size(), size);
+}
+
+void TraceRenderer::endLateGroup() {
+    if (!lateGroupOpen) {
+        return;
+    }
+    lateGroupOpen = false;
+    LateGroup& group = lateGroups.back();
+    group.indexCount = static_cast<uint32_t>(lateBatch.indices.size()) - group.firstIndex;
+}
+
+void TraceRenderer::drawLateGroups() {
+    lateGroupOpen = false;
+    if (lateGroups.empty() || lateBatch.empty()) {
+        lateGroups.clear();
+        lateBatch.clear();
+        return;
+    }
+
+    // Same order as DX11Renderer::drawLateGroups: latch, upload everything, draw the groups.
+    uploadAtlas();
+    float pointerX = latchedPointerX;
+    float pointerY = latchedPointerY;
+    bool answered = pointerSource && pointerSource(pointerX, pointerY);
+    if (answered) {
+        latchedPointerX = pointerX;
+        latchedPointerY = pointerY;
+    }
+    log(EVENT_LATCH, answered ? 1 : 0, static_cast<uint64_t>(static_cast<int64_t>(latchedPointerX)), static_cast<uint64_t>(static_cast<int64_t>(latchedPointerY)));
+    log(EVENT_VERTEX_UPLOAD, 0, 0, sizeof(Vertex) * lateBatch.vertices.size());
+    log(EVENT_INDEX_UPLOAD, 0, 0, sizeof(uint32_t) * lateBatch.indices.size());
+    if (!lateBatch.shadows.empty()) {
+        log(EVENT_SHADOW_UPLOAD, 0, lateBatch.shadows.size(), sizeof(AnalyticShadow::Params) * lateBatch.shadows.size());
+    }
+    uploadTranslations();
+
+    setState(STATE_TEXTURE, atlasGeneration);
+    setState(STATE_DEPTH, DEPTH_NONE);
+    for (const LateGroup& group : lateGroups) {
+        if (group.indexCount == 0) {
+            continue;
+        }
+        if (group.kind == LATE_HOVER && !(latchedPointerX >= group.x && latchedPointerX <= group.x + group.width && latchedPointerY >= group.y && latchedPointerY <= group.y + group.height)) {
+            continue;
+        }
+        log(EVENT_DRAW, 0, group.firstIndex, group.indexCount);
+    }
+    lateGroups.clear();
+    lateBatch.clear();
+}
+
+void TraceRenderer::uploadAtlas() {
+    TextureAtlas::Region region;
+    if (atlasUploaded && atlasGeneration == atlas.getGeneration()) {
+        if (atlas.takeDirtyRegion(region)) {
+            log(EVENT_ATLAS_UPLOAD, 0, 0, static_cast<uint64_t>(region.width) * region.height * 4);
+        }
+        return;
+    }
+
+    // Recreated with the full page, like DX11Renderer::uploadAtlas.
+    atlas.takeDirtyRegion(region);
+    log(EVENT_ATLAS_UPLOAD, 0, 0, static_cast<uint64_t>(atlas.getWidth()) * atlas.getHeight() * 4);
+    atlasUploaded = true;
+    atlasGeneration = atlas.getGeneration();
+}
+
+void TraceRenderer::logUploads(EventType type) {
+    for (const UploadMirror::Range& range : dirtyRanges) {
+        log(type, 0, range.offset, range.size);
+    }
+}
+
+void TraceRenderer::flush() {
+    if (batch.empty()) {
+        return;
+    }
+
+    uploadAtlas();
+    log(EVENT_FLUSH, 0, batch.vertices.size(), batch.indices.size());
+
+    // Layers have no depth buffer of their own and are drawn in painter order.
+    const std::vector<uint32_t>* submittedIndices = &orderedIndices;
+    bool useDepth = depthPrepass && activeLayer < 0;
+    uint32_t opaqueIndexCount = batch.buildSubmission(useDepth, orderedIndices, textureRuns);
+    log(EVENT_SORT, 0, batch.getSortStats().unsortedRuns, batch.getSortStats().runs);
+
+    // Same growth policy as DX11Renderer::createVertexBuffer, a new buffer starts empty.
+    if (batch.vertices.size() > vertexCapacity) {
+        vertexCapacity = 1024;
+        while (vertexCapacity < batch.vertices.size()) vertexCapacity *= 2;
+        vertexMirror.invalidate();
+    }
+    if (batch.indices.size() > indexCapacity) {
+        indexCapacity = 1536;
+        while (indexCapacity < batch.indices.size()) indexCapacity *= 2;
+        indexMirror.invalidate();
+    }
+
+    vertexSegments.clear();
+    for (const GeometryBatch::Item& item : batch.items) {
+        vertexSegments.push_back(sizeof(Vertex) * (item.firstVertex + item.vertexCount));
+    }
+    if (!partialUploads) {
+        vertexMirror.invalidate();
+        indexMirror.invalidate();
+    }
+    vertexMirror.update(reinterpret_cast<const uint8_t*>(batch.vertices.data()), sizeof(Vertex) * batch.vertices.size(), vertexSegments, dirtyRanges);
+    logUploads(EVENT_VERTEX_UPLOAD);
+    indexMirror.update(reinterpret_cast<const uint8_t*>(submittedIndices->data()), sizeof(uint32_t) * submittedIndices->size(), 1024, dirtyRanges);
+    logUploads(EVENT_INDEX_UPLOAD);
+    if (!batch.shadows.empty()) {
+        log(EVENT_SHADOW_UPLOAD, 0, batch.shadows.size(), sizeof(AnalyticShadow::Params) * batch.shadows.size());
+    }
+    uploadTranslations();
+
+    // Partial frames draw the screen once per redraw rectangle, like DX11Renderer.
+    bool scissored = damageActive && activeLayer < 0;
+    size_t passes = scissored ? redrawRects : 1;
+    for (size_t pass = 0; pass < passes; ++pass) {
+        if (scissored) {
+            setState(STATE_SCISSOR, static_cast<int64_t>(pass));
+        }
+        if (opaqueIndexCount > 0) {
+            setState(STATE_TEXTURE, atlasGeneration);
+            setState(STATE_DEPTH, DEPTH_OPAQUE);
+            log(EVENT_DRAW, 0, 0, opaqueIndexCount);
+        }
+        for (const GeometryBatch::TextureRun& run : textureRuns) {
+            setState(STATE_TEXTURE, run.texture == 0 ? static_cast<int64_t>(atlasGeneration) : -static_cast<int64_t>(run.texture));
+            setState(STATE_DEPTH, useDepth ? DEPTH_TRANSLUCENT : DEPTH_NONE);
+            log(EVENT_DRAW, 0, run.firstIndex, run.indexCount);
+        }
+    }
+    if (scissored) {
+        setState(STATE_SCISSOR, -1);
+    }
+
+    batch.clear();
+}
+
+TraceRenderer::FrameSummary TraceRenderer::summarize(uint32_t frame) const {
+    FrameSummary summary;
+    for (const Event& event : events) {
+        if (event.frame != frame) {
+            continue;
+        }
+        switch (event.type) {
+        case EVENT_PRIMITIVE:
+            summary.primitives++;
+            break;
+        case EVENT_FLUSH:
+            summary.flushes++;
+            summary.vertices += event.offset;
+            summary.indices += event.size;
+            break;
+        case EVENT_ATLAS_UPLOAD:
+        case EVENT_VERTEX_UPLOAD:
+        case EVENT_INDEX_UPLOAD:
+        case EVENT_SHADOW_UPLOAD:
+        case EVENT_TRANSLATION_UPLOAD:
+            summary.uploadedBytes += event.size;
+            summary.uploadRanges++;
+            break;
+        case EVENT_STATE:
+            summary.stateChanges++;
+            break;
+        case EVENT_DRAW:
+            summary.drawCalls++;
+            break;
+        case EVENT_SORT:
+            summary.unsortedTextureRuns += static_cast<uint32_t>(event.offset);
+            summary.textureRuns += static_cast<uint32_t>(event.size);
+            break;
+        case EVENT_DAMAGE:
+            summary.partial = true;
+            summary.redrawnPixels += event.offset;
+            break;
+        default:
+            break;
+        }
+    }
+    return summary;
+}
+
+uint32_t TraceRenderer::count(uint32_t frame, EventType type) const {
+    uint32_t total = 0;
+    for (const Event& event : events) {
+        if (event.frame == frame && event.type == type) {
+            total++;
+        }
+    }
+    return total;
+}
+
+static bool checkCount(const char* name, int64_t expected, uint64_t actual, bool atMost, std::string* failure) {
+    if (expected < 0) {
+        return true;
+    }
+    bool ok = atMost ? actual <= static_cast<uint64_t>(expected) : actual == static_cast<uint64_t>(expected);
+    if (!ok && failure) {
+        *failure += std::string(failure->empty() ? "" : ", ") + name + " " + std::to_string(actual) + (atMost ? " > " : " != ") + std::to_string(expected);
+    }
+    return ok;
+}
+
+bool TraceRenderer::expect(uint32_t frame, const Expectation& expectation, std::string* failure) const {
+    if (failure) {
+        failure->clear();
+    }
+    FrameSummary summary = summarize(frame);
+    bool ok = true;
+    ok &= checkCount("primitives", expectation.primitives, summary.primitives, expectation.atMost, failure);
+    ok &= checkCount("draw calls", expectation.drawCalls, summary.drawCalls, expectation.atMost, failure);
+    ok &= checkCount("state changes", expectation.stateChanges, summary.stateChanges, expectation.atMost, failure);
+    ok &= checkCount("vertices", expectation.vertices, summary.vertices, expectation.atMost, failure);
+    ok &= checkCount("indices", expectation.indices, summary.indices, expectation.atMost, failure);
+    ok &= checkCount("uploaded bytes", expectation.uploadedBytes, summary.uploadedBytes, expectation.atMost, failure);
+    if (!ok && failure) {
+        *failure = "frame " + std::to_string(frame) + ": " + *failure;
+    }
+    return ok;
+}
+
+void TraceRenderer::dump(std::ostream& out, uint32_t frame) const {
+    static const char* const shapeNames[] = { "rectangle", "circle", "triangle", "image", "border", "ring", "line", "polyline", "graph", "layer", "shadow", "path" };
+    static const char* const depthNames[] = { "opaque", "translucent", "none" };
+
+    for (const Event& event : events) {
+        if (event.frame != frame) {
+            continue;
+        }
+        switch (event.type) {
+        case EVENT_CLEAR:
+            out << (event.detail ? "clear " + std::to_string(event.detail) + " rectangles\n" : std::string("clear\n"));
+            break;
+        case EVENT_DAMAGE:
+            out << "damage " << event.detail << " rectangles, " << event.offset << " pixels redrawn, " << event.size << " dirty\n";
+            break;
+        case EVENT_PRIMITIVE:
+            out << "  " << (event.detail < sizeof(shapeNames) / sizeof(shapeNames[0]) ? shapeNames[event.detail] : "unknown") << "\n";
+            break;
+        case EVENT_FLUSH:
+            out << "flush " << event.offset << " vertices, " << event.size << " indices\n";
+            break;
+        case EVENT_ATLAS_UPLOAD:
+            out << "  upload atlas " << event.size << " bytes\n";
+            break;
+        case EVENT_VERTEX_UPLOAD:
+            out << "  upload vertices [" << event.offset << ", " << event.offset + event.size << ")\n";
+            break;
+        case EVENT_INDEX_UPLOAD:
+            out << "  upload indices [" << event.offset << ", " << event.offset + event.size << ")\n";
+            break;
+        case EVENT_LATCH:
+            out << "  latch pointer " << static_cast<int64_t>(event.offset) << ", " << static_cast<int64_t>(event.size) << (event.detail ? "" : " (kept)") << "\n";
+            break;
+        case EVENT_SHADOW_UPLOAD:
+            out << "  upload " << event.offset << " shadows, " << event.size << " bytes\n";
+            break;
+        case EVENT_TRANSLATION_UPLOAD:
+            out << "  upload " << event.offset << " translations, " << event.size << " bytes\n";
+            break;
+        case EVENT_STATE:
+            if (event.detail == STATE_DEPTH) {
+                out << "  depth state " << depthNames[event.offset] << "\n";
+            }
+            else if (event.detail == STATE_SCISSOR) {
+                int64_t rect = static_cast<int64_t>(event.offset);
+                out << (rect < 0 ? std::string("  no scissor") : "  scissor rectangle " + std::to_string(rect)) << "\n";
+            }
+            else if (event.detail == STATE_TARGET) {
+                int64_t target = static_cast<int64_t>(event.offset);
+                out << (target < 0 ? std::string("target screen") : "target layer " + std::to_string(target)) << "\n";
+            }
+            else if (static_cast<int64_t>(event.offset) < 0) {
+                out << "  bind layer " << -1 - static_cast<int64_t>(event.offset) << "\n";
+            }
+            else {
+                out << "  bind atlas generation " << event.offset << "\n";
+            }
+            break;
+        case EVENT_SORT:
+            out << "  " << event.offset << " texture runs in painter order, " << event.size << " sorted\n";
+            break;
+        case EVENT_DRAW:
+            out << "  draw indexed " << event.size << " from " << event.offset << "\n";
+            break;
+        case EVENT_PRESENT:
+            out << "present\n";
+            break;
+        }
+    }
+}
+
+void TraceRenderer::clearLog() {
+    events.clear();
+    commands.clear();
+}
@@ -0,0 +1,183 @@
+#pragma once
+#include "backend.hpp"
+#include "atlas.hpp"
+#include "geometry.hpp"
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Backend that draws nothing and logs what DX11Renderer would have done with the same calls:
+// every primitive, each flush with the buffer uploads and state changes it causes, and the
+// draw calls it ends in. Batching, depth ordering and partial uploads run through the same
+// GeometryBatch and UploadMirror code, so the counts match the D3D11 backend without needing
+// a GPU or Windows. Meant for performance regression tests of batching and culling.
+class TraceRenderer : public RenderBackend {
+public:
+    enum EventType {
+        EVENT_CLEAR,            // detail: redraw rectangles cleared, 0 for the whole target
+        EVENT_PRIMITIVE,        // detail: ShapeType, offset: index into the recorded commands
+        EVENT_FLUSH,            // batch boundary, offset: vertices, size: indices
+        EVENT_ATLAS_UPLOAD,     // size: bytes
+        EVENT_VERTEX_UPLOAD,    // offset, size: byte range
+        EVENT_INDEX_UPLOAD,     // offset, size: byte range
+        EVENT_STATE,            // detail: StateKind, offset: the new value
+        EVENT_DRAW,             // offset: first index, size: index count
+        EVENT_SORT,             // offset: texture runs in painter order, size: after state sorting
+        EVENT_SHADOW_UPLOAD,    // offset: shadows, size: bytes
+        EVENT_LATCH,            // detail: 1 when the pointer source answered, offset, size: pointer x, y
+        EVENT_TRANSLATION_UPLOAD,   // offset: slots, size: bytes
+        EVENT_DAMAGE,           // detail: redraw rectangles, offset: pixels redrawn, size: dirty pixels
+        EVENT_PRESENT
+    };
+
+    enum StateKind {
+        STATE_DEPTH,            // value is a DepthMode
+        STATE_TEXTURE,          // value is the atlas generation bound, or -1 - id of a layer
+        STATE_TARGET,           // value is -1 for the screen, or the id of a layer
+        STATE_SCISSOR           // value is the redraw rectangle clipped to, or -1 for none
+    };
+
+    enum DepthMode {
+        DEPTH_OPAQUE,
+        DEPTH_TRANSLUCENT,
+        DEPTH_NONE
+    };
+
+    struct Event {
+        EventType type;
+        uint32_t frame;
+        uint32_t detail;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    struct FrameSummary {
+        uint32_t primitives = 0;
+        uint32_t flushes = 0;
+        uint32_t drawCalls = 0;
+        uint32_t stateChanges = 0;
+        uint64_t vertices = 0;
+        uint64_t indices = 0;
+        uint64_t uploadedBytes = 0;     // vertex, index, shadow, translation and atlas bytes
+        uint32_t uploadRanges = 0;
+        uint32_t textureRuns = 0;
+        uint32_t unsortedTextureRuns = 0;
+        bool partial = false;           // drawn with setDamage()
+        uint64_t redrawnPixels = 0;     // of a partial frame
+    };
+
+    // Counts a frame is checked against by expect(), fields left at -1 are not checked.
+    struct Expectation {
+        int64_t primitives = -1;
+        int64_t drawCalls = -1;
+        int64_t stateChanges = -1;
+        int64_t vertices = -1;
+        int64_t indices = -1;
+        int64_t uploadedBytes = -1;
+        bool atMost = false;            // treat the counts as upper bounds instead of exact values
+    };
+
+    TraceRenderer();
+
+    void draw(const DrawCommand& command) override;
+    void clearScreen(float r, float g, float b, float a) override;
+    void present() override;
+    int createLayer(int width, int height) override;
+    void destroyLayer(int layerId) override;
+    bool beginLayer(int layerId, float x, float y) override;
+    void endLayer() override;
+    void setPointerSource(PointerSource source) override { pointerSource = source; }
+    bool beginLateGroup(LateGroupKind kind, float x, float y, float width, float height) override;
+    void endLateGroup() override;
+    bool setTranslation(uint32_t slot, float x, float y) override;
+    void useTranslation(uint32_t slot) override { batch.useTranslation(slot); }
+    bool getBackBuffer(int& width, int& height, uint32_t& age) override;
+    void setDamage(const DamageRect* redraw, size_t redrawCount, const DamageRect* dirty, size_t dirtyCount) override;
+
+    // Acts as if presenting through a flip model swap chain of bufferCount width x height
+    // buffers, so damage rendering can be traced. With 0 buffers, the default, there is no
+    // back buffer to report and every frame is whole.
+    void setSwapChain(int width, int height, uint32_t bufferCount);
+
+    // Same switches as DX11Renderer, with the same defaults.
+    void setDepthPrepass(bool enable) { depthPrepass = enable; }
+    void setPartialUploads(bool enable);
+    void setStateSorting(bool enable) { batch.setStateSorting(enable); }
+
+    int createImage(int width, int height, const uint8_t* rgba);
+    void destroyImage(int imageId);
+    TextureAtlas& getAtlas() { return atlas; }
+
+    void flush();
+
+    // Frames are numbered from 0 and end with present(), events logged after the last
+    // present() belong to the frame in progress.
+    uint32_t frameCount() const { return currentFrame; }
+    const std::vector<Event>& getEvents() const { return events; }
+    // Recorded commands keep pointing at the caller's points for polylines and graphs.
+    const DrawCommand& command(const Event& event) const { return commands[static_cast<size_t>(event.offset)]; }
+    FrameSummary summarize(uint32_t frame) const;
+    uint32_t count(uint32_t frame, EventType type) const;
+    // Returns false and describes every mismatch in failure when the frame differs.
+    bool expect(uint32_t frame, const Expectation& expectation, std::string* failure = nullptr) const;
+    // Human readable log of one frame, one event per line.
+    void dump(std::ostream& out, uint32_t frame) const;
+    // Drops the log, frame numbering and GPU side state continue.
+    void clearLog();
+
+private:
+    TextureAtlas atlas;
+    GeometryBatch batch;
+    bool depthPrepass = true;
+    bool partialUploads = true;
+
+    // Mirrors of the D3D11 backend's GPU side state.
+    size_t vertexCapacity = 0;
+    size_t indexCapacity = 0;
+    bool atlasUploaded = false;
+    uint32_t atlasGeneration = 0;
+    int64_t boundDepth = -1;
+    int64_t boundTexture = -1;
+    int64_t boundTarget = -1;
+    int64_t boundScissor = -1;
+    int activeLayer = -1;
+    std::vector<bool> liveLayers;
+
+    struct LateGroup {
+        LateGroupKind kind;
+        float x, y, width, height;
+        uint32_t firstIndex, indexCount;
+    };
+
+    GeometryBatch lateBatch;
+    std::vector<LateGroup> lateGroups;
+    bool lateGroupOpen = false;
+    PointerSource pointerSource;
+    float latchedPointerX = 0.0f;
+    float latchedPointerY = 0.0f;
+    std::vector<GeometryBatch::Translation> uploadedTranslations;
+    int swapChainWidth = 0;
+    int swapChainHeight = 0;
+    uint32_t swapChainBuffers = 0;
+    uint32_t presentedBuffers = 0;
+    bool damageActive = false;
+    size_t redrawRects = 0;
+    std::vector<GeometryBatch::TextureRun> textureRuns;
+    UploadMirror vertexMirror;
+    UploadMirror indexMirror;
+    std::vector<uint32_t> orderedIndices;
+    std::vector<size_t> vertexSegments;
+    std::vector<UploadMirror::Range> dirtyRanges;
+
+    uint32_t currentFrame = 0;
+    std::vector<Event> events;
+    std::vector<DrawCommand> commands;
+
+    void log(EventType type, uint32_t detail = 0, uint64_t offset = 0, uint64_t size = 0);
+    void setState(StateKind kind, int64_t value);
+    void uploadAtlas();
+    void logUploads(EventType type);
+    void uploadTranslations();
+    void drawLateGroups();
+};
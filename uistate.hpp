@@ -0,0 +1,138 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+
+// Lock-free triple buffer for one writer and one reader. The writer fills back() and
+// publishes it, the reader picks up the newest published slot with acquire() and keeps
+// using front() until the next one. Neither side ever waits for the other and the reader
+// never sees a slot that is still being written.
+template <typename T>
+class TripleBuffer {
+public:
+    T& back() { return slots[backIndex]; }
+
+    void publish() {
+        uint8_t previous = middle.exchange(static_cast<uint8_t>(backIndex | FRESH), std::memory_order_acq_rel);
+        backIndex = previous & INDEX_MASK;
+    }
+
+    // Returns true when a newer slot was swapped into front().
+    bool acquire() {
+        if (!(middle.load(std::memory_order_acquire) & FRESH)) {
+            return false;
+        }
+        uint8_t previous = middle.exchange(frontIndex, std::memory_order_acq_rel);
+        frontIndex = previous & INDEX_MASK;
+        return true;
+    }
+
+    const T& front() const { return slots[frontIndex]; }
+
+private:
+    static const uint8_t INDEX_MASK = 0x3;
+    static const uint8_t FRESH = 0x4;
+
+    T slots[3];
+    uint8_t backIndex = 0;
+    std::atomic<uint8_t> middle{ 1 };
+    uint8_t frontIndex = 2;
+};
+
+// Bounded lock-free queue for many producers and a single consumer (Vyukov's sequence
+// numbered ring). push() fails instead of blocking when the ring is full.
+template <typename T>
+class ChangeQueue {
+public:
+    explicit ChangeQueue(size_t capacity = 4096) {
+        size_t size = 2;
+        while (size < capacity) size *= 2;
+        mask = size - 1;
+        cells.reset(new Cell[size]);
+        for (size_t i = 0; i < size; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool push(const T& value) {
+        size_t position = enqueuePosition.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[position & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (difference == 0) {
+                if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (difference < 0) {
+                return false;
+            }
+            else {
+                position = enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop(T& value) {
+        Cell& cell = cells[dequeuePosition & mask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        if (static_cast<intptr_t>(sequence) - static_cast<intptr_t>(dequeuePosition + 1) < 0) {
+            return false;
+        }
+        value = cell.value;
+        cell.sequence.store(dequeuePosition + mask + 1, std::memory_order_release);
+        dequeuePosition++;
+        return true;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> enqueuePosition{ 0 };
+    alignas(64) size_t dequeuePosition = 0;
+};
+
+// Statistics written by one thread and read by any number of others, copied through relaxed
+// atomic words so neither side ever takes a lock or waits. A read racing a write may mix
+// fields of two consecutive values, which is fine for counters.
+template <typename T>
+class StatsSlot {
+    static_assert(std::is_trivially_copyable<T>::value, "StatsSlot copies T word by word");
+
+public:
+    StatsSlot() { store(T()); }
+
+    void store(const T& value) {
+        uint64_t copy[WORDS] = {};
+        memcpy(copy, &value, sizeof(T));
+        for (size_t i = 0; i < WORDS; ++i) {
+            words[i].store(copy[i], std::memory_order_relaxed);
+        }
+    }
+
+    T load() const {
+        uint64_t copy[WORDS];
+        for (size_t i = 0; i < WORDS; ++i) {
+            copy[i] = words[i].load(std::memory_order_relaxed);
+        }
+        T value;
+        memcpy(&value, copy, sizeof(T));
+        return value;
+    }
+
+private:
+    static const size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    std::atomic<uint64_t> words[WORDS];
+};